@@ -0,0 +1,215 @@
+/*
+ * Copyright (C) 2015 soud
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * reads many files and echoes messages over loopback sockets, with blocking
+ * system calls or through erupt_aio, and prints the throughput in MB/s,
+ * without the time it takes to set them up.
+ * usage: aio blocking|aio files|echo
+ */
+
+#ifndef _GNU_SOURCE
+# define _GNU_SOURCE
+#endif
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "runtime.h"
+
+#define FILES 512
+#define FILE_PASSES 20
+#define CONNECTIONS 32
+#define MESSAGE_SIZE 4096
+#define ROUNDS 2000
+
+static bool blocking;
+static double start;
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void check(bool ok, const char *what)
+{
+    if (!ok) {
+        perror(what);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* read FILES files of ERUPT_IO_BUFFER_SIZE bytes FILE_PASSES times */
+static size_t read_files(void)
+{
+    char dir[] = "/tmp/erupt_bench_XXXXXX";
+    char path[64];
+    int fds[FILES];
+    char *buffers[ERUPT_AIO_BUFFERS];
+    erupt_aio_t reads[ERUPT_AIO_BUFFERS];
+    size_t total = 0;
+
+    check(mkdtemp(dir), "mkdtemp");
+
+    for (int i = 0; i < FILES; ++i) {
+        static char data[ERUPT_IO_BUFFER_SIZE];
+
+        sprintf(path, "%s/%d", dir, i);
+        fds[i] = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+        check(fds[i] >= 0 && write(fds[i], data, sizeof(data)) ==
+              sizeof(data), "write");
+        unlink(path);
+    }
+
+    rmdir(dir);
+
+    for (int i = 0; i < ERUPT_AIO_BUFFERS; ++i)
+        buffers[i] = erupt_aio_buffer();
+
+    start = now();
+
+    for (int pass = 0; pass < FILE_PASSES; ++pass) {
+        for (int i = 0; i < FILES; i += ERUPT_AIO_BUFFERS) {
+            for (int k = 0; k < ERUPT_AIO_BUFFERS; ++k) {
+                if (blocking)
+                    total += pread(fds[i + k], buffers[k],
+                                   ERUPT_IO_BUFFER_SIZE, 0);
+                else
+                    erupt_aio_read(&reads[k], fds[i + k], buffers[k],
+                                   ERUPT_IO_BUFFER_SIZE, 0);
+            }
+
+            for (int k = 0; !blocking && k < ERUPT_AIO_BUFFERS; ++k)
+                total += erupt_aio_wait(&reads[k]);
+        }
+    }
+
+    for (int i = 0; i < FILES; ++i)
+        close(fds[i]);
+
+    return total;
+}
+
+/* echo ROUNDS messages from each of CONNECTIONS clients */
+static size_t echo(void)
+{
+    struct sockaddr_in addr = { .sin_family = AF_INET };
+    socklen_t length = sizeof(addr);
+    int server = socket(AF_INET, SOCK_STREAM, 0);
+    int clients[CONNECTIONS], conns[CONNECTIONS];
+    static char buffers[CONNECTIONS][MESSAGE_SIZE];
+    char message[MESSAGE_SIZE] = { 0 };
+    erupt_aio_t requests[CONNECTIONS];
+    size_t total = 0;
+
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    check(!bind(server, (struct sockaddr *)&addr, sizeof(addr)) &&
+          !listen(server, CONNECTIONS) &&
+          !getsockname(server, (struct sockaddr *)&addr, &length), "listen");
+
+    for (int i = 0; i < CONNECTIONS; ++i) {
+        clients[i] = socket(AF_INET, SOCK_STREAM, 0);
+        check(!connect(clients[i], (struct sockaddr *)&addr, sizeof(addr)),
+              "connect");
+        conns[i] = accept(server, NULL, NULL);
+    }
+
+    start = now();
+
+    for (int round = 0; round < ROUNDS; ++round) {
+        for (int i = 0; i < CONNECTIONS; ++i)
+            check(write(clients[i], message, MESSAGE_SIZE) == MESSAGE_SIZE,
+                  "write");
+
+        /* the server side, short reads are echoed as they are */
+        for (int i = 0; i < CONNECTIONS; ++i) {
+            if (blocking)
+                requests[i].result = read(conns[i], buffers[i], MESSAGE_SIZE);
+            else
+                erupt_aio_read(&requests[i], conns[i], buffers[i],
+                               MESSAGE_SIZE, -1);
+        }
+
+        for (int i = 0; i < CONNECTIONS; ++i) {
+            int64_t n = blocking ? requests[i].result
+                                 : erupt_aio_wait(&requests[i]);
+
+            check(n > 0, "read");
+
+            if (blocking)
+                requests[i].result = write(conns[i], buffers[i], n);
+            else
+                erupt_aio_write(&requests[i], conns[i], buffers[i], n, -1);
+        }
+
+        for (int i = 0; i < CONNECTIONS; ++i) {
+            int64_t n = blocking ? requests[i].result
+                                 : erupt_aio_wait(&requests[i]);
+
+            check(n > 0, "write");
+            total += n;
+
+            for (int64_t left = n; left > 0; ) {
+                ssize_t got = read(clients[i], message, left);
+
+                check(got > 0, "read");
+                left -= got;
+            }
+        }
+    }
+
+    for (int i = 0; i < CONNECTIONS; ++i) {
+        close(clients[i]);
+        close(conns[i]);
+    }
+
+    close(server);
+
+    return total;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s blocking|aio files|echo\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    blocking = strcmp(argv[1], "blocking") == 0;
+
+    size_t bytes = strcmp(argv[2], "files") == 0 ? read_files() : echo();
+
+    printf("%.0f\n", bytes / (now() - start) / 1e6);
+
+    return 0;
+}
@@ -0,0 +1,39 @@
+#! /usr/bin/env bash
+
+# compares blocking IO with the runtime's asynchronous IO, on io_uring and on
+# the epoll fallback. shows the best of $RUNS runs (default: 5) in MB/s.
+
+CC=${CC:-gcc}
+RUNS=${RUNS:-5}
+TMP=$(mktemp -d)
+
+trap 'rm -rf "$TMP"' EXIT
+
+"$CC" -O2 -std=c11 -pthread -Iruntime -o "$TMP/aio" bench/aio.c \
+    build/liberupt_rt.a -lm || exit 1
+
+# the best throughput of running "$@" $RUNS times
+best() {
+    local best=
+
+    for ((i = 0; i < RUNS; ++i)); do
+        local mbs
+
+        mbs=$("$@")
+
+        if [[ -z $best || $mbs -gt $best ]]; then
+            best=$mbs
+        fi
+    done
+
+    echo "$best"
+}
+
+printf "%-24s %10s %10s %10s\n" benchmark blocking io_uring epoll
+
+for test in files echo; do
+    printf "%-24s %10s %10s %10s\n" "$test" \
+        "$(best "$TMP/aio" blocking "$test")" \
+        "$(best env ERUPT_AIO=uring "$TMP/aio" aio "$test")" \
+        "$(best env ERUPT_AIO=epoll "$TMP/aio" aio "$test")"
+done
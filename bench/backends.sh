@@ -0,0 +1,46 @@
+#! /usr/bin/env bash
+
+# compares the backends on every example: compiling natively and running the
+# executable, the JIT and the VM. shows the best of $RUNS runs (default: 5).
+
+ERUPT=${ERUPT:-build/erupt}
+RUNS=${RUNS:-5}
+TMP=$(mktemp -d)
+
+trap 'rm -rf "$TMP"' EXIT
+
+# the best wall time of running "$@" $RUNS times, in milliseconds
+best() {
+    local best=
+
+    for ((i = 0; i < RUNS; ++i)); do
+        local start end
+
+        start=$(date +%s%N)
+        "$@" > /dev/null 2>&1
+        end=$(date +%s%N)
+
+        local ms=$(( (end - start) / 1000000 ))
+
+        if [[ -z $best || $ms -lt $best ]]; then
+            best=$ms
+        fi
+    done
+
+    echo "$best"
+}
+
+printf "%-24s %10s %10s %10s %10s\n" example compile native jit vm
+
+for file in examples/*.er; do
+    if ! "$ERUPT" --no-cache -o "$TMP/a.out" "$file" > /dev/null 2>&1; then
+        printf "%-24s %s\n" "$(basename "$file")" "doesn't compile"
+        continue
+    fi
+
+    printf "%-24s %10s %10s %10s %10s\n" "$(basename "$file")" \
+        "$(best "$ERUPT" --no-cache -o "$TMP/a.out" "$file")" \
+        "$(best "$TMP/a.out")" \
+        "$(best "$ERUPT" --run "$file")" \
+        "$(best "$ERUPT" --backend=vm "$file")"
+done
@@ -0,0 +1,151 @@
+/*
+ * Copyright (C) 2015 soud
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * allocates like a functional program does, many binary trees that die
+ * young next to one that lives the whole run, and prints the allocation
+ * rate in MB/s, the time spent in collections and the longest pause in ms.
+ * gc builds the trees out of lists on the heap, malloc with malloc and
+ * free, for comparison.
+ * usage: gc gc|malloc
+ */
+
+#ifndef _GNU_SOURCE
+# define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "runtime.h"
+
+#define LONG_LIVED_DEPTH 18
+#define MAX_DEPTH 16
+#define MIN_DEPTH 4
+
+typedef struct node {
+    struct node *left;
+    struct node *right;
+} node_t;
+
+static uint64_t allocated;
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* a leaf is [], a node is [left, right] */
+static int64_t tree(int depth)
+{
+    if (depth == 0)
+        return ERUPT_REF(erupt_list_from(NULL, 0));
+
+    int64_t children[2];
+
+    children[0] = tree(depth - 1);
+    children[1] = tree(depth - 1);
+
+    return ERUPT_REF(erupt_list_from(children, 2));
+}
+
+static int64_t count(int64_t t)
+{
+    erupt_list_t *l = ERUPT_DEREF(t);
+
+    return erupt_list_length(l) ? 1 + count(l->tail[0]) + count(l->tail[1])
+                                : 1;
+}
+
+static node_t *malloc_tree(int depth)
+{
+    node_t *n = malloc(sizeof(node_t));
+
+    allocated += sizeof(node_t);
+    n->left = depth ? malloc_tree(depth - 1) : NULL;
+    n->right = depth ? malloc_tree(depth - 1) : NULL;
+
+    return n;
+}
+
+static int64_t malloc_count(node_t *n)
+{
+    return n->left ? 1 + malloc_count(n->left) + malloc_count(n->right) : 1;
+}
+
+static void malloc_free(node_t *n)
+{
+    if (n->left) {
+        malloc_free(n->left);
+        malloc_free(n->right);
+    }
+
+    free(n);
+}
+
+int main(int argc, char *argv[])
+{
+    bool gc = argc < 2 || strcmp(argv[1], "malloc") != 0;
+    volatile int64_t sink = 0;
+    erupt_gc_stats_t stats;
+    double start = now();
+
+    if (gc) {
+        int64_t long_lived = tree(LONG_LIVED_DEPTH);
+
+        for (int d = MIN_DEPTH; d <= MAX_DEPTH; d += 2) {
+            for (int i = 0; i < 1 << (MAX_DEPTH - d + MIN_DEPTH); ++i)
+                sink += count(tree(d));
+        }
+
+        sink += count(long_lived);
+        erupt_gc_stats(&stats);
+    } else {
+        node_t *long_lived = malloc_tree(LONG_LIVED_DEPTH);
+
+        for (int d = MIN_DEPTH; d <= MAX_DEPTH; d += 2) {
+            for (int i = 0; i < 1 << (MAX_DEPTH - d + MIN_DEPTH); ++i) {
+                node_t *t = malloc_tree(d);
+
+                sink += malloc_count(t);
+                malloc_free(t);
+            }
+        }
+
+        sink += malloc_count(long_lived);
+        malloc_free(long_lived);
+
+        memset(&stats, 0, sizeof stats);
+        stats.allocated = allocated;
+    }
+
+    printf("%.0f %.1f %.2f\n", stats.allocated / (now() - start) / 1e6,
+           stats.pause_ns / 1e6, stats.max_pause_ns / 1e6);
+
+    return sink == -1;
+}
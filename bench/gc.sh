@@ -0,0 +1,40 @@
+#! /usr/bin/env bash
+
+# builds binary trees like a functional program, most of them die young.
+# compares lists on the collected heap with malloc and free. shows the best
+# allocation rate of $RUNS runs (default: 5) in MB/s, with the time spent
+# in collections and the longest pause of that run in ms.
+
+CC=${CC:-gcc}
+RUNS=${RUNS:-5}
+TMP=$(mktemp -d)
+
+trap 'rm -rf "$TMP"' EXIT
+
+"$CC" -O2 -std=c11 -Iruntime -o "$TMP/gc" bench/gc.c runtime/*.c -lrt -lm \
+    -pthread || exit 1
+
+# the run of "$@" with the best allocation rate out of $RUNS
+best() {
+    local best= result=
+
+    for ((i = 0; i < RUNS; ++i)); do
+        local line
+
+        line=$("$@")
+
+        if [[ -z $best || ${line%% *} -gt $best ]]; then
+            best=${line%% *}
+            result=$line
+        fi
+    done
+
+    echo "$result"
+}
+
+printf "%-24s %10s %10s %10s\n" benchmark MB/s "pause ms" "max ms"
+
+for mode in gc malloc; do
+    read -r mbs pause max <<< "$(best "$TMP/gc" "$mode")"
+    printf "%-24s %10s %10s %10s\n" "$mode" "$mbs" "$pause" "$max"
+done
@@ -0,0 +1,135 @@
+/*
+ * Copyright (C) 2015 soud
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * lexes a generated data table of numeric literals and prints the
+ * throughput in MB/s, without generating it. memcpy shows what memory
+ * bandwidth allows, scan converts the literals with scan_number, strtod
+ * with the C library and lex runs the whole lexer.
+ * usage: lex memcpy|scan|strtod|lex
+ */
+
+#ifndef _GNU_SOURCE
+# define _GNU_SOURCE
+#endif
+
+#include <time.h>
+
+#include "lexer.h"
+#include "number.h"
+
+#define SOURCE_SIZE (64 << 20)
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* rows of ints, prices, measurements and hex masks, like a generated table */
+static char *generate(size_t *length)
+{
+    char *source = smalloc(SOURCE_SIZE + 256);
+    size_t n = 0, row = 0;
+    uint64_t state = 88172645463325252u;
+
+    while (n < SOURCE_SIZE) {
+        uint64_t r[4];
+
+        for (int i = 0; i < 4; ++i) {
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            r[i] = state;
+        }
+
+        n += (size_t)sprintf(source + n,
+                             "row%zu => [%u, %u.%02u, %.17g, 0x%x, 1_%03u]\n",
+                             row++, (unsigned)(r[0] % 1000000000),
+                             (unsigned)(r[1] % 100000), (unsigned)(r[1] % 100),
+                             (double)(r[2] >> 11) / (1 << 20),
+                             (unsigned)r[3], (unsigned)(r[3] >> 40) % 1000);
+    }
+
+    *length = n;
+
+    return source;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *mode = argc > 1 ? argv[1] : "lex";
+    size_t length;
+    char *source = generate(&length);
+    volatile double sink = 0;
+    double start = now();
+
+    if (strcmp(mode, "memcpy") == 0) {
+        char *copy = smalloc(length + 1);
+
+        start = now();
+        memcpy(copy, source, length + 1);
+        sink += copy[length / 2];
+        free(copy);
+    } else if (strcmp(mode, "scan") == 0 || strcmp(mode, "strtod") == 0) {
+        bool scan = mode[1] == 'c';
+        const char *end = source + length;
+
+        for (const char *p = source; p < end;) {
+            /* skip identifiers, their digits aren't numbers */
+            if ((*p >= 'a' && *p <= 'z') || *p == '_') {
+                while (*p != ' ')
+                    ++p;
+            } else if (*p < '0' || *p > '9') {
+                ++p;
+            } else if (scan) {
+                number_t n;
+
+                p += scan_number(p, end, &n);
+                sink += n.type == INT ? (double)n.i : n.f;
+            } else {
+                char *after;
+
+                sink += strtod(p, &after);
+                p = after;
+
+                /* strtod stops at separators, as if there were two */
+                while (*p == '_' || (*p >= '0' && *p <= '9') ||
+                       (*p >= 'a' && *p <= 'f') || *p == 'x')
+                    ++p;
+            }
+        }
+    } else {
+        lexer_t *l = lex("bench", source);
+
+        sink += l->failed;
+        destroy_lexer(l);
+    }
+
+    printf("%.0f\n", length / (now() - start) / 1e6);
+    free(source);
+
+    return sink == -1;
+}
@@ -0,0 +1,37 @@
+#! /usr/bin/env bash
+
+# lexes a 64 MB table of numeric literals. compares converting them with
+# scan_number and with strtod, the whole lexer, and memcpy for how fast
+# memory is. shows the best of $RUNS runs (default: 5) in MB/s.
+
+CC=${CC:-gcc}
+RUNS=${RUNS:-5}
+TMP=$(mktemp -d)
+
+trap 'rm -rf "$TMP"' EXIT
+
+"$CC" -O2 -std=c11 -Isrc -o "$TMP/lex" bench/lex.c src/lexer.c src/token.c \
+    src/number.c src/erupt.c -lm || exit 1
+
+# the best throughput of running "$@" $RUNS times
+best() {
+    local best=
+
+    for ((i = 0; i < RUNS; ++i)); do
+        local mbs
+
+        mbs=$("$@")
+
+        if [[ -z $best || $mbs -gt $best ]]; then
+            best=$mbs
+        fi
+    done
+
+    echo "$best"
+}
+
+printf "%-24s %10s\n" benchmark MB/s
+
+for mode in memcpy scan strtod lex; do
+    printf "%-24s %10s\n" "$mode" "$(best "$TMP/lex" "$mode")"
+done
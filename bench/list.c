@@ -0,0 +1,205 @@
+/*
+ * Copyright (C) 2015 soud
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * times the operations on persistent lists, each one leaving the list it
+ * started from as it was, and prints the time per operation in ns for
+ * building a list by appending, updating values at random, iterating,
+ * and concatenating two halves.
+ * rrb uses the runtime's lists, flat copies a flat array for every change,
+ * like lists were represented before, for comparison.
+ * usage: list rrb|flat
+ */
+
+#ifndef _GNU_SOURCE
+# define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "runtime.h"
+
+#define LENGTH (1 << 15)
+#define UPDATES (1 << 15)
+
+typedef struct flat {
+    int64_t length;
+    int64_t values[];
+} flat_t;
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static flat_t *flat_copy(const flat_t *l, int64_t length)
+{
+    flat_t *r = malloc(sizeof(flat_t) + sizeof(int64_t) * (size_t)length);
+
+    r->length = length;
+    memcpy(r->values, l->values,
+           sizeof(int64_t) * (size_t)(l->length < length ? l->length
+                                                          : length));
+
+    return r;
+}
+
+static flat_t *flat_push(const flat_t *l, int64_t v)
+{
+    flat_t *r = flat_copy(l, l->length + 1);
+
+    r->values[l->length] = v;
+
+    return r;
+}
+
+static flat_t *flat_set(const flat_t *l, int64_t i, int64_t v)
+{
+    flat_t *r = flat_copy(l, l->length);
+
+    r->values[i] = v;
+
+    return r;
+}
+
+static flat_t *flat_concat(const flat_t *a, const flat_t *b)
+{
+    flat_t *r = flat_copy(a, a->length + b->length);
+
+    memcpy(r->values + a->length, b->values,
+           sizeof(int64_t) * (size_t)b->length);
+
+    return r;
+}
+
+static void rrb(double *times, volatile int64_t *sink)
+{
+    erupt_list_t *l = erupt_list_from(NULL, 0);
+    double start = now();
+
+    for (int64_t i = 0; i < LENGTH; ++i)
+        l = erupt_list_push(l, ERUPT_TAG(i));
+
+    times[0] = now() - start;
+    start = now();
+
+    for (int64_t i = 0; i < UPDATES; ++i)
+        l = erupt_list_set(l, rand() % LENGTH, ERUPT_TAG(i));
+
+    times[1] = now() - start;
+    start = now();
+
+    for (int64_t i = 0, n; i < LENGTH; i += n) {
+        const int64_t *values = erupt_list_chunk(l, i, &n);
+
+        for (int64_t k = 0; k < n; ++k)
+            *sink += values[k];
+    }
+
+    times[2] = now() - start;
+    start = now();
+
+    for (int64_t i = 0; i < UPDATES; ++i) {
+        int64_t half = rand() % LENGTH;
+
+        *sink += erupt_list_length(
+            erupt_list_concat(erupt_list_slice(l, 0, half),
+                              erupt_list_slice(l, half, LENGTH)));
+    }
+
+    times[3] = now() - start;
+}
+
+static void flat(double *times, volatile int64_t *sink)
+{
+    flat_t *l = calloc(1, sizeof(flat_t));
+    double start = now();
+
+    for (int64_t i = 0; i < LENGTH; ++i) {
+        flat_t *next = flat_push(l, ERUPT_TAG(i));
+
+        free(l);
+        l = next;
+    }
+
+    times[0] = now() - start;
+    start = now();
+
+    for (int64_t i = 0; i < UPDATES; ++i) {
+        flat_t *next = flat_set(l, rand() % LENGTH, ERUPT_TAG(i));
+
+        free(l);
+        l = next;
+    }
+
+    times[1] = now() - start;
+    start = now();
+
+    for (int64_t i = 0; i < LENGTH; ++i)
+        *sink += l->values[i];
+
+    times[2] = now() - start;
+    start = now();
+
+    for (int64_t i = 0; i < UPDATES; ++i) {
+        int64_t half = rand() % LENGTH;
+        flat_t *a = flat_copy(l, half), *b = malloc(sizeof(flat_t)
+            + sizeof(int64_t) * (size_t)(LENGTH - half));
+        flat_t *r;
+
+        b->length = LENGTH - half;
+        memcpy(b->values, l->values + half,
+               sizeof(int64_t) * (size_t)b->length);
+        r = flat_concat(a, b);
+        *sink += r->length;
+        free(a);
+        free(b);
+        free(r);
+    }
+
+    times[3] = now() - start;
+    free(l);
+}
+
+int main(int argc, char *argv[])
+{
+    volatile int64_t sink = 0;
+    double times[4];
+
+    if (argc < 2 || strcmp(argv[1], "flat") != 0)
+        rrb(times, &sink);
+    else
+        flat(times, &sink);
+
+    printf("%.1f %.1f %.2f %.1f\n", times[0] / LENGTH * 1e9,
+           times[1] / UPDATES * 1e9, times[2] / LENGTH * 1e9,
+           times[3] / UPDATES * 1e9);
+
+    return sink == -1;
+}
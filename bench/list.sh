@@ -0,0 +1,41 @@
+#! /usr/bin/env bash
+
+# compares persistent lists as relaxed radix balanced trees with flat arrays
+# that are copied on every change. shows the best of $RUNS runs (default: 5)
+# in ns per operation.
+
+CC=${CC:-gcc}
+RUNS=${RUNS:-5}
+TMP=$(mktemp -d)
+
+trap 'rm -rf "$TMP"' EXIT
+
+"$CC" -O2 -std=c11 -Iruntime -o "$TMP/list" bench/list.c runtime/*.c -lrt \
+    -lm -pthread || exit 1
+
+# the run of "$@" with the fastest updates out of $RUNS
+best() {
+    local best= result=
+
+    for ((i = 0; i < RUNS; ++i)); do
+        local line update
+
+        line=$("$@")
+        read -r _ update _ <<< "$line"
+
+        if [[ -z $best ]] || (( ${update%.*} < ${best%.*} )); then
+            best=$update
+            result=$line
+        fi
+    done
+
+    echo "$result"
+}
+
+printf "%-24s %10s %10s %10s %10s\n" benchmark push set iterate concat
+
+for mode in rrb flat; do
+    read -r push set iterate concat <<< "$(best "$TMP/list" "$mode")"
+    printf "%-24s %10s %10s %10s %10s\n" "$mode" "$push" "$set" "$iterate" \
+        "$concat"
+done
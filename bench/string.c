@@ -0,0 +1,147 @@
+/*
+ * Copyright (C) 2015 soud
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * builds strings like a program formatting its output does, by appending
+ * pieces of 1 to 9 bytes to a string that keeps growing, and by
+ * concatenating pairs of short strings. prints the time per concatenation
+ * in ns and the bytes allocated per concatenation for both.
+ * rope uses the runtime's strings, flat copies both strings into a new one
+ * on every concatenation, like strings were concatenated before, for
+ * comparison.
+ * usage: string rope|flat
+ */
+
+#ifndef _GNU_SOURCE
+# define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "runtime.h"
+
+#define PIECES 20000
+#define PAIRS (1 << 20)
+
+static const char *words[] = { "a", "IO", "map", "list", "erupt", "string",
+                               "pointer", "!", ", ", "x = 1" };
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t allocated(void)
+{
+    erupt_gc_stats_t stats;
+
+    erupt_gc_stats(&stats);
+
+    return stats.allocated;
+}
+
+/* a NUL terminated copy of a followed by b, on the heap */
+static char *flat_concat(const char *a, const char *b)
+{
+    size_t a_len = strlen(a), b_len = strlen(b);
+    char *s = erupt_gc_alloc(ERUPT_STRING, a_len + b_len + 1);
+
+    memcpy(s, a, a_len);
+    memcpy(s + a_len, b, b_len + 1);
+
+    return s;
+}
+
+static void rope(double *times, uint64_t *bytes, volatile int64_t *sink)
+{
+    erupt_string_t *pieces[10], *s = erupt_string_from("", 0);
+
+    for (int i = 0; i < 10; ++i)
+        pieces[i] = erupt_string_from(words[i], (int64_t)strlen(words[i]));
+
+    uint64_t before = allocated();
+    double start = now();
+
+    for (int i = 0; i < PIECES; ++i)
+        s = erupt_string_concat(s, pieces[i % 10]);
+
+    times[0] = now() - start;
+    bytes[0] = allocated() - before;
+    *sink += erupt_string_length(s);
+    before = allocated();
+    start = now();
+
+    for (int i = 0; i < PAIRS; ++i) {
+        *sink += erupt_string_length(
+            erupt_string_concat(pieces[i % 4], pieces[i % 3]));
+    }
+
+    times[1] = now() - start;
+    bytes[1] = allocated() - before;
+}
+
+static void flat(double *times, uint64_t *bytes, volatile int64_t *sink)
+{
+    char *s = flat_concat("", "");
+    uint64_t before = allocated();
+    double start = now();
+
+    for (int i = 0; i < PIECES; ++i)
+        s = flat_concat(s, words[i % 10]);
+
+    times[0] = now() - start;
+    bytes[0] = allocated() - before;
+    *sink += (int64_t)strlen(s);
+    before = allocated();
+    start = now();
+
+    for (int i = 0; i < PAIRS; ++i)
+        *sink += (int64_t)strlen(flat_concat(words[i % 4], words[i % 3]));
+
+    times[1] = now() - start;
+    bytes[1] = allocated() - before;
+}
+
+int main(int argc, char *argv[])
+{
+    volatile int64_t sink = 0;
+    double times[2];
+    uint64_t bytes[2];
+
+    if (argc < 2 || strcmp(argv[1], "flat") != 0)
+        rope(times, bytes, &sink);
+    else
+        flat(times, bytes, &sink);
+
+    printf("%.1f %.1f %.1f %.1f\n", times[0] / PIECES * 1e9,
+           (double)bytes[0] / PIECES, times[1] / PAIRS * 1e9,
+           (double)bytes[1] / PAIRS);
+
+    return sink == -1;
+}
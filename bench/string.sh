@@ -0,0 +1,44 @@
+#! /usr/bin/env bash
+
+# compares concatenating the runtime's strings, ropes and short strings,
+# with copying both strings every time. shows the best of $RUNS runs
+# (default: 5) in ns and in bytes allocated per concatenation, for appending
+# small pieces to a growing string and for joining two short strings.
+
+CC=${CC:-gcc}
+RUNS=${RUNS:-5}
+TMP=$(mktemp -d)
+
+trap 'rm -rf "$TMP"' EXIT
+
+"$CC" -O2 -std=c11 -Iruntime -o "$TMP/string" bench/string.c runtime/*.c \
+    -lrt -lm -pthread || exit 1
+
+# the run of "$@" with the fastest appends out of $RUNS
+best() {
+    local best= result=
+
+    for ((i = 0; i < RUNS; ++i)); do
+        local line append
+
+        line=$("$@")
+        read -r append _ <<< "$line"
+
+        if [[ -z $best ]] || (( ${append%.*} < ${best%.*} )); then
+            best=$append
+            result=$line
+        fi
+    done
+
+    echo "$result"
+}
+
+printf "%-24s %10s %10s %10s %10s\n" benchmark "append ns" bytes \
+    "short ns" bytes
+
+for mode in rope flat; do
+    read -r append append_bytes short short_bytes <<< \
+        "$(best "$TMP/string" "$mode")"
+    printf "%-24s %10s %10s %10s %10s\n" "$mode" "$append" "$append_bytes" \
+        "$short" "$short_bytes"
+done
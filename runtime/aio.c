@@ -0,0 +1,547 @@
+/*
+ * Copyright (C) 2015 soud
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * asynchronous file and socket IO. requests go to an io_uring: they're
+ * queued in its submission ring and submitted together, with one system
+ * call, when somebody waits for one of them or the ring is full. reads and
+ * writes of the buffers from erupt_aio_buffer use buffers registered with
+ * the kernel, which saves mapping them for every request.
+ *
+ * tasks run on their worker's stack and can't be put aside halfway, so a
+ * task waiting for a request does what erupt_join does: it reaps completions
+ * and runs other tasks until its request is done, and only blocks in the
+ * kernel when there's nothing else to do. one thread at a time reaps, the
+ * others find their requests done when they look again.
+ *
+ * kernels without io_uring (or ERUPT_AIO=epoll) wait for sockets and pipes
+ * to be ready with epoll instead and read regular files right away.
+ */
+
+#ifndef _GNU_SOURCE
+# define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "runtime.h"
+
+#define MAX_IDLE_SLEEP_NS 1000000 /* 1ms */
+#define MAX_EVENTS 64
+
+_Static_assert(ERUPT_AIO_BUFFERS <= 32, "free_buffers is a 32 bit mask");
+
+enum {
+    AIO_READ,
+    AIO_WRITE,
+    AIO_ACCEPT
+};
+
+/* the rings shared with the kernel */
+typedef struct {
+    int fd;
+    unsigned entries;
+    unsigned pending;
+    atomic_uint *sq_head;
+    atomic_uint *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    atomic_uint *cq_head;
+    atomic_uint *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    bool registered;
+} ring_t;
+
+static ring_t ring = { .fd = -1 };
+static int epoll_fd = -1;
+static char *buffers;
+static uint32_t free_buffers;
+
+/* submit_lock guards the submission ring and the buffers, reap_lock reaping */
+static pthread_mutex_t submit_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t reap_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t aio_once = PTHREAD_ONCE_INIT;
+
+static void start(erupt_aio_t *r, int op, int fd, void *buffer, size_t length,
+                  int64_t offset);
+static void start_aio(void);
+static bool setup_ring(void);
+static void queue(erupt_aio_t *r);
+static int registered_buffer(erupt_aio_t *r);
+static void submit(void);
+static bool reap(bool block);
+static void reap_blocking(void *arg);
+static void sleep_for(void *ts);
+static bool reap_ring(bool block);
+static bool reap_epoll(bool block);
+static void watch(erupt_aio_t *r);
+static int arm(erupt_aio_t *r, int op);
+static int64_t perform(erupt_aio_t *r);
+static void complete(erupt_aio_t *r, int64_t result);
+static bool is_done(erupt_aio_t *r);
+
+/*
+ * read up to length bytes of fd at offset into buffer, or from its current
+ * position if offset is negative. the result of erupt_aio_wait is the
+ * number of bytes read or -errno.
+ */
+void erupt_aio_read(erupt_aio_t *r, int fd, void *buffer, size_t length,
+                    int64_t offset)
+{
+    start(r, AIO_READ, fd, buffer, length, offset);
+}
+
+void erupt_aio_write(erupt_aio_t *r, int fd, const void *buffer,
+                     size_t length, int64_t offset)
+{
+    start(r, AIO_WRITE, fd, (void *)buffer, length, offset);
+}
+
+/* accept a connection on the listening socket fd, the result is its fd */
+void erupt_aio_accept(erupt_aio_t *r, int fd)
+{
+    start(r, AIO_ACCEPT, fd, NULL, 0, -1);
+}
+
+/* submit the requests queued so far without waiting for them */
+void erupt_aio_submit(void)
+{
+    pthread_once(&aio_once, start_aio);
+
+    if (ring.fd < 0)
+        return;
+
+    pthread_mutex_lock(&submit_lock);
+    submit();
+    pthread_mutex_unlock(&submit_lock);
+}
+
+int64_t erupt_aio_wait(erupt_aio_t *r)
+{
+    long sleep_ns = 1000;
+
+    erupt_aio_submit();
+
+    while (!is_done(r)) {
+        if (!pthread_mutex_trylock(&reap_lock)) {
+            reap(false);
+            pthread_mutex_unlock(&reap_lock);
+        }
+
+        if (is_done(r) || erupt_task_yield()) {
+            sleep_ns = 1000;
+            continue;
+        }
+
+        /* nothing else to do, block until something completes */
+        if (!pthread_mutex_trylock(&reap_lock)) {
+            if (!is_done(r))
+                erupt_gc_blocking(reap_blocking, NULL);
+
+            pthread_mutex_unlock(&reap_lock);
+            continue;
+        }
+
+        struct timespec ts = { 0, sleep_ns };
+
+        erupt_gc_blocking(sleep_for, &ts);
+
+        if (sleep_ns < MAX_IDLE_SLEEP_NS)
+            sleep_ns *= 2;
+    }
+
+    return r->result;
+}
+
+/*
+ * a buffer of ERUPT_IO_BUFFER_SIZE bytes. the first ERUPT_AIO_BUFFERS are
+ * registered with the io_uring, after that they're allocated.
+ */
+void *erupt_aio_buffer(void)
+{
+    pthread_once(&aio_once, start_aio);
+    pthread_mutex_lock(&submit_lock);
+
+    void *buffer = NULL;
+
+    if (free_buffers) {
+        int i = __builtin_ctz(free_buffers);
+
+        free_buffers &= ~(1u << i);
+        buffer = buffers + (size_t)i * ERUPT_IO_BUFFER_SIZE;
+    }
+
+    pthread_mutex_unlock(&submit_lock);
+
+    if (!buffer && !(buffer = malloc(ERUPT_IO_BUFFER_SIZE)))
+        erupt_panic("out of memory");
+
+    return buffer;
+}
+
+void erupt_aio_release(void *buffer)
+{
+    uintptr_t p = (uintptr_t)buffer, start = (uintptr_t)buffers;
+
+    if (!buffers || p < start ||
+        p >= start + ERUPT_AIO_BUFFERS * ERUPT_IO_BUFFER_SIZE) {
+        free(buffer);
+        return;
+    }
+
+    pthread_mutex_lock(&submit_lock);
+    free_buffers |= 1u << ((p - start) / ERUPT_IO_BUFFER_SIZE);
+    pthread_mutex_unlock(&submit_lock);
+}
+
+static void start(erupt_aio_t *r, int op, int fd, void *buffer, size_t length,
+                  int64_t offset)
+{
+    pthread_once(&aio_once, start_aio);
+
+    r->op = op;
+    r->fd = fd;
+    r->wait_fd = -1;
+    r->buffer = buffer;
+    r->length = length;
+    r->offset = offset;
+    r->result = 0;
+    atomic_store_explicit(&r->done, 0, memory_order_relaxed);
+
+    if (ring.fd >= 0)
+        queue(r);
+    else
+        watch(r);
+}
+
+static void start_aio(void)
+{
+    const char *env = getenv("ERUPT_AIO");
+
+    buffers = mmap(NULL, ERUPT_AIO_BUFFERS * ERUPT_IO_BUFFER_SIZE,
+                   PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (buffers == MAP_FAILED)
+        buffers = NULL;
+    else
+        free_buffers = (uint32_t)((1ull << ERUPT_AIO_BUFFERS) - 1);
+
+    if ((!env || strcmp(env, "epoll") != 0) && setup_ring())
+        return;
+
+    if ((epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+        erupt_panic("couldn't start asynchronous IO: %s", strerror(errno));
+}
+
+static bool setup_ring(void)
+{
+    struct io_uring_params p;
+
+    memset(&p, 0, sizeof(p));
+
+    int fd = (int)syscall(__NR_io_uring_setup, ERUPT_AIO_ENTRIES, &p);
+
+    if (fd < 0)
+        return false;
+
+    /* reading at the current position came with IORING_OP_READ */
+    if (!(p.features & IORING_FEAT_RW_CUR_POS)) {
+        close(fd);
+        return false;
+    }
+
+    size_t sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    size_t cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        sq_size = cq_size = sq_size > cq_size ? sq_size : cq_size;
+
+    char *sq = mmap(NULL, sq_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    char *cq = sq;
+    struct io_uring_sqe *sqes = mmap(NULL,
+                                     p.sq_entries * sizeof(*sqes),
+                                     PROT_READ | PROT_WRITE,
+                                     MAP_SHARED | MAP_POPULATE, fd,
+                                     IORING_OFF_SQES);
+
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP) && sq != MAP_FAILED)
+        cq = mmap(NULL, cq_size, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+
+    if (sq == MAP_FAILED || cq == MAP_FAILED || sqes == MAP_FAILED) {
+        close(fd);
+        return false;
+    }
+
+    ring.fd = fd;
+    ring.entries = p.sq_entries;
+    ring.sq_head = (atomic_uint *)(sq + p.sq_off.head);
+    ring.sq_tail = (atomic_uint *)(sq + p.sq_off.tail);
+    ring.sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    ring.sq_array = (unsigned *)(sq + p.sq_off.array);
+    ring.sqes = sqes;
+    ring.cq_head = (atomic_uint *)(cq + p.cq_off.head);
+    ring.cq_tail = (atomic_uint *)(cq + p.cq_off.tail);
+    ring.cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    ring.cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+    if (buffers) {
+        struct iovec iov[ERUPT_AIO_BUFFERS];
+
+        for (int i = 0; i < ERUPT_AIO_BUFFERS; ++i) {
+            iov[i].iov_base = buffers + (size_t)i * ERUPT_IO_BUFFER_SIZE;
+            iov[i].iov_len = ERUPT_IO_BUFFER_SIZE;
+        }
+
+        /* fails when they'd go over RLIMIT_MEMLOCK, they're just slower */
+        ring.registered = syscall(__NR_io_uring_register, fd,
+                                  IORING_REGISTER_BUFFERS, iov,
+                                  ERUPT_AIO_BUFFERS) == 0;
+    }
+
+    return true;
+}
+
+/* put r in the submission ring, it's submitted with the next batch */
+static void queue(erupt_aio_t *r)
+{
+    pthread_mutex_lock(&submit_lock);
+
+    if (ring.pending == ring.entries)
+        submit();
+
+    unsigned tail = atomic_load_explicit(ring.sq_tail, memory_order_relaxed);
+    unsigned index = tail & *ring.sq_mask;
+    struct io_uring_sqe *sqe = &ring.sqes[index];
+    int fixed = registered_buffer(r);
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->fd = r->fd;
+    sqe->user_data = (uintptr_t)r;
+
+    if (r->op == AIO_ACCEPT) {
+        sqe->opcode = IORING_OP_ACCEPT;
+        sqe->accept_flags = SOCK_CLOEXEC;
+    } else {
+        sqe->opcode = r->op == AIO_READ ? IORING_OP_READ : IORING_OP_WRITE;
+        sqe->addr = (uintptr_t)r->buffer;
+        sqe->len = r->length > INT32_MAX ? INT32_MAX : (unsigned)r->length;
+        sqe->off = r->offset < 0 ? (uint64_t)-1 : (uint64_t)r->offset;
+
+        if (fixed >= 0) {
+            sqe->opcode = r->op == AIO_READ ? IORING_OP_READ_FIXED
+                                            : IORING_OP_WRITE_FIXED;
+            sqe->buf_index = (uint16_t)fixed;
+        }
+    }
+
+    ring.sq_array[index] = index;
+    atomic_store_explicit(ring.sq_tail, tail + 1, memory_order_release);
+    ++ring.pending;
+
+    pthread_mutex_unlock(&submit_lock);
+}
+
+/* the registered buffer r reads into or writes from, -1 if it isn't one */
+static int registered_buffer(erupt_aio_t *r)
+{
+    uintptr_t p = (uintptr_t)r->buffer, start = (uintptr_t)buffers;
+
+    if (!ring.registered || !r->length || p < start)
+        return -1;
+
+    size_t i = (p - start) / ERUPT_IO_BUFFER_SIZE;
+
+    if (i >= ERUPT_AIO_BUFFERS ||
+        p + r->length > start + (i + 1) * ERUPT_IO_BUFFER_SIZE)
+        return -1;
+
+    return (int)i;
+}
+
+/* hand the queued requests to the kernel, with submit_lock held */
+static void submit(void)
+{
+    while (ring.pending) {
+        int n = (int)syscall(__NR_io_uring_enter, ring.fd, ring.pending, 0,
+                             0, NULL, 0);
+
+        if (n >= 0) {
+            ring.pending -= (unsigned)n;
+            continue;
+        }
+
+        if (errno == EINTR)
+            continue;
+
+        /* too many completions nobody reaped yet, make room */
+        if (errno != EAGAIN && errno != EBUSY)
+            erupt_panic("couldn't submit IO: %s", strerror(errno));
+
+        if (!pthread_mutex_trylock(&reap_lock)) {
+            reap(false);
+            pthread_mutex_unlock(&reap_lock);
+        } else {
+            sched_yield();
+        }
+    }
+}
+
+static void reap_blocking(void *arg)
+{
+    (void)arg;
+    reap(true);
+}
+
+static void sleep_for(void *ts)
+{
+    nanosleep(ts, NULL);
+}
+
+/* complete finished requests, with reap_lock held. false if there were none */
+static bool reap(bool block)
+{
+    return ring.fd >= 0 ? reap_ring(block) : reap_epoll(block);
+}
+
+static bool reap_ring(bool block)
+{
+    unsigned head = atomic_load_explicit(ring.cq_head, memory_order_relaxed);
+    unsigned tail = atomic_load_explicit(ring.cq_tail, memory_order_acquire);
+
+    while (head == tail && block) {
+        syscall(__NR_io_uring_enter, ring.fd, 0, 1, IORING_ENTER_GETEVENTS,
+                NULL, 0);
+        tail = atomic_load_explicit(ring.cq_tail, memory_order_acquire);
+    }
+
+    if (head == tail)
+        return false;
+
+    for (; head != tail; ++head) {
+        struct io_uring_cqe *cqe = &ring.cqes[head & *ring.cq_mask];
+
+        complete((erupt_aio_t *)(uintptr_t)cqe->user_data, cqe->res);
+    }
+
+    atomic_store_explicit(ring.cq_head, head, memory_order_release);
+
+    return true;
+}
+
+static bool reap_epoll(bool block)
+{
+    struct epoll_event events[MAX_EVENTS];
+    int n = epoll_wait(epoll_fd, events, MAX_EVENTS, block ? -1 : 0);
+
+    for (int i = 0; i < n; ++i) {
+        erupt_aio_t *r = events[i].data.ptr;
+        int64_t result = perform(r);
+
+        /* somebody else got there first, wait for the next time */
+        if (result == -EAGAIN && !arm(r, EPOLL_CTL_MOD))
+            continue;
+
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, r->wait_fd, NULL);
+        close(r->wait_fd);
+        complete(r, result);
+    }
+
+    return n > 0;
+}
+
+/*
+ * wait for r's fd to be ready with epoll. every request watches its own
+ * duplicate of the fd, so a read and a write of one socket don't replace
+ * each other. regular files can't be watched and are always ready.
+ */
+static void watch(erupt_aio_t *r)
+{
+    if ((r->wait_fd = fcntl(r->fd, F_DUPFD_CLOEXEC, 0)) < 0) {
+        complete(r, -errno);
+        return;
+    }
+
+    if (!arm(r, EPOLL_CTL_ADD))
+        return;
+
+    close(r->wait_fd);
+    complete(r, errno == EPERM ? perform(r) : -errno);
+}
+
+/* wait for r's wait_fd to be ready once, like epoll_ctl returns */
+static int arm(erupt_aio_t *r, int op)
+{
+    struct epoll_event ev = {
+        .events = (r->op == AIO_WRITE ? EPOLLOUT : EPOLLIN) | EPOLLONESHOT,
+        .data.ptr = r
+    };
+
+    return epoll_ctl(epoll_fd, op, r->wait_fd, &ev);
+}
+
+static int64_t perform(erupt_aio_t *r)
+{
+    ssize_t n;
+
+    switch (r->op) {
+    case AIO_READ:
+        n = r->offset < 0 ? read(r->fd, r->buffer, r->length)
+                          : pread(r->fd, r->buffer, r->length, r->offset);
+        break;
+    case AIO_WRITE:
+        n = r->offset < 0 ? write(r->fd, r->buffer, r->length)
+                          : pwrite(r->fd, r->buffer, r->length, r->offset);
+        break;
+    default:
+        n = accept4(r->fd, NULL, NULL, SOCK_CLOEXEC);
+    }
+
+    return n < 0 ? -errno : n;
+}
+
+static void complete(erupt_aio_t *r, int64_t result)
+{
+    r->result = result;
+    atomic_store_explicit(&r->done, 1, memory_order_release);
+}
+
+static bool is_done(erupt_aio_t *r)
+{
+    return atomic_load_explicit(&r->done, memory_order_acquire);
+}
@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2015 soud
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * closures. a closure is made once, when the lambda it comes from is
+ * evaluated, with a flat copy of the values it captured, which are never
+ * changed after. calling one calls its function with the closure itself
+ * as the first argument, followed by the arguments of the call.
+ */
+
+#include <inttypes.h>
+#include <string.h>
+
+#include "runtime.h"
+
+/* a closure of code over the n values in env, which can be anywhere */
+erupt_closure_t *erupt_closure_from(void *code, int64_t arity,
+                                    const int64_t *env, int64_t n)
+{
+    erupt_closure_t *c = erupt_gc_alloc(ERUPT_CLOSURE,
+                                        sizeof(erupt_closure_t) +
+                                        sizeof(int64_t) * (size_t)n);
+
+    c->code = (int64_t)(uintptr_t)code;
+    c->arity = ERUPT_TAG(arity);
+
+    if (n)
+        memcpy(c->env, env, sizeof(int64_t) * (size_t)n);
+
+    return c;
+}
+
+/* called when f can't be called with n arguments */
+void erupt_apply_error(int64_t f, int64_t n)
+{
+    if (ERUPT_IS_CLOSURE(f)) {
+        const erupt_closure_t *c = ERUPT_DEREF(f);
+
+        erupt_panic("a function of %" PRId64 " argument(s) called with %"
+                    PRId64, ERUPT_UNTAG(c->arity), n);
+    }
+
+    /* words that are neither ints nor references are short strings */
+    erupt_panic("can't call a value of type %s",
+                ERUPT_IS_SMALL(f) ? "int" :
+                ERUPT_IS_REF(f) ? erupt_kind_str(ERUPT_KIND(ERUPT_DEREF(f)))
+                                : "string");
+}
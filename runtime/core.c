@@ -0,0 +1,124 @@
+/*
+ * Copyright (C) 2015 soud
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "runtime.h"
+
+/* report a runtime error and stop the program */
+void erupt_panic(const char *fmt, ...)
+{
+    va_list args;
+
+    erupt_io_flush();
+    fputs("erupt: runtime error: ", stderr);
+
+    va_start(args, fmt);
+    vfprintf(stderr, fmt, args);
+    va_end(args);
+
+    fputc('\n', stderr);
+
+    exit(EXIT_FAILURE);
+}
+
+void erupt_nomatch(const char *fn)
+{
+    erupt_panic("no clause of '%s' matches its arguments", fn);
+}
+
+/* floats are stored in lists as a reference to a copy */
+int64_t erupt_float_box(double f)
+{
+    double *p = erupt_gc_alloc(ERUPT_FLOAT, sizeof(double));
+
+    *p = f;
+
+    return ERUPT_REF(p);
+}
+
+/* what a word is, an int, a float, a string or a list */
+int erupt_value_kind(int64_t v)
+{
+    if (ERUPT_IS_SMALL(v))
+        return ERUPT_BIGNUM;
+
+    if (!ERUPT_IS_REF(v))
+        return ERUPT_STRING;
+
+    int kind = ERUPT_KIND(ERUPT_DEREF(v));
+
+    return kind == ERUPT_ROPE ? ERUPT_STRING : kind;
+}
+
+static double to_float(int64_t v)
+{
+    if (erupt_value_kind(v) == ERUPT_FLOAT)
+        return *(double *)ERUPT_DEREF(v);
+
+    return erupt_int_to_float(v);
+}
+
+/*
+ * compare words of any kind. numbers compare by value, other values of
+ * different kinds by their kind.
+ */
+int erupt_value_compare(int64_t a, int64_t b)
+{
+    int ka = erupt_value_kind(a), kb = erupt_value_kind(b);
+
+    if (ka == ERUPT_BIGNUM && kb == ERUPT_BIGNUM)
+        return erupt_int_compare(a, b);
+
+    if ((ka == ERUPT_BIGNUM || ka == ERUPT_FLOAT) &&
+        (kb == ERUPT_BIGNUM || kb == ERUPT_FLOAT)) {
+        double x = to_float(a), y = to_float(b);
+
+        return (x > y) - (x < y);
+    }
+
+    if (ka != kb)
+        return (ka > kb) - (ka < kb);
+
+    if (ka == ERUPT_STRING)
+        return erupt_string_compare(ERUPT_DEREF(a), ERUPT_DEREF(b));
+
+    /* closures are only equal to themselves */
+    if (ka == ERUPT_CLOSURE)
+        return (a > b) - (a < b);
+
+    return erupt_list_compare(ERUPT_DEREF(a), ERUPT_DEREF(b));
+}
+
+const char *erupt_kind_str(int kind)
+{
+    switch (kind) {
+    case ERUPT_BIGNUM: return "int";
+    case ERUPT_FLOAT: return "float";
+    case ERUPT_STRING: return "string";
+    case ERUPT_LIST: return "list";
+    case ERUPT_CLOSURE: return "function";
+    default: return "unknown value";
+    }
+}
@@ -0,0 +1,1186 @@
+/*
+ * Copyright (C) 2015 soud
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * the garbage collector. threads allocate by bumping a pointer through
+ * their own piece of the nursery. when the nursery is full, the objects in
+ * it that are still reachable are copied to the old generation, where
+ * objects go in the free lines of 32 KB blocks, like in Immix. once the old
+ * generation is bigger than ERUPT_MIN_HEAP_SIZE and twice as big as after
+ * the previous major collection, it's marked and swept line by line.
+ *
+ * objects are traced precisely: a word in a list, a node or a rope refers
+ * to an object if its low bits are 001. stacks can't be, generated code,
+ * the VM and the runtime keep untyped words in registers and frames. every
+ * word on the stack of a thread, or in a range of roots, that points into
+ * an object keeps it alive and in place. such objects are pinned, they stay
+ * in the nursery until nothing on a stack points to them anymore.
+ *
+ * values never change once they're made, so the only old objects that point
+ * to young ones are those promoted while what they point to was pinned,
+ * objects allocated in the old generation and filled right away, and those
+ * changed in place by a transient list, which calls erupt_gc_write. they're
+ * remembered until the next minor collection.
+ *
+ * threads stop for a collection when they allocate or call erupt_gc_poll,
+ * and are out of the way while they're in erupt_gc_blocking.
+ */
+
+#ifndef _GNU_SOURCE
+# define _GNU_SOURCE
+#endif
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#include "runtime.h"
+
+/* the pieces of the nursery threads allocate in */
+#define TLAB_SIZE (32 << 10)
+
+/* objects bigger than this are allocated in the old generation directly */
+#define LARGE_SIZE (8 << 10)
+
+#define BLOCK_SIZE (32 << 10)
+#define LINE_SIZE 256
+#define LINES (BLOCK_SIZE / LINE_SIZE)
+
+/* address space for the old generation, only what's used is backed */
+#define OLD_RESERVE ((size_t)1 << 36)
+
+/* gaps between pinned objects smaller than this aren't allocated in */
+#define MIN_FRAGMENT 512
+
+/* the collector's bits in a header */
+#define MARK 0x01
+#define PINNED 0x02
+#define FORWARDED 0x04
+#define REMEMBERED 0x08
+#define LARGE 0x10
+
+#define GC_BITS UINT64_C(0xff)
+#define SIZE(h) ((size_t)((h) >> 16) + sizeof(uint64_t))
+#define KIND(h) ((int)((h) >> 8 & 0xff))
+
+/* objects whose words are all values */
+#define TRACED_KIND(k) \
+    ((k) == ERUPT_LIST || (k) == ERUPT_NODE || (k) == ERUPT_ROPE || \
+     (k) == ERUPT_CLOSURE)
+#define TRACED(h) TRACED_KIND(KIND(h))
+#define WORDS(h) ((SIZE(*(h)) - sizeof(uint64_t)) / sizeof(int64_t))
+
+typedef struct thread {
+    /* the piece of the nursery the thread allocates in */
+    char *start;
+    char *cursor;
+    char *limit;
+
+    /* its stack, from the deepest frame in use while it's stopped */
+    char *sp;
+    char *top;
+
+    struct thread *next;
+} thread_t;
+
+typedef struct {
+    char *start;
+    char *end;
+} range_t;
+
+/* objects, by the address of their header */
+typedef struct {
+    uint64_t **objects;
+    size_t length;
+    size_t capacity;
+} objects_t;
+
+typedef struct {
+    bool used;
+
+    /* which lines were in use after the last major collection */
+    uint8_t lines[LINES];
+
+    /* a bit for every word an object starts at */
+    uint64_t starts[BLOCK_SIZE / sizeof(uint64_t) / 64];
+} block_t;
+
+static pthread_once_t gc_once = PTHREAD_ONCE_INIT;
+static pthread_key_t gc_key;
+static pthread_mutex_t gc_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t gc_cond = PTHREAD_COND_INITIALIZER;
+static atomic_bool stopping;
+
+static thread_t *threads;
+static size_t running;
+static _Thread_local thread_t *me;
+
+/* ranges of words that are scanned like stacks */
+static range_t *roots;
+static size_t n_roots, roots_capacity;
+
+static char *nursery, *nursery_end;
+
+/* the free parts of the nursery, and the next one to hand out */
+static range_t *fragments;
+static size_t n_fragments, fragments_capacity, next_fragment;
+
+/* the parts of the nursery objects were allocated in since the last minor
+   collection, and the pinned objects that survived it */
+static range_t *regions;
+static size_t n_regions, regions_capacity;
+
+/* words on the stacks that point into the nursery */
+static char **candidates;
+static size_t n_candidates, candidates_capacity;
+
+static char *old;
+static block_t *blocks;
+static size_t n_blocks, blocks_capacity;
+
+/* where the old generation allocates, a run of free lines in a block */
+static char *hole, *hole_end;
+static size_t block_i, line_i;
+
+/* large objects, sorted by address */
+static uint64_t **large;
+static size_t n_large, large_capacity, large_bytes;
+
+static objects_t pinned, remembered, gray;
+
+/* objects are marked if their MARK bit is this. it flips at the start of
+   every major collection, so everything is unmarked then */
+static uint64_t mark;
+
+/* bytes in lines that survived the last major collection, and promoted
+   since then */
+static size_t heap_live, promoted_since;
+static size_t heap_limit = ERUPT_MIN_HEAP_SIZE;
+
+static erupt_gc_stats_t stats;
+static uint64_t started_ns;
+
+static void init_gc(void);
+static void unregister_thread(void *p);
+static void print_stats(void);
+static void *alloc_slow(int kind, size_t size);
+static void *alloc_large(int kind, size_t size);
+static void *alloc_old(int kind, size_t size);
+static bool refill(thread_t *t, size_t n);
+static void retire(thread_t *t);
+static void collect(bool full);
+static void park(void);
+static void save_sp(thread_t *t);
+static void minor(void);
+static void add_candidate(char *p);
+static void pin_candidates(void);
+static void scan_young(uint64_t *h);
+static int64_t forward(int64_t v, bool *young);
+static void reset_nursery(void);
+static void major(void);
+static void mark_candidate(char *p);
+static void mark_value(int64_t v);
+static void mark_object(uint64_t *h);
+static uint64_t *old_object(char *p);
+static uint64_t *large_object(char *p);
+static void sweep(void);
+static void sweep_block(size_t i);
+static void *old_alloc(size_t n);
+static void next_hole(size_t n);
+static void scan_roots(void (*visit)(char *));
+static size_t old_size(void);
+static void push(objects_t *s, uint64_t *h);
+static void add_range(range_t **ranges, size_t *n, size_t *capacity,
+                      char *start, char *end);
+static void *grow(void *p, size_t *capacity, size_t n, size_t size);
+static size_t round_size(size_t size);
+static bool is_young(const char *p);
+static bool is_old(const char *p);
+static uint64_t now_ns(void);
+static int compare_ranges(const void *a, const void *b);
+static int compare_pointers(const void *a, const void *b);
+
+/*
+ * an object of kind with room for size bytes, zeroed. small objects are
+ * bumped off the thread's piece of the nursery.
+ */
+void *erupt_gc_alloc(int kind, size_t size)
+{
+    thread_t *t = me;
+    size_t n = round_size(size);
+
+    if (t && n <= (size_t)(t->limit - t->cursor)) {
+        uint64_t *h = (uint64_t *)t->cursor;
+
+        t->cursor += n;
+        *h = ERUPT_HEADER(kind, n - sizeof(uint64_t));
+
+        return h + 1;
+    }
+
+    return alloc_slow(kind, size);
+}
+
+/* a minor collection, followed by a major one if major */
+void erupt_gc_collect(bool major)
+{
+    erupt_gc_register_thread();
+
+    pthread_mutex_lock(&gc_lock);
+    collect(major);
+    pthread_mutex_unlock(&gc_lock);
+}
+
+/* threads have to be registered before they hold on to objects */
+void erupt_gc_register_thread(void)
+{
+    if (me)
+        return;
+
+    pthread_once(&gc_once, init_gc);
+
+    thread_t *t = calloc(1, sizeof(thread_t));
+    pthread_attr_t attr;
+    void *stack;
+    size_t size;
+
+    if (!t || pthread_getattr_np(pthread_self(), &attr))
+        erupt_panic("couldn't register a thread with the collector");
+
+    pthread_attr_getstack(&attr, &stack, &size);
+    pthread_attr_destroy(&attr);
+
+    t->top = (char *)stack + size;
+
+    pthread_mutex_lock(&gc_lock);
+
+    t->next = threads;
+    threads = t;
+    me = t;
+    ++running;
+    ++stats.threads;
+
+    /* a thread that exits is unregistered by the key's destructor */
+    pthread_setspecific(gc_key, t);
+
+    if (atomic_load(&stopping))
+        park();
+
+    pthread_mutex_unlock(&gc_lock);
+}
+
+/* stop here while another thread collects */
+void erupt_gc_poll(void)
+{
+    if (!me || !atomic_load_explicit(&stopping, memory_order_relaxed))
+        return;
+
+    pthread_mutex_lock(&gc_lock);
+
+    if (atomic_load(&stopping))
+        park();
+
+    pthread_mutex_unlock(&gc_lock);
+}
+
+/*
+ * call fn(arg), which mustn't touch the heap and might take a while, like
+ * sleeping. other threads can collect in the meantime.
+ */
+void erupt_gc_blocking(void (*fn)(void *), void *arg)
+{
+    if (!me) {
+        fn(arg);
+        return;
+    }
+
+    /* the callers' registers are kept in this frame, where they're scanned */
+    __builtin_unwind_init();
+
+    pthread_mutex_lock(&gc_lock);
+    save_sp(me);
+    --running;
+    pthread_cond_broadcast(&gc_cond);
+    pthread_mutex_unlock(&gc_lock);
+
+    fn(arg);
+
+    pthread_mutex_lock(&gc_lock);
+
+    while (atomic_load(&stopping))
+        pthread_cond_wait(&gc_cond, &gc_lock);
+
+    ++running;
+    pthread_mutex_unlock(&gc_lock);
+}
+
+/* the words in [start, end) keep what they point to alive, like stacks */
+void erupt_gc_add_roots(void *start, void *end)
+{
+    pthread_mutex_lock(&gc_lock);
+    add_range(&roots, &n_roots, &roots_capacity, start, end);
+    pthread_mutex_unlock(&gc_lock);
+}
+
+void erupt_gc_remove_roots(void *start)
+{
+    pthread_mutex_lock(&gc_lock);
+
+    for (size_t i = 0; i < n_roots; ++i) {
+        if (roots[i].start == start) {
+            roots[i] = roots[--n_roots];
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&gc_lock);
+}
+
+/* object, which may be old, was changed to point to v */
+void erupt_gc_write(void *object, int64_t v)
+{
+    uint64_t *h = (uint64_t *)object - 1;
+
+    if (!ERUPT_IS_REF(v) || !is_young(ERUPT_DEREF(v)) || is_young(object))
+        return;
+
+    pthread_mutex_lock(&gc_lock);
+
+    if (!(*h & REMEMBERED)) {
+        *h |= REMEMBERED;
+        push(&remembered, h);
+    }
+
+    pthread_mutex_unlock(&gc_lock);
+}
+
+void erupt_gc_stats(erupt_gc_stats_t *s)
+{
+    pthread_mutex_lock(&gc_lock);
+
+    *s = stats;
+    s->heap = old_size();
+    s->elapsed_ns = started_ns ? now_ns() - started_ns : 0;
+
+    /* what the current thread bumped so far */
+    if (me && me->cursor)
+        s->allocated += (uint64_t)(me->cursor - me->start);
+
+    pthread_mutex_unlock(&gc_lock);
+}
+
+static void init_gc(void)
+{
+    const char *env = getenv("ERUPT_NURSERY");
+    size_t size = env ? (size_t)atol(env) << 10 : ERUPT_NURSERY_SIZE;
+
+    size &= ~(size_t)(TLAB_SIZE - 1);
+
+    if (size < TLAB_SIZE)
+        size = TLAB_SIZE;
+
+    nursery = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    old = mmap(NULL, OLD_RESERVE, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+    if (nursery == MAP_FAILED || old == MAP_FAILED)
+        erupt_panic("couldn't reserve memory for the heap");
+
+    if (pthread_key_create(&gc_key, unregister_thread))
+        erupt_panic("couldn't register a thread with the collector");
+
+    nursery_end = nursery + size;
+    add_range(&fragments, &n_fragments, &fragments_capacity, nursery,
+              nursery_end);
+
+    mark = MARK;
+    started_ns = now_ns();
+
+    if (getenv("ERUPT_GC_STATS"))
+        atexit(print_stats);
+}
+
+/*
+ * the exiting thread's stack is gone, it's no longer scanned or waited for.
+ * a collection that was waiting for it to stop can go ahead.
+ */
+static void unregister_thread(void *p)
+{
+    thread_t *t = p, **link = &threads;
+
+    pthread_mutex_lock(&gc_lock);
+
+    while (*link != t)
+        link = &(*link)->next;
+
+    *link = t->next;
+    retire(t);
+    --running;
+    --stats.threads;
+    pthread_cond_broadcast(&gc_cond);
+
+    pthread_mutex_unlock(&gc_lock);
+
+    me = NULL;
+    free(t);
+}
+
+/* for ERUPT_GC_STATS, a summary on stderr when the program exits */
+static void print_stats(void)
+{
+    erupt_gc_stats_t s;
+
+    erupt_gc_stats(&s);
+
+    double seconds = (double)s.elapsed_ns / 1e9;
+
+    fprintf(stderr, "gc: %.1f MB allocated (%.0f MB/s), %.1f MB promoted, "
+            "%.1f MB heap\n", (double)s.allocated / 1e6,
+            seconds > 0 ? (double)s.allocated / 1e6 / seconds : 0.0,
+            (double)s.promoted / 1e6, (double)s.heap / 1e6);
+    fprintf(stderr, "gc: %" PRIu64 " minor, %" PRIu64 " major collections, "
+            "paused %.2f ms, at most %.2f ms\n", s.minor, s.major,
+            (double)s.pause_ns / 1e6, (double)s.max_pause_ns / 1e6);
+}
+
+static void *alloc_slow(int kind, size_t size)
+{
+    size_t n = round_size(size);
+
+    erupt_gc_register_thread();
+
+    if (size > LARGE_SIZE)
+        return alloc_large(kind, size);
+
+    pthread_mutex_lock(&gc_lock);
+
+    if (atomic_load(&stopping))
+        park();
+
+    retire(me);
+
+    /* a nursery full of pinned objects might not have room after one */
+    if (!refill(me, n)) {
+        collect(false);
+
+        if (!refill(me, n)) {
+            void *p = alloc_old(kind, size);
+
+            pthread_mutex_unlock(&gc_lock);
+
+            return p;
+        }
+    }
+
+    pthread_mutex_unlock(&gc_lock);
+
+    /* zeroed outside of the lock, a list is all 0s until it's filled */
+    memset(me->cursor, 0, (size_t)(me->limit - me->cursor));
+
+    return erupt_gc_alloc(kind, size);
+}
+
+static void *alloc_large(int kind, size_t size)
+{
+    size_t n = round_size(size);
+
+    pthread_mutex_lock(&gc_lock);
+
+    if (atomic_load(&stopping))
+        park();
+
+    if (old_size() + n > heap_limit)
+        collect(true);
+
+    uint64_t *h = calloc(1, n);
+
+    if (!h)
+        erupt_panic("out of memory");
+
+    *h = ERUPT_HEADER(kind, n - sizeof(uint64_t)) | LARGE | mark;
+
+    /* it's filled with references to young objects next */
+    if (TRACED_KIND(kind)) {
+        *h |= REMEMBERED;
+        push(&remembered, h);
+    }
+
+    size_t i = n_large;
+
+    large = grow(large, &large_capacity, n_large + 1, sizeof(uint64_t *));
+
+    while (i > 0 && large[i - 1] > h) {
+        large[i] = large[i - 1];
+        --i;
+    }
+
+    large[i] = h;
+    ++n_large;
+    large_bytes += n;
+    stats.allocated += n;
+
+    pthread_mutex_unlock(&gc_lock);
+
+    return h + 1;
+}
+
+/* in the old generation, with gc_lock held */
+static void *alloc_old(int kind, size_t size)
+{
+    size_t n = round_size(size);
+    uint64_t *h = old_alloc(n);
+
+    memset(h, 0, n);
+    *h = ERUPT_HEADER(kind, n - sizeof(uint64_t)) | mark;
+
+    if (TRACED_KIND(kind)) {
+        *h |= REMEMBERED;
+        push(&remembered, h);
+    }
+
+    promoted_since += n;
+    stats.allocated += n;
+
+    return h + 1;
+}
+
+/* a new piece of the nursery for t, with room for n bytes at least */
+static bool refill(thread_t *t, size_t n)
+{
+    for (; next_fragment < n_fragments; ++next_fragment) {
+        range_t *f = &fragments[next_fragment];
+        size_t left = (size_t)(f->end - f->start);
+
+        if (left < n)
+            continue;
+
+        t->start = t->cursor = f->start;
+        t->limit = f->start + (left < TLAB_SIZE ? left : TLAB_SIZE);
+        f->start = t->limit;
+
+        add_range(&regions, &n_regions, &regions_capacity, t->start,
+                  t->limit);
+
+        return true;
+    }
+
+    return false;
+}
+
+/* fill the rest of t's piece of the nursery, so it can be walked */
+static void retire(thread_t *t)
+{
+    if (!t->start)
+        return;
+
+    if (t->cursor < t->limit) {
+        size_t left = (size_t)(t->limit - t->cursor);
+
+        *(uint64_t *)t->cursor = ERUPT_HEADER(ERUPT_FILLER,
+                                              left - sizeof(uint64_t));
+    }
+
+    stats.allocated += (uint64_t)(t->cursor - t->start);
+    t->start = t->cursor = t->limit = NULL;
+}
+
+/* stop the other threads and collect, with gc_lock held */
+static void collect(bool full)
+{
+    /* somebody else got there first */
+    if (atomic_load(&stopping)) {
+        park();
+        return;
+    }
+
+    /* the callers' registers are kept in this frame, where they're scanned */
+    __builtin_unwind_init();
+
+    uint64_t start = now_ns();
+
+    atomic_store(&stopping, true);
+    save_sp(me);
+    --running;
+
+    while (running)
+        pthread_cond_wait(&gc_cond, &gc_lock);
+
+    for (thread_t *t = threads; t; t = t->next)
+        retire(t);
+
+    minor();
+
+    if (full || old_size() > heap_limit)
+        major();
+
+    uint64_t pause = now_ns() - start;
+
+    stats.pause_ns += pause;
+
+    if (pause > stats.max_pause_ns)
+        stats.max_pause_ns = pause;
+
+    ++running;
+    atomic_store(&stopping, false);
+    pthread_cond_broadcast(&gc_cond);
+}
+
+/* wait for a collection to finish, with gc_lock held */
+static void park(void)
+{
+    __builtin_unwind_init();
+
+    save_sp(me);
+    --running;
+    pthread_cond_broadcast(&gc_cond);
+
+    while (atomic_load(&stopping))
+        pthread_cond_wait(&gc_cond, &gc_lock);
+
+    ++running;
+}
+
+/* below the frame of the caller, and the registers it saved */
+static __attribute__((noinline)) void save_sp(thread_t *t)
+{
+    char here;
+
+    t->sp = (char *)((uintptr_t)&here & ~(uintptr_t)7);
+}
+
+/*
+ * copy everything that's reachable from the pinned and remembered objects
+ * to the old generation. afterwards the nursery is empty, except for the
+ * pinned objects.
+ */
+static void minor(void)
+{
+    objects_t old_remembered = remembered;
+
+    ++stats.minor;
+    memset(&remembered, 0, sizeof(objects_t));
+
+    n_candidates = 0;
+    scan_roots(add_candidate);
+    pin_candidates();
+
+    for (size_t i = 0; i < pinned.length; ++i)
+        scan_young(pinned.objects[i]);
+
+    for (size_t i = 0; i < old_remembered.length; ++i) {
+        *old_remembered.objects[i] &= ~(uint64_t)REMEMBERED;
+        scan_young(old_remembered.objects[i]);
+    }
+
+    while (gray.length)
+        scan_young(gray.objects[--gray.length]);
+
+    free(old_remembered.objects);
+    reset_nursery();
+}
+
+static void add_candidate(char *p)
+{
+    if (!is_young(p))
+        return;
+
+    candidates = grow(candidates, &candidates_capacity, n_candidates + 1,
+                      sizeof(char *));
+    candidates[n_candidates++] = p;
+}
+
+/* pin the objects the candidates point into, walking the regions once */
+static void pin_candidates(void)
+{
+    size_t c = 0;
+
+    qsort(candidates, n_candidates, sizeof(char *), compare_pointers);
+    qsort(regions, n_regions, sizeof(range_t), compare_ranges);
+
+    for (size_t r = 0; r < n_regions && c < n_candidates; ++r) {
+        char *p = regions[r].start, *end = regions[r].end;
+
+        while (c < n_candidates && candidates[c] < p)
+            ++c;
+
+        while (p < end && c < n_candidates && candidates[c] < end) {
+            uint64_t *h = (uint64_t *)p;
+
+            p += SIZE(*h);
+
+            if (candidates[c] >= p)
+                continue;
+
+            if (KIND(*h) != ERUPT_FILLER && !(*h & PINNED)) {
+                *h |= PINNED;
+                push(&pinned, h);
+            }
+
+            while (c < n_candidates && candidates[c] < p)
+                ++c;
+        }
+    }
+}
+
+/* promote what h refers to, h is remembered if it still points to a pinned
+   young object */
+static void scan_young(uint64_t *h)
+{
+    if (!TRACED(*h))
+        return;
+
+    int64_t *words = (int64_t *)(h + 1);
+    bool young = false;
+
+    for (size_t i = 0; i < WORDS(h); ++i)
+        words[i] = forward(words[i], &young);
+
+    if (young && !is_young((char *)h) && !(*h & REMEMBERED)) {
+        *h |= REMEMBERED;
+        push(&remembered, h);
+    }
+}
+
+/* where the object v refers to is after the collection */
+static int64_t forward(int64_t v, bool *young)
+{
+    if (!ERUPT_IS_REF(v) || !is_young(ERUPT_DEREF(v)))
+        return v;
+
+    uint64_t *h = (uint64_t *)ERUPT_DEREF(v) - 1;
+
+    if (*h & FORWARDED)
+        return ERUPT_REF(((uint64_t **)h)[1]);
+
+    if (*h & PINNED) {
+        *young = true;
+        return v;
+    }
+
+    size_t n = SIZE(*h);
+    uint64_t *to = old_alloc(n);
+
+    memcpy(to, h, n);
+    *to = (*to & ~GC_BITS) | mark;
+
+    *h |= FORWARDED;
+    ((uint64_t **)h)[1] = to + 1;
+
+    stats.promoted += n;
+    promoted_since += n;
+
+    if (TRACED(*to))
+        push(&gray, to);
+
+    return ERUPT_REF(to + 1);
+}
+
+/* everything but the pinned objects is free again */
+static void reset_nursery(void)
+{
+    char *free = nursery;
+
+    qsort(pinned.objects, pinned.length, sizeof(uint64_t *),
+          compare_pointers);
+
+    n_regions = n_fragments = next_fragment = 0;
+
+    for (size_t i = 0; i <= pinned.length; ++i) {
+        char *p = i < pinned.length ? (char *)pinned.objects[i] : nursery_end;
+
+        if (p - free >= MIN_FRAGMENT)
+            add_range(&fragments, &n_fragments, &fragments_capacity, free, p);
+
+        if (i == pinned.length)
+            break;
+
+        *pinned.objects[i] &= ~(uint64_t)PINNED;
+        free = p + SIZE(*pinned.objects[i]);
+        add_range(&regions, &n_regions, &regions_capacity, p, free);
+    }
+
+    pinned.length = 0;
+}
+
+/*
+ * mark what's reachable from the stacks, the roots and the objects that are
+ * still in the nursery, then sweep the lines of the blocks and the large
+ * objects.
+ */
+static void major(void)
+{
+    ++stats.major;
+    mark ^= MARK;
+
+    scan_roots(mark_candidate);
+
+    for (size_t r = 0; r < n_regions; ++r)
+        push(&gray, (uint64_t *)regions[r].start);
+
+    while (gray.length) {
+        uint64_t *h = gray.objects[--gray.length];
+
+        if (!TRACED(*h))
+            continue;
+
+        int64_t *words = (int64_t *)(h + 1);
+
+        for (size_t i = 0; i < WORDS(h); ++i)
+            mark_value(words[i]);
+    }
+
+    sweep();
+}
+
+static void mark_candidate(char *p)
+{
+    uint64_t *h = is_old(p) ? old_object(p) : large_object(p);
+
+    if (h)
+        mark_object(h);
+}
+
+static void mark_value(int64_t v)
+{
+    if (!ERUPT_IS_REF(v))
+        return;
+
+    char *p = ERUPT_DEREF(v);
+
+    if (is_old(p))
+        mark_object((uint64_t *)p - 1);
+    else if (!is_young(p))
+        mark_candidate(p);
+}
+
+static void mark_object(uint64_t *h)
+{
+    if ((*h & MARK) == mark)
+        return;
+
+    *h = (*h & ~(uint64_t)MARK) | mark;
+
+    if (TRACED(*h))
+        push(&gray, h);
+}
+
+/* the object in the old generation p points into, if any */
+static uint64_t *old_object(char *p)
+{
+    size_t offset = (size_t)(p - old);
+    block_t *b = &blocks[offset / BLOCK_SIZE];
+    char *base = old + offset / BLOCK_SIZE * BLOCK_SIZE;
+    size_t word = offset % BLOCK_SIZE / sizeof(uint64_t);
+
+    if (!b->used)
+        return NULL;
+
+    /* the closest object that starts at or before p */
+    for (size_t i = word / 64 + 1; i-- > 0;) {
+        uint64_t bits = b->starts[i];
+
+        if (i == word / 64)
+            bits &= ~UINT64_C(0) >> (63 - word % 64);
+
+        if (bits) {
+            size_t start = i * 64 + 63 - (size_t)__builtin_clzll(bits);
+            uint64_t *h = (uint64_t *)base + start;
+
+            return p < (char *)h + SIZE(*h) ? h : NULL;
+        }
+    }
+
+    return NULL;
+}
+
+/* the large object p points into, if any */
+static uint64_t *large_object(char *p)
+{
+    size_t low = 0, high = n_large;
+
+    while (low < high) {
+        size_t mid = (low + high) / 2;
+
+        if ((char *)large[mid] <= p)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    if (!low)
+        return NULL;
+
+    uint64_t *h = large[low - 1];
+
+    return p < (char *)h + SIZE(*h) ? h : NULL;
+}
+
+static void sweep(void)
+{
+    size_t n = 0;
+
+    heap_live = 0;
+
+    for (size_t i = 0; i < n_blocks; ++i)
+        sweep_block(i);
+
+    large_bytes = 0;
+
+    for (size_t i = 0; i < n_large; ++i) {
+        uint64_t *h = large[i];
+
+        if ((*h & MARK) != mark) {
+            free(h);
+            continue;
+        }
+
+        large_bytes += SIZE(*h);
+        large[n++] = h;
+    }
+
+    n_large = n;
+
+    /* remembered objects that died */
+    n = 0;
+
+    for (size_t i = 0; i < remembered.length; ++i) {
+        uint64_t *h = remembered.objects[i];
+
+        if ((*h & MARK) == mark)
+            remembered.objects[n++] = h;
+    }
+
+    remembered.length = n;
+
+    promoted_since = 0;
+    block_i = line_i = 0;
+    hole = hole_end = NULL;
+
+    heap_limit = 2 * old_size();
+
+    if (heap_limit < ERUPT_MIN_HEAP_SIZE)
+        heap_limit = ERUPT_MIN_HEAP_SIZE;
+}
+
+/* the lines of block i that marked objects are on are in use */
+static void sweep_block(size_t i)
+{
+    block_t *b = &blocks[i];
+    char *base = old + i * BLOCK_SIZE;
+    bool live = false;
+
+    if (!b->used)
+        return;
+
+    memset(b->lines, 0, LINES);
+
+    for (size_t w = 0; w < sizeof b->starts / sizeof b->starts[0]; ++w) {
+        for (uint64_t bits = b->starts[w]; bits; bits &= bits - 1) {
+            size_t start = w * 64 + (size_t)__builtin_ctzll(bits);
+            uint64_t *h = (uint64_t *)base + start;
+
+            if ((*h & MARK) != mark) {
+                b->starts[w] &= ~(UINT64_C(1) << start % 64);
+                continue;
+            }
+
+            size_t first = start * sizeof(uint64_t) / LINE_SIZE;
+            size_t last = (start * sizeof(uint64_t) + SIZE(*h) - 1) /
+                          LINE_SIZE;
+
+            memset(b->lines + first, 1, last - first + 1);
+            live = true;
+        }
+    }
+
+    if (!live) {
+        b->used = false;
+        madvise(base, BLOCK_SIZE, MADV_DONTNEED);
+        return;
+    }
+
+    for (size_t l = 0; l < LINES; ++l)
+        heap_live += b->lines[l] ? LINE_SIZE : 0;
+}
+
+/* n bytes in a free run of lines */
+static void *old_alloc(size_t n)
+{
+    if ((size_t)(hole_end - hole) < n)
+        next_hole(n);
+
+    char *p = hole;
+    size_t offset = (size_t)(p - old);
+    size_t word = offset % BLOCK_SIZE / sizeof(uint64_t);
+
+    blocks[offset / BLOCK_SIZE].starts[word / 64] |= UINT64_C(1) << word % 64;
+    hole += n;
+
+    return p;
+}
+
+/* the next run of free lines that n bytes fit in, in a new block if need be */
+static void next_hole(size_t n)
+{
+    for (;;) {
+        if (block_i == n_blocks) {
+            if ((n_blocks + 1) * BLOCK_SIZE > OLD_RESERVE)
+                erupt_panic("out of memory");
+
+            blocks = grow(blocks, &blocks_capacity, n_blocks + 1,
+                          sizeof(block_t));
+            memset(&blocks[n_blocks++], 0, sizeof(block_t));
+        }
+
+        block_t *b = &blocks[block_i];
+        char *base = old + block_i * BLOCK_SIZE;
+
+        /* a free block, all of it */
+        if (!b->used) {
+            b->used = true;
+            memset(b->lines, 0, LINES);
+            hole = base;
+            hole_end = base + BLOCK_SIZE;
+            ++block_i;
+            line_i = 0;
+            return;
+        }
+
+        while (line_i < LINES && b->lines[line_i])
+            ++line_i;
+
+        size_t first = line_i;
+
+        while (line_i < LINES && !b->lines[line_i])
+            ++line_i;
+
+        if (first < LINES && (line_i - first) * LINE_SIZE >= n) {
+            hole = base + first * LINE_SIZE;
+            hole_end = base + line_i * LINE_SIZE;
+            return;
+        }
+
+        if (line_i == LINES) {
+            ++block_i;
+            line_i = 0;
+        }
+    }
+}
+
+/* every word on the stacks and in the ranges of roots */
+static void scan_roots(void (*visit)(char *))
+{
+    for (thread_t *t = threads; t; t = t->next) {
+        for (char **w = (char **)t->sp; w < (char **)t->top; ++w)
+            visit(*w);
+    }
+
+    for (size_t i = 0; i < n_roots; ++i) {
+        for (char **w = (char **)roots[i].start; w < (char **)roots[i].end;
+             ++w)
+            visit(*w);
+    }
+}
+
+static size_t old_size(void)
+{
+    return heap_live + promoted_since + large_bytes;
+}
+
+static void push(objects_t *s, uint64_t *h)
+{
+    s->objects = grow(s->objects, &s->capacity, s->length + 1,
+                      sizeof(uint64_t *));
+    s->objects[s->length++] = h;
+}
+
+static void add_range(range_t **ranges, size_t *n, size_t *capacity,
+                      char *start, char *end)
+{
+    *ranges = grow(*ranges, capacity, *n + 1, sizeof(range_t));
+    (*ranges)[*n].start = start;
+    (*ranges)[(*n)++].end = end;
+}
+
+/* p, with room for n elements of size bytes */
+static void *grow(void *p, size_t *capacity, size_t n, size_t size)
+{
+    if (n <= *capacity)
+        return p;
+
+    *capacity = *capacity ? *capacity * 2 : 64;
+
+    if (*capacity < n)
+        *capacity = n;
+
+    if (!(p = realloc(p, *capacity * size)))
+        erupt_panic("out of memory");
+
+    return p;
+}
+
+/* the bytes an object of size bytes takes, with its header */
+static size_t round_size(size_t size)
+{
+    if (size < sizeof(uint64_t))
+        size = sizeof(uint64_t);
+
+    return ((size + 7) & ~(size_t)7) + sizeof(uint64_t);
+}
+
+static bool is_young(const char *p)
+{
+    return p >= nursery && p < nursery_end;
+}
+
+static bool is_old(const char *p)
+{
+    return p >= old && p < old + n_blocks * BLOCK_SIZE;
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+static int compare_ranges(const void *a, const void *b)
+{
+    const range_t *x = a, *y = b;
+
+    return (x->start > y->start) - (x->start < y->start);
+}
+
+static int compare_pointers(const void *a, const void *b)
+{
+    const char *x = *(char *const *)a, *y = *(char *const *)b;
+
+    return (x > y) - (x < y);
+}
@@ -0,0 +1,855 @@
+/*
+ * Copyright (C) 2015 soud
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * ints that don't fit in a tagged word. generated code and the VM do the
+ * arithmetic of small ints themselves and call these when an operand is a
+ * bignum or the result overflows. every function takes and returns tagged
+ * ints, and results that fit are always small again, so a bignum is never
+ * equal to a small int.
+ *
+ * bignums are a sign and a magnitude of 32 bit limbs, least significant
+ * first. large products are split with Karatsuba's method, division is
+ * Knuth's algorithm D. the limbs of intermediate results are malloced,
+ * only the results are allocated on the heap.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "runtime.h"
+
+/* operands with fewer limbs than this are multiplied the schoolbook way */
+#define KARATSUBA_THRESHOLD 32
+
+typedef struct {
+    bool negative;
+    size_t length;
+    uint32_t limbs[];
+} bigint_t;
+
+/* an int unpacked for the arithmetic, small ones use the two limbs here */
+typedef struct {
+    bool negative;
+    size_t length;
+    const uint32_t *limbs;
+    uint32_t small[2];
+} num_t;
+
+static void unpack(int64_t v, num_t *n);
+static int64_t pack(bool negative, uint32_t *limbs, size_t length);
+static uint32_t *alloc_limbs(size_t n);
+static int64_t add(const num_t *a, const num_t *b, bool negate_b);
+static int compare_mag(const uint32_t *a, size_t na, const uint32_t *b,
+                       size_t nb);
+static uint32_t add_into(uint32_t *r, size_t nr, const uint32_t *a,
+                         size_t na);
+static void sub_into(uint32_t *r, size_t nr, const uint32_t *a, size_t na);
+static void mul_mag(const uint32_t *a, size_t na, const uint32_t *b,
+                    size_t nb, uint32_t *out);
+static void karatsuba(const uint32_t *a, size_t na, const uint32_t *b,
+                      size_t nb, uint32_t *out);
+static uint32_t divide_small(uint32_t *q, const uint32_t *u, size_t n,
+                             uint32_t v);
+static void divide_mag(const num_t *u, const num_t *v, uint32_t *q,
+                       uint32_t *r);
+static int64_t divide(int64_t a, int64_t b, bool remainder);
+static int64_t bitwise(int64_t a, int64_t b, char op);
+static uint32_t *twos_complement(const num_t *a, size_t n);
+static int64_t shift_left(const num_t *a, uint64_t bits);
+static int64_t shift_right(const num_t *a, uint64_t bits);
+static size_t trim(const uint32_t *limbs, size_t length);
+
+int64_t erupt_int_add(int64_t a, int64_t b)
+{
+    num_t x, y;
+
+    unpack(a, &x);
+    unpack(b, &y);
+
+    return add(&x, &y, false);
+}
+
+int64_t erupt_int_sub(int64_t a, int64_t b)
+{
+    num_t x, y;
+
+    unpack(a, &x);
+    unpack(b, &y);
+
+    return add(&x, &y, true);
+}
+
+int64_t erupt_int_mul(int64_t a, int64_t b)
+{
+    num_t x, y;
+
+    unpack(a, &x);
+    unpack(b, &y);
+
+    if (!x.length || !y.length)
+        return 0;
+
+    uint32_t *out = alloc_limbs(x.length + y.length);
+
+    mul_mag(x.limbs, x.length, y.limbs, y.length, out);
+
+    int64_t r = pack(x.negative != y.negative, out, x.length + y.length);
+
+    free(out);
+
+    return r;
+}
+
+/* division truncates, like C's */
+int64_t erupt_int_div(int64_t a, int64_t b)
+{
+    return divide(a, b, false);
+}
+
+/* the remainder has the sign of a */
+int64_t erupt_int_mod(int64_t a, int64_t b)
+{
+    return divide(a, b, true);
+}
+
+/* exponentiation by squaring, integer division for negative exponents */
+int64_t erupt_int_pow(int64_t base, int64_t exp)
+{
+    int64_t one = ERUPT_TAG(1);
+
+    bool negative = erupt_int_compare(exp, 0) < 0;
+
+    if (negative && base == 0)
+        erupt_panic("division by zero");
+
+    if (base == one || (base == 0 && !negative && exp != 0))
+        return base;
+
+    if (base == ERUPT_TAG(-1))
+        return erupt_int_and(exp, one) ? base : one;
+
+    if (negative)
+        return 0;
+
+    if (!ERUPT_IS_SMALL(exp))
+        erupt_panic("exponent too large");
+
+    int64_t result = one;
+
+    for (int64_t e = ERUPT_UNTAG(exp); e; e >>= 1) {
+        if (e & 1)
+            result = erupt_int_mul(result, base);
+
+        if (e > 1)
+            base = erupt_int_mul(base, base);
+    }
+
+    return result;
+}
+
+int64_t erupt_int_neg(int64_t a)
+{
+    return erupt_int_sub(0, a);
+}
+
+int64_t erupt_int_and(int64_t a, int64_t b)
+{
+    return bitwise(a, b, '&');
+}
+
+int64_t erupt_int_or(int64_t a, int64_t b)
+{
+    return bitwise(a, b, '|');
+}
+
+int64_t erupt_int_xor(int64_t a, int64_t b)
+{
+    return bitwise(a, b, '^');
+}
+
+/* ~a is -a - 1 */
+int64_t erupt_int_not(int64_t a)
+{
+    return erupt_int_sub(ERUPT_TAG(-1), a);
+}
+
+/* a * 2^b, a shift by a negative b shifts the other way */
+int64_t erupt_int_shl(int64_t a, int64_t b)
+{
+    num_t x, y;
+
+    unpack(a, &x);
+    unpack(b, &y);
+
+    if (!x.length)
+        return 0;
+
+    if (y.negative && !ERUPT_IS_SMALL(b))
+        return x.negative ? ERUPT_TAG(-1) : 0;
+
+    if (y.negative)
+        return shift_right(&x, -(uint64_t)ERUPT_UNTAG(b));
+
+    if (!ERUPT_IS_SMALL(b) || ERUPT_UNTAG(b) > UINT32_MAX)
+        erupt_panic("shift too large");
+
+    return shift_left(&x, (uint64_t)ERUPT_UNTAG(b));
+}
+
+/* a / 2^b, rounded down */
+int64_t erupt_int_shr(int64_t a, int64_t b)
+{
+    if (erupt_int_compare(b, 0) < 0)
+        return erupt_int_shl(a, erupt_int_neg(b));
+
+    num_t x;
+
+    unpack(a, &x);
+
+    if (!ERUPT_IS_SMALL(b))
+        return x.negative ? ERUPT_TAG(-1) : 0;
+
+    return shift_right(&x, (uint64_t)ERUPT_UNTAG(b));
+}
+
+/* < 0, 0 or > 0, like strcmp */
+int erupt_int_compare(int64_t a, int64_t b)
+{
+    if (ERUPT_IS_SMALL(a) && ERUPT_IS_SMALL(b))
+        return (a > b) - (a < b);
+
+    /* strings and lists passed where an int was expected */
+    if (erupt_value_kind(a) != ERUPT_BIGNUM ||
+        erupt_value_kind(b) != ERUPT_BIGNUM)
+        return erupt_value_compare(a, b);
+
+    num_t x, y;
+
+    unpack(a, &x);
+    unpack(b, &y);
+
+    if (x.negative != y.negative)
+        return x.negative ? -1 : 1;
+
+    int c = compare_mag(x.limbs, x.length, y.limbs, y.length);
+
+    return x.negative ? -c : c;
+}
+
+double erupt_int_to_float(int64_t a)
+{
+    if (ERUPT_IS_SMALL(a))
+        return (double)ERUPT_UNTAG(a);
+
+    num_t x;
+    double d = 0;
+
+    unpack(a, &x);
+
+    for (size_t i = x.length; i > 0; --i)
+        d = d * 4294967296.0 + x.limbs[i - 1];
+
+    return x.negative ? -d : d;
+}
+
+/* the integer part of f */
+int64_t erupt_int_from_float(double f)
+{
+    if (isnan(f) || isinf(f))
+        erupt_panic("%s can't be converted to an int",
+                    isnan(f) ? "nan" : "inf");
+
+    if (f >= (double)ERUPT_INT_MIN && f < -(double)ERUPT_INT_MIN)
+        return erupt_int_from_int64((int64_t)f);
+
+    /* |f| >= 2^62 has no fraction, it's a 53 bit int times 2^e */
+    int e;
+    int64_t mantissa = (int64_t)ldexp(frexp(f, &e), 53);
+
+    return erupt_int_shl(erupt_int_from_int64(mantissa), ERUPT_TAG(e - 53));
+}
+
+/* v as a tagged int, a bignum if it's outside of the small ints */
+int64_t erupt_int_from_int64(int64_t v)
+{
+    if (v >= ERUPT_INT_MIN && v <= ERUPT_INT_MAX)
+        return ERUPT_TAG(v);
+
+    uint64_t mag = v < 0 ? -(uint64_t)v : (uint64_t)v;
+    uint32_t limbs[2] = { (uint32_t)mag, (uint32_t)(mag >> 32) };
+
+    return pack(v < 0, limbs, 2);
+}
+
+/* the low 64 bits of a, in two's complement, like C's conversions */
+int64_t erupt_int_wrap(int64_t a)
+{
+    if (ERUPT_IS_SMALL(a))
+        return ERUPT_UNTAG(a);
+
+    num_t x;
+
+    unpack(a, &x);
+
+    uint64_t low = x.limbs[0] | (uint64_t)x.limbs[1] << 32;
+
+    return (int64_t)(x.negative ? -low : low);
+}
+
+/* the digits of a, allocated */
+char *erupt_int_to_string(int64_t a)
+{
+    num_t x;
+
+    unpack(a, &x);
+
+    /* 9 digits for every 32 bits is more than enough, and a sign */
+    size_t size = x.length * 10 + 3, n = size;
+    char *s = malloc(size);
+    uint32_t *q = alloc_limbs(x.length + 1);
+    size_t length = x.length;
+
+    if (!s)
+        erupt_panic("out of memory");
+
+    memcpy(q, x.limbs, x.length * sizeof(uint32_t));
+    s[--n] = '\0';
+
+    /* nine digits at a time, the remainders of dividing by 10^9 */
+    do {
+        uint32_t r = divide_small(q, q, length, 1000000000);
+
+        length = trim(q, length);
+
+        for (int i = 0; i < 9 && (length || r); ++i, r /= 10)
+            s[--n] = (char)('0' + r % 10);
+    } while (length);
+
+    if (n == size - 1)
+        s[--n] = '0';
+
+    if (x.negative)
+        s[--n] = '-';
+
+    free(q);
+    memmove(s, s + n, size - n);
+
+    return s;
+}
+
+/* the int with the digits s, decimal or after a 0x or 0b */
+int64_t erupt_int_parse(const char *s)
+{
+    uint32_t radix = 10;
+
+    if (s[0] == '0' && (s[1] == 'x' || s[1] == 'X' || s[1] == 'b' ||
+                        s[1] == 'B')) {
+        radix = s[1] == 'x' || s[1] == 'X' ? 16 : 2;
+        s += 2;
+    }
+
+    /* every digit is at most 4 bits */
+    uint32_t *limbs = alloc_limbs(strlen(s) / 8 + 1);
+    size_t length = 0;
+
+    for (; *s; ++s) {
+        uint64_t carry = (uint64_t)(*s >= 'a' ? *s - 'a' + 10 :
+                                    *s >= 'A' ? *s - 'A' + 10 : *s - '0');
+
+        for (size_t i = 0; i < length; ++i) {
+            carry += (uint64_t)limbs[i] * radix;
+            limbs[i] = (uint32_t)carry;
+            carry >>= 32;
+        }
+
+        if (carry)
+            limbs[length++] = (uint32_t)carry;
+    }
+
+    int64_t v = pack(false, limbs, length);
+
+    free(limbs);
+
+    return v;
+}
+
+static void unpack(int64_t v, num_t *n)
+{
+    if (!ERUPT_IS_SMALL(v)) {
+        const bigint_t *b = ERUPT_DEREF(v);
+
+        if (erupt_value_kind(v) != ERUPT_BIGNUM) {
+            erupt_panic("expected an int, got a %s",
+                        erupt_kind_str(erupt_value_kind(v)));
+        }
+
+        n->negative = b->negative;
+        n->length = b->length;
+        n->limbs = b->limbs;
+        return;
+    }
+
+    int64_t x = ERUPT_UNTAG(v);
+    uint64_t mag = x < 0 ? -(uint64_t)x : (uint64_t)x;
+
+    n->negative = x < 0;
+    n->small[0] = (uint32_t)mag;
+    n->small[1] = (uint32_t)(mag >> 32);
+    n->length = trim(n->small, 2);
+    n->limbs = n->small;
+}
+
+/* the int with this sign and magnitude, small if it fits */
+static int64_t pack(bool negative, uint32_t *limbs, size_t length)
+{
+    length = trim(limbs, length);
+
+    if (length <= 2) {
+        uint64_t mag = length ? limbs[0] : 0;
+
+        if (length == 2)
+            mag |= (uint64_t)limbs[1] << 32;
+
+        if (mag <= (uint64_t)ERUPT_INT_MAX)
+            return ERUPT_TAG(negative ? -(int64_t)mag : (int64_t)mag);
+
+        if (negative && mag == -(uint64_t)ERUPT_INT_MIN)
+            return ERUPT_TAG(ERUPT_INT_MIN);
+    }
+
+    bigint_t *b = erupt_gc_alloc(ERUPT_BIGNUM, sizeof(bigint_t) +
+                                               length * sizeof(uint32_t));
+
+    b->negative = negative;
+    b->length = length;
+    memcpy(b->limbs, limbs, length * sizeof(uint32_t));
+
+    return ERUPT_REF(b);
+}
+
+/* n zeroed limbs */
+static uint32_t *alloc_limbs(size_t n)
+{
+    uint32_t *limbs = calloc(n + 1, sizeof(uint32_t));
+
+    if (!limbs)
+        erupt_panic("out of memory");
+
+    return limbs;
+}
+
+/* a + b, or a - b */
+static int64_t add(const num_t *a, const num_t *b, bool negate_b)
+{
+    bool b_negative = b->negative != negate_b;
+    const num_t *big = a, *small = b;
+    bool negative = a->negative;
+
+    if (compare_mag(a->limbs, a->length, b->limbs, b->length) < 0) {
+        big = b;
+        small = a;
+        negative = b_negative;
+    }
+
+    uint32_t *r = alloc_limbs(big->length + 1);
+
+    memcpy(r, big->limbs, big->length * sizeof(uint32_t));
+
+    if (a->negative == b_negative)
+        r[big->length] = add_into(r, big->length, small->limbs, small->length);
+    else
+        sub_into(r, big->length, small->limbs, small->length);
+
+    int64_t result = pack(negative, r, big->length + 1);
+
+    free(r);
+
+    return result;
+}
+
+static int compare_mag(const uint32_t *a, size_t na, const uint32_t *b,
+                       size_t nb)
+{
+    if (na != nb)
+        return na < nb ? -1 : 1;
+
+    for (size_t i = na; i > 0; --i) {
+        if (a[i - 1] != b[i - 1])
+            return a[i - 1] < b[i - 1] ? -1 : 1;
+    }
+
+    return 0;
+}
+
+/* r += a, for nr >= na. returns the carry out of r */
+static uint32_t add_into(uint32_t *r, size_t nr, const uint32_t *a,
+                         size_t na)
+{
+    uint64_t carry = 0;
+
+    for (size_t i = 0; i < nr && (i < na || carry); ++i) {
+        carry += (uint64_t)r[i] + (i < na ? a[i] : 0);
+        r[i] = (uint32_t)carry;
+        carry >>= 32;
+    }
+
+    return (uint32_t)carry;
+}
+
+/* r -= a, for r >= a */
+static void sub_into(uint32_t *r, size_t nr, const uint32_t *a, size_t na)
+{
+    int64_t borrow = 0;
+
+    for (size_t i = 0; i < nr && (i < na || borrow); ++i) {
+        borrow += (int64_t)r[i] - (i < na ? a[i] : 0);
+        r[i] = (uint32_t)borrow;
+        borrow = borrow < 0 ? -1 : 0;
+    }
+}
+
+/* out = a * b, out has na + nb zeroed limbs and doesn't overlap a or b */
+static void mul_mag(const uint32_t *a, size_t na, const uint32_t *b,
+                    size_t nb, uint32_t *out)
+{
+    if (na >= KARATSUBA_THRESHOLD && nb >= KARATSUBA_THRESHOLD) {
+        karatsuba(a, na, b, nb, out);
+        return;
+    }
+
+    for (size_t i = 0; i < nb; ++i) {
+        uint64_t carry = 0;
+
+        for (size_t j = 0; j < na; ++j) {
+            carry += (uint64_t)a[j] * b[i] + out[i + j];
+            out[i + j] = (uint32_t)carry;
+            carry >>= 32;
+        }
+
+        out[i + na] = (uint32_t)carry;
+    }
+}
+
+/*
+ * with a = a1 * B^m + a0 and b = b1 * B^m + b0, a * b is
+ * a1 b1 B^2m + ((a0 + a1)(b0 + b1) - a0 b0 - a1 b1) B^m + a0 b0,
+ * three products of half the size instead of four.
+ */
+static void karatsuba(const uint32_t *a, size_t na, const uint32_t *b,
+                      size_t nb, uint32_t *out)
+{
+    if (na < nb) {
+        const uint32_t *t = a;
+        size_t nt = na;
+
+        a = b;
+        na = nb;
+        b = t;
+        nb = nt;
+    }
+
+    size_t m = na / 2;
+
+    /* b is too short to split, multiply it with both halves of a */
+    if (nb <= m) {
+        uint32_t *high = alloc_limbs(na - m + nb);
+
+        mul_mag(a, m, b, nb, out);
+        mul_mag(a + m, na - m, b, nb, high);
+        add_into(out + m, na + nb - m, high, na - m + nb);
+        free(high);
+        return;
+    }
+
+    size_t n1 = na - m + 1;
+    uint32_t *sa = alloc_limbs(n1), *sb = alloc_limbs(n1);
+    uint32_t *middle = alloc_limbs(2 * n1);
+
+    /* a0 b0 and a1 b1 go straight to where they belong */
+    mul_mag(a, m, b, m, out);
+    mul_mag(a + m, na - m, b + m, nb - m, out + 2 * m);
+
+    memcpy(sa, a + m, (na - m) * sizeof(uint32_t));
+    add_into(sa, n1, a, m);
+    memcpy(sb, b + m, (nb - m) * sizeof(uint32_t));
+    add_into(sb, n1, b, m);
+
+    size_t la = trim(sa, n1), lb = trim(sb, n1);
+
+    mul_mag(sa, la, sb, lb, middle);
+    sub_into(middle, 2 * n1, out, trim(out, 2 * m));
+    sub_into(middle, 2 * n1, out + 2 * m, trim(out + 2 * m, na + nb - 2 * m));
+    add_into(out + m, na + nb - m, middle, trim(middle, 2 * n1));
+
+    free(sa);
+    free(sb);
+    free(middle);
+}
+
+/* q = u / v for a single limb v, returns the remainder. q may be u */
+static uint32_t divide_small(uint32_t *q, const uint32_t *u, size_t n,
+                             uint32_t v)
+{
+    uint64_t r = 0;
+
+    for (size_t i = n; i > 0; --i) {
+        uint64_t d = r << 32 | u[i - 1];
+
+        q[i - 1] = (uint32_t)(d / v);
+        r = d % v;
+    }
+
+    return (uint32_t)r;
+}
+
+/*
+ * q = u / v and r = u % v of the magnitudes, Knuth's algorithm D. q has
+ * room for u->length - v->length + 1 limbs and r for v->length, v isn't 0.
+ */
+static void divide_mag(const num_t *u, const num_t *v, uint32_t *q,
+                       uint32_t *r)
+{
+    size_t m = u->length, n = v->length;
+
+    if (n == 1) {
+        r[0] = divide_small(q, u->limbs, m, v->limbs[0]);
+        return;
+    }
+
+    /* normalize, so the top limb of v has its high bit set */
+    int s = __builtin_clz(v->limbs[n - 1]);
+    uint32_t *un = alloc_limbs(m + 1), *vn = alloc_limbs(n);
+
+    for (size_t i = n - 1; i > 0; --i)
+        vn[i] = v->limbs[i] << s | (s ? v->limbs[i - 1] >> (32 - s) : 0);
+
+    vn[0] = v->limbs[0] << s;
+    un[m] = s ? u->limbs[m - 1] >> (32 - s) : 0;
+
+    for (size_t i = m - 1; i > 0; --i)
+        un[i] = u->limbs[i] << s | (s ? u->limbs[i - 1] >> (32 - s) : 0);
+
+    un[0] = u->limbs[0] << s;
+
+    for (size_t j = m - n + 1; j-- > 0; ) {
+        /* estimate the next limb of q from the top two of the remainder */
+        uint64_t top = (uint64_t)un[j + n] << 32 | un[j + n - 1];
+        uint64_t qhat = top / vn[n - 1], rhat = top % vn[n - 1];
+
+        while (qhat >> 32 ||
+               qhat * vn[n - 2] > (rhat << 32 | un[j + n - 2])) {
+            --qhat;
+            rhat += vn[n - 1];
+
+            if (rhat >> 32)
+                break;
+        }
+
+        /* un -= qhat * vn */
+        int64_t borrow = 0;
+        uint64_t carry = 0;
+
+        for (size_t i = 0; i < n; ++i) {
+            uint64_t p = qhat * vn[i] + carry;
+
+            carry = p >> 32;
+            borrow += (int64_t)un[i + j] - (uint32_t)p;
+            un[i + j] = (uint32_t)borrow;
+            borrow >>= 32;
+        }
+
+        borrow += (int64_t)un[j + n] - (int64_t)carry;
+        un[j + n] = (uint32_t)borrow;
+
+        /* qhat was one too large, add v back */
+        if (borrow < 0) {
+            --qhat;
+            un[j + n] += add_into(un + j, n, vn, n);
+        }
+
+        q[j] = (uint32_t)qhat;
+    }
+
+    for (size_t i = 0; i < n; ++i)
+        r[i] = un[i] >> s | (s ? un[i + 1] << (32 - s) : 0);
+
+    free(un);
+    free(vn);
+}
+
+static int64_t divide(int64_t a, int64_t b, bool remainder)
+{
+    num_t u, v;
+
+    if (b == 0)
+        erupt_panic("division by zero");
+
+    unpack(a, &u);
+    unpack(b, &v);
+
+    if (compare_mag(u.limbs, u.length, v.limbs, v.length) < 0)
+        return remainder ? a : 0;
+
+    uint32_t *q = alloc_limbs(u.length - v.length + 1);
+    uint32_t *r = alloc_limbs(v.length);
+    int64_t result;
+
+    divide_mag(&u, &v, q, r);
+
+    if (remainder)
+        result = pack(u.negative, r, v.length);
+    else
+        result = pack(u.negative != v.negative, q, u.length - v.length + 1);
+
+    free(q);
+    free(r);
+
+    return result;
+}
+
+/*
+ * &, | and ^ work on two's complement, as if both ints were sign extended
+ * forever. a negative int is ~(|a| - 1) in it.
+ */
+static int64_t bitwise(int64_t a, int64_t b, char op)
+{
+    num_t x, y;
+
+    unpack(a, &x);
+    unpack(b, &y);
+
+    size_t n = (x.length > y.length ? x.length : y.length) + 1;
+    uint32_t *bx = twos_complement(&x, n), *by = twos_complement(&y, n);
+    uint32_t one = 1;
+    bool negative;
+
+    switch (op) {
+    case '&': negative = x.negative && y.negative; break;
+    case '|': negative = x.negative || y.negative; break;
+    default: negative = x.negative != y.negative;
+    }
+
+    for (size_t i = 0; i < n; ++i) {
+        switch (op) {
+        case '&': bx[i] &= by[i]; break;
+        case '|': bx[i] |= by[i]; break;
+        default: bx[i] ^= by[i];
+        }
+
+        /* back to a magnitude */
+        bx[i] ^= negative ? UINT32_MAX : 0;
+    }
+
+    if (negative)
+        add_into(bx, n, &one, 1);
+
+    int64_t r = pack(negative, bx, n);
+
+    free(bx);
+    free(by);
+
+    return r;
+}
+
+/* the n limbs of a in two's complement */
+static uint32_t *twos_complement(const num_t *a, size_t n)
+{
+    uint32_t *limbs = alloc_limbs(n);
+    uint32_t one = 1;
+
+    memcpy(limbs, a->limbs, a->length * sizeof(uint32_t));
+
+    if (!a->negative)
+        return limbs;
+
+    sub_into(limbs, n, &one, 1);
+
+    for (size_t i = 0; i < n; ++i)
+        limbs[i] = ~limbs[i];
+
+    return limbs;
+}
+
+static int64_t shift_left(const num_t *a, uint64_t bits)
+{
+    size_t words = bits / 32, n = a->length + words + 1;
+    unsigned s = bits % 32;
+    uint32_t *r = alloc_limbs(n);
+
+    for (size_t i = 0; i < a->length; ++i) {
+        r[i + words] |= a->limbs[i] << s;
+        r[i + words + 1] = s ? a->limbs[i] >> (32 - s) : 0;
+    }
+
+    int64_t result = pack(a->negative, r, n);
+
+    free(r);
+
+    return result;
+}
+
+/* rounds down, so negative ints are -((|a| - 1) >> bits) - 1 */
+static int64_t shift_right(const num_t *a, uint64_t bits)
+{
+    size_t words = bits / 32;
+    unsigned s = bits % 32;
+
+    if (words >= a->length)
+        return a->negative ? ERUPT_TAG(-1) : 0;
+
+    size_t n = a->length - words;
+    uint32_t *mag = alloc_limbs(a->length), *r = alloc_limbs(n + 1);
+    uint32_t one = 1;
+
+    memcpy(mag, a->limbs, a->length * sizeof(uint32_t));
+
+    if (a->negative)
+        sub_into(mag, a->length, &one, 1);
+
+    for (size_t i = 0; i < n; ++i) {
+        r[i] = mag[i + words] >> s;
+
+        if (s && i + words + 1 < a->length)
+            r[i] |= mag[i + words + 1] << (32 - s);
+    }
+
+    if (a->negative)
+        r[n] = add_into(r, n, &one, 1);
+
+    int64_t result = pack(a->negative, r, n + 1);
+
+    free(mag);
+    free(r);
+
+    return result;
+}
+
+/* the length of limbs without its leading zeros */
+static size_t trim(const uint32_t *limbs, size_t length)
+{
+    while (length && !limbs[length - 1])
+        --length;
+
+    return length;
+}
@@ -0,0 +1,484 @@
+/*
+ * Copyright (C) 2015 soud
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * the IO module. output goes through a buffer per stream and is written
+ * when the buffer is full, with a single writev of the buffer and whatever
+ * didn't fit, when the program calls IO.flush and when it exits. streams
+ * that are terminals are flushed after every line instead. numbers are
+ * formatted straight into the buffer, without printf.
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "runtime.h"
+
+/* the most a number can take, "-1.23457e-308" or INT64_MIN */
+#define MAX_NUMBER 24
+
+/* significant digits of floats, like printf's %g */
+#define FLOAT_DIGITS 6
+
+/* 32 bit words in a big_t, enough for any double times any power of 10 */
+#define BIG_WORDS 64
+
+typedef struct {
+    int fd;
+    char buffer[ERUPT_IO_BUFFER_SIZE];
+    size_t length;
+    bool line_buffered;
+    pthread_mutex_t lock;
+} stream_t;
+
+/* an unsigned integer of BIG_WORDS words, least significant first */
+typedef struct {
+    uint32_t words[BIG_WORDS];
+    int length;
+} big_t;
+
+static stream_t out = { STDOUT_FILENO, { 0 }, 0, false,
+                        PTHREAD_MUTEX_INITIALIZER };
+static pthread_once_t io_once = PTHREAD_ONCE_INIT;
+
+static stream_t *open_stream(stream_t *s);
+static void init_io(void);
+static void flush_at_exit(void);
+static void flush_stream(stream_t *s, const char *data, size_t n);
+static void write_bytes(stream_t *s, const char *data, size_t n);
+static char *reserve(stream_t *s, size_t n);
+static void end_line(stream_t *s);
+static void write_value(stream_t *s, int64_t v);
+static void write_string(stream_t *s, const erupt_string_t *str);
+static void write_list(stream_t *s, const erupt_list_t *l);
+static size_t format_int(char *p, int64_t v);
+static size_t format_float(char *p, double v);
+static double scale(double v, int k);
+static double round_scaled(double v, int k);
+static int compare_half(double v, int k, double base);
+static void big_multiply(big_t *b, uint32_t m);
+static void big_shift(big_t *b, int bits);
+static int big_compare(const big_t *a, const big_t *b);
+
+void erupt_print_int(int64_t v)
+{
+    stream_t *s = open_stream(&out);
+
+    write_value(s, v);
+    end_line(s);
+}
+
+void erupt_print_float(double v)
+{
+    stream_t *s = open_stream(&out);
+
+    s->length += format_float(reserve(s, MAX_NUMBER), v);
+    end_line(s);
+}
+
+void erupt_print_bool(bool v)
+{
+    stream_t *s = open_stream(&out);
+
+    write_bytes(s, v ? "true" : "false", v ? 4 : 5);
+    end_line(s);
+}
+
+void erupt_print_string(const erupt_string_t *str)
+{
+    stream_t *s = open_stream(&out);
+
+    write_string(s, str);
+    end_line(s);
+}
+
+void erupt_print_list(const erupt_list_t *l)
+{
+    stream_t *s = open_stream(&out);
+
+    write_list(s, l);
+    end_line(s);
+}
+
+/* IO.flush, write everything that's buffered */
+void erupt_io_flush(void)
+{
+    stream_t *s = open_stream(&out);
+
+    flush_stream(s, NULL, 0);
+    pthread_mutex_unlock(&s->lock);
+}
+
+/* lock s, the first use of a stream sets up the IO module */
+static stream_t *open_stream(stream_t *s)
+{
+    pthread_once(&io_once, init_io);
+    pthread_mutex_lock(&s->lock);
+
+    return s;
+}
+
+static void init_io(void)
+{
+    out.line_buffered = isatty(out.fd);
+    atexit(flush_at_exit);
+}
+
+static void flush_at_exit(void)
+{
+    erupt_io_flush();
+}
+
+/* write the buffer of s followed by the n bytes of data, in one syscall */
+static void flush_stream(stream_t *s, const char *data, size_t n)
+{
+    struct iovec iov[2];
+    struct iovec *next = iov;
+    int left = 0;
+
+    if (s->length)
+        iov[left++] = (struct iovec){ s->buffer, s->length };
+
+    if (n)
+        iov[left++] = (struct iovec){ (void *)data, n };
+
+    while (left) {
+        ssize_t written = writev(s->fd, next, left);
+
+        /* output that can't be written is dropped, like stdio does */
+        if (written < 0 && errno == EINTR)
+            continue;
+
+        if (written < 0)
+            break;
+
+        for (; left && (size_t)written >= next->iov_len; ++next, --left)
+            written -= next->iov_len;
+
+        if (left) {
+            next->iov_base = (char *)next->iov_base + written;
+            next->iov_len -= written;
+        }
+    }
+
+    s->length = 0;
+}
+
+static void write_bytes(stream_t *s, const char *data, size_t n)
+{
+    if (s->length + n > sizeof(s->buffer)) {
+        flush_stream(s, data, n);
+        return;
+    }
+
+    memcpy(s->buffer + s->length, data, n);
+    s->length += n;
+}
+
+/* room for n more bytes at the end of the buffer of s */
+static char *reserve(stream_t *s, size_t n)
+{
+    if (s->length + n > sizeof(s->buffer))
+        flush_stream(s, NULL, 0);
+
+    return s->buffer + s->length;
+}
+
+/* end a print and unlock s */
+static void end_line(stream_t *s)
+{
+    write_bytes(s, "\n", 1);
+
+    if (s->line_buffered)
+        flush_stream(s, NULL, 0);
+
+    pthread_mutex_unlock(&s->lock);
+}
+
+/* v is a tagged int, bignums are formatted by int.c */
+/* an int, or whatever else a word refers to */
+static void write_value(stream_t *s, int64_t v)
+{
+    if (ERUPT_IS_SMALL(v)) {
+        s->length += format_int(reserve(s, MAX_NUMBER), ERUPT_UNTAG(v));
+        return;
+    }
+
+    const char *p = ERUPT_DEREF(v);
+
+    switch (erupt_value_kind(v)) {
+    case ERUPT_FLOAT:
+        s->length += format_float(reserve(s, MAX_NUMBER), *(double *)p);
+        break;
+    case ERUPT_STRING:
+        write_string(s, (const erupt_string_t *)p);
+        break;
+    case ERUPT_LIST:
+        write_list(s, (const erupt_list_t *)p);
+        break;
+    case ERUPT_CLOSURE:
+        write_bytes(s, "<function>", 10);
+        break;
+    default: {
+        char *digits = erupt_int_to_string(v);
+
+        write_bytes(s, digits, strlen(digits));
+        free(digits);
+    }
+    }
+}
+
+static void write_string(stream_t *s, const erupt_string_t *str)
+{
+    int64_t length = erupt_string_length(str);
+    char buffer[ERUPT_SHORT_STRING];
+
+    for (int64_t i = 0, n; i < length; i += n) {
+        const char *bytes = erupt_string_chunk(str, i, &n, buffer);
+
+        write_bytes(s, bytes, (size_t)n);
+    }
+}
+
+static void write_list(stream_t *s, const erupt_list_t *l)
+{
+    int64_t length = erupt_list_length(l);
+
+    write_bytes(s, "[", 1);
+
+    for (int64_t i = 0; i < length;) {
+        int64_t n;
+        const int64_t *values = erupt_list_chunk(l, i, &n);
+
+        for (int64_t k = 0; k < n; ++k, ++i) {
+            if (i)
+                write_bytes(s, ", ", 2);
+
+            write_value(s, values[k]);
+        }
+    }
+
+    write_bytes(s, "]", 1);
+}
+
+static size_t format_int(char *p, int64_t v)
+{
+    char digits[MAX_NUMBER];
+    uint64_t u = v < 0 ? -(uint64_t)v : (uint64_t)v;
+    size_t n = 0, length = 0;
+
+    do {
+        digits[n++] = (char)('0' + u % 10);
+        u /= 10;
+    } while (u);
+
+    if (v < 0)
+        p[length++] = '-';
+
+    while (n)
+        p[length++] = digits[--n];
+
+    return length;
+}
+
+/* like printf's %g: FLOAT_DIGITS significant digits, without trailing 0s */
+static size_t format_float(char *p, double v)
+{
+    char *start = p;
+
+    if (signbit(v)) {
+        *p++ = '-';
+        v = -v;
+    }
+
+    if (isnan(v) || isinf(v)) {
+        memcpy(p, isnan(v) ? "nan" : "inf", 3);
+        return (size_t)(p + 3 - start);
+    }
+
+    if (v == 0) {
+        *p++ = '0';
+        return (size_t)(p - start);
+    }
+
+    /* the digits as an integer, log10 can be off by one near powers of 10 */
+    int exp = (int)floor(log10(v));
+    double digits = round_scaled(v, FLOAT_DIGITS - 1 - exp);
+
+    if (digits < 1e5) {
+        --exp;
+        digits = round_scaled(v, FLOAT_DIGITS - 1 - exp);
+    }
+
+    if (digits >= 1e6) {
+        ++exp;
+        digits = round_scaled(v, FLOAT_DIGITS - 1 - exp);
+    }
+
+    char d[FLOAT_DIGITS];
+    uint64_t u = (uint64_t)digits;
+    int n = FLOAT_DIGITS;
+
+    for (int i = FLOAT_DIGITS - 1; i >= 0; --i, u /= 10)
+        d[i] = (char)('0' + u % 10);
+
+    while (n > 1 && d[n - 1] == '0')
+        --n;
+
+    if (exp < -4 || exp >= FLOAT_DIGITS) {
+        *p++ = d[0];
+
+        if (n > 1) {
+            *p++ = '.';
+            memcpy(p, d + 1, n - 1);
+            p += n - 1;
+        }
+
+        *p++ = 'e';
+        *p++ = exp < 0 ? '-' : '+';
+
+        if (exp > -10 && exp < 10)
+            *p++ = '0';
+
+        p += format_int(p, exp < 0 ? -exp : exp);
+    } else if (exp >= 0) {
+        for (int i = 0; i <= exp; ++i)
+            *p++ = i < n ? d[i] : '0';
+
+        if (n > exp + 1) {
+            *p++ = '.';
+            memcpy(p, d + exp + 1, n - exp - 1);
+            p += n - exp - 1;
+        }
+    } else {
+        *p++ = '0';
+        *p++ = '.';
+
+        for (int i = -1; i > exp; --i)
+            *p++ = '0';
+
+        memcpy(p, d, n);
+        p += n;
+    }
+
+    return (size_t)(p - start);
+}
+
+/* v * 10^k, in steps that don't overflow for the smallest doubles */
+static double scale(double v, int k)
+{
+    for (; k > 300; k -= 300)
+        v *= 1e300;
+
+    return k >= 0 ? v * pow(10, k) : v / pow(10, -k);
+}
+
+/* v * 10^k rounded to an integer, ties to even, the way printf rounds */
+static double round_scaled(double v, int k)
+{
+    double x = scale(v, k);
+    double r = rint(x);
+    double frac = x - r;
+
+    /* scale can be off by a few ulps, decide close calls exactly */
+    if (fabs(fabs(frac) - 0.5) > 1e-6)
+        return r;
+
+    double base = frac < 0 ? r - 1 : r;
+    int c = compare_half(v, k, base);
+
+    if (c == 0)
+        return fmod(base, 2) == 0 ? base : base + 1;
+
+    return c > 0 ? base + 1 : base;
+}
+
+/* compare v * 10^k with base + 1/2, as m * 2^(e + 1) * 10^k with 2 base + 1 */
+static int compare_half(double v, int k, double base)
+{
+    int e;
+    uint64_t m = (uint64_t)ldexp(frexp(v, &e), 53);
+    big_t left = { { (uint32_t)m, (uint32_t)(m >> 32) }, 2 };
+    big_t right = { { (uint32_t)(2 * base + 1) }, 1 };
+    big_t *tens = k >= 0 ? &left : &right;
+
+    e = e - 53 + 1;
+
+    for (int i = abs(k); i > 0; i -= 13)
+        big_multiply(tens, i >= 13 ? 1220703125 : (uint32_t)pow(5, i));
+
+    big_shift(tens, abs(k));
+    big_shift(e >= 0 ? &left : &right, abs(e));
+
+    return big_compare(&left, &right);
+}
+
+static void big_multiply(big_t *b, uint32_t m)
+{
+    uint64_t carry = 0;
+
+    for (int i = 0; i < b->length; ++i) {
+        carry += (uint64_t)b->words[i] * m;
+        b->words[i] = (uint32_t)carry;
+        carry >>= 32;
+    }
+
+    if (carry)
+        b->words[b->length++] = (uint32_t)carry;
+}
+
+static void big_shift(big_t *b, int bits)
+{
+    int words = bits / 32;
+
+    bits %= 32;
+    b->words[b->length] = 0;
+
+    for (int i = b->length; i >= 0; --i) {
+        uint32_t lower = i > 0 && bits ? b->words[i - 1] >> (32 - bits) : 0;
+        b->words[i + words] = (b->words[i] << bits) | lower;
+    }
+
+    memset(b->words, 0, words * sizeof(uint32_t));
+    b->length += words + 1;
+
+    while (b->length && !b->words[b->length - 1])
+        --b->length;
+}
+
+static int big_compare(const big_t *a, const big_t *b)
+{
+    if (a->length != b->length)
+        return a->length < b->length ? -1 : 1;
+
+    for (int i = a->length - 1; i >= 0; --i) {
+        if (a->words[i] != b->words[i])
+            return a->words[i] < b->words[i] ? -1 : 1;
+    }
+
+    return 0;
+}
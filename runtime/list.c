@@ -0,0 +1,830 @@
+/*
+ * Copyright (C) 2015 soud
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * lists are persistent vectors, relaxed radix balanced trees as described
+ * by Bagwell and Rompf. finding the child an index is in starts from the
+ * index's bits, as if the nodes below were full, and moves right past the
+ * children that aren't, which concatenation keeps to a few. appending
+ * copies the tail until it's full and becomes a leaf of the tree, updating
+ * copies the path to the value. concatenating merges the right edge of one
+ * tree with the left edge of the other, spreading the slots of the nodes
+ * along it over as few nodes as needed, and slicing cuts the edges off.
+ *
+ * a transient is a list that push and set change in place, along with the
+ * nodes it made itself, instead of copying them. lists are built as
+ * transients, and erupt_list_persistent turns them into values again.
+ * transients mustn't be shared before that.
+ */
+
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <string.h>
+
+#include "runtime.h"
+
+#define BITS ERUPT_LIST_BITS
+#define BRANCH ERUPT_LIST_BRANCH
+
+/*
+ * a concatenation leaves a level with at most this many more nodes than it
+ * needs, and nodes with no more than INVARIANT slots free as they are
+ */
+#define EXTRAS 2
+#define INVARIANT 1
+
+#define NODE(v) ((erupt_node_t *)ERUPT_DEREF(v))
+#define LENGTH(n) ERUPT_UNTAG((n)->length)
+
+static atomic_int_fast64_t last_owner;
+
+static erupt_list_t *new_list(int64_t length, int64_t shift, int64_t root,
+                              int64_t tail, int64_t owner);
+static int64_t new_owner(void);
+static int64_t tree_length(const erupt_list_t *l);
+static const int64_t *leaf_of(const erupt_list_t *l, int64_t i,
+                              int64_t *start, int64_t *length);
+static erupt_node_t *new_node(int64_t shift, int64_t owner);
+static erupt_node_t *editable(erupt_node_t *node, int64_t shift,
+                              int64_t owner);
+static int64_t node_of(const int64_t *children, int64_t n, int64_t shift);
+static int64_t size_of(const erupt_node_t *node, int64_t shift);
+static void set_sizes(erupt_node_t *node, int64_t shift);
+static int64_t slot_of(const erupt_node_t *node, int64_t shift, int64_t *i);
+static int64_t set_in(int64_t ref, int64_t shift, int64_t i, int64_t v,
+                      int64_t owner);
+static void push_leaf(int64_t *root, int64_t *shift, int64_t leaf,
+                      int64_t n, int64_t owner);
+static int64_t push_into(int64_t ref, int64_t shift, int64_t leaf, int64_t n,
+                         int64_t owner);
+static int64_t path(int64_t leaf, int64_t n, int64_t shift, int64_t owner);
+static int64_t merge(int64_t left, int64_t left_shift, int64_t right,
+                     int64_t right_shift, bool top, int64_t *shift);
+static int64_t rebalance(const erupt_node_t *left,
+                         const erupt_node_t *centre,
+                         const erupt_node_t *right, int64_t shift, bool top,
+                         int64_t *top_shift);
+static int64_t plan(const int64_t *nodes, int64_t n, int64_t *lengths);
+static void redistribute(const int64_t *nodes, const int64_t *lengths,
+                         int64_t n, int64_t shift, int64_t *to);
+static int64_t take(int64_t ref, int64_t shift, int64_t n);
+static int64_t drop(int64_t ref, int64_t shift, int64_t n);
+static void collapse(int64_t *root, int64_t *shift);
+static void check_index(const erupt_list_t *l, int64_t i);
+
+/* a list of the n values, they don't have to be on the heap */
+erupt_list_t *erupt_list_from(const int64_t *values, int64_t n)
+{
+    if (n < 0 || n > ERUPT_INT_MAX)
+        erupt_panic("list too long");
+
+    if (n <= BRANCH) {
+        erupt_list_t *l = new_list(n, 0, 0, n, 0);
+
+        if (n)
+            memcpy(l->tail, values, sizeof(int64_t) * (size_t)n);
+
+        return l;
+    }
+
+    /* full leaves go in the tree, the tail has the 1 to BRANCH left */
+    erupt_list_t *l = new_list(0, 0, 0, BRANCH, new_owner());
+    int64_t in_tree = (n - 1) / BRANCH * BRANCH, root = 0, shift = 0;
+
+    for (int64_t i = 0; i < in_tree; i += BRANCH) {
+        erupt_node_t *leaf = new_node(0, l->owner);
+
+        memcpy(leaf->slots, values + i, sizeof(int64_t) * BRANCH);
+        leaf->length = ERUPT_TAG(BRANCH);
+        push_leaf(&root, &shift, ERUPT_REF(leaf), BRANCH, l->owner);
+    }
+
+    memcpy(l->tail, values + in_tree, sizeof(int64_t) * (size_t)(n - in_tree));
+    l->length = ERUPT_TAG(n);
+    l->shift = ERUPT_TAG(shift);
+    l->root = root;
+    erupt_gc_write(l, root);
+
+    return erupt_list_persistent(l);
+}
+
+int64_t erupt_list_length(const erupt_list_t *l)
+{
+    return ERUPT_UNTAG(l->length);
+}
+
+int64_t erupt_list_get(const erupt_list_t *l, int64_t i)
+{
+    int64_t n;
+
+    check_index(l, i);
+
+    return *erupt_list_chunk(l, i, &n);
+}
+
+/*
+ * the values from index i to the end of the leaf it's in, there are *n.
+ * iterating over a list a chunk at a time only walks the tree once per leaf.
+ */
+const int64_t *erupt_list_chunk(const erupt_list_t *l, int64_t i, int64_t *n)
+{
+    int64_t start, length;
+    const int64_t *values = leaf_of(l, i, &start, &length);
+
+    *n = start + length - i;
+
+    return values + (i - start);
+}
+
+erupt_list_t *erupt_list_set(erupt_list_t *l, int64_t i, int64_t v)
+{
+    int64_t length = ERUPT_UNTAG(l->length), offset = tree_length(l);
+    erupt_list_t *r = l;
+
+    check_index(l, i);
+
+    if (!l->owner) {
+        r = new_list(length, ERUPT_UNTAG(l->shift), l->root, length - offset,
+                     0);
+        memcpy(r->tail, l->tail, sizeof(int64_t) * (size_t)(length - offset));
+    }
+
+    if (i >= offset) {
+        r->tail[i - offset] = v;
+        erupt_gc_write(r, v);
+    } else {
+        r->root = set_in(r->root, ERUPT_UNTAG(r->shift), i, v, r->owner);
+        erupt_gc_write(r, r->root);
+    }
+
+    return r;
+}
+
+/* l with v appended */
+erupt_list_t *erupt_list_push(erupt_list_t *l, int64_t v)
+{
+    int64_t length = ERUPT_UNTAG(l->length), tail = length - tree_length(l);
+    int64_t root = l->root, shift = ERUPT_UNTAG(l->shift);
+    erupt_list_t *r = l;
+
+    /* a full tail becomes a leaf */
+    if (tail == BRANCH) {
+        erupt_node_t *leaf = new_node(0, l->owner);
+
+        memcpy(leaf->slots, l->tail, sizeof(int64_t) * BRANCH);
+        leaf->length = ERUPT_TAG(BRANCH);
+        push_leaf(&root, &shift, ERUPT_REF(leaf), BRANCH, l->owner);
+        tail = 0;
+
+        if (l->owner)
+            memset(l->tail, 0, sizeof(int64_t) * BRANCH);
+    }
+
+    if (!l->owner) {
+        r = new_list(length, shift, root, tail + 1, 0);
+        memcpy(r->tail, l->tail, sizeof(int64_t) * (size_t)tail);
+    } else {
+        r->root = root;
+        r->shift = ERUPT_TAG(shift);
+        erupt_gc_write(r, root);
+    }
+
+    r->tail[tail] = v;
+    r->length = ERUPT_TAG(length + 1);
+    erupt_gc_write(r, v);
+
+    return r;
+}
+
+erupt_list_t *erupt_list_concat(const erupt_list_t *a, const erupt_list_t *b)
+{
+    int64_t length = ERUPT_UNTAG(a->length), tail = length - tree_length(a);
+    int64_t root = a->root, shift = ERUPT_UNTAG(a->shift);
+
+    if (!b->length)
+        return (erupt_list_t *)a;
+
+    if (!a->length)
+        return (erupt_list_t *)b;
+
+    /* b is all tail, push its values one by one */
+    if (!b->root) {
+        erupt_list_t *r = erupt_list_transient(a);
+
+        for (int64_t i = 0; i < ERUPT_UNTAG(b->length); ++i)
+            erupt_list_push(r, b->tail[i]);
+
+        return erupt_list_persistent(r);
+    }
+
+    /* a's tail goes in its tree, b's tail stays the tail */
+    if (tail) {
+        erupt_node_t *leaf = new_node(0, 0);
+
+        memcpy(leaf->slots, a->tail, sizeof(int64_t) * (size_t)tail);
+        leaf->length = ERUPT_TAG(tail);
+        push_leaf(&root, &shift, ERUPT_REF(leaf), tail, 0);
+    }
+
+    root = merge(root, shift, b->root, ERUPT_UNTAG(b->shift), true, &shift);
+    collapse(&root, &shift);
+
+    tail = ERUPT_UNTAG(b->length) - tree_length(b);
+    length += ERUPT_UNTAG(b->length);
+
+    erupt_list_t *r = new_list(length, shift, root, tail, 0);
+
+    memcpy(r->tail, b->tail, sizeof(int64_t) * (size_t)tail);
+
+    return r;
+}
+
+/* the values of l from index from up to index to */
+erupt_list_t *erupt_list_slice(const erupt_list_t *l, int64_t from,
+                               int64_t to)
+{
+    int64_t length = ERUPT_UNTAG(l->length), start, n;
+
+    if (from < 0 || to > length || from > to) {
+        erupt_panic("slice %" PRId64 "..%" PRId64 " is out of range for a "
+                    "list of %" PRId64, from, to, length);
+    }
+
+    if (from == 0 && to == length)
+        return (erupt_list_t *)l;
+
+    if (from == to)
+        return erupt_list_from(NULL, 0);
+
+    /* the slice ends with the values of the leaf that has its last one */
+    const int64_t *last = leaf_of(l, to - 1, &start, &n);
+    int64_t first = from > start ? from : start;
+    erupt_list_t *r = new_list(to - from, 0, 0, to - first, 0);
+
+    memcpy(r->tail, last + (first - start),
+           sizeof(int64_t) * (size_t)(to - first));
+
+    if (from < first) {
+        int64_t root = l->root, shift = ERUPT_UNTAG(l->shift);
+
+        root = drop(take(root, shift, first), shift, from);
+        collapse(&root, &shift);
+
+        r->root = root;
+        r->shift = ERUPT_TAG(shift);
+    }
+
+    return r;
+}
+
+/* a copy of l that push and set change in place */
+erupt_list_t *erupt_list_transient(const erupt_list_t *l)
+{
+    int64_t length = ERUPT_UNTAG(l->length), tail = length - tree_length(l);
+    erupt_list_t *r = new_list(length, ERUPT_UNTAG(l->shift), l->root,
+                               BRANCH, new_owner());
+
+    memcpy(r->tail, l->tail, sizeof(int64_t) * (size_t)tail);
+
+    return r;
+}
+
+/* l, a transient, as a value that can't be changed anymore */
+erupt_list_t *erupt_list_persistent(erupt_list_t *l)
+{
+    l->owner = 0;
+
+    return l;
+}
+
+/* lexicographic, a shorter list is smaller than one it's a prefix of */
+int erupt_list_compare(const erupt_list_t *a, const erupt_list_t *b)
+{
+    int64_t length_a = ERUPT_UNTAG(a->length);
+    int64_t length_b = ERUPT_UNTAG(b->length);
+    int64_t length = length_a < length_b ? length_a : length_b;
+
+    for (int64_t i = 0; i < length;) {
+        int64_t n_a, n_b;
+        const int64_t *values_a = erupt_list_chunk(a, i, &n_a);
+        const int64_t *values_b = erupt_list_chunk(b, i, &n_b);
+        int64_t n = n_a < n_b ? n_a : n_b;
+
+        if (n > length - i)
+            n = length - i;
+
+        for (int64_t k = 0; k < n; ++k) {
+            int c = erupt_value_compare(values_a[k], values_b[k]);
+
+            if (c)
+                return c;
+        }
+
+        i += n;
+    }
+
+    return (length_a > length_b) - (length_a < length_b);
+}
+
+static erupt_list_t *new_list(int64_t length, int64_t shift, int64_t root,
+                              int64_t tail, int64_t owner)
+{
+    erupt_list_t *l = erupt_gc_alloc(ERUPT_LIST, sizeof(erupt_list_t) +
+                                                 sizeof(int64_t) *
+                                                 (size_t)tail);
+
+    l->length = ERUPT_TAG(length);
+    l->shift = ERUPT_TAG(shift);
+    l->owner = owner;
+    l->root = root;
+
+    return l;
+}
+
+/* a transient's mark on the nodes it may change */
+static int64_t new_owner(void)
+{
+    return ERUPT_TAG(atomic_fetch_add(&last_owner, 1) + 1);
+}
+
+/* how many values are in the tree, the rest are in the tail */
+static int64_t tree_length(const erupt_list_t *l)
+{
+    return l->root ? size_of(NODE(l->root), ERUPT_UNTAG(l->shift)) : 0;
+}
+
+/* the values of the leaf, or the tail, index i is in. it starts at *start */
+static const int64_t *leaf_of(const erupt_list_t *l, int64_t i,
+                              int64_t *start, int64_t *length)
+{
+    int64_t offset = tree_length(l), j = i;
+
+    if (i >= offset) {
+        *start = offset;
+        *length = ERUPT_UNTAG(l->length) - offset;
+
+        return l->tail;
+    }
+
+    const erupt_node_t *node = NODE(l->root);
+
+    for (int64_t shift = ERUPT_UNTAG(l->shift); shift > 0; shift -= BITS)
+        node = NODE(node->slots[slot_of(node, shift, &j)]);
+
+    *start = i - j;
+    *length = LENGTH(node);
+
+    return node->slots;
+}
+
+/* a leaf if shift is 0, an internal node otherwise */
+static erupt_node_t *new_node(int64_t shift, int64_t owner)
+{
+    erupt_node_t *node = erupt_gc_alloc(ERUPT_NODE, sizeof(erupt_node_t) +
+                                        (shift ? sizeof(int64_t) * BRANCH
+                                               : 0));
+
+    node->owner = owner;
+
+    return node;
+}
+
+/* node, or a copy of it if it can't be changed by owner */
+static erupt_node_t *editable(erupt_node_t *node, int64_t shift,
+                              int64_t owner)
+{
+    if (owner && node->owner == owner)
+        return node;
+
+    erupt_node_t *copy = new_node(shift, owner);
+
+    copy->length = node->length;
+    memcpy(copy->slots, node->slots, sizeof(int64_t) *
+                                     (shift ? 2 * BRANCH : BRANCH));
+
+    return copy;
+}
+
+/* an internal node at shift with n children */
+static int64_t node_of(const int64_t *children, int64_t n, int64_t shift)
+{
+    erupt_node_t *node = new_node(shift, 0);
+
+    memcpy(node->slots, children, sizeof(int64_t) * (size_t)n);
+    node->length = ERUPT_TAG(n);
+    set_sizes(node, shift);
+
+    return ERUPT_REF(node);
+}
+
+/* how many values are under node */
+static int64_t size_of(const erupt_node_t *node, int64_t shift)
+{
+    return shift ? ERUPT_UNTAG(node->sizes[LENGTH(node) - 1]) : LENGTH(node);
+}
+
+static void set_sizes(erupt_node_t *node, int64_t shift)
+{
+    int64_t size = 0;
+
+    for (int64_t k = 0; k < LENGTH(node); ++k) {
+        size += size_of(NODE(node->slots[k]), shift - BITS);
+        node->sizes[k] = ERUPT_TAG(size);
+    }
+}
+
+/*
+ * the slot of node that index i is under. the children before it hold at
+ * most 1 << shift values each, so it's i >> shift or a bit further. i
+ * becomes the index within the child.
+ */
+static int64_t slot_of(const erupt_node_t *node, int64_t shift, int64_t *i)
+{
+    int64_t k = *i >> shift;
+
+    while (ERUPT_UNTAG(node->sizes[k]) <= *i)
+        ++k;
+
+    if (k)
+        *i -= ERUPT_UNTAG(node->sizes[k - 1]);
+
+    return k;
+}
+
+/* the tree ref, at shift, with the value at index i replaced by v */
+static int64_t set_in(int64_t ref, int64_t shift, int64_t i, int64_t v,
+                      int64_t owner)
+{
+    erupt_node_t *node = editable(NODE(ref), shift, owner);
+
+    if (shift) {
+        int64_t k = slot_of(node, shift, &i);
+
+        v = set_in(node->slots[k], shift - BITS, i, v, owner);
+        node->slots[k] = v;
+    } else {
+        node->slots[i] = v;
+    }
+
+    erupt_gc_write(node, v);
+
+    return ERUPT_REF(node);
+}
+
+/* add leaf, with n values, to the right of the tree *root */
+static void push_leaf(int64_t *root, int64_t *shift, int64_t leaf,
+                      int64_t n, int64_t owner)
+{
+    if (!*root) {
+        *root = leaf;
+        *shift = 0;
+        return;
+    }
+
+    int64_t pushed = push_into(*root, *shift, leaf, n, owner);
+
+    /* the tree is full, it gets a new root */
+    if (!pushed) {
+        int64_t children[] = { *root, path(leaf, n, *shift, owner) };
+
+        pushed = node_of(children, 2, *shift + BITS);
+        *shift += BITS;
+    }
+
+    *root = pushed;
+}
+
+/* the tree ref with leaf added to its right, or 0 if it's full */
+static int64_t push_into(int64_t ref, int64_t shift, int64_t leaf, int64_t n,
+                         int64_t owner)
+{
+    erupt_node_t *node = NODE(ref);
+    int64_t length = LENGTH(node), child = 0;
+
+    if (!shift)
+        return 0;
+
+    if (shift > BITS)
+        child = push_into(node->slots[length - 1], shift - BITS, leaf, n,
+                          owner);
+
+    if (!child && length == BRANCH)
+        return 0;
+
+    node = editable(node, shift, owner);
+
+    if (child) {
+        node->slots[length - 1] = child;
+    } else {
+        child = path(leaf, n, shift - BITS, owner);
+        node->slots[length] = child;
+        node->sizes[length] = node->sizes[length - 1];
+        node->length = ERUPT_TAG(++length);
+    }
+
+    node->sizes[length - 1] = ERUPT_TAG(ERUPT_UNTAG(node->sizes[length - 1]) +
+                                        n);
+    erupt_gc_write(node, child);
+
+    return ERUPT_REF(node);
+}
+
+/* leaf, under as many nodes with one child as it takes to reach shift */
+static int64_t path(int64_t leaf, int64_t n, int64_t shift, int64_t owner)
+{
+    for (int64_t s = BITS; s <= shift; s += BITS) {
+        erupt_node_t *node = new_node(s, owner);
+
+        node->slots[0] = leaf;
+        node->sizes[0] = ERUPT_TAG(n);
+        node->length = ERUPT_TAG(1);
+        leaf = ERUPT_REF(node);
+    }
+
+    return leaf;
+}
+
+/*
+ * the tree with the values of left followed by those of right. its level,
+ * *shift, is one above the higher of the two, except at the top where it
+ * can be the same if its children fit in one node.
+ */
+static int64_t merge(int64_t left, int64_t left_shift, int64_t right,
+                     int64_t right_shift, bool top, int64_t *shift)
+{
+    const erupt_node_t *l = NODE(left), *r = NODE(right);
+    int64_t centre, s;
+
+    if (left_shift > right_shift) {
+        centre = merge(l->slots[LENGTH(l) - 1], left_shift - BITS, right,
+                       right_shift, false, &s);
+
+        return rebalance(l, NODE(centre), NULL, left_shift, top, shift);
+    }
+
+    if (left_shift < right_shift) {
+        centre = merge(left, left_shift, r->slots[0], right_shift - BITS,
+                       false, &s);
+
+        return rebalance(NULL, NODE(centre), r, right_shift, top, shift);
+    }
+
+    if (!left_shift) {
+        int64_t length = LENGTH(l) + LENGTH(r);
+
+        if (top && length <= BRANCH) {
+            erupt_node_t *leaf = new_node(0, 0);
+
+            memcpy(leaf->slots, l->slots, sizeof(int64_t) * (size_t)LENGTH(l));
+            memcpy(leaf->slots + LENGTH(l), r->slots,
+                   sizeof(int64_t) * (size_t)LENGTH(r));
+            leaf->length = ERUPT_TAG(length);
+            *shift = 0;
+
+            return ERUPT_REF(leaf);
+        }
+
+        int64_t leaves[] = { left, right };
+
+        *shift = BITS;
+
+        return node_of(leaves, 2, BITS);
+    }
+
+    centre = merge(l->slots[LENGTH(l) - 1], left_shift - BITS, r->slots[0],
+                   right_shift - BITS, false, &s);
+
+    return rebalance(l, NODE(centre), r, left_shift, top, shift);
+}
+
+/*
+ * the children of left but its last, of centre and of right but its first,
+ * all at shift - BITS, redistributed so that there are few of them and put
+ * in one or two nodes at shift, under a node at shift + BITS unless it's
+ * the top and one node was enough.
+ */
+static int64_t rebalance(const erupt_node_t *left,
+                         const erupt_node_t *centre,
+                         const erupt_node_t *right, int64_t shift, bool top,
+                         int64_t *top_shift)
+{
+    /* left and right have BRANCH children at most, centre 2 */
+    int64_t nodes[2 * BRANCH + 2], lengths[2 * BRANCH + 2];
+    int64_t children[2 * BRANCH + 2], n = 0;
+
+    for (int64_t k = 0; left && k < LENGTH(left) - 1; ++k)
+        nodes[n++] = left->slots[k];
+
+    for (int64_t k = 0; k < LENGTH(centre); ++k)
+        nodes[n++] = centre->slots[k];
+
+    for (int64_t k = 1; right && k < LENGTH(right); ++k)
+        nodes[n++] = right->slots[k];
+
+    n = plan(nodes, n, lengths);
+    redistribute(nodes, lengths, n, shift - BITS, children);
+
+    *top_shift = shift + BITS;
+
+    if (n <= BRANCH) {
+        int64_t node = node_of(children, n, shift);
+
+        if (top) {
+            *top_shift = shift;
+            return node;
+        }
+
+        return node_of(&node, 1, shift + BITS);
+    }
+
+    int64_t halves[] = { node_of(children, BRANCH, shift), 0 };
+
+    halves[1] = node_of(children + BRANCH, n - BRANCH, shift);
+
+    return node_of(halves, 2, shift + BITS);
+}
+
+/*
+ * how many slots each of the nodes should have for there to be no more
+ * than EXTRAS nodes than the least that can hold them all. nodes that are
+ * too short are merged into the ones after them, leaving the rest alone.
+ */
+static int64_t plan(const int64_t *nodes, int64_t n, int64_t *lengths)
+{
+    int64_t total = 0, optimal, i = 0;
+
+    for (int64_t k = 0; k < n; ++k) {
+        lengths[k] = LENGTH(NODE(nodes[k]));
+        total += lengths[k];
+    }
+
+    optimal = (total - 1) / BRANCH + 1;
+
+    while (optimal + EXTRAS < n) {
+        while (lengths[i] > BRANCH - INVARIANT)
+            ++i;
+
+        /* spread the slots of node i over the nodes after it */
+        int64_t left = lengths[i];
+
+        do {
+            int64_t length = left + lengths[i + 1];
+
+            if (length > BRANCH)
+                length = BRANCH;
+
+            left += lengths[i + 1] - length;
+            lengths[i++] = length;
+        } while (left > 0);
+
+        memmove(lengths + i, lengths + i + 1,
+                sizeof(int64_t) * (size_t)(n - i - 1));
+        --n;
+        --i;
+    }
+
+    return n;
+}
+
+/* new nodes at shift with lengths[k] of the slots of the nodes each */
+static void redistribute(const int64_t *nodes, const int64_t *lengths,
+                         int64_t n, int64_t shift, int64_t *to)
+{
+    int64_t from = 0, offset = 0;
+
+    for (int64_t k = 0; k < n; ++k) {
+        const erupt_node_t *old = NODE(nodes[from]);
+
+        /* nodes that keep their slots aren't copied */
+        if (!offset && lengths[k] == LENGTH(old)) {
+            to[k] = nodes[from++];
+            continue;
+        }
+
+        erupt_node_t *node = new_node(shift, 0);
+        int64_t length = 0;
+
+        while (length < lengths[k]) {
+            old = NODE(nodes[from]);
+
+            int64_t m = LENGTH(old) - offset;
+
+            if (m > lengths[k] - length)
+                m = lengths[k] - length;
+
+            memcpy(node->slots + length, old->slots + offset,
+                   sizeof(int64_t) * (size_t)m);
+            length += m;
+            offset += m;
+
+            if (offset == LENGTH(old)) {
+                ++from;
+                offset = 0;
+            }
+        }
+
+        node->length = ERUPT_TAG(length);
+
+        if (shift)
+            set_sizes(node, shift);
+
+        to[k] = ERUPT_REF(node);
+    }
+}
+
+/* the tree ref with only its first n values, n isn't 0 */
+static int64_t take(int64_t ref, int64_t shift, int64_t n)
+{
+    const erupt_node_t *node = NODE(ref);
+
+    if (n == size_of(node, shift))
+        return ref;
+
+    erupt_node_t *r = new_node(shift, 0);
+
+    if (!shift) {
+        memcpy(r->slots, node->slots, sizeof(int64_t) * (size_t)n);
+        r->length = ERUPT_TAG(n);
+
+        return ERUPT_REF(r);
+    }
+
+    int64_t i = n - 1, k = slot_of(node, shift, &i);
+
+    memcpy(r->slots, node->slots, sizeof(int64_t) * (size_t)k);
+    memcpy(r->sizes, node->sizes, sizeof(int64_t) * (size_t)k);
+    r->slots[k] = take(node->slots[k], shift - BITS, i + 1);
+    r->sizes[k] = ERUPT_TAG(n);
+    r->length = ERUPT_TAG(k + 1);
+
+    return ERUPT_REF(r);
+}
+
+/* the tree ref without its first n values, n is less than its size */
+static int64_t drop(int64_t ref, int64_t shift, int64_t n)
+{
+    const erupt_node_t *node = NODE(ref);
+    int64_t length = LENGTH(node);
+
+    if (!n)
+        return ref;
+
+    erupt_node_t *r = new_node(shift, 0);
+
+    if (!shift) {
+        memcpy(r->slots, node->slots + n, sizeof(int64_t) * (size_t)(length -
+                                                                     n));
+        r->length = ERUPT_TAG(length - n);
+
+        return ERUPT_REF(r);
+    }
+
+    int64_t i = n, k = slot_of(node, shift, &i);
+
+    r->slots[0] = drop(node->slots[k], shift - BITS, i);
+    memcpy(r->slots + 1, node->slots + k + 1,
+           sizeof(int64_t) * (size_t)(length - k - 1));
+
+    for (int64_t j = 0; j < length - k; ++j)
+        r->sizes[j] = ERUPT_TAG(ERUPT_UNTAG(node->sizes[k + j]) - n);
+
+    r->length = ERUPT_TAG(length - k);
+
+    return ERUPT_REF(r);
+}
+
+/* remove the nodes with one child from the top of the tree */
+static void collapse(int64_t *root, int64_t *shift)
+{
+    while (*shift && LENGTH(NODE(*root)) == 1) {
+        *root = NODE(*root)->slots[0];
+        *shift -= BITS;
+    }
+}
+
+static void check_index(const erupt_list_t *l, int64_t i)
+{
+    if (i < 0 || i >= ERUPT_UNTAG(l->length)) {
+        erupt_panic("index %" PRId64 " is out of range for a list of %"
+                    PRId64, i, ERUPT_UNTAG(l->length));
+    }
+}
@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2015 soud
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "runtime.h"
+
+static const char *const *profile_names;
+static uint64_t *profile_counters;
+static int64_t profile_size;
+
+static void write_profile(void);
+
+/*
+ * called before main by instrumented programs. counters are incremented by
+ * the generated code, names[i] is the profile point counters[i] counts.
+ * they're written to the profile when the program exits.
+ */
+void erupt_profile_start(const char *const *names, uint64_t *counters,
+                         int64_t n)
+{
+    profile_names = names;
+    profile_counters = counters;
+    profile_size = n;
+
+    atexit(write_profile);
+}
+
+static void write_profile(void)
+{
+    const char *path = getenv("ERUPT_PROFILE");
+    FILE *file;
+
+    if (!path || !*path)
+        path = ERUPT_DEFAULT_PROFILE;
+
+    if (!(file = fopen(path, "w"))) {
+        fprintf(stderr, "erupt: couldn't write profile '%s'\n", path);
+        return;
+    }
+
+    fputs("# erupt profile\n", file);
+
+    for (int64_t i = 0; i < profile_size; ++i) {
+        fprintf(file, "%s %" PRIu64 "\n", profile_names[i],
+                __atomic_load_n(&profile_counters[i], __ATOMIC_RELAXED));
+    }
+
+    fclose(file);
+}
@@ -0,0 +1,306 @@
+/*
+ * Copyright (C) 2015 soud
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef RUNTIME_H
+#define RUNTIME_H
+
+/*
+ * the interface between code generated by erupt and its runtime library.
+ * everything in here is prefixed with erupt_ so it can't clash with the
+ * functions of an erupt program.
+ */
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* spawned tasks deeper than this run inline (ERUPT_SPAWN_DEPTH overrides) */
+#define ERUPT_DEFAULT_SPAWN_DEPTH 12
+
+/* where instrumented programs write their profile (ERUPT_PROFILE overrides) */
+#define ERUPT_DEFAULT_PROFILE "erupt.profile"
+
+/* the size of the buffer of every output stream */
+#define ERUPT_IO_BUFFER_SIZE 65536
+
+/* requests in flight before submitting waits for completions */
+#define ERUPT_AIO_ENTRIES 256
+
+/* registered buffers of ERUPT_IO_BUFFER_SIZE bytes, at most 32 */
+#define ERUPT_AIO_BUFFERS 16
+
+/* in bytes, where objects are allocated (ERUPT_NURSERY overrides, in KB) */
+#define ERUPT_NURSERY_SIZE (4 << 20)
+
+/* the old generation is collected once it's this big, or twice as big as
+   after it was last collected */
+#define ERUPT_MIN_HEAP_SIZE (32 << 20)
+
+/*
+ * ints are tagged words. a small int v is stored as v << 1, an int that
+ * doesn't fit in the 63 bits left is a reference to a bignum: a pointer with
+ * the low bit set. strings, lists and floats are references too where they
+ * are stored as a word, in lists and as the arguments of functions. objects
+ * are aligned to 8 bytes, so the low bits of a word that refers to one are
+ * 001, short strings are the only other words with the low bit set.
+ */
+#define ERUPT_INT_MIN (-(INT64_C(1) << 62))
+#define ERUPT_INT_MAX ((INT64_C(1) << 62) - 1)
+#define ERUPT_IS_SMALL(v) (((v) & 1) == 0)
+#define ERUPT_IS_REF(v) (((v) & 7) == 1)
+#define ERUPT_TAG(v) ((int64_t)((uint64_t)(v) << 1))
+#define ERUPT_UNTAG(v) ((v) >> 1)
+#define ERUPT_REF(p) ((int64_t)((uintptr_t)(p) | 1))
+#define ERUPT_DEREF(v) ((void *)(uintptr_t)((v) & ~INT64_C(1)))
+
+/* what's in an object */
+enum {
+    ERUPT_FILLER, /* unused space */
+    ERUPT_BIGNUM,
+    ERUPT_FLOAT,
+    ERUPT_STRING,
+    ERUPT_LIST,
+    ERUPT_NODE,   /* part of a list */
+    ERUPT_ROPE,   /* a string made of two others */
+    ERUPT_CLOSURE
+};
+
+/*
+ * objects, and string constants, are preceded by a header word: the size of
+ * the object in bytes, its kind and 8 bits for the collector. values point
+ * past the header.
+ */
+#define ERUPT_HEADER(kind, size) \
+    ((uint64_t)(size) << 16 | (uint64_t)(kind) << 8)
+#define ERUPT_HEADER_OF(p) (((uint64_t *)(p))[-1])
+#define ERUPT_KIND(p) ((int)(ERUPT_HEADER_OF(p) >> 8 & 0xff))
+
+/* tasks live in their parent's frame, codegen reserves this many bytes */
+#define ERUPT_TASK_SIZE 32
+
+typedef struct erupt_task {
+    void (*fn)(void *);
+    void *arg;
+    int depth;
+    atomic_int done;
+} erupt_task_t;
+
+_Static_assert(sizeof(erupt_task_t) <= ERUPT_TASK_SIZE,
+               "erupt_task_t doesn't fit in ERUPT_TASK_SIZE");
+
+/*
+ * an asynchronous read, write or accept. like tasks, requests live in the
+ * frame of whoever started them and have to be waited for before it returns.
+ */
+typedef struct erupt_aio {
+    int op;
+    int fd;
+    int wait_fd;
+    void *buffer;
+    size_t length;
+    int64_t offset;
+    int64_t result;
+    atomic_int done;
+} erupt_aio_t;
+
+/*
+ * strings are flat, their length followed by their bytes and a 0, or ropes
+ * that concatenate two other strings. strings of up to ERUPT_SHORT_STRING
+ * bytes are no objects at all: their bytes are stored in the pointer itself,
+ * above a byte with their length and the low bits 010, which no object's
+ * address has. stored as a word, the low bits of a short string are 011.
+ */
+#define ERUPT_SHORT_STRING 7
+#define ERUPT_IS_SHORT(s) (((uintptr_t)(s) & 7) == 2)
+
+typedef struct erupt_string {
+    int64_t length;
+    char bytes[];
+} erupt_string_t;
+
+/* every word of a rope is a value, like those of a list */
+typedef struct erupt_rope {
+    int64_t length;
+    int64_t depth;   /* of the deepest rope in it, plus 1 */
+    int64_t left;
+    int64_t right;
+} erupt_rope_t;
+
+/*
+ * lists are relaxed radix balanced trees: their values are in leaves of up
+ * to ERUPT_LIST_BRANCH values, under nodes with as many children. the last
+ * values of a list are kept in the list itself, in its tail, so appending
+ * to it rarely touches the tree.
+ *
+ * values of every type are stored as a word in lists, and every word of a
+ * list or a node is a value: their lengths and sizes are tagged like ints.
+ */
+#define ERUPT_LIST_BITS 5
+#define ERUPT_LIST_BRANCH (1 << ERUPT_LIST_BITS)
+
+typedef struct erupt_list {
+    int64_t length;
+    int64_t shift;   /* the bits of an index above those the root uses */
+    int64_t owner;   /* for transients, 0 once the list is persistent */
+    int64_t root;    /* the tree with the values before the tail, or 0 */
+    int64_t tail[];
+} erupt_list_t;
+
+/*
+ * a leaf or an internal node. the children of an internal node are
+ * followed by how many values are under each of them and the ones before.
+ */
+typedef struct erupt_node {
+    int64_t length;
+    int64_t owner;   /* the transient that may change it in place */
+    int64_t slots[ERUPT_LIST_BRANCH];
+    int64_t sizes[];
+} erupt_node_t;
+
+/*
+ * a function value: the function, which takes the closure itself and arity
+ * arguments, and a flat copy of the values it captured. the address of the
+ * function is outside the heap, the collector passes over it. the VM keeps
+ * the index of its function there instead.
+ */
+typedef struct erupt_closure {
+    int64_t code;
+    int64_t arity;
+    int64_t env[];
+} erupt_closure_t;
+
+#define ERUPT_IS_CLOSURE(v) \
+    (ERUPT_IS_REF(v) && ERUPT_KIND(ERUPT_DEREF(v)) == ERUPT_CLOSURE)
+
+typedef struct {
+    uint64_t allocated;    /* bytes, since the program started */
+    uint64_t promoted;     /* bytes copied out of the nursery */
+    uint64_t heap;         /* bytes in the old generation */
+    uint64_t minor;        /* collections of the nursery */
+    uint64_t major;        /* collections of the whole heap */
+    uint64_t pause_ns;     /* all collections together */
+    uint64_t max_pause_ns;
+    uint64_t elapsed_ns;   /* since the first allocation */
+    uint64_t threads;      /* registered ones that haven't exited */
+} erupt_gc_stats_t;
+
+/* core.c */
+_Noreturn void erupt_panic(const char *fmt, ...);
+_Noreturn void erupt_nomatch(const char *fn);
+int64_t erupt_float_box(double f);
+int erupt_value_kind(int64_t v);
+int erupt_value_compare(int64_t a, int64_t b);
+const char *erupt_kind_str(int kind);
+
+/* gc.c */
+void *erupt_gc_alloc(int kind, size_t size);
+void erupt_gc_collect(bool major);
+void erupt_gc_register_thread(void);
+void erupt_gc_poll(void);
+void erupt_gc_blocking(void (*fn)(void *), void *arg);
+void erupt_gc_add_roots(void *start, void *end);
+void erupt_gc_remove_roots(void *start);
+void erupt_gc_write(void *object, int64_t v);
+void erupt_gc_stats(erupt_gc_stats_t *stats);
+
+/* int.c */
+int64_t erupt_int_add(int64_t a, int64_t b);
+int64_t erupt_int_sub(int64_t a, int64_t b);
+int64_t erupt_int_mul(int64_t a, int64_t b);
+int64_t erupt_int_div(int64_t a, int64_t b);
+int64_t erupt_int_mod(int64_t a, int64_t b);
+int64_t erupt_int_pow(int64_t base, int64_t exp);
+int64_t erupt_int_neg(int64_t a);
+int64_t erupt_int_and(int64_t a, int64_t b);
+int64_t erupt_int_or(int64_t a, int64_t b);
+int64_t erupt_int_xor(int64_t a, int64_t b);
+int64_t erupt_int_not(int64_t a);
+int64_t erupt_int_shl(int64_t a, int64_t b);
+int64_t erupt_int_shr(int64_t a, int64_t b);
+int erupt_int_compare(int64_t a, int64_t b);
+double erupt_int_to_float(int64_t a);
+int64_t erupt_int_from_float(double f);
+int64_t erupt_int_from_int64(int64_t v);
+int64_t erupt_int_wrap(int64_t a);
+char *erupt_int_to_string(int64_t a);
+int64_t erupt_int_parse(const char *s);
+
+/* io.c */
+void erupt_print_int(int64_t v);
+void erupt_print_float(double v);
+void erupt_print_bool(bool v);
+void erupt_print_string(const erupt_string_t *s);
+void erupt_print_list(const erupt_list_t *l);
+void erupt_io_flush(void);
+
+/* aio.c */
+void erupt_aio_read(erupt_aio_t *r, int fd, void *buffer, size_t length,
+                    int64_t offset);
+void erupt_aio_write(erupt_aio_t *r, int fd, const void *buffer,
+                     size_t length, int64_t offset);
+void erupt_aio_accept(erupt_aio_t *r, int fd);
+void erupt_aio_submit(void);
+int64_t erupt_aio_wait(erupt_aio_t *r);
+void *erupt_aio_buffer(void);
+void erupt_aio_release(void *buffer);
+
+/* string.c */
+erupt_string_t *erupt_string_from(const char *bytes, int64_t n);
+int64_t erupt_string_length(const erupt_string_t *s);
+const char *erupt_string_chunk(const erupt_string_t *s, int64_t i, int64_t *n,
+                               char *buffer);
+erupt_string_t *erupt_string_concat(const erupt_string_t *a,
+                                    const erupt_string_t *b);
+int erupt_string_compare(const erupt_string_t *a, const erupt_string_t *b);
+
+/* list.c */
+erupt_list_t *erupt_list_from(const int64_t *values, int64_t n);
+int64_t erupt_list_length(const erupt_list_t *l);
+int64_t erupt_list_get(const erupt_list_t *l, int64_t i);
+const int64_t *erupt_list_chunk(const erupt_list_t *l, int64_t i,
+                                int64_t *n);
+erupt_list_t *erupt_list_set(erupt_list_t *l, int64_t i, int64_t v);
+erupt_list_t *erupt_list_push(erupt_list_t *l, int64_t v);
+erupt_list_t *erupt_list_concat(const erupt_list_t *a, const erupt_list_t *b);
+erupt_list_t *erupt_list_slice(const erupt_list_t *l, int64_t from,
+                               int64_t to);
+erupt_list_t *erupt_list_transient(const erupt_list_t *l);
+erupt_list_t *erupt_list_persistent(erupt_list_t *l);
+int erupt_list_compare(const erupt_list_t *a, const erupt_list_t *b);
+
+/* closure.c */
+erupt_closure_t *erupt_closure_from(void *code, int64_t arity,
+                                    const int64_t *env, int64_t n);
+_Noreturn void erupt_apply_error(int64_t f, int64_t n);
+
+/* profile.c */
+void erupt_profile_start(const char *const *names, uint64_t *counters,
+                         int64_t n);
+
+/* task.c */
+void erupt_fork(erupt_task_t *task, void (*fn)(void *), void *arg);
+void erupt_join(erupt_task_t *task);
+size_t erupt_workers(void);
+bool erupt_task_yield(void);
+
+#endif /* !RUNTIME_H */
@@ -0,0 +1,337 @@
+/*
+ * Copyright (C) 2015 soud
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * strings are ropes, as described by Boehm, Atkinson and Plass: a
+ * concatenation that isn't short refers to the two strings it's made of
+ * instead of copying them. short ones are copied into a flat string, and so
+ * are short strings appended to a rope that ends in one, which keeps the
+ * leaves of ropes that are built a piece at a time long. once a rope gets
+ * deeper than MAX_DEPTH, the parts of it that aren't balanced are rebuilt
+ * from their leaves.
+ *
+ * strings of up to ERUPT_SHORT_STRING bytes are stored in the pointer, see
+ * runtime.h, so making them doesn't allocate at all.
+ */
+
+#include <string.h>
+
+#include "runtime.h"
+
+/* concatenations up to this long are copied */
+#define FLAT_MAX 128
+
+/* ropes deeper than this are rebalanced */
+#define MAX_DEPTH 48
+
+/* the fibonacci numbers from 1 on, up to the first past ERUPT_INT_MAX */
+#define MAX_LENGTHS 90
+
+#define SHORT ERUPT_SHORT_STRING
+#define EMPTY ((erupt_string_t *)(uintptr_t)2)
+
+#define ROPE(s) ((const erupt_rope_t *)(s))
+#define IS_ROPE(s) (!ERUPT_IS_SHORT(s) && ERUPT_KIND(s) == ERUPT_ROPE)
+#define LEFT(s) ((const erupt_string_t *)ERUPT_DEREF(ROPE(s)->left))
+#define RIGHT(s) ((const erupt_string_t *)ERUPT_DEREF(ROPE(s)->right))
+
+static erupt_string_t *new_short(const char *bytes, int64_t n);
+static erupt_string_t *new_flat(int64_t n);
+static erupt_string_t *new_rope(const erupt_string_t *left,
+                                const erupt_string_t *right);
+static int64_t depth_of(const erupt_string_t *s);
+static void read_bytes(const erupt_string_t *s, char *to);
+static erupt_string_t *join(const erupt_string_t *a, const erupt_string_t *b);
+static erupt_string_t *rebalance(const erupt_string_t *s);
+static void insert(const erupt_string_t **forest, const int64_t *min_lengths,
+                   const erupt_string_t *s);
+static void add_to_forest(const erupt_string_t **forest,
+                          const int64_t *min_lengths,
+                          const erupt_string_t *s);
+
+erupt_string_t *erupt_string_from(const char *bytes, int64_t n)
+{
+    if (n <= SHORT)
+        return new_short(bytes, n);
+
+    erupt_string_t *s = new_flat(n);
+
+    memcpy(s->bytes, bytes, (size_t)n);
+
+    return s;
+}
+
+int64_t erupt_string_length(const erupt_string_t *s)
+{
+    if (ERUPT_IS_SHORT(s))
+        return (int64_t)((uintptr_t)s >> 3 & 0x1f);
+
+    return IS_ROPE(s) ? ERUPT_UNTAG(ROPE(s)->length) : s->length;
+}
+
+/*
+ * the bytes of s from i on that are stored together, n of them. the bytes
+ * of short strings are copied to buffer, which has room for
+ * ERUPT_SHORT_STRING of them.
+ */
+const char *erupt_string_chunk(const erupt_string_t *s, int64_t i, int64_t *n,
+                               char *buffer)
+{
+    while (IS_ROPE(s)) {
+        int64_t left_length = erupt_string_length(LEFT(s));
+
+        if (i < left_length) {
+            s = LEFT(s);
+        } else {
+            s = RIGHT(s);
+            i -= left_length;
+        }
+    }
+
+    int64_t length = erupt_string_length(s);
+
+    *n = length - i;
+
+    if (!ERUPT_IS_SHORT(s))
+        return s->bytes + i;
+
+    for (int64_t k = i; k < length; ++k)
+        buffer[k - i] = (char)((uintptr_t)s >> 8 * (k + 1));
+
+    return buffer;
+}
+
+erupt_string_t *erupt_string_concat(const erupt_string_t *a,
+                                    const erupt_string_t *b)
+{
+    int64_t length_a = erupt_string_length(a);
+    int64_t length_b = erupt_string_length(b);
+
+    if (length_a > ERUPT_INT_MAX - length_b)
+        erupt_panic("string too long");
+
+    /* the bytes of b go right after those of a, above its length */
+    if (ERUPT_IS_SHORT(a) && ERUPT_IS_SHORT(b) && length_a + length_b <= SHORT)
+        return (erupt_string_t *)(((uintptr_t)a | (uintptr_t)b >> 8 <<
+                                   8 * (length_a + 1)) +
+                                  ((uintptr_t)length_b << 3));
+
+    if (length_a + length_b <= FLAT_MAX || !length_a || !length_b)
+        return join(a, b);
+
+    /* a short string after a rope that ends in one goes in the same leaf */
+    if (IS_ROPE(a) && !IS_ROPE(RIGHT(a)) &&
+        erupt_string_length(RIGHT(a)) + length_b <= FLAT_MAX)
+        return new_rope(LEFT(a), join(RIGHT(a), b));
+
+    erupt_string_t *s = new_rope(a, b);
+
+    return depth_of(s) > MAX_DEPTH ? rebalance(s) : s;
+}
+
+/* < 0, 0 or > 0, like strcmp */
+int erupt_string_compare(const erupt_string_t *a, const erupt_string_t *b)
+{
+    int64_t length_a = erupt_string_length(a);
+    int64_t length_b = erupt_string_length(b);
+    int64_t length = length_a < length_b ? length_a : length_b;
+    char buffer_a[SHORT], buffer_b[SHORT];
+
+    if (a == b)
+        return 0;
+
+    for (int64_t i = 0; i < length;) {
+        int64_t n_a, n_b;
+        const char *bytes_a = erupt_string_chunk(a, i, &n_a, buffer_a);
+        const char *bytes_b = erupt_string_chunk(b, i, &n_b, buffer_b);
+        int64_t n = n_a < n_b ? n_a : n_b;
+
+        if (n > length - i)
+            n = length - i;
+
+        int c = memcmp(bytes_a, bytes_b, (size_t)n);
+
+        if (c)
+            return (c > 0) - (c < 0);
+
+        i += n;
+    }
+
+    return (length_a > length_b) - (length_a < length_b);
+}
+
+static erupt_string_t *new_short(const char *bytes, int64_t n)
+{
+    uintptr_t s = (uintptr_t)n << 3 | 2;
+
+    for (int64_t k = 0; k < n; ++k)
+        s |= (uintptr_t)(unsigned char)bytes[k] << 8 * (k + 1);
+
+    return (erupt_string_t *)s;
+}
+
+static erupt_string_t *new_flat(int64_t n)
+{
+    erupt_string_t *s = erupt_gc_alloc(ERUPT_STRING, sizeof(erupt_string_t) +
+                                                     (size_t)n + 1);
+
+    s->length = n;
+    s->bytes[n] = '\0';
+
+    return s;
+}
+
+static erupt_string_t *new_rope(const erupt_string_t *left,
+                                const erupt_string_t *right)
+{
+    int64_t depth_left = depth_of(left), depth_right = depth_of(right);
+    erupt_rope_t *r = erupt_gc_alloc(ERUPT_ROPE, sizeof(erupt_rope_t));
+
+    r->length = ERUPT_TAG(erupt_string_length(left) +
+                          erupt_string_length(right));
+    r->depth = ERUPT_TAG((depth_left > depth_right ? depth_left
+                                                   : depth_right) + 1);
+    r->left = ERUPT_REF(left);
+    r->right = ERUPT_REF(right);
+
+    return (erupt_string_t *)r;
+}
+
+static int64_t depth_of(const erupt_string_t *s)
+{
+    return IS_ROPE(s) ? ERUPT_UNTAG(ROPE(s)->depth) : 0;
+}
+
+/* copy the bytes of s to to */
+static void read_bytes(const erupt_string_t *s, char *to)
+{
+    int64_t length = erupt_string_length(s);
+    char buffer[SHORT];
+
+    /* the bytes of a short string are copied to to as the buffer */
+    if (ERUPT_IS_SHORT(s)) {
+        erupt_string_chunk(s, 0, &length, to);
+        return;
+    }
+
+    if (!IS_ROPE(s)) {
+        memcpy(to, s->bytes, (size_t)length);
+        return;
+    }
+
+    for (int64_t i = 0, n; i < length; i += n) {
+        const char *bytes = erupt_string_chunk(s, i, &n, buffer);
+
+        memcpy(to + i, bytes, (size_t)n);
+    }
+}
+
+/* a followed by b, copied if that's short */
+static erupt_string_t *join(const erupt_string_t *a, const erupt_string_t *b)
+{
+    int64_t length_a = erupt_string_length(a);
+    int64_t length_b = erupt_string_length(b);
+
+    if (!length_a || !length_b)
+        return (erupt_string_t *)(length_a ? a : b);
+
+    if (length_a + length_b > FLAT_MAX)
+        return new_rope(a, b);
+
+    char bytes[FLAT_MAX];
+
+    read_bytes(a, bytes);
+    read_bytes(b, bytes + length_a);
+
+    return erupt_string_from(bytes, length_a + length_b);
+}
+
+/*
+ * s, with the ropes in it that aren't balanced rebuilt. a rope is balanced
+ * if it's at least min_lengths[depth] long. forest[i] is a balanced rope of
+ * about min_lengths[i] bytes, or NULL, and comes after those in the slots
+ * above it.
+ */
+static erupt_string_t *rebalance(const erupt_string_t *s)
+{
+    const erupt_string_t *forest[MAX_LENGTHS] = { NULL };
+    int64_t min_lengths[MAX_LENGTHS] = { 1, 2 };
+    erupt_string_t *r = EMPTY;
+
+    for (int i = 2; i < MAX_LENGTHS; ++i)
+        min_lengths[i] = min_lengths[i - 1] + min_lengths[i - 2];
+
+    insert(forest, min_lengths, s);
+
+    for (int i = 0; i < MAX_LENGTHS; ++i) {
+        if (forest[i])
+            r = join(forest[i], r);
+    }
+
+    return r;
+}
+
+/* add the leaves of s, and the balanced ropes in it, to the forest */
+static void insert(const erupt_string_t **forest, const int64_t *min_lengths,
+                   const erupt_string_t *s)
+{
+    int64_t depth = depth_of(s);
+
+    if (IS_ROPE(s) && (depth >= MAX_DEPTH ||
+                       erupt_string_length(s) < min_lengths[depth])) {
+        insert(forest, min_lengths, LEFT(s));
+        insert(forest, min_lengths, RIGHT(s));
+    } else {
+        add_to_forest(forest, min_lengths, s);
+    }
+}
+
+/*
+ * join the ropes in the slots below the one s belongs in, and s, then the
+ * ropes in the slots that what's joined grows into
+ */
+static void add_to_forest(const erupt_string_t **forest,
+                          const int64_t *min_lengths,
+                          const erupt_string_t *s)
+{
+    int64_t length = erupt_string_length(s);
+    const erupt_string_t *sum = EMPTY;
+    int i = 0;
+
+    for (; length > min_lengths[i + 1]; ++i) {
+        if (forest[i]) {
+            sum = join(forest[i], sum);
+            forest[i] = NULL;
+        }
+    }
+
+    sum = join(sum, s);
+
+    for (; erupt_string_length(sum) >= min_lengths[i]; ++i) {
+        if (forest[i]) {
+            sum = join(forest[i], sum);
+            forest[i] = NULL;
+        }
+    }
+
+    forest[i - 1] = sum;
+}
@@ -0,0 +1,306 @@
+/*
+ * Copyright (C) 2015 soud
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * a work-stealing task pool for fork-join parallelism. every worker owns a
+ * Chase-Lev deque: it pushes and pops tasks at the bottom, idle workers
+ * steal from the top. tasks are strictly nested, a parent always joins its
+ * children before returning, which is why they can live in the parent's
+ * stack frame. the pool is started on the first fork, programs that never
+ * fork never start a thread.
+ */
+
+#ifndef _GNU_SOURCE
+# define _GNU_SOURCE
+#endif
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "runtime.h"
+
+#define DEQUE_SIZE 1024 /* must be a power of two */
+#define MAX_WORKERS 256
+#define MAX_IDLE_SLEEP_NS 1000000 /* 1ms */
+
+typedef struct {
+    atomic_llong top;
+    atomic_llong bottom;
+    _Atomic(erupt_task_t *) tasks[DEQUE_SIZE];
+} deque_t;
+
+typedef struct {
+    deque_t deque;
+    pthread_t thread;
+    unsigned seed;
+} worker_t;
+
+static worker_t *workers;
+static size_t n_workers;
+static int max_depth = ERUPT_DEFAULT_SPAWN_DEPTH;
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+
+/* the worker the current thread is, NULL for threads outside the pool */
+static _Thread_local worker_t *self;
+static _Thread_local int depth;
+
+static void start_pool(void);
+static void *work(void *arg);
+static void sleep_for(void *ts);
+static void run(erupt_task_t *task);
+static bool steal_and_run(void);
+static bool push(deque_t *d, erupt_task_t *task);
+static erupt_task_t *pop(deque_t *d);
+static erupt_task_t *steal(deque_t *d);
+
+/*
+ * start evaluating fn(arg) in a task, which has to be joined before the
+ * caller returns. below the spawn depth cutoff, with only one worker or
+ * from a thread outside the pool, fn(arg) is simply called right away.
+ */
+void erupt_fork(erupt_task_t *task, void (*fn)(void *), void *arg)
+{
+    pthread_once(&pool_once, start_pool);
+
+    task->fn = fn;
+    task->arg = arg;
+    task->depth = depth + 1;
+    atomic_store_explicit(&task->done, 0, memory_order_relaxed);
+
+    if (n_workers < 2 || !self || depth >= max_depth ||
+        !push(&self->deque, task))
+        run(task);
+}
+
+void erupt_join(erupt_task_t *task)
+{
+    if (atomic_load_explicit(&task->done, memory_order_acquire))
+        return;
+
+    /* nobody stole it yet, it's at the bottom of our own deque */
+    erupt_task_t *t;
+
+    while ((t = pop(&self->deque))) {
+        run(t);
+
+        if (t == task)
+            return;
+    }
+
+    /* stolen, help out with other work until the thief is done */
+    unsigned backoff = 0;
+
+    while (!atomic_load_explicit(&task->done, memory_order_acquire)) {
+        erupt_gc_poll();
+
+        if (steal_and_run())
+            backoff = 0;
+        else if (++backoff > 64)
+            sched_yield();
+    }
+}
+
+size_t erupt_workers(void)
+{
+    pthread_once(&pool_once, start_pool);
+
+    return n_workers;
+}
+
+/* run a task of another worker while waiting, false if there was none */
+bool erupt_task_yield(void)
+{
+    return self && steal_and_run();
+}
+
+static void start_pool(void)
+{
+    const char *env = getenv("ERUPT_THREADS");
+    long n = env ? atol(env) : sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (n < 1)
+        n = 1;
+
+    if (n > MAX_WORKERS)
+        n = MAX_WORKERS;
+
+    if ((env = getenv("ERUPT_SPAWN_DEPTH")))
+        max_depth = atoi(env);
+
+    workers = calloc(n, sizeof(worker_t));
+
+    if (!workers) {
+        n_workers = 0;
+        return;
+    }
+
+    /* the thread that forked first is worker 0 */
+    self = &workers[0];
+    n_workers = 1;
+    erupt_gc_register_thread();
+
+    for (long i = 1; i < n; ++i) {
+        workers[i].seed = (unsigned)i * 2654435761u;
+
+        if (pthread_create(&workers[i].thread, NULL, work, &workers[i]))
+            break;
+
+        pthread_detach(workers[i].thread);
+        ++n_workers;
+    }
+}
+
+static void *work(void *arg)
+{
+    long sleep_ns = 1000;
+
+    self = arg;
+    erupt_gc_register_thread();
+
+    for (;;) {
+        if (steal_and_run()) {
+            sleep_ns = 1000;
+            continue;
+        }
+
+        struct timespec ts = { 0, sleep_ns };
+
+        erupt_gc_blocking(sleep_for, &ts);
+
+        if (sleep_ns < MAX_IDLE_SLEEP_NS)
+            sleep_ns *= 2;
+    }
+
+    return NULL;
+}
+
+static void sleep_for(void *ts)
+{
+    nanosleep(ts, NULL);
+}
+
+static void run(erupt_task_t *task)
+{
+    int parent = depth;
+
+    depth = task->depth;
+    task->fn(task->arg);
+    depth = parent;
+
+    atomic_store_explicit(&task->done, 1, memory_order_release);
+}
+
+static bool steal_and_run(void)
+{
+    if (n_workers < 2)
+        return false;
+
+    size_t start = rand_r(&self->seed) % n_workers;
+
+    for (size_t i = 0; i < n_workers; ++i) {
+        worker_t *victim = &workers[(start + i) % n_workers];
+
+        if (victim == self)
+            continue;
+
+        erupt_task_t *task = steal(&victim->deque);
+
+        if (task) {
+            run(task);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static bool push(deque_t *d, erupt_task_t *task)
+{
+    long long b = atomic_load_explicit(&d->bottom, memory_order_relaxed);
+    long long t = atomic_load_explicit(&d->top, memory_order_acquire);
+
+    if (b - t >= DEQUE_SIZE)
+        return false;
+
+    atomic_store_explicit(&d->tasks[b & (DEQUE_SIZE - 1)], task,
+                          memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+
+    return true;
+}
+
+static erupt_task_t *pop(deque_t *d)
+{
+    long long b = atomic_load_explicit(&d->bottom, memory_order_relaxed) - 1;
+
+    atomic_store_explicit(&d->bottom, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+
+    long long t = atomic_load_explicit(&d->top, memory_order_relaxed);
+
+    if (t > b) {
+        atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+        return NULL;
+    }
+
+    erupt_task_t *task = atomic_load_explicit(&d->tasks[b & (DEQUE_SIZE - 1)],
+                                              memory_order_relaxed);
+
+    if (t == b) {
+        /* the last task, race the thieves for it */
+        if (!atomic_compare_exchange_strong_explicit(&d->top, &t, t + 1,
+                                                     memory_order_seq_cst,
+                                                     memory_order_relaxed))
+            task = NULL;
+
+        atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+    }
+
+    return task;
+}
+
+static erupt_task_t *steal(deque_t *d)
+{
+    long long t = atomic_load_explicit(&d->top, memory_order_acquire);
+
+    atomic_thread_fence(memory_order_seq_cst);
+
+    long long b = atomic_load_explicit(&d->bottom, memory_order_acquire);
+
+    if (t >= b)
+        return NULL;
+
+    erupt_task_t *task = atomic_load_explicit(&d->tasks[t & (DEQUE_SIZE - 1)],
+                                              memory_order_relaxed);
+
+    if (!atomic_compare_exchange_strong_explicit(&d->top, &t, t + 1,
+                                                 memory_order_seq_cst,
+                                                 memory_order_relaxed))
+        return NULL;
+
+    return task;
+}
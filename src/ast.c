@@ -20,12 +20,14 @@
  * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
  */
 
+#include <inttypes.h>
+
 #include "ast.h"
 #include "erupt.h"
 
-ast_node_t *create_int(int v)
+ast_node_t *create_int(int64_t v)
 {
-    ast_node_t *node = smalloc(sizeof(ast_node_t));
+    ast_node_t *node = scalloc(1, sizeof(ast_node_t));
 
     node->type = TYPE_INT;
     node->int_num.v = v;
@@ -33,9 +35,18 @@ ast_node_t *create_int(int v)
     return node;
 }
 
-ast_node_t *create_float(float v)
+ast_node_t *create_bignum(const char *digits)
+{
+    ast_node_t *node = create_int(0);
+
+    node->int_num.big = strdup(digits);
+
+    return node;
+}
+
+ast_node_t *create_float(double v)
 {
-    ast_node_t *node = smalloc(sizeof(ast_node_t));
+    ast_node_t *node = scalloc(1, sizeof(ast_node_t));
 
     node->type = TYPE_FLOAT;
     node->float_num.v = v;
@@ -45,7 +56,7 @@ ast_node_t *create_float(float v)
 
 ast_node_t *create_string(const char *v)
 {
-    ast_node_t *node = smalloc(sizeof(ast_node_t));
+    ast_node_t *node = scalloc(1, sizeof(ast_node_t));
 
     node->type = TYPE_STRING;
     node->string.v = strdup(v);
@@ -55,17 +66,18 @@ ast_node_t *create_string(const char *v)
 
 ast_node_t *create_list(ast_node_list_t *values)
 {
-    ast_node_t *node = smalloc(sizeof(ast_node_t));
+    ast_node_t *node = scalloc(1, sizeof(ast_node_t));
 
     node->type = TYPE_LIST;
     node->list.values = values;
+    node->list.on_stack = false;
 
     return node;
 }
 
 ast_node_t *create_var(const char *name, bool mutable, ast_node_t *v)
 {
-    ast_node_t *node = smalloc(sizeof(ast_node_t));
+    ast_node_t *node = scalloc(1, sizeof(ast_node_t));
 
     node->type = TYPE_VAR;
     node->var.name = strdup(name);
@@ -77,7 +89,7 @@ ast_node_t *create_var(const char *name, bool mutable, ast_node_t *v)
 
 ast_node_t *create_fn_proto(const char *name, ast_node_list_t *args)
 {
-    ast_node_t *node = smalloc(sizeof(ast_node_t));
+    ast_node_t *node = scalloc(1, sizeof(ast_node_t));
 
     node->type = TYPE_PROTO;
     node->prototype.name = strdup(name);
@@ -88,7 +100,7 @@ ast_node_t *create_fn_proto(const char *name, ast_node_list_t *args)
 
 ast_node_t *create_struct(const char *name, ast_node_list_t *fields)
 {
-    ast_node_t *node = smalloc(sizeof(ast_node_t));
+    ast_node_t *node = scalloc(1, sizeof(ast_node_t));
 
     node->type = TYPE_STRUCT;
     node->struct_stmt.name = strdup(name);
@@ -99,18 +111,31 @@ ast_node_t *create_struct(const char *name, ast_node_list_t *fields)
 
 ast_node_t *create_fn(ast_node_t *prototype, ast_node_list_t *body)
 {
-    ast_node_t *node = smalloc(sizeof(ast_node_t));
+    ast_node_t *node = scalloc(1, sizeof(ast_node_t));
 
     node->type = TYPE_FN;
     node->fn.prototype = prototype;
     node->fn.body = body;
+    node->fn.counter = NO_COUNTER;
+    node->fn.count = UNKNOWN_COUNT;
+
+    return node;
+}
+
+ast_node_t *create_lambda(ast_node_list_t *args, ast_node_list_t *body)
+{
+    ast_node_t *node = scalloc(1, sizeof(ast_node_t));
+
+    node->type = TYPE_CLOSURE;
+    node->closure.args = args;
+    node->closure.body = body;
 
     return node;
 }
 
 ast_node_t *create_call(const char *name, ast_node_list_t *args)
 {
-    ast_node_t *node = smalloc(sizeof(ast_node_t));
+    ast_node_t *node = scalloc(1, sizeof(ast_node_t));
 
     node->type = TYPE_CALL;
     node->call.name = strdup(name);
@@ -123,31 +148,34 @@ ast_node_t *create_call(const char *name, ast_node_list_t *args)
 ast_node_t *create_if(ast_node_t *condition, ast_node_list_t *true_body,
                    ast_node_list_t *false_body)
 {
-    ast_node_t *node = smalloc(sizeof(ast_node_t));
+    ast_node_t *node = scalloc(1, sizeof(ast_node_t));
 
     node->type = TYPE_IF;
     node->if_expr.condition = condition;
     node->if_expr.true_body = true_body;
     node->if_expr.false_body = false_body;
+    node->if_expr.counter = NO_COUNTER;
+    node->if_expr.counts[0] = node->if_expr.counts[1] = UNKNOWN_COUNT;
 
     return node;
 }
 
 ast_node_t *create_expr(ast_operator_t *operator, ast_node_t *lhs, ast_node_t *rhs)
 {
-    ast_node_t *node = smalloc(sizeof(ast_node_t));
+    ast_node_t *node = scalloc(1, sizeof(ast_node_t));
 
     node->type = TYPE_EXPR;
     node->expr.operator= operator;
     node->expr.lhs = lhs;
     node->expr.rhs = rhs;
+    node->expr.parallel = false;
 
     return node;
 }
 
 ast_node_t *create_return(ast_node_t *expr)
 {
-    ast_node_t *node = smalloc(sizeof(ast_node_t));
+    ast_node_t *node = scalloc(1, sizeof(ast_node_t));
 
     node->type = TYPE_RETURN;
     node->return_expr.expr = expr;
@@ -155,6 +183,17 @@ ast_node_t *create_return(ast_node_t *expr)
     return node;
 }
 
+ast_node_t *create_import(const char *name, bool include)
+{
+    ast_node_t *node = scalloc(1, sizeof(ast_node_t));
+
+    node->type = TYPE_IMPORT;
+    node->import.name = strdup(name);
+    node->import.include = include;
+
+    return node;
+}
+
 ast_node_list_t *create_node_list(void)
 {
     ast_node_list_t *nl = smalloc(sizeof(ast_node_list_t));
@@ -165,6 +204,213 @@ ast_node_list_t *create_node_list(void)
     return nl;
 }
 
+void append_node(ast_node_list_t *nl, ast_node_t *node)
+{
+    /* an empty list is a single cell without a node */
+    if (!nl->node && !nl->next) {
+        nl->node = node;
+        return;
+    }
+
+    while (nl->next)
+        nl = nl->next;
+
+    nl->next = create_node_list();
+    nl->next->node = node;
+}
+
+/*
+ * unlink node from nl without destroying it. returns false if nl doesn't
+ * contain node.
+ */
+bool remove_node(ast_node_list_t *nl, ast_node_t *node)
+{
+    ast_node_list_t *prev = NULL;
+
+    for (; nl; prev = nl, nl = nl->next) {
+        if (nl->node != node)
+            continue;
+
+        if (prev) {
+            prev->next = nl->next;
+            free(nl);
+        } else if (nl->next) {
+            /* the head cell is owned by the caller, pull the next one in */
+            ast_node_list_t *next = nl->next;
+
+            *nl = *next;
+            free(next);
+        } else {
+            nl->node = NULL;
+        }
+
+        return true;
+    }
+
+    return false;
+}
+
+/* the copied node, without its line */
+static ast_node_t *copy_contents(ast_node_t *node)
+{
+    if (!node)
+        return NULL;
+
+    switch (node->type) {
+    case TYPE_INT:
+        return node->int_num.big ? create_bignum(node->int_num.big)
+                                 : create_int(node->int_num.v);
+    case TYPE_FLOAT: return create_float(node->float_num.v);
+    case TYPE_STRING: return create_string(node->string.v);
+    case TYPE_LIST: return create_list(copy_node_list(node->list.values));
+    case TYPE_VAR:
+        return create_var(node->var.name, node->var.mutable,
+                          copy_node(node->var.v));
+    case TYPE_PROTO:
+        return create_fn_proto(node->prototype.name,
+                               copy_node_list(node->prototype.args));
+    case TYPE_STRUCT:
+        return create_struct(node->struct_stmt.name,
+                             copy_node_list(node->struct_stmt.fields));
+    case TYPE_FN: {
+        ast_node_t *copy = create_fn(copy_node(node->fn.prototype),
+                                     copy_node_list(node->fn.body));
+
+        copy->fn.counter = node->fn.counter;
+        copy->fn.count = node->fn.count;
+
+        return copy;
+    }
+    case TYPE_CLOSURE: {
+        ast_node_t *copy = create_lambda(copy_node_list(node->closure.args),
+                                         copy_node_list(node->closure.body));
+
+        if (node->closure.name)
+            copy->closure.name = strdup(node->closure.name);
+
+        copy->closure.captures = copy_node_list(node->closure.captures);
+
+        return copy;
+    }
+    case TYPE_CALL:
+        return create_call(node->call.name, copy_node_list(node->call.args));
+    case TYPE_IF: {
+        ast_node_t *copy = create_if(copy_node(node->if_expr.condition),
+                                     copy_node_list(node->if_expr.true_body),
+                                     copy_node_list(node->if_expr.false_body));
+
+        /* inlined code keeps the profile of the function it came from */
+        copy->if_expr.counter = node->if_expr.counter;
+        copy->if_expr.counts[0] = node->if_expr.counts[0];
+        copy->if_expr.counts[1] = node->if_expr.counts[1];
+
+        return copy;
+    }
+    case TYPE_EXPR:
+        /* operators are shared, only the operands are copied */
+        return create_expr(node->expr.operator, copy_node(node->expr.lhs),
+                           copy_node(node->expr.rhs));
+    case TYPE_RETURN:
+        return create_return(copy_node(node->return_expr.expr));
+    case TYPE_IMPORT:
+        return create_import(node->import.name, node->import.include);
+    }
+
+    return NULL;
+}
+
+/* a copy keeps the line of the original, so inlined code keeps its lines */
+ast_node_t *copy_node(ast_node_t *node)
+{
+    ast_node_t *copy = copy_contents(node);
+
+    if (copy)
+        copy->line_n = node->line_n;
+
+    return copy;
+}
+
+ast_node_list_t *copy_node_list(ast_node_list_t *nl)
+{
+    if (!nl)
+        return NULL;
+
+    ast_node_list_t *copy = create_node_list();
+
+    do {
+        if (nl->node)
+            append_node(copy, copy_node(nl->node));
+    } while ((nl = nl->next));
+
+    return copy;
+}
+
+/*
+ * call fn on node and every node below it, parents before children.
+ */
+void visit_node(ast_node_t *node, void (*fn)(ast_node_t *, void *),
+                void *data)
+{
+    if (!node)
+        return;
+
+    fn(node, data);
+
+    switch (node->type) {
+    case TYPE_INT:
+    case TYPE_FLOAT:
+    case TYPE_STRING:
+    case TYPE_IMPORT: break;
+    case TYPE_LIST:
+        visit_node_list(node->list.values, fn, data);
+        break;
+    case TYPE_VAR:
+        visit_node(node->var.v, fn, data);
+        break;
+    case TYPE_PROTO:
+        visit_node_list(node->prototype.args, fn, data);
+        break;
+    case TYPE_STRUCT:
+        visit_node_list(node->struct_stmt.fields, fn, data);
+        break;
+    case TYPE_FN:
+        visit_node(node->fn.prototype, fn, data);
+        visit_node_list(node->fn.body, fn, data);
+        break;
+    case TYPE_CLOSURE:
+        visit_node_list(node->closure.args, fn, data);
+        visit_node_list(node->closure.body, fn, data);
+        visit_node_list(node->closure.captures, fn, data);
+        break;
+    case TYPE_CALL:
+        visit_node_list(node->call.args, fn, data);
+        break;
+    case TYPE_IF:
+        visit_node(node->if_expr.condition, fn, data);
+        visit_node_list(node->if_expr.true_body, fn, data);
+        visit_node_list(node->if_expr.false_body, fn, data);
+        break;
+    case TYPE_EXPR:
+        visit_node(node->expr.lhs, fn, data);
+        visit_node(node->expr.rhs, fn, data);
+        break;
+    case TYPE_RETURN:
+        visit_node(node->return_expr.expr, fn, data);
+        break;
+    }
+}
+
+void visit_node_list(ast_node_list_t *nl, void (*fn)(ast_node_t *, void *),
+                     void *data)
+{
+    if (!nl)
+        return;
+
+    do {
+        visit_node(nl->node, fn, data);
+    } while ((nl = nl->next));
+}
+
 void swap_lists(ast_node_list_t *a, ast_node_list_t *b)
 {
     ast_node_list_t *tmp = a;
@@ -179,6 +425,8 @@ void destroy_node(ast_node_t *node)
 
     switch (node->type) {
     case TYPE_INT:
+        free(node->int_num.big);
+        break;
     case TYPE_FLOAT: break;
     case TYPE_STRING:
         free(node->string.v);
@@ -212,6 +460,16 @@ void destroy_node(ast_node_t *node)
         if (node->fn.body)
             destroy_ast(node->fn.body);
         break;
+    case TYPE_CLOSURE:
+        free(node->closure.name);
+
+        if (node->closure.args)
+            destroy_ast(node->closure.args);
+        if (node->closure.body)
+            destroy_ast(node->closure.body);
+        if (node->closure.captures)
+            destroy_ast(node->closure.captures);
+        break;
     case TYPE_CALL:
         free(node->call.name);
 
@@ -238,6 +496,9 @@ void destroy_node(ast_node_t *node)
         if (node->return_expr.expr)
             destroy_node(node->return_expr.expr);
         break;
+    case TYPE_IMPORT:
+        free(node->import.name);
+        break;
     }
 
     free(node);
@@ -265,8 +526,13 @@ static void dump_node(ast_node_t *node)
         return;
 
     switch (node->type) {
-    case TYPE_INT: printf("int:\n\tvalue: %d\n", node->int_num.v); break;
-    case TYPE_FLOAT: printf("float:\n\tvalue: %f\n", node->float_num.v); break;
+    case TYPE_INT:
+        if (node->int_num.big)
+            printf("int:\n\tvalue: %s\n", node->int_num.big);
+        else
+            printf("int:\n\tvalue: %" PRId64 "\n", node->int_num.v);
+        break;
+    case TYPE_FLOAT: printf("float:\n\tvalue: %.17g\n", node->float_num.v); break;
     case TYPE_STRING: printf("string:\n\tvalue: %s\n", node->string.v); break;
     case TYPE_LIST:
         printf("list:\n\t");
@@ -293,6 +559,10 @@ static void dump_node(ast_node_t *node)
             dump_node_list(node->fn.body);
         }
         break;
+    case TYPE_CLOSURE:
+        printf("closure:\n\tname: %s\n",
+               node->closure.name ? node->closure.name : "(lambda)");
+        break;
     case TYPE_CALL:
         /* TODO */
         break;
@@ -305,6 +575,10 @@ static void dump_node(ast_node_t *node)
     case TYPE_RETURN:
         /* TODO */
         break;
+    case TYPE_IMPORT:
+        printf("import:\n\tname: %s\n\tinclude: %d\n", node->import.name,
+               node->import.include);
+        break;
     }
 }
 
@@ -37,12 +37,14 @@ typedef struct ast_var_t ast_var_t;
 typedef struct ast_prototype_t ast_prototype_t;
 typedef struct ast_struct_t ast_struct_t;
 typedef struct ast_function_t ast_function_t;
+typedef struct ast_closure_t ast_closure_t;
 typedef struct ast_call_t ast_call_t;
 typedef struct ast_if_t ast_if_t;
 typedef struct ast_expr_t ast_expr_t;
 typedef struct ast_node_t ast_node_t;
 typedef struct ast_node_list_t ast_node_list_t;
 typedef struct ast_return_t ast_return_t;
+typedef struct ast_import_t ast_import_t;
 
 struct ast_operator_t {
     token_type_t symbol;
@@ -56,22 +58,27 @@ struct ast_operator_t {
 struct ast_node_t;
 struct ast_node_list_t;
 
+/* an int outside int64 has big, its digits, and v is 0 */
 struct ast_int_t {
-    int v;
+    int64_t v;
+    char *big;
 };
 
 struct ast_float_t {
-    float v;
+    double v;
 };
 
 struct ast_string_t {
     char *v;
 };
 
+/* on_stack is set by escape analysis when the list can't outlive its call */
 struct ast_list_t {
     ast_node_list_t *values;
+    bool on_stack;
 };
 
+/* a var without a value (v == NULL) is a reference to a parameter */
 struct ast_var_t {
     char *name;
     bool mutable;
@@ -88,9 +95,26 @@ struct ast_struct_t {
     ast_node_list_t *fields;
 };
 
+/* counter and count are a clause's profile data, see profile.c */
 struct ast_function_t {
     ast_node_t *prototype;
     ast_node_list_t *body;
+
+    size_t counter;
+    uint64_t count;
+};
+
+/*
+ * an anonymous function, a value. lift_lambdas() moves its body into a top
+ * level function called name, which takes the captured values after args.
+ * what's left is a closure of that function over captures, name is NULL
+ * until then.
+ */
+struct ast_closure_t {
+    char *name;
+    ast_node_list_t *args;
+    ast_node_list_t *body;
+    ast_node_list_t *captures;
 };
 
 struct ast_call_t {
@@ -98,10 +122,14 @@ struct ast_call_t {
     ast_node_list_t *args;
 };
 
+/* the true branch is counted by counter, the false one by counter + 1 */
 struct ast_if_t {
     ast_node_t *condition;
     ast_node_list_t *true_body;
     ast_node_list_t *false_body;
+
+    size_t counter;
+    uint64_t counts[2];
 };
 
 struct ast_expr_t {
@@ -109,12 +137,21 @@ struct ast_expr_t {
 
     ast_node_t *lhs;
     ast_node_t *rhs;
+
+    /* lhs can be evaluated in a task while rhs is, see parallel.c */
+    bool parallel;
 };
 
 struct ast_return_t {
     ast_node_t *expr;
 };
 
+/* 'use' makes a module's functions available as Module.fn, 'include' as fn */
+struct ast_import_t {
+    char *name;
+    bool include;
+};
+
 struct ast_node_t {
     enum {
         TYPE_INT,
@@ -125,10 +162,12 @@ struct ast_node_t {
         TYPE_PROTO,
         TYPE_STRUCT,
         TYPE_FN,
+        TYPE_CLOSURE,
         TYPE_CALL,
         TYPE_IF,
         TYPE_EXPR,
-        TYPE_RETURN
+        TYPE_RETURN,
+        TYPE_IMPORT
     } type;
 
     union {
@@ -140,11 +179,16 @@ struct ast_node_t {
         ast_prototype_t prototype;
         ast_struct_t struct_stmt;
         ast_function_t fn;
+        ast_closure_t closure;
         ast_call_t call;
         ast_if_t if_expr;
         ast_expr_t expr;
         ast_return_t return_expr;
+        ast_import_t import;
     };
+
+    /* the source line the node starts on, 0 if unknown */
+    size_t line_n;
 };
 
 struct ast_node_list_t {
@@ -152,21 +196,32 @@ struct ast_node_list_t {
     ast_node_list_t *next;
 };
 
-ast_node_t *create_int(int v);
-ast_node_t *create_float(float v);
+ast_node_t *create_int(int64_t v);
+ast_node_t *create_bignum(const char *digits);
+ast_node_t *create_float(double v);
 ast_node_t *create_string(const char *v);
 ast_node_t *create_list(ast_node_list_t *values);
 ast_node_t *create_var(const char *name, bool mutable, ast_node_t *v);
 ast_node_t *create_fn_proto(const char *name, ast_node_list_t *args);
 ast_node_t *create_struct(const char *name, ast_node_list_t *fields);
 ast_node_t *create_fn(ast_node_t *prototype, ast_node_list_t *body);
+ast_node_t *create_lambda(ast_node_list_t *args, ast_node_list_t *body);
 ast_node_t *create_call(const char *name, ast_node_list_t *args);
 ast_node_t *create_if(ast_node_t *condition, ast_node_list_t *true_body,
                    ast_node_list_t *false_body);
 ast_node_t *create_expr(ast_operator_t *operator, ast_node_t *lhs,
                         ast_node_t *rhs);
 ast_node_t *create_return(ast_node_t *expr);
+ast_node_t *create_import(const char *name, bool include);
 ast_node_list_t *create_node_list(void);
+void append_node(ast_node_list_t *nl, ast_node_t *node);
+bool remove_node(ast_node_list_t *nl, ast_node_t *node);
+ast_node_t *copy_node(ast_node_t *node);
+ast_node_list_t *copy_node_list(ast_node_list_t *nl);
+void visit_node(ast_node_t *node, void (*fn)(ast_node_t *, void *),
+                void *data);
+void visit_node_list(ast_node_list_t *nl, void (*fn)(ast_node_t *, void *),
+                     void *data);
 void swap_lists(ast_node_list_t *a, ast_node_list_t *b);
 void destroy_node(ast_node_t *node);
 void destroy_ast(ast_node_list_t *nl);
@@ -0,0 +1,1085 @@
+/*
+ * Copyright (C) 2015 soud
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * lowering EIR to bytecode. every value gets a register of its own, phis
+ * become moves on the edges into their block. constants don't get a
+ * register, they're loaded where they're used, or folded into the
+ * superinstructions that take a constant: ADDK, SUBK and the J*K jumps that
+ * clause dispatch is made of.
+ */
+
+#include "bytecode.h"
+#include "dce.h"
+#include "../runtime/runtime.h"
+
+#define NO_REG SIZE_MAX
+
+/* a jump to a block that isn't generated yet, from the end of pred */
+typedef struct {
+    size_t at;
+    eir_block_t *pred;
+    eir_block_t *to;
+} fixup_t;
+
+/* the moves of the edge from pred to to, in front of a jump to to */
+typedef struct {
+    eir_block_t *pred;
+    eir_block_t *to;
+    size_t pc;
+} pad_t;
+
+typedef struct {
+    eir_module_t *m;
+    vm_program_t *p;
+    eir_fn_t *fn;
+    vm_fn_t *out;
+    eir_block_t *block;
+
+    /* indexed by instruction and block id */
+    size_t *regs;
+    size_t *uses;
+    size_t *block_pc;
+
+    fixup_t *fixups;
+    size_t n_fixups;
+    pad_t *pads;
+    size_t n_pads;
+
+    bool failed;
+} bc_lower_t;
+
+static const char *opcode_names[] = {
+#define VM_NAME(name) #name,
+    VM_OPCODES(VM_NAME)
+#undef VM_NAME
+};
+
+static void lower_fn(bc_lower_t *l, eir_fn_t *fn);
+static void assign_regs(bc_lower_t *l);
+static void lower_instr(bc_lower_t *l, eir_instr_t *i);
+static void lower_binop(bc_lower_t *l, eir_instr_t *i, size_t dst);
+static void lower_compare(bc_lower_t *l, eir_instr_t *i, size_t dst);
+static void lower_unop(bc_lower_t *l, eir_instr_t *i, size_t dst);
+static void lower_call(bc_lower_t *l, eir_instr_t *i, size_t dst);
+static void lower_closure(bc_lower_t *l, eir_instr_t *i, size_t dst);
+static size_t consecutive_args(bc_lower_t *l, eir_instr_t *i);
+static void lower_builtin(bc_lower_t *l, eir_instr_t *i, size_t dst);
+static void lower_condbr(bc_lower_t *l, eir_instr_t *i);
+static void lower_switch(bc_lower_t *l, eir_instr_t *i);
+static bool is_int_compare(eir_instr_t *i);
+static bool is_fused(bc_lower_t *l, eir_instr_t *i);
+static void jump(bc_lower_t *l, vm_opcode_t op, size_t a, size_t b,
+                 eir_block_t *to);
+static void edge_moves(bc_lower_t *l, eir_block_t *pred, eir_block_t *to);
+static void finish_jumps(bc_lower_t *l);
+static size_t use(bc_lower_t *l, eir_instr_t *v, eir_type_t type);
+static void into(bc_lower_t *l, size_t dst, eir_instr_t *v, eir_type_t type);
+static void convert(bc_lower_t *l, size_t dst, size_t src, eir_type_t from,
+                    eir_type_t to);
+static vm_value_t constant_value(bc_lower_t *l, eir_instr_t *v,
+                                 eir_type_t type);
+static size_t constant(bc_lower_t *l, vm_value_t v);
+static size_t new_reg(bc_lower_t *l);
+static void emit(bc_lower_t *l, vm_opcode_t op, size_t a, size_t b, size_t c);
+static void unsupported(bc_lower_t *l, eir_instr_t *i);
+static bool same_bits(eir_type_t from, eir_type_t to);
+static bool is_pointer(eir_type_t type);
+static erupt_string_t *new_string(vm_program_t *p, const char *s,
+                                  size_t length);
+static int64_t keep(vm_program_t *p, int64_t v);
+static void *add_object(vm_program_t *p, uint64_t *h);
+static bool has_phis(eir_block_t *block);
+
+/* gives NULL if m can't be run by the VM, after reporting why */
+vm_program_t *lower_bytecode(eir_module_t *m)
+{
+    vm_program_t *p = scalloc(1, sizeof(vm_program_t));
+    eir_fn_t *main_fn = eir_lookup_fn(m, ENTRY_POINT);
+    bc_lower_t l;
+
+    if (!main_fn) {
+        erupt_error("'%s' has no %s function", m->name, ENTRY_POINT);
+        free(p);
+
+        return NULL;
+    }
+
+    verbose_printf("lowering EIR to bytecode");
+
+    memset(&l, 0, sizeof(bc_lower_t));
+    l.m = m;
+    l.p = p;
+
+    for (eir_fn_t *fn = m->first; fn; fn = fn->next) {
+        if (fn->index >= p->n_fns)
+            p->n_fns = fn->index + 1;
+    }
+
+    if (p->n_fns > VM_MAX_INDEX) {
+        erupt_error("'%s' has too many functions for the VM", m->name);
+        l.failed = true;
+    }
+
+    p->fns = scalloc(p->n_fns + 1, sizeof(vm_fn_t));
+    p->entry = main_fn->index;
+
+    for (eir_fn_t *fn = m->first; fn && !l.failed; fn = fn->next)
+        lower_fn(&l, fn);
+
+    if (l.failed) {
+        destroy_bytecode(p);
+        return NULL;
+    }
+
+    return p;
+}
+
+void dump_bytecode(vm_program_t *p, FILE *out)
+{
+    for (size_t f = 0; f < p->n_fns; ++f) {
+        vm_fn_t *fn = &p->fns[f];
+
+        if (!fn->code)
+            continue;
+
+        fprintf(out, "%sfn %s/%zu, %zu register(s)\n", f ? "\n" : "",
+                fn->name, fn->n_params, fn->n_regs);
+
+        for (size_t k = 0; k < fn->n_constants; ++k)
+            fprintf(out, "  k%zu = %" PRId64 "\n", k, fn->constants[k].i);
+
+        for (size_t pc = 0; pc < fn->n_code; ++pc) {
+            vm_instr_t *i = &fn->code[pc];
+
+            fprintf(out, "%5zu  %-8s %u, %u, %u\n", pc,
+                    p->threaded ? "?" : opcode_names[i->op], i->a, i->b,
+                    i->c);
+        }
+    }
+}
+
+void destroy_bytecode(vm_program_t *p)
+{
+    if (!p)
+        return;
+
+    for (size_t f = 0; f < p->n_fns; ++f) {
+        free(p->fns[f].name);
+        free(p->fns[f].code);
+        free(p->fns[f].constants);
+    }
+
+    for (size_t o = 0; o < p->n_objects; ++o)
+        free(p->objects[o]);
+
+    free(p->fns);
+    free(p->objects);
+    free(p);
+}
+
+static void lower_fn(bc_lower_t *l, eir_fn_t *fn)
+{
+    size_t n_instrs = 0, n_blocks = 0;
+
+    /* unlike eir_number, void values get a number too, calls can use them */
+    for (eir_block_t *b = fn->first; b; b = b->next) {
+        b->id = n_blocks++;
+
+        for (eir_instr_t *i = b->first; i; i = i->next)
+            i->id = n_instrs++;
+    }
+
+    l->fn = fn;
+    l->out = &l->p->fns[fn->index];
+    l->out->name = strdup(fn->name);
+    l->out->n_params = fn->n_params;
+    l->out->ret = fn->ret;
+    l->out->n_regs = fn->n_params;
+    l->regs = smalloc(sizeof(size_t) * (n_instrs + 1));
+    l->uses = scalloc(n_instrs + 1, sizeof(size_t));
+    l->block_pc = smalloc(sizeof(size_t) * (n_blocks + 1));
+    l->n_fixups = 0;
+    l->n_pads = 0;
+
+    assign_regs(l);
+
+    for (eir_block_t *b = fn->first; b; b = b->next) {
+        l->block = b;
+        l->block_pc[b->id] = l->out->n_code;
+
+        for (eir_instr_t *i = b->first; i; i = i->next)
+            lower_instr(l, i);
+    }
+
+    finish_jumps(l);
+
+    if (l->out->n_regs > VM_MAX_INDEX || l->out->n_constants > VM_MAX_INDEX) {
+        erupt_error("'%s' is too big for the VM", fn->name);
+        l->failed = true;
+    }
+
+    free(l->regs);
+    free(l->uses);
+    free(l->block_pc);
+    free(l->fixups);
+    free(l->pads);
+    l->fixups = NULL;
+    l->pads = NULL;
+}
+
+/*
+ * parameters are the first registers, every other value that isn't a
+ * constant gets the next one. uses are counted to find the compares that
+ * can be fused into the jump after them.
+ */
+static void assign_regs(bc_lower_t *l)
+{
+    for (eir_block_t *b = l->fn->first; b; b = b->next) {
+        for (eir_instr_t *i = b->first; i; i = i->next) {
+            for (size_t k = 0; k < i->n_operands; ++k)
+                ++l->uses[i->operands[k]->id];
+
+            switch (i->op) {
+            case EIR_CONST_INT:
+            case EIR_CONST_FLOAT:
+            case EIR_CONST_STRING:
+            case EIR_CONST_BIGNUM:
+            case EIR_COUNT:
+                l->regs[i->id] = NO_REG;
+                break;
+            case EIR_PARAM:
+                /* parameters are passed as ints */
+                if (i->type == EIR_INT || i->type == EIR_VOID) {
+                    l->regs[i->id] = (size_t)i->imm.i;
+                    break;
+                }
+                /* fallthrough */
+            default:
+                l->regs[i->id] = eir_is_terminator(i) ? NO_REG : new_reg(l);
+            }
+        }
+    }
+}
+
+static void lower_instr(bc_lower_t *l, eir_instr_t *i)
+{
+    size_t dst = l->regs[i->id];
+
+    switch (i->op) {
+    case EIR_CONST_INT:
+    case EIR_CONST_FLOAT:
+    case EIR_CONST_STRING:
+    case EIR_CONST_BIGNUM:
+    case EIR_PHI:
+    /* the VM isn't instrumented */
+    case EIR_COUNT:
+        break;
+    case EIR_PARAM:
+        if (dst != (size_t)i->imm.i)
+            convert(l, dst, (size_t)i->imm.i, EIR_INT, i->type);
+        break;
+    case EIR_MAKE_LIST: {
+        size_t first = l->out->n_regs;
+
+        l->out->n_regs += i->n_operands;
+
+        /* floats are boxed */
+        for (size_t k = 0; k < i->n_operands; ++k) {
+            eir_instr_t *v = i->operands[k];
+
+            if (v->type == EIR_FLOAT) {
+                into(l, first + k, v, EIR_FLOAT);
+                emit(l, VM_BOXF, first + k, first + k, 0);
+            } else {
+                into(l, first + k, v, EIR_INT);
+            }
+        }
+
+        emit(l, VM_LIST, dst, i->n_operands, first);
+        break;
+    }
+    case EIR_BINOP:
+        if (!is_fused(l, i))
+            lower_binop(l, i, dst);
+        break;
+    case EIR_UNOP:
+        lower_unop(l, i, dst);
+        break;
+    case EIR_CALL:
+    case EIR_SPAWN:
+        /* the VM has one thread, spawned calls are evaluated right away */
+        lower_call(l, i, dst);
+        break;
+    case EIR_CLOSURE:
+    case EIR_APPLY:
+        lower_closure(l, i, dst);
+        break;
+    case EIR_ENV:
+        emit(l, VM_ENV, dst, use(l, i->operands[0], EIR_INT),
+             (size_t)i->imm.i);
+        break;
+    case EIR_JOIN: {
+        eir_instr_t *spawn = i->operands[0];
+        eir_fn_t *callee = eir_lookup_fn(l->m, spawn->callee);
+
+        convert(l, dst, l->regs[spawn->id], callee ? callee->ret : EIR_INT,
+                i->type);
+        break;
+    }
+    case EIR_BR:
+        edge_moves(l, i->parent, i->blocks[0]);
+
+        /* falling through to the next block needs no jump */
+        if (i->blocks[0] != i->parent->next)
+            jump(l, VM_JMP, 0, 0, i->blocks[0]);
+        break;
+    case EIR_CONDBR:
+        lower_condbr(l, i);
+        break;
+    case EIR_SWITCH:
+        lower_switch(l, i);
+        break;
+    case EIR_RET:
+        emit(l, VM_RET, use(l, i->operands[0], l->fn->ret), 0, 0);
+        break;
+    case EIR_NOMATCH:
+        emit(l, VM_NOMATCH, 0, 0, 0);
+        break;
+    case EIR_OPCODE_COUNT:
+        unsupported(l, i);
+    }
+}
+
+static void lower_binop(bc_lower_t *l, eir_instr_t *i, size_t dst)
+{
+    eir_instr_t *lhs = i->operands[0], *rhs = i->operands[1];
+
+    if (i->type == EIR_BOOL) {
+        lower_compare(l, i, dst);
+        return;
+    }
+
+    if (i->type == EIR_STRING || i->type == EIR_LIST) {
+        /* one of them can be a word typed as an int */
+        if (i->symbol != PLUS ||
+            (lhs->type != i->type && rhs->type != i->type) ||
+            (lhs->type != i->type && lhs->type != EIR_INT) ||
+            (rhs->type != i->type && rhs->type != EIR_INT)) {
+            unsupported(l, i);
+            return;
+        }
+
+        emit(l, i->type == EIR_STRING ? VM_SCONCAT : VM_LCONCAT, dst,
+             use(l, lhs, i->type), use(l, rhs, i->type));
+        return;
+    }
+
+    if (i->type == EIR_FLOAT) {
+        vm_opcode_t op;
+
+        switch (i->symbol) {
+        case PLUS: op = VM_FADD; break;
+        case MIN: op = VM_FSUB; break;
+        case STAR: op = VM_FMUL; break;
+        case SLASH: op = VM_FDIV; break;
+        case MOD: op = VM_FMOD; break;
+        case STAR_STAR: op = VM_FPOW; break;
+        default:
+            unsupported(l, i);
+            return;
+        }
+
+        emit(l, op, dst, use(l, lhs, EIR_FLOAT), use(l, rhs, EIR_FLOAT));
+        return;
+    }
+
+    /* x + 1 and x - 1 and friends take the constant directly */
+    if ((i->symbol == PLUS || i->symbol == MIN) &&
+        rhs->op == EIR_CONST_INT) {
+        emit(l, i->symbol == PLUS ? VM_ADDK : VM_SUBK, dst,
+             use(l, lhs, EIR_INT), constant(l, constant_value(l, rhs,
+                                                              EIR_INT)));
+        return;
+    }
+
+    vm_opcode_t op;
+
+    switch (i->symbol) {
+    case PLUS: op = VM_ADD; break;
+    case MIN: op = VM_SUB; break;
+    case STAR: op = VM_MUL; break;
+    case SLASH: op = VM_DIV; break;
+    case MOD: op = VM_MOD; break;
+    case STAR_STAR: op = VM_POW; break;
+    case B_AND: op = VM_BAND; break;
+    case B_OR: op = VM_BOR; break;
+    case B_XOR: op = VM_BXOR; break;
+    case L_SHIFT: op = VM_SHL; break;
+    case R_SHIFT: op = VM_SHR; break;
+    default:
+        unsupported(l, i);
+        return;
+    }
+
+    emit(l, op, dst, use(l, lhs, EIR_INT), use(l, rhs, EIR_INT));
+}
+
+/* EQ_EQ .. GT_EQ map to the compares in this order */
+static vm_opcode_t compare_op(token_type_t symbol, vm_opcode_t first)
+{
+    switch (symbol) {
+    case EQ_EQ: return first;
+    case BANG_EQ: return first + 1;
+    case LT: return first + 2;
+    case LT_EQ: return first + 3;
+    case GT: return first + 4;
+    case GT_EQ: return first + 5;
+    default: return VM_OPCODE_COUNT;
+    }
+}
+
+static void lower_compare(bc_lower_t *l, eir_instr_t *i, size_t dst)
+{
+    eir_instr_t *lhs = i->operands[0], *rhs = i->operands[1];
+    eir_type_t lt = lhs->type, rt = rhs->type;
+
+    if (i->symbol == AND || i->symbol == OR) {
+        emit(l, i->symbol == AND ? VM_BAND : VM_BOR, dst,
+             use(l, lhs, EIR_BOOL), use(l, rhs, EIR_BOOL));
+        return;
+    }
+
+    if (compare_op(i->symbol, VM_EQ) == VM_OPCODE_COUNT) {
+        unsupported(l, i);
+        return;
+    }
+
+    if (lt == EIR_FLOAT || rt == EIR_FLOAT) {
+        emit(l, compare_op(i->symbol, VM_FEQ), dst, use(l, lhs, EIR_FLOAT),
+             use(l, rhs, EIR_FLOAT));
+        return;
+    }
+
+    /* strings and lists are compared by the runtime, then to 0 */
+    if ((lt == EIR_STRING || lt == EIR_LIST) && rt == lt) {
+        size_t order = new_reg(l), zero = new_reg(l);
+        vm_value_t none = { .i = 0 };
+
+        emit(l, lt == EIR_STRING ? VM_SCMP : VM_LCMP, order,
+             use(l, lhs, lt), use(l, rhs, rt));
+        emit(l, VM_LOADK, zero, constant(l, none), 0);
+        emit(l, compare_op(i->symbol, VM_EQ), dst, order, zero);
+        return;
+    }
+
+    if (is_pointer(lt) || is_pointer(rt)) {
+        unsupported(l, i);
+        return;
+    }
+
+    /* bools become the ints 0 or 1 */
+    emit(l, compare_op(i->symbol, VM_EQ), dst, use(l, lhs, EIR_INT),
+         use(l, rhs, EIR_INT));
+}
+
+static void lower_unop(bc_lower_t *l, eir_instr_t *i, size_t dst)
+{
+    eir_instr_t *operand = i->operands[0];
+
+    switch (i->symbol) {
+    case PLUS:
+        into(l, dst, operand, i->type);
+        return;
+    case MIN:
+        if (operand->type == EIR_FLOAT) {
+            emit(l, VM_FNEG, dst, use(l, operand, EIR_FLOAT), 0);
+            return;
+        }
+
+        if (operand->type != EIR_INT)
+            break;
+
+        emit(l, VM_NEG, dst, use(l, operand, EIR_INT), 0);
+        return;
+    case BANG:
+        emit(l, VM_NOT, dst, use(l, operand, EIR_BOOL), 0);
+        return;
+    case B_NOT:
+        if (operand->type != EIR_INT)
+            break;
+
+        emit(l, VM_BNOT, dst, use(l, operand, EIR_INT), 0);
+        return;
+    default:
+        break;
+    }
+
+    unsupported(l, i);
+}
+
+/* the arguments are moved to consecutive registers, as ints */
+static void lower_call(bc_lower_t *l, eir_instr_t *i, size_t dst)
+{
+    eir_fn_t *callee = eir_lookup_fn(l->m, i->callee);
+
+    if (!callee) {
+        if (i->op == EIR_CALL) {
+            lower_builtin(l, i, dst);
+        } else {
+            file_error(l->m->name, i->line_n, "can't evaluate '%s' in "
+                       "parallel", i->callee);
+            l->failed = true;
+        }
+
+        return;
+    }
+
+    if (callee->n_params != i->n_operands) {
+        file_error(l->m->name, i->line_n, "'%s' takes %zu argument(s), %zu "
+                   "given", i->callee, callee->n_params, i->n_operands);
+        l->failed = true;
+
+        return;
+    }
+
+    size_t first = consecutive_args(l, i);
+
+    if (first == NO_REG) {
+        first = l->out->n_regs;
+        l->out->n_regs += i->n_operands;
+
+        for (size_t k = 0; k < i->n_operands; ++k)
+            into(l, first + k, i->operands[k], EIR_INT);
+    }
+
+    /* a spawn keeps the callee's result as it is, the join converts it */
+    if (i->op == EIR_SPAWN || callee->ret == i->type ||
+        (callee->ret == EIR_VOID && i->type == EIR_INT)) {
+        emit(l, VM_CALL, dst, callee->index, first);
+        return;
+    }
+
+    size_t result = new_reg(l);
+
+    emit(l, VM_CALL, result, callee->index, first);
+    convert(l, dst, result, callee->ret, i->type);
+}
+
+/*
+ * the captures of a closure, or an applied closure and its arguments, are
+ * moved to consecutive registers as words
+ */
+static void lower_closure(bc_lower_t *l, eir_instr_t *i, size_t dst)
+{
+    size_t first = l->out->n_regs;
+
+    l->out->n_regs += i->n_operands;
+
+    for (size_t k = 0; k < i->n_operands; ++k)
+        into(l, first + k, i->operands[k], EIR_INT);
+
+    if (i->op == EIR_APPLY) {
+        emit(l, VM_APPLY, dst, first, i->n_operands - 1);
+        return;
+    }
+
+    emit(l, VM_CLOSURE, dst, eir_lookup_fn(l->m, i->callee)->index,
+         first | i->n_operands << 16);
+}
+
+/* the register of i's first argument, if the others follow it already */
+static size_t consecutive_args(bc_lower_t *l, eir_instr_t *i)
+{
+    size_t first = i->n_operands ? l->regs[i->operands[0]->id] : NO_REG;
+
+    for (size_t k = 0; k < i->n_operands && first != NO_REG; ++k) {
+        eir_instr_t *arg = i->operands[k];
+
+        if (l->regs[arg->id] != first + k || !same_bits(arg->type, EIR_INT))
+            return NO_REG;
+    }
+
+    return first;
+}
+
+static void lower_builtin(bc_lower_t *l, eir_instr_t *i, size_t dst)
+{
+    if (strcmp(i->callee, "IO.print") == 0 && i->n_operands == 1) {
+        eir_instr_t *arg = i->operands[0];
+        vm_value_t none = { .i = 0 };
+
+        switch (arg->type) {
+        case EIR_BOOL:
+            emit(l, VM_PRINTB, use(l, arg, EIR_BOOL), 0, 0);
+            break;
+        case EIR_FLOAT:
+            emit(l, VM_PRINTF, use(l, arg, EIR_FLOAT), 0, 0);
+            break;
+        case EIR_STRING:
+            emit(l, VM_PRINTS, use(l, arg, EIR_STRING), 0, 0);
+            break;
+        case EIR_LIST:
+            emit(l, VM_PRINTL, use(l, arg, EIR_LIST), 0, 0);
+            break;
+        default:
+            emit(l, VM_PRINTI, use(l, arg, EIR_INT), 0, 0);
+        }
+
+        emit(l, VM_LOADK, dst, constant(l, none), 0);
+        return;
+    }
+
+    if (strcmp(i->callee, "IO.flush") == 0 && i->n_operands == 0) {
+        vm_value_t none = { .i = 0 };
+
+        emit(l, VM_FLUSH, 0, 0, 0);
+        emit(l, VM_LOADK, dst, constant(l, none), 0);
+        return;
+    }
+
+    file_error(l->m->name, i->line_n, "undefined function '%s'", i->callee);
+    l->failed = true;
+}
+
+/*
+ * a compare of ints that's only used by the branch after it becomes one
+ * jump, which takes the constant directly if it compares to one.
+ */
+static void lower_condbr(bc_lower_t *l, eir_instr_t *i)
+{
+    eir_instr_t *cond = i->operands[0];
+    eir_block_t *then = i->blocks[0], *otherwise = i->blocks[1];
+
+    if (is_fused(l, cond)) {
+        eir_instr_t *lhs = cond->operands[0], *rhs = cond->operands[1];
+        token_type_t symbol = cond->symbol;
+
+        /* 0 < x is x > 0 */
+        if (lhs->op == EIR_CONST_INT && rhs->op != EIR_CONST_INT) {
+            eir_instr_t *swap = lhs;
+
+            lhs = rhs;
+            rhs = swap;
+
+            switch (symbol) {
+            case LT: symbol = GT; break;
+            case LT_EQ: symbol = GT_EQ; break;
+            case GT: symbol = LT; break;
+            case GT_EQ: symbol = LT_EQ; break;
+            default: break;
+            }
+        }
+
+        if (rhs->op == EIR_CONST_INT) {
+            jump(l, compare_op(symbol, VM_JEQK), use(l, lhs, EIR_INT),
+                 constant(l, constant_value(l, rhs, EIR_INT)), then);
+        } else {
+            jump(l, compare_op(symbol, VM_JEQ), use(l, lhs, EIR_INT),
+                 use(l, rhs, EIR_INT), then);
+        }
+    } else {
+        jump(l, VM_JT, use(l, cond, EIR_BOOL), 0, then);
+    }
+
+    if (otherwise != i->parent->next || has_phis(otherwise))
+        jump(l, VM_JMP, 0, 0, otherwise);
+}
+
+/* clause dispatch, a JEQK for every case */
+static void lower_switch(bc_lower_t *l, eir_instr_t *i)
+{
+    size_t v = use(l, i->operands[0], EIR_INT);
+
+    for (size_t k = 0; k < i->n_cases; ++k) {
+        vm_value_t c = { .i = ERUPT_TAG(i->cases[k]) };
+
+        jump(l, VM_JEQK, v, constant(l, c), i->blocks[k + 1]);
+    }
+
+    jump(l, VM_JMP, 0, 0, i->blocks[0]);
+}
+
+static bool is_int_compare(eir_instr_t *i)
+{
+    if (i->op != EIR_BINOP || i->type != EIR_BOOL ||
+        compare_op(i->symbol, VM_EQ) == VM_OPCODE_COUNT)
+        return false;
+
+    for (size_t k = 0; k < 2; ++k) {
+        eir_type_t type = i->operands[k]->type;
+
+        if (type == EIR_FLOAT || is_pointer(type))
+            return false;
+    }
+
+    return true;
+}
+
+/* whether the compare i is generated by the branch that ends its block */
+static bool is_fused(bc_lower_t *l, eir_instr_t *i)
+{
+    eir_instr_t *term = eir_terminator(i->parent);
+
+    return is_int_compare(i) && l->uses[i->id] == 1 && term &&
+           term->op == EIR_CONDBR && term->operands[0] == i;
+}
+
+/* a jump to the block to, through the moves of its phis if it has any */
+static void jump(bc_lower_t *l, vm_opcode_t op, size_t a, size_t b,
+                 eir_block_t *to)
+{
+    l->fixups = srealloc(l->fixups, sizeof(fixup_t) * (l->n_fixups + 1));
+    l->fixups[l->n_fixups].at = l->out->n_code;
+    l->fixups[l->n_fixups].pred = l->block;
+    l->fixups[l->n_fixups].to = to;
+    l->n_fixups++;
+
+    emit(l, op, a, b, 0);
+}
+
+/*
+ * set the phis of to for the edge from pred. every move reads the values
+ * from before the edge, so if a phi is moved into another phi of the same
+ * block all of them go through temporaries first.
+ */
+static void edge_moves(bc_lower_t *l, eir_block_t *pred, eir_block_t *to)
+{
+    size_t n = 0, *temps;
+    bool parallel = false;
+
+    for (eir_instr_t *phi = to->first; phi && phi->op == EIR_PHI;
+         phi = phi->next) {
+        for (size_t k = 0; k < phi->n_operands; ++k) {
+            eir_instr_t *v = phi->operands[k];
+
+            if (phi->blocks[k] != pred)
+                continue;
+
+            if (v->op == EIR_PHI && v->parent == to)
+                parallel = true;
+
+            ++n;
+        }
+    }
+
+    if (n == 0)
+        return;
+
+    temps = smalloc(sizeof(size_t) * n);
+    n = 0;
+
+    for (eir_instr_t *phi = to->first; phi && phi->op == EIR_PHI;
+         phi = phi->next) {
+        for (size_t k = 0; k < phi->n_operands; ++k) {
+            if (phi->blocks[k] != pred)
+                continue;
+
+            temps[n] = parallel ? new_reg(l) : l->regs[phi->id];
+            into(l, temps[n++], phi->operands[k], phi->type);
+        }
+    }
+
+    if (parallel) {
+        n = 0;
+
+        for (eir_instr_t *phi = to->first; phi && phi->op == EIR_PHI;
+             phi = phi->next) {
+            for (size_t k = 0; k < phi->n_operands; ++k) {
+                if (phi->blocks[k] == pred)
+                    emit(l, VM_MOVE, l->regs[phi->id], temps[n++], 0);
+            }
+        }
+    }
+
+    free(temps);
+}
+
+static bool has_phis(eir_block_t *block)
+{
+    return block->first && block->first->op == EIR_PHI;
+}
+
+/*
+ * point the jumps at their blocks. a jump from a branch with more than one
+ * target to a block with phis goes to a pad with the moves of its edge,
+ * added after the code of the function.
+ */
+static void finish_jumps(bc_lower_t *l)
+{
+    for (size_t f = 0; f < l->n_fixups; ++f) {
+        fixup_t *fixup = &l->fixups[f];
+        size_t target = l->block_pc[fixup->to->id];
+
+        /* a plain branch has its moves in front of the jump already */
+        if (has_phis(fixup->to) &&
+            eir_terminator(fixup->pred)->op != EIR_BR) {
+            size_t p;
+
+            for (p = 0; p < l->n_pads; ++p) {
+                if (l->pads[p].pred == fixup->pred &&
+                    l->pads[p].to == fixup->to)
+                    break;
+            }
+
+            if (p == l->n_pads) {
+                l->pads = srealloc(l->pads, sizeof(pad_t) * (p + 1));
+                l->pads[p].pred = fixup->pred;
+                l->pads[p].to = fixup->to;
+                l->pads[p].pc = l->out->n_code;
+                l->n_pads++;
+
+                edge_moves(l, fixup->pred, fixup->to);
+                emit(l, VM_JMP, 0, 0, target);
+            }
+
+            target = l->pads[p].pc;
+        }
+
+        l->out->code[fixup->at].c = (uint32_t)target;
+    }
+}
+
+/* a register with v in it, as a value of type */
+static size_t use(bc_lower_t *l, eir_instr_t *v, eir_type_t type)
+{
+    size_t reg = l->regs[v->id];
+
+    if (reg != NO_REG && same_bits(v->type, type))
+        return reg;
+
+    reg = new_reg(l);
+    into(l, reg, v, type);
+
+    return reg;
+}
+
+/* put v, as a value of type, in the register dst */
+static void into(bc_lower_t *l, size_t dst, eir_instr_t *v, eir_type_t type)
+{
+    if (l->regs[v->id] == NO_REG)
+        emit(l, VM_LOADK, dst, constant(l, constant_value(l, v, type)), 0);
+    else
+        convert(l, dst, l->regs[v->id], v->type, type);
+}
+
+/* like codegen's coerce */
+static void convert(bc_lower_t *l, size_t dst, size_t src, eir_type_t from,
+                    eir_type_t to)
+{
+    if (same_bits(from, to)) {
+        if (dst != src)
+            emit(l, VM_MOVE, dst, src, 0);
+    } else if (to == EIR_BOOL) {
+        emit(l, from == EIR_FLOAT ? VM_FTOBOOL : VM_TOBOOL, dst, src, 0);
+    } else if (is_pointer(from)) {
+        emit(l, VM_PTOI, dst, src, 0);
+
+        if (to == EIR_FLOAT)
+            emit(l, VM_ITOF, dst, dst, 0);
+    } else if (is_pointer(to)) {
+        if (from == EIR_INT || from == EIR_VOID) {
+            emit(l, VM_ITOP, dst, src, 0);
+        } else {
+            convert(l, dst, src, from, EIR_INT);
+            emit(l, VM_ITOP, dst, dst, 0);
+        }
+    } else if (from == EIR_BOOL) {
+        emit(l, VM_BTOI, dst, src, 0);
+
+        if (to == EIR_FLOAT)
+            emit(l, VM_ITOF, dst, dst, 0);
+    } else if (to == EIR_FLOAT) {
+        emit(l, VM_ITOF, dst, src, 0);
+    } else {
+        emit(l, VM_FTOI, dst, src, 0);
+    }
+}
+
+/* pointers are converted to pointers as they are, and ints to ints */
+static bool same_bits(eir_type_t from, eir_type_t to)
+{
+    if (from == to || (from == EIR_VOID && to == EIR_INT) ||
+        (from == EIR_INT && to == EIR_VOID))
+        return true;
+
+    return is_pointer(from) && is_pointer(to);
+}
+
+/* the constant v, converted to type while lowering */
+static vm_value_t constant_value(bc_lower_t *l, eir_instr_t *v,
+                                 eir_type_t type)
+{
+    vm_value_t value;
+
+    if (v->op == EIR_CONST_STRING) {
+        vm_program_t *p = l->p;
+        size_t length = strlen(v->imm.s);
+
+        /* short strings aren't objects, they don't allocate */
+        value.p = length <= ERUPT_SHORT_STRING ?
+                  erupt_string_from(v->imm.s, (int64_t)length) : NULL;
+
+        for (size_t k = 0; k < p->n_objects && !value.p; ++k) {
+            erupt_string_t *s = (erupt_string_t *)(p->objects[k] + 1);
+
+            if (ERUPT_KIND(s) == ERUPT_STRING &&
+                strcmp(s->bytes, v->imm.s) == 0)
+                value.p = s;
+        }
+
+        if (!value.p)
+            value.p = new_string(p, v->imm.s, length);
+
+        if (!is_pointer(type))
+            value.i = ERUPT_REF(value.p);
+
+        return value;
+    }
+
+    if (v->op == EIR_CONST_BIGNUM) {
+        int64_t big = keep(l->p, erupt_int_parse(v->imm.s));
+
+        if (type == EIR_FLOAT)
+            value.f = erupt_int_to_float(big);
+        else
+            value.i = type == EIR_BOOL ? 1 : big;
+
+        return value;
+    }
+
+    if (v->op == EIR_CONST_FLOAT) {
+        if (type == EIR_FLOAT)
+            value.f = v->imm.f;
+        else if (type == EIR_BOOL)
+            value.i = v->imm.f != 0;
+        else
+            value.i = keep(l->p, erupt_int_from_float(v->imm.f));
+
+        return value;
+    }
+
+    if (type == EIR_FLOAT)
+        value.f = v->type == EIR_BOOL ? (double)(v->imm.i != 0)
+                                      : (double)v->imm.i;
+    else if (type == EIR_BOOL)
+        value.i = v->imm.i != 0;
+    else
+        value.i = keep(l->p, erupt_int_from_int64(v->imm.i));
+
+    return value;
+}
+
+/* the index of v in the constants, added if it isn't there yet */
+static size_t constant(bc_lower_t *l, vm_value_t v)
+{
+    vm_fn_t *out = l->out;
+
+    for (size_t k = 0; k < out->n_constants; ++k) {
+        if (out->constants[k].i == v.i)
+            return k;
+    }
+
+    out->constants = srealloc(out->constants,
+                              sizeof(vm_value_t) * (out->n_constants + 1));
+    out->constants[out->n_constants] = v;
+
+    return out->n_constants++;
+}
+
+static size_t new_reg(bc_lower_t *l)
+{
+    return l->out->n_regs++;
+}
+
+static void emit(bc_lower_t *l, vm_opcode_t op, size_t a, size_t b, size_t c)
+{
+    vm_fn_t *out = l->out;
+
+    out->code = srealloc(out->code, sizeof(vm_instr_t) * (out->n_code + 1));
+    out->code[out->n_code].op = op;
+    out->code[out->n_code].a = (uint16_t)a;
+    out->code[out->n_code].b = (uint16_t)b;
+    out->code[out->n_code++].c = (uint32_t)c;
+}
+
+static void unsupported(bc_lower_t *l, eir_instr_t *i)
+{
+    if (i->op == EIR_BINOP || i->op == EIR_UNOP) {
+        file_error(l->m->name, i->line_n, "unsupported operator '%s' for "
+                   "%s", token_type_str(i->symbol),
+                   eir_type_str(i->operands[0]->type));
+    } else {
+        file_error(l->m->name, i->line_n, "can't generate bytecode for this "
+                   "instruction");
+    }
+
+    l->failed = true;
+}
+
+static bool is_pointer(eir_type_t type)
+{
+    return type == EIR_STRING || type == EIR_LIST || type == EIR_TASK;
+}
+
+/* a string constant, with a header like a flat string on the heap */
+static erupt_string_t *new_string(vm_program_t *p, const char *s,
+                                  size_t length)
+{
+    size_t size = sizeof(erupt_string_t) +
+                  ((length + sizeof(uint64_t)) & ~(sizeof(uint64_t) - 1));
+    uint64_t *h = smalloc(sizeof(uint64_t) + size);
+    erupt_string_t *str = (erupt_string_t *)(h + 1);
+
+    memset(h, 0, sizeof(uint64_t) + size);
+    *h = ERUPT_HEADER(ERUPT_STRING, size);
+    str->length = (int64_t)length;
+    memcpy(str->bytes, s, length);
+
+    return add_object(p, h);
+}
+
+/* a copy of a big int constant, which the program keeps until it's freed */
+static int64_t keep(vm_program_t *p, int64_t v)
+{
+    if (ERUPT_IS_SMALL(v))
+        return v;
+
+    uint64_t *from = (uint64_t *)ERUPT_DEREF(v) - 1;
+    size_t size = (size_t)(*from >> 16) + sizeof(uint64_t);
+    uint64_t *h = smalloc(size);
+
+    memcpy(h, from, size);
+
+    /* without the collector's bits */
+    *h &= ~UINT64_C(0xff);
+
+    return ERUPT_REF(add_object(p, h));
+}
+
+static void *add_object(vm_program_t *p, uint64_t *h)
+{
+    p->objects = srealloc(p->objects, sizeof(uint64_t *) * (p->n_objects + 1));
+    p->objects[p->n_objects++] = h;
+
+    return h + 1;
+}
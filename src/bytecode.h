@@ -0,0 +1,184 @@
+/*
+ * Copyright (C) 2015 soud
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef BYTECODE_H
+#define BYTECODE_H
+
+/*
+ * erupt's bytecode, for the VM. it's register based: every instruction
+ * names the registers it reads and writes, a function's registers are a
+ * window on the VM's stack. EIR's types are resolved while lowering, so
+ * every opcode knows what kind of value it works on.
+ */
+
+#include <stdint.h>
+
+#include "eir.h"
+
+/* registers, constants and functions are numbered with 16 bits */
+#define VM_MAX_INDEX UINT16_MAX
+
+typedef union {
+    int64_t i;
+    double f;
+    void *p;
+} vm_value_t;
+
+#define VM_OPCODES(X) \
+    X(MOVE)     /* a = b */ \
+    X(LOADK)    /* a = constants[b] */ \
+    X(ADD)      /* a = b + c, and so on for ints */ \
+    X(SUB) \
+    X(MUL) \
+    X(DIV) \
+    X(MOD) \
+    X(POW) \
+    X(BAND) \
+    X(BOR) \
+    X(BXOR) \
+    X(SHL) \
+    X(SHR) \
+    X(ADDK)     /* a = b + constants[c] */ \
+    X(SUBK)     /* a = b - constants[c] */ \
+    X(FADD)     /* a = b + c, and so on for floats */ \
+    X(FSUB) \
+    X(FMUL) \
+    X(FDIV) \
+    X(FMOD) \
+    X(FPOW) \
+    X(EQ)       /* a = b == c, and so on for ints */ \
+    X(NE) \
+    X(LT) \
+    X(LE) \
+    X(GT) \
+    X(GE) \
+    X(FEQ)      /* a = b == c, and so on for floats */ \
+    X(FNE) \
+    X(FLT) \
+    X(FLE) \
+    X(FGT) \
+    X(FGE) \
+    X(NEG)      /* a = -b */ \
+    X(FNEG) \
+    X(NOT)      /* a = !b, of a bool */ \
+    X(BNOT)     /* a = ~b */ \
+    X(TOBOOL)   /* a = b != 0, of an int or pointer */ \
+    X(FTOBOOL)  /* a = b != 0.0 */ \
+    X(ITOF)     /* a = (double)b */ \
+    X(FTOI)     /* a = (int64_t)b */ \
+    X(BTOI)     /* a = b, a bool as an int */ \
+    X(PTOI)     /* a = b | 1, a pointer as a reference */ \
+    X(ITOP)     /* a = b & ~1, a reference as a pointer */ \
+    X(BOXF)     /* a = a float object holding b, as a reference */ \
+    X(SCONCAT)  /* a = b + c, of strings */ \
+    X(LCONCAT)  /* a = b + c, of lists */ \
+    X(SCMP)     /* a = compare(b, c), of strings, an int < 0, 0 or > 0 */ \
+    X(LCMP)     /* a = compare(b, c), of lists */ \
+    X(LIST)     /* a = [c, c + 1, ..., c + b - 1] */ \
+    X(PRINTI)   /* print a */ \
+    X(PRINTF) \
+    X(PRINTB) \
+    X(PRINTS) \
+    X(PRINTL) \
+    X(FLUSH)    /* write buffered output */ \
+    X(JMP)      /* goto c */ \
+    X(JT)       /* if a goto c */ \
+    X(JF)       /* if !a goto c */ \
+    X(JEQ)      /* if a == b goto c, and so on for ints */ \
+    X(JNE) \
+    X(JLT) \
+    X(JLE) \
+    X(JGT) \
+    X(JGE) \
+    X(JEQK)     /* if a == constants[b] goto c, and so on */ \
+    X(JNEK) \
+    X(JLTK) \
+    X(JLEK) \
+    X(JGTK) \
+    X(JGEK) \
+    X(CALL)     /* a = functions[b](c, c + 1, ...) */ \
+    X(CLOSURE)  /* a = functions[b] over c & 0xffff, ..., c >> 16 of them */ \
+    X(ENV)      /* a = the value closure b captured at c */ \
+    X(APPLY)    /* a = closure b(b, b + 1, ..., b + c) */ \
+    X(RET)      /* return a */ \
+    X(NOMATCH)  /* no clause matched */
+
+typedef enum {
+#define VM_ENUM(name) VM_##name,
+    VM_OPCODES(VM_ENUM)
+#undef VM_ENUM
+    VM_OPCODE_COUNT
+} vm_opcode_t;
+
+/*
+ * 16 bytes. op is replaced by the address of its handler before the VM
+ * runs. c is the third register or where to jump to.
+ */
+typedef struct {
+    union {
+        vm_opcode_t op;
+        const void *handler;
+    };
+
+    uint16_t a;
+    uint16_t b;
+    uint32_t c;
+} vm_instr_t;
+
+typedef struct {
+    char *name;
+    size_t n_params;
+    eir_type_t ret;
+
+    /* the parameters are the first registers */
+    size_t n_regs;
+
+    vm_instr_t *code;
+    size_t n_code;
+
+    vm_value_t *constants;
+    size_t n_constants;
+} vm_fn_t;
+
+typedef struct {
+    vm_fn_t *fns;
+    size_t n_fns;
+
+    /* the function main, the program starts there */
+    size_t entry;
+
+    /*
+     * string and big int constants, by the address of their header. they're
+     * owned by the program, not the collector.
+     */
+    uint64_t **objects;
+    size_t n_objects;
+
+    /* once run, the opcodes are replaced by the address of their handler */
+    bool threaded;
+} vm_program_t;
+
+vm_program_t *lower_bytecode(eir_module_t *m);
+void dump_bytecode(vm_program_t *p, FILE *out);
+void destroy_bytecode(vm_program_t *p);
+
+#endif /* !BYTECODE_H */
@@ -0,0 +1,356 @@
+/*
+ * Copyright (C) 2015 soud
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * a persistent, content-addressed cache of compiled objects, in
+ * $XDG_CACHE_HOME/erupt. an object is stored under the hash of everything
+ * that went into it: the code it was generated from, the compiler that
+ * did so and the options and target it was compiled for. keys never go
+ * stale, a change makes a new one. the cache is only an optimization, when
+ * something goes wrong with it the object is simply compiled again.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cache.h"
+
+typedef struct {
+    char *path;
+    off_t size;
+    struct timespec used;
+} cache_entry_t;
+
+static char *cache_dir(void);
+static bool make_dirs(char *path);
+static char *object_path(cache_t *cache, const char *key);
+static void evict(cache_t *cache);
+static size_t list_entries(const char *dir, cache_entry_t **entries,
+                           size_t n);
+static int compare_used(const void *a, const void *b);
+
+/*
+ * the cache in $XDG_CACHE_HOME/erupt, or ~/.cache/erupt. gives NULL when
+ * it's disabled with ERUPT_CACHE_SIZE=0 or there's nowhere to keep it.
+ */
+cache_t *open_cache(void)
+{
+    const char *size = getenv("ERUPT_CACHE_SIZE");
+    unsigned long max_size = DEFAULT_CACHE_SIZE;
+    struct stat exe;
+    char *end;
+
+    if (size) {
+        errno = 0;
+        max_size = strtoul(size, &end, 10);
+
+        if (errno || *size == '\0' || *end != '\0') {
+            erupt_warning("ignoring ERUPT_CACHE_SIZE '%s'", size);
+            max_size = DEFAULT_CACHE_SIZE;
+        }
+    }
+
+    if (max_size == 0)
+        return NULL;
+
+    char *dir = cache_dir();
+
+    if (!dir || !make_dirs(dir)) {
+        verbose_printf("not using the compile cache, it has no directory");
+        free(dir);
+
+        return NULL;
+    }
+
+    cache_t *cache = smalloc(sizeof(cache_t));
+
+    cache->dir = dir;
+    cache->max_size = (size_t)max_size << 20;
+    atomic_init(&cache->hits, 0);
+    atomic_init(&cache->misses, 0);
+    atomic_init(&cache->stored, 0);
+
+    /* a rebuilt compiler may generate other code, even with this version */
+    if (stat("/proc/self/exe", &exe) != 0)
+        memset(&exe, 0, sizeof(exe));
+
+    cache->compiler = smalloc(sizeof(ERUPT_VERSION) + 64);
+    sprintf(cache->compiler, "erupt %s %jd %jd.%09ld", ERUPT_VERSION,
+            (intmax_t)exe.st_size, (intmax_t)exe.st_mtim.tv_sec,
+            exe.st_mtim.tv_nsec);
+
+    verbose_printf("using the compile cache in '%s'", dir);
+
+    return cache;
+}
+
+/* hash data into key, which has room for CACHE_KEY_LENGTH + 1 chars */
+void cache_key(const char *data, size_t size, char *key)
+{
+    /* FNV-1a, 128 bits */
+    const unsigned __int128 prime = ((unsigned __int128)1 << 88) + 0x13b;
+    unsigned __int128 hash = ((unsigned __int128)0x6c62272e07bb0142 << 64) |
+                             0x62b821756295c58d;
+
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= (unsigned char)data[i];
+        hash *= prime;
+    }
+
+    sprintf(key, "%016" PRIx64 "%016" PRIx64, (uint64_t)(hash >> 64),
+            (uint64_t)hash);
+}
+
+/* the object stored under key, or NULL if there is none */
+LLVMMemoryBufferRef cache_load(cache_t *cache, const char *key)
+{
+    char *path = object_path(cache, key);
+    int fd = open(path, O_RDONLY);
+    LLVMMemoryBufferRef object = NULL;
+    struct stat st;
+
+    free(path);
+
+    if (fd >= 0 && fstat(fd, &st) == 0) {
+        char *data = smalloc((size_t)st.st_size + 1);
+
+        if (read(fd, data, (size_t)st.st_size) == st.st_size)
+            object = LLVMCreateMemoryBufferWithMemoryRangeCopy(
+                data, (size_t)st.st_size, key
+            );
+
+        free(data);
+
+        /* the modification time says when it was last used, for evict() */
+        futimens(fd, NULL);
+    }
+
+    if (fd >= 0)
+        close(fd);
+
+    atomic_fetch_add(object ? &cache->hits : &cache->misses, 1);
+
+    return object;
+}
+
+/*
+ * store object under key. it's written to a temporary file first and
+ * renamed, so other compilers never see half an object.
+ */
+void cache_store(cache_t *cache, const char *key, LLVMMemoryBufferRef object)
+{
+    char *path = object_path(cache, key);
+    char *tmp = smalloc(strlen(path) + sizeof(".XXXXXX"));
+    char *slash = strrchr(path, '/');
+    size_t size = LLVMGetBufferSize(object);
+    int fd;
+
+    sprintf(tmp, "%s.XXXXXX", path);
+
+    /* objects are kept in directories named after the key's first byte */
+    *slash = '\0';
+    mkdir(path, 0755);
+    *slash = '/';
+
+    if ((fd = mkstemp(tmp)) < 0) {
+        verbose_printf("couldn't add '%s' to the compile cache", key);
+        free(path);
+        free(tmp);
+
+        return;
+    }
+
+    bool written = write(fd, LLVMGetBufferStart(object), size) ==
+                   (ssize_t)size;
+
+    close(fd);
+
+    if (written && rename(tmp, path) == 0)
+        atomic_fetch_add(&cache->stored, 1);
+    else
+        unlink(tmp);
+
+    free(path);
+    free(tmp);
+}
+
+/* report how useful the cache was and make room for the next build */
+void close_cache(cache_t *cache)
+{
+    if (!cache)
+        return;
+
+    verbose_printf("compile cache: %zu hit(s), %zu miss(es)",
+                   atomic_load(&cache->hits), atomic_load(&cache->misses));
+
+    if (atomic_load(&cache->stored))
+        evict(cache);
+
+    free(cache->dir);
+    free(cache->compiler);
+    free(cache);
+}
+
+static char *cache_dir(void)
+{
+    const char *base = getenv("XDG_CACHE_HOME");
+    const char *suffix = "/erupt";
+    char *dir;
+
+    /* the spec says relative paths are invalid and should be ignored */
+    if (!base || base[0] != '/') {
+        if (!(base = getenv("HOME")))
+            return NULL;
+
+        suffix = "/.cache/erupt";
+    }
+
+    dir = smalloc(strlen(base) + strlen(suffix) + 1);
+    sprintf(dir, "%s%s", base, suffix);
+
+    return dir;
+}
+
+/* mkdir -p */
+static bool make_dirs(char *path)
+{
+    for (char *slash = strchr(path + 1, '/'); slash;
+         slash = strchr(slash + 1, '/')) {
+        *slash = '\0';
+
+        if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+            *slash = '/';
+            return false;
+        }
+
+        *slash = '/';
+    }
+
+    return mkdir(path, 0755) == 0 || errno == EEXIST;
+}
+
+/* <dir>/<first byte of key>/<rest of key>.o */
+static char *object_path(cache_t *cache, const char *key)
+{
+    char *path = smalloc(strlen(cache->dir) + CACHE_KEY_LENGTH +
+                         sizeof("//.o"));
+
+    sprintf(path, "%s/%.2s/%s.o", cache->dir, key, key + 2);
+
+    return path;
+}
+
+/* remove the least recently used objects until the cache fits again */
+static void evict(cache_t *cache)
+{
+    cache_entry_t *entries = NULL;
+    size_t n = 0, size = 0;
+    DIR *dir = opendir(cache->dir);
+    struct dirent *d;
+
+    if (!dir)
+        return;
+
+    while ((d = readdir(dir))) {
+        if (strlen(d->d_name) != 2 || d->d_name[0] == '.')
+            continue;
+
+        char *sub = smalloc(strlen(cache->dir) + sizeof("/xx"));
+
+        sprintf(sub, "%s/%s", cache->dir, d->d_name);
+        n = list_entries(sub, &entries, n);
+        free(sub);
+    }
+
+    closedir(dir);
+
+    for (size_t i = 0; i < n; ++i)
+        size += (size_t)entries[i].size;
+
+    if (size > cache->max_size) {
+        qsort(entries, n, sizeof(cache_entry_t), compare_used);
+
+        for (size_t i = 0; i < n && size > cache->max_size; ++i) {
+            if (unlink(entries[i].path) == 0)
+                size -= (size_t)entries[i].size;
+        }
+
+        verbose_printf("evicted objects from the compile cache, %zu KiB "
+                       "left", size >> 10);
+    }
+
+    for (size_t i = 0; i < n; ++i)
+        free(entries[i].path);
+
+    free(entries);
+}
+
+/* add the files in dir to entries, which has n of them already */
+static size_t list_entries(const char *dir, cache_entry_t **entries,
+                           size_t n)
+{
+    DIR *handle = opendir(dir);
+    struct dirent *d;
+    struct stat st;
+
+    if (!handle)
+        return n;
+
+    while ((d = readdir(handle))) {
+        char *path = smalloc(strlen(dir) + strlen(d->d_name) + 2);
+
+        sprintf(path, "%s/%s", dir, d->d_name);
+
+        if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) {
+            free(path);
+            continue;
+        }
+
+        *entries = srealloc(*entries, sizeof(cache_entry_t) * (n + 1));
+        (*entries)[n].path = path;
+        (*entries)[n].size = st.st_size;
+        (*entries)[n++].used = st.st_mtim;
+    }
+
+    closedir(handle);
+
+    return n;
+}
+
+/* oldest first */
+static int compare_used(const void *a, const void *b)
+{
+    const struct timespec *x = &((const cache_entry_t *)a)->used;
+    const struct timespec *y = &((const cache_entry_t *)b)->used;
+
+    if (x->tv_sec != y->tv_sec)
+        return x->tv_sec < y->tv_sec ? -1 : 1;
+
+    if (x->tv_nsec != y->tv_nsec)
+        return x->tv_nsec < y->tv_nsec ? -1 : 1;
+
+    return 0;
+}
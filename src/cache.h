@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2015 soud
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <llvm-c/Core.h>
+#include <stdatomic.h>
+
+#include "erupt.h"
+
+/* in megabytes, the least recently used objects go first when it's full */
+#define DEFAULT_CACHE_SIZE 256
+
+/* a 128-bit hash in hex */
+#define CACHE_KEY_LENGTH 32
+
+typedef struct {
+    char *dir;
+    size_t max_size;
+
+    /* tells one build of the compiler from another */
+    char *compiler;
+
+    atomic_size_t hits;
+    atomic_size_t misses;
+    atomic_size_t stored;
+} cache_t;
+
+cache_t *open_cache(void);
+void cache_key(const char *data, size_t size, char *key);
+LLVMMemoryBufferRef cache_load(cache_t *cache, const char *key);
+void cache_store(cache_t *cache, const char *key, LLVMMemoryBufferRef object);
+void close_cache(cache_t *cache);
+
+#endif /* !CACHE_H */
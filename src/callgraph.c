@@ -0,0 +1,238 @@
+/*
+ * Copyright (C) 2015 soud
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "callgraph.h"
+#include "erupt.h"
+
+typedef struct {
+    callgraph_t *cg;
+    cg_node_t *caller;
+} collect_t;
+
+typedef struct {
+    size_t index;
+    size_t *indices;
+    size_t *lowlinks;
+    bool *on_stack;
+    size_t *stack;
+    size_t sp;
+} tarjan_t;
+
+static const char *fn_name(ast_node_t *fn);
+static cg_node_t *add_function(callgraph_t *cg, ast_node_t *fn);
+static void collect_call(ast_node_t *node, void *data);
+static void add_callee(cg_node_t *caller, size_t callee);
+static void strong_connect(callgraph_t *cg, tarjan_t *t, size_t v);
+
+/*
+ * build the call graph of every top level function in ast. calls to names
+ * that aren't defined in ast (eg. IO.print) are left out.
+ */
+callgraph_t *build_callgraph(ast_node_list_t *ast)
+{
+    callgraph_t *cg = smalloc(sizeof(callgraph_t));
+
+    cg->nodes = NULL;
+    cg->n_nodes = 0;
+    cg->n_sccs = 0;
+
+    if (!ast)
+        return cg;
+
+    /* first gather all functions so forward calls can be resolved */
+    for (ast_node_list_t *nl = ast; nl; nl = nl->next) {
+        if (nl->node && nl->node->type == TYPE_FN)
+            add_function(cg, nl->node);
+    }
+
+    for (size_t i = 0; i < cg->n_nodes; ++i) {
+        collect_t c = { cg, &cg->nodes[i] };
+
+        for (size_t j = 0; j < cg->nodes[i].n_clauses; ++j)
+            visit_node_list(cg->nodes[i].clauses[j]->fn.body, collect_call,
+                            &c);
+    }
+
+    tarjan_t t;
+
+    t.index = 1;
+    t.sp = 0;
+    t.indices = scalloc(cg->n_nodes + 1, sizeof(size_t));
+    t.lowlinks = scalloc(cg->n_nodes + 1, sizeof(size_t));
+    t.on_stack = scalloc(cg->n_nodes + 1, sizeof(bool));
+    t.stack = scalloc(cg->n_nodes + 1, sizeof(size_t));
+
+    for (size_t i = 0; i < cg->n_nodes; ++i) {
+        if (!t.indices[i])
+            strong_connect(cg, &t, i);
+    }
+
+    free(t.indices);
+    free(t.lowlinks);
+    free(t.on_stack);
+    free(t.stack);
+
+    verbose_printf("built call graph of %zu functions in %zu components",
+                   cg->n_nodes, cg->n_sccs);
+
+    return cg;
+}
+
+cg_node_t *callgraph_lookup(callgraph_t *cg, const char *name)
+{
+    for (size_t i = 0; i < cg->n_nodes; ++i) {
+        if (strcmp(cg->nodes[i].name, name) == 0)
+            return &cg->nodes[i];
+    }
+
+    return NULL;
+}
+
+void destroy_callgraph(callgraph_t *cg)
+{
+    if (!cg)
+        return;
+
+    for (size_t i = 0; i < cg->n_nodes; ++i) {
+        free(cg->nodes[i].clauses);
+        free(cg->nodes[i].callees);
+    }
+
+    free(cg->nodes);
+    free(cg);
+}
+
+static const char *fn_name(ast_node_t *fn)
+{
+    return fn->fn.prototype ? fn->fn.prototype->prototype.name : NULL;
+}
+
+static cg_node_t *add_function(callgraph_t *cg, ast_node_t *fn)
+{
+    const char *name = fn_name(fn);
+
+    if (!name)
+        return NULL;
+
+    cg_node_t *node = callgraph_lookup(cg, name);
+
+    if (!node) {
+        cg->nodes = srealloc(cg->nodes,
+                             sizeof(cg_node_t) * (cg->n_nodes + 1));
+        node = &cg->nodes[cg->n_nodes++];
+
+        node->name = name;
+        node->clauses = NULL;
+        node->n_clauses = 0;
+        node->callees = NULL;
+        node->n_callees = 0;
+        node->scc = 0;
+        node->recursive = false;
+    }
+
+    node->clauses = srealloc(node->clauses,
+                             sizeof(ast_node_t *) * (node->n_clauses + 1));
+    node->clauses[node->n_clauses++] = fn;
+
+    return node;
+}
+
+static void collect_call(ast_node_t *node, void *data)
+{
+    collect_t *c = data;
+    const char *name;
+
+    /* a var without a value can be a function taken as a value */
+    if (node->type == TYPE_CALL)
+        name = node->call.name;
+    else if (node->type == TYPE_CLOSURE && node->closure.name)
+        name = node->closure.name;
+    else if (node->type == TYPE_VAR && !node->var.v)
+        name = node->var.name;
+    else
+        return;
+
+    cg_node_t *callee = callgraph_lookup(c->cg, name);
+
+    if (callee)
+        add_callee(c->caller, callee - c->cg->nodes);
+}
+
+static void add_callee(cg_node_t *caller, size_t callee)
+{
+    for (size_t i = 0; i < caller->n_callees; ++i) {
+        if (caller->callees[i] == callee)
+            return;
+    }
+
+    caller->callees = srealloc(caller->callees,
+                               sizeof(size_t) * (caller->n_callees + 1));
+    caller->callees[caller->n_callees++] = callee;
+}
+
+/*
+ * Tarjan's algorithm. components are completed leaves first, so numbering
+ * them in completion order gives a bottom-up order over the call graph.
+ */
+static void strong_connect(callgraph_t *cg, tarjan_t *t, size_t v)
+{
+    cg_node_t *node = &cg->nodes[v];
+
+    t->indices[v] = t->lowlinks[v] = t->index++;
+    t->stack[t->sp++] = v;
+    t->on_stack[v] = true;
+
+    for (size_t i = 0; i < node->n_callees; ++i) {
+        size_t w = node->callees[i];
+
+        if (w == v)
+            node->recursive = true;
+
+        if (!t->indices[w]) {
+            strong_connect(cg, t, w);
+
+            if (t->lowlinks[w] < t->lowlinks[v])
+                t->lowlinks[v] = t->lowlinks[w];
+        } else if (t->on_stack[w] && t->indices[w] < t->lowlinks[v]) {
+            t->lowlinks[v] = t->indices[w];
+        }
+    }
+
+    if (t->lowlinks[v] != t->indices[v])
+        return;
+
+    size_t scc = cg->n_sccs++;
+    size_t top = t->sp;
+    size_t w;
+
+    do {
+        w = t->stack[--t->sp];
+        t->on_stack[w] = false;
+        cg->nodes[w].scc = scc;
+    } while (w != v);
+
+    /* every member of a component with more than one function is recursive */
+    if (top - t->sp > 1) {
+        for (size_t i = t->sp; i < top; ++i)
+            cg->nodes[t->stack[i]].recursive = true;
+    }
+}
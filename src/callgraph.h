@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2015 soud
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef CALLGRAPH_H
+#define CALLGRAPH_H
+
+#include "ast.h"
+
+typedef struct {
+    const char *name;
+
+    /* every TYPE_FN clause defining this function, in source order */
+    ast_node_t **clauses;
+    size_t n_clauses;
+
+    /*
+     * indices into callgraph_t.nodes of the functions called, or taken as
+     * values, which can then be called from anywhere
+     */
+    size_t *callees;
+    size_t n_callees;
+
+    /* strongly connected components are numbered callees first */
+    size_t scc;
+    bool recursive;
+} cg_node_t;
+
+typedef struct {
+    cg_node_t *nodes;
+    size_t n_nodes;
+    size_t n_sccs;
+} callgraph_t;
+
+callgraph_t *build_callgraph(ast_node_list_t *ast);
+cg_node_t *callgraph_lookup(callgraph_t *cg, const char *name);
+void destroy_callgraph(callgraph_t *cg);
+
+#endif /* !CALLGRAPH_H */
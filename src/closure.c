@@ -0,0 +1,584 @@
+/*
+ * Copyright (C) 2015 soud
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "closure.h"
+#include "erupt.h"
+
+typedef struct {
+    const char **names;
+    size_t n_names;
+} names_t;
+
+typedef struct {
+    ast_node_list_t *ast;
+
+    /* the top level functions, calls resolve to them before closures */
+    names_t fns;
+
+    /* the function lambdas are lifted out of */
+    const char *outer;
+
+    size_t n_lifted;
+    size_t direct;
+} lifter_t;
+
+static void lift_list(lifter_t *lf, ast_node_list_t *nl, names_t *scope);
+static void lift_node(lifter_t *lf, ast_node_t *node, names_t *scope);
+static void lift(lifter_t *lf, ast_node_t *lambda, names_t *scope);
+static bool call_directly(lifter_t *lf, ast_node_t *clause,
+                          ast_node_list_t *body, names_t *tried);
+static bool only_called(lifter_t *lf, ast_node_t *clause,
+                        ast_node_t *binding);
+static void count_uses(ast_node_t *node, const char *name, size_t arity,
+                       bool *called_only);
+static void rewrite_calls(ast_node_t *node, const char *name,
+                          ast_node_t *closure);
+static ast_node_list_t *capture_args(ast_node_t *closure,
+                                     ast_node_list_t *args);
+static size_t closure_arity(lifter_t *lf, ast_node_t *closure);
+static void scan(ast_node_t *node, names_t *bound, names_t *refs);
+static void scan_list(ast_node_list_t *nl, names_t *bound, names_t *refs);
+static void scan_params(ast_node_list_t *params, names_t *bound);
+static size_t count_name(names_t *n, const char *name);
+static void add_name(names_t *n, const char *name);
+
+/*
+ * lift every lambda in ast into a top level function that takes the values
+ * it captures after its own arguments, innermost first. a lambda that is
+ * only ever called, by the name it's bound to, is then called directly with
+ * its captures as extra arguments and doesn't exist at runtime. any other
+ * lambda becomes a closure, its function with a flat copy of the captured
+ * values. returns the number of lambdas that are called directly.
+ */
+size_t lift_lambdas(ast_node_list_t *ast)
+{
+    lifter_t lf;
+
+    if (!ast)
+        return 0;
+
+    memset(&lf, 0, sizeof(lifter_t));
+    lf.ast = ast;
+
+    for (ast_node_list_t *nl = ast; nl; nl = nl->next) {
+        if (nl->node && nl->node->type == TYPE_FN)
+            add_name(&lf.fns, nl->node->fn.prototype->prototype.name);
+    }
+
+    /* lifted functions are appended, they have no lambdas left in them */
+    for (ast_node_list_t *nl = ast; nl; nl = nl->next) {
+        ast_node_t *clause = nl->node;
+
+        if (!clause || clause->type != TYPE_FN)
+            continue;
+
+        names_t scope = { NULL, 0 };
+
+        lf.outer = clause->fn.prototype->prototype.name;
+        scan_params(clause->fn.prototype->prototype.args, &scope);
+        scan_list(clause->fn.body, &scope, NULL);
+        lift_list(&lf, clause->fn.body, &scope);
+
+        free(scope.names);
+    }
+
+    if (lf.n_lifted) {
+        for (ast_node_list_t *nl = ast; nl; nl = nl->next) {
+            ast_node_t *clause = nl->node;
+            names_t tried = { NULL, 0 };
+
+            if (!clause || clause->type != TYPE_FN)
+                continue;
+
+            while (call_directly(&lf, clause, clause->fn.body, &tried))
+                ;
+
+            free(tried.names);
+        }
+
+        verbose_printf("lifted %zu lambda(s), %zu called directly",
+                       lf.n_lifted, lf.direct);
+    }
+
+    free(lf.fns.names);
+
+    return lf.direct;
+}
+
+static void lift_list(lifter_t *lf, ast_node_list_t *nl, names_t *scope)
+{
+    for (; nl; nl = nl->next)
+        lift_node(lf, nl->node, scope);
+}
+
+static void lift_node(lifter_t *lf, ast_node_t *node, names_t *scope)
+{
+    if (!node)
+        return;
+
+    switch (node->type) {
+    case TYPE_LIST:
+        lift_list(lf, node->list.values, scope);
+        break;
+    case TYPE_VAR:
+        lift_node(lf, node->var.v, scope);
+        break;
+    case TYPE_CLOSURE:
+        if (!node->closure.name)
+            lift(lf, node, scope);
+        break;
+    case TYPE_CALL:
+        lift_list(lf, node->call.args, scope);
+        break;
+    case TYPE_IF:
+        lift_node(lf, node->if_expr.condition, scope);
+        lift_list(lf, node->if_expr.true_body, scope);
+        lift_list(lf, node->if_expr.false_body, scope);
+        break;
+    case TYPE_EXPR:
+        lift_node(lf, node->expr.lhs, scope);
+        lift_node(lf, node->expr.rhs, scope);
+        break;
+    case TYPE_RETURN:
+        lift_node(lf, node->return_expr.expr, scope);
+        break;
+    default:
+        break;
+    }
+}
+
+/*
+ * the captures of lambda are the names it uses that scope binds and it
+ * doesn't, in the order they're first used.
+ */
+static void lift(lifter_t *lf, ast_node_t *lambda, names_t *scope)
+{
+    ast_closure_t *c = &lambda->closure;
+    names_t own = { NULL, 0 }, inner = { NULL, 0 }, refs = { NULL, 0 };
+    names_t captured = { NULL, 0 };
+
+    scan_params(c->args, &own);
+    scan_list(c->body, &own, NULL);
+
+    for (size_t i = 0; i < scope->n_names; ++i)
+        add_name(&inner, scope->names[i]);
+
+    for (size_t i = 0; i < own.n_names; ++i)
+        add_name(&inner, own.names[i]);
+
+    lift_list(lf, c->body, &inner);
+    scan_list(c->body, NULL, &refs);
+
+    ast_node_list_t *args = copy_node_list(c->args);
+    ast_node_list_t *captures = NULL;
+
+    if (!args)
+        args = create_node_list();
+
+    for (size_t i = 0; i < refs.n_names; ++i) {
+        const char *name = refs.names[i];
+
+        if (!count_name(scope, name) || count_name(&own, name) ||
+            count_name(&captured, name))
+            continue;
+
+        add_name(&captured, name);
+
+        if (!captures)
+            captures = create_node_list();
+
+        append_node(captures, create_var(name, false, NULL));
+        append_node(args, create_var(name, false, NULL));
+    }
+
+    char *name = smalloc(strlen(lf->outer) + sizeof(LAMBDA_INFIX) + 20);
+
+    sprintf(name, "%s" LAMBDA_INFIX "%zu", lf->outer, ++lf->n_lifted);
+
+    ast_node_t *fn = create_fn(create_fn_proto(name, args), c->body);
+
+    fn->line_n = lambda->line_n;
+    fn->fn.prototype->line_n = lambda->line_n;
+    append_node(lf->ast, fn);
+    add_name(&lf->fns, fn->fn.prototype->prototype.name);
+
+    verbose_printf("lifted a lambda in '%s' into '%s'", lf->outer, name);
+
+    if (c->args)
+        destroy_ast(c->args);
+
+    c->name = name;
+    c->args = NULL;
+    c->body = NULL;
+    c->captures = captures;
+
+    free(own.names);
+    free(inner.names);
+    free(refs.names);
+    free(captured.names);
+}
+
+/*
+ * find a closure bound to a name in body, or a body nested in it, that is
+ * only ever called, and call its function directly instead. tried holds
+ * the names that can't be, gives whether anything changed.
+ */
+static bool call_directly(lifter_t *lf, ast_node_t *clause,
+                          ast_node_list_t *body, names_t *tried)
+{
+    for (ast_node_list_t *nl = body; nl && nl->node; nl = nl->next) {
+        ast_node_t *node = nl->node;
+
+        if (node->type == TYPE_IF) {
+            if (call_directly(lf, clause, node->if_expr.true_body, tried) ||
+                call_directly(lf, clause, node->if_expr.false_body, tried))
+                return true;
+
+            continue;
+        }
+
+        /* the last expression is the body's value, which escapes */
+        if (!nl->next || node->type != TYPE_VAR || !node->var.v ||
+            node->var.v->type != TYPE_CLOSURE ||
+            count_name(tried, node->var.name))
+            continue;
+
+        if (!only_called(lf, clause, node)) {
+            add_name(tried, node->var.name);
+            continue;
+        }
+
+        rewrite_calls(clause, node->var.name, node->var.v);
+
+        verbose_printf("calling '%s' directly", node->var.v->closure.name);
+
+        remove_node(body, node);
+        destroy_node(node);
+        ++lf->direct;
+
+        return true;
+    }
+
+    return false;
+}
+
+/*
+ * whether the closure binding binds is only called, with the right number
+ * of arguments, and neither its name nor what it captures is ever bound
+ * again, so passing the captures at the calls gives the same values.
+ */
+static bool only_called(lifter_t *lf, ast_node_t *clause,
+                        ast_node_t *binding)
+{
+    ast_node_t *closure = binding->var.v;
+    names_t bound = { NULL, 0 };
+    bool called_only = true;
+
+    scan_params(clause->fn.prototype->prototype.args, &bound);
+    scan_list(clause->fn.body, &bound, NULL);
+
+    if (count_name(&lf->fns, binding->var.name) ||
+        count_name(&bound, binding->var.name) != 1)
+        called_only = false;
+
+    for (ast_node_list_t *nl = closure->closure.captures;
+         called_only && nl && nl->node; nl = nl->next)
+        called_only = count_name(&bound, nl->node->var.name) == 1;
+
+    free(bound.names);
+
+    for (ast_node_list_t *nl = clause->fn.body;
+         called_only && nl && nl->node; nl = nl->next)
+        count_uses(nl->node, binding->var.name, closure_arity(lf, closure),
+                   &called_only);
+
+    return called_only;
+}
+
+static void count_uses(ast_node_t *node, const char *name, size_t arity,
+                       bool *called_only)
+{
+    if (!node || !*called_only)
+        return;
+
+    size_t n = 0;
+
+    switch (node->type) {
+    case TYPE_LIST:
+        for (ast_node_list_t *nl = node->list.values; nl; nl = nl->next)
+            count_uses(nl->node, name, arity, called_only);
+        break;
+    case TYPE_VAR:
+        if (!node->var.v && strcmp(node->var.name, name) == 0)
+            *called_only = false;
+
+        count_uses(node->var.v, name, arity, called_only);
+        break;
+    case TYPE_CLOSURE:
+        for (ast_node_list_t *nl = node->closure.captures; nl; nl = nl->next)
+            count_uses(nl->node, name, arity, called_only);
+        break;
+    case TYPE_CALL:
+        for (ast_node_list_t *nl = node->call.args; nl; nl = nl->next) {
+            if (nl->node)
+                ++n;
+
+            count_uses(nl->node, name, arity, called_only);
+        }
+
+        if (strcmp(node->call.name, name) == 0 && n != arity)
+            *called_only = false;
+        break;
+    case TYPE_IF:
+        count_uses(node->if_expr.condition, name, arity, called_only);
+
+        for (ast_node_list_t *nl = node->if_expr.true_body; nl; nl = nl->next)
+            count_uses(nl->node, name, arity, called_only);
+
+        for (ast_node_list_t *nl = node->if_expr.false_body; nl;
+             nl = nl->next)
+            count_uses(nl->node, name, arity, called_only);
+        break;
+    case TYPE_EXPR: {
+        ast_node_t *rhs = node->expr.rhs;
+
+        count_uses(node->expr.lhs, name, arity, called_only);
+
+        /* x |> f is f(x) and x |> f(y) is f(x, y) */
+        if (node->expr.operator && node->expr.operator->symbol == PIPE &&
+            rhs && rhs->type == TYPE_VAR && !rhs->var.v) {
+            if (strcmp(rhs->var.name, name) == 0 && arity != 1)
+                *called_only = false;
+            break;
+        }
+
+        if (node->expr.operator && node->expr.operator->symbol == PIPE &&
+            rhs && rhs->type == TYPE_CALL) {
+            for (ast_node_list_t *nl = rhs->call.args; nl; nl = nl->next) {
+                if (nl->node)
+                    ++n;
+
+                count_uses(nl->node, name, arity, called_only);
+            }
+
+            if (strcmp(rhs->call.name, name) == 0 && n + 1 != arity)
+                *called_only = false;
+            break;
+        }
+
+        count_uses(rhs, name, arity, called_only);
+        break;
+    }
+    case TYPE_RETURN:
+        count_uses(node->return_expr.expr, name, arity, called_only);
+        break;
+    default:
+        break;
+    }
+}
+
+/* turn calls to name into calls to the function of closure */
+static void rewrite_calls(ast_node_t *node, const char *name,
+                          ast_node_t *closure)
+{
+    if (!node)
+        return;
+
+    switch (node->type) {
+    case TYPE_FN:
+        for (ast_node_list_t *nl = node->fn.body; nl; nl = nl->next)
+            rewrite_calls(nl->node, name, closure);
+        break;
+    case TYPE_LIST:
+        for (ast_node_list_t *nl = node->list.values; nl; nl = nl->next)
+            rewrite_calls(nl->node, name, closure);
+        break;
+    case TYPE_VAR:
+        rewrite_calls(node->var.v, name, closure);
+        break;
+    case TYPE_CALL:
+        for (ast_node_list_t *nl = node->call.args; nl; nl = nl->next)
+            rewrite_calls(nl->node, name, closure);
+
+        if (strcmp(node->call.name, name) == 0) {
+            free(node->call.name);
+            node->call.name = strdup(closure->closure.name);
+            node->call.args = capture_args(closure, node->call.args);
+        }
+        break;
+    case TYPE_IF:
+        rewrite_calls(node->if_expr.condition, name, closure);
+
+        for (ast_node_list_t *nl = node->if_expr.true_body; nl; nl = nl->next)
+            rewrite_calls(nl->node, name, closure);
+
+        for (ast_node_list_t *nl = node->if_expr.false_body; nl;
+             nl = nl->next)
+            rewrite_calls(nl->node, name, closure);
+        break;
+    case TYPE_EXPR: {
+        ast_node_t *rhs = node->expr.rhs;
+
+        rewrite_calls(node->expr.lhs, name, closure);
+
+        if (node->expr.operator && node->expr.operator->symbol == PIPE &&
+            rhs && rhs->type == TYPE_VAR && !rhs->var.v &&
+            strcmp(rhs->var.name, name) == 0) {
+            node->expr.rhs = create_call(closure->closure.name,
+                                         capture_args(closure, NULL));
+            node->expr.rhs->line_n = rhs->line_n;
+            destroy_node(rhs);
+            break;
+        }
+
+        rewrite_calls(rhs, name, closure);
+        break;
+    }
+    case TYPE_RETURN:
+        rewrite_calls(node->return_expr.expr, name, closure);
+        break;
+    default:
+        break;
+    }
+}
+
+/* args followed by the captures of closure, which go after them */
+static ast_node_list_t *capture_args(ast_node_t *closure,
+                                     ast_node_list_t *args)
+{
+    for (ast_node_list_t *nl = closure->closure.captures; nl && nl->node;
+         nl = nl->next) {
+        if (!args)
+            args = create_node_list();
+
+        append_node(args, copy_node(nl->node));
+    }
+
+    return args;
+}
+
+/* the arguments a lifted closure takes, besides its captures */
+static size_t closure_arity(lifter_t *lf, ast_node_t *closure)
+{
+    size_t n = 0;
+
+    for (ast_node_list_t *nl = lf->ast; nl; nl = nl->next) {
+        ast_node_t *fn = nl->node;
+
+        if (!fn || fn->type != TYPE_FN ||
+            strcmp(fn->fn.prototype->prototype.name, closure->closure.name))
+            continue;
+
+        for (ast_node_list_t *a = fn->fn.prototype->prototype.args;
+             a && a->node; a = a->next)
+            ++n;
+
+        break;
+    }
+
+    for (ast_node_list_t *nl = closure->closure.captures; nl && nl->node;
+         nl = nl->next)
+        --n;
+
+    return n;
+}
+
+/*
+ * add the names node binds to bound, and the ones it uses to refs, either
+ * can be NULL. lambdas that aren't lifted yet bind and use names of their
+ * own, a lifted one uses its captures.
+ */
+static void scan(ast_node_t *node, names_t *bound, names_t *refs)
+{
+    if (!node)
+        return;
+
+    switch (node->type) {
+    case TYPE_LIST:
+        scan_list(node->list.values, bound, refs);
+        break;
+    case TYPE_VAR:
+        if (node->var.v) {
+            if (bound)
+                add_name(bound, node->var.name);
+
+            scan(node->var.v, bound, refs);
+        } else if (refs) {
+            add_name(refs, node->var.name);
+        }
+        break;
+    case TYPE_CLOSURE:
+        scan_list(node->closure.captures, bound, refs);
+        break;
+    case TYPE_CALL:
+        if (refs)
+            add_name(refs, node->call.name);
+
+        scan_list(node->call.args, bound, refs);
+        break;
+    case TYPE_IF:
+        scan(node->if_expr.condition, bound, refs);
+        scan_list(node->if_expr.true_body, bound, refs);
+        scan_list(node->if_expr.false_body, bound, refs);
+        break;
+    case TYPE_EXPR:
+        scan(node->expr.lhs, bound, refs);
+        scan(node->expr.rhs, bound, refs);
+        break;
+    case TYPE_RETURN:
+        scan(node->return_expr.expr, bound, refs);
+        break;
+    default:
+        break;
+    }
+}
+
+static void scan_list(ast_node_list_t *nl, names_t *bound, names_t *refs)
+{
+    for (; nl; nl = nl->next)
+        scan(nl->node, bound, refs);
+}
+
+/* parameters that aren't literal patterns bind their name */
+static void scan_params(ast_node_list_t *params, names_t *bound)
+{
+    for (; params && params->node; params = params->next) {
+        if (params->node->type == TYPE_VAR && !params->node->var.v)
+            add_name(bound, params->node->var.name);
+    }
+}
+
+static size_t count_name(names_t *n, const char *name)
+{
+    size_t count = 0;
+
+    for (size_t i = 0; i < n->n_names; ++i)
+        count += strcmp(n->names[i], name) == 0;
+
+    return count;
+}
+
+static void add_name(names_t *n, const char *name)
+{
+    n->names = srealloc(n->names, sizeof(char *) * (n->n_names + 1));
+    n->names[n->n_names++] = name;
+}
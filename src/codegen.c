@@ -0,0 +1,2089 @@
+/*
+ * Copyright (C) 2015 soud
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * generate LLVM IR from EIR. every value is represented by its natural LLVM
+ * type: ints are i64, floats double, bools i1 and strings and lists are
+ * pointers into the runtime's memory. functions take their arguments as
+ * i64, since parameters are ints until there's type inference.
+ */
+
+#include <libgen.h>
+#include <llvm-c/Analysis.h>
+#include <llvm-c/DebugInfo.h>
+
+#include "codegen.h"
+#include "dce.h"
+#include "../runtime/runtime.h"
+
+/* a string literal, at offset in the module's pool of them */
+typedef struct {
+    const char *s;
+    size_t length;
+    size_t offset;
+} literal_t;
+
+typedef struct {
+    const char *target;
+    eir_module_t *m;
+
+    LLVMContextRef ctx;
+    LLVMModuleRef mod;
+    LLVMBuilderRef b;
+
+    /* the function being generated */
+    eir_fn_t *fn;
+    LLVMValueRef llvm_fn;
+
+    /* indexed by block id, NULL for unreachable blocks */
+    LLVMBasicBlockRef *blocks;
+    LLVMBasicBlockRef *ends;
+
+    LLVMTypeRef i1;
+    LLVMTypeRef i32;
+    LLVMTypeRef i64;
+    LLVMTypeRef f64;
+    LLVMTypeRef ptr;
+    LLVMTypeRef list;
+    LLVMTypeRef void_type;
+
+    /* functions are only visible inside the object they end up in */
+    bool hidden;
+    bool failed;
+
+    /* the profile counters are defined in this module, not declared */
+    bool has_counters;
+
+    /* set while converting the incoming values of phis, which can't branch */
+    bool in_phi;
+
+    /* NULL unless generating for the tiered JIT */
+    const codegen_tiers_t *tiers;
+
+    /*
+     * the string literals of the module, each one once. they're generated
+     * as a single constant when the module is finished, until then they
+     * point into a placeholder.
+     */
+    literal_t *literals;
+    size_t n_literals;
+    size_t *literal_slots;    /* hash table of indices into literals + 1 */
+    size_t n_literal_slots;
+    size_t pool_size;
+    LLVMValueRef pool;
+
+    /* debug info, NULL unless m->debug_info is set */
+    LLVMDIBuilderRef di;
+    LLVMMetadataRef di_file;
+    LLVMMetadataRef di_fn;
+} codegen_t;
+
+/* the block a fast path branches from and the one both paths end in */
+typedef struct {
+    LLVMBasicBlockRef fast;
+    LLVMBasicBlockRef done;
+} slow_path_t;
+
+static void init_codegen(codegen_t *cg, eir_module_t *m, const char *name,
+                         LLVMContextRef ctx);
+static LLVMModuleRef finish_codegen(codegen_t *cg);
+static LLVMValueRef get_fn(codegen_t *cg, eir_fn_t *fn);
+static void generate_fn(codegen_t *cg, eir_fn_t *fn, const char *symbol);
+static void generate_block(codegen_t *cg, eir_block_t *block, bool counted);
+static void init_debug_info(codegen_t *cg);
+static void debug_fn(codegen_t *cg, eir_fn_t *fn);
+static void debug_location(codegen_t *cg, size_t line_n);
+static bool *loop_headers(eir_block_t **order, size_t n, size_t n_blocks);
+static void generate_count(codegen_t *cg);
+static void generate_profile_count(codegen_t *cg, eir_instr_t *i);
+static LLVMValueRef profile_counters(codegen_t *cg);
+static void start_profile(codegen_t *cg);
+static void set_profile(codegen_t *cg, LLVMValueRef v, const char *kind,
+                        const uint64_t *counts, size_t n);
+static LLVMValueRef call_fn(codegen_t *cg, eir_fn_t *fn, LLVMValueRef *args,
+                            unsigned n);
+static LLVMValueRef address(codegen_t *cg, void *p, LLVMTypeRef type);
+static void generate_entry(codegen_t *cg);
+static size_t reverse_postorder(eir_fn_t *fn, size_t n_blocks,
+                                eir_block_t **order);
+static LLVMValueRef generate_instr(codegen_t *cg, eir_instr_t *i);
+static LLVMValueRef generate_list(codegen_t *cg, eir_instr_t *i);
+static LLVMValueRef generate_string(codegen_t *cg, const char *s);
+static size_t literal_offset(codegen_t *cg, const char *s, size_t length);
+static size_t *literal_slot(codegen_t *cg, const char *s);
+static void generate_pool(codegen_t *cg);
+static LLVMValueRef generate_binop(codegen_t *cg, eir_instr_t *i);
+static LLVMValueRef generate_compare(codegen_t *cg, eir_instr_t *i);
+static LLVMValueRef generate_division(codegen_t *cg, token_type_t symbol,
+                                      LLVMValueRef a, LLVMValueRef b);
+static LLVMValueRef generate_unop(codegen_t *cg, eir_instr_t *i);
+static LLVMValueRef generate_int(codegen_t *cg, int64_t v);
+static LLVMValueRef generate_bignum(codegen_t *cg, const char *digits);
+static bool start_slow_path(codegen_t *cg, slow_path_t *p, LLVMValueRef ok);
+static LLVMValueRef finish_slow_path(codegen_t *cg, slow_path_t *p,
+                                     LLVMValueRef fast, LLVMValueRef slow);
+static LLVMValueRef int_op(codegen_t *cg, LLVMValueRef fast, LLVMValueRef ok,
+                           const char *fn, LLVMTypeRef ret, LLVMValueRef *args,
+                           unsigned n);
+static LLVMValueRef with_overflow(codegen_t *cg, const char *name,
+                                  LLVMValueRef x, LLVMValueRef y,
+                                  LLVMValueRef *overflow);
+static LLVMValueRef is_small(codegen_t *cg, LLVMValueRef x, LLVMValueRef y);
+static LLVMValueRef untag(codegen_t *cg, LLVMValueRef v);
+static LLVMValueRef generate_call(codegen_t *cg, eir_instr_t *i);
+static LLVMValueRef generate_builtin(codegen_t *cg, eir_instr_t *i);
+static LLVMValueRef generate_spawn(codegen_t *cg, eir_instr_t *i);
+static LLVMValueRef generate_join(codegen_t *cg, eir_instr_t *i);
+static LLVMValueRef generate_closure(codegen_t *cg, eir_instr_t *i);
+static LLVMValueRef static_closure(codegen_t *cg, eir_fn_t *entry,
+                                   LLVMValueRef code);
+static LLVMValueRef closure_words(codegen_t *cg, LLVMValueRef f);
+static LLVMValueRef generate_env(codegen_t *cg, eir_instr_t *i);
+static LLVMValueRef generate_apply(codegen_t *cg, eir_instr_t *i);
+static void check_apply(codegen_t *cg, LLVMValueRef ok, LLVMValueRef f,
+                        size_t n);
+static void add_incoming(codegen_t *cg, eir_instr_t *phi);
+static LLVMValueRef task_thunk(codegen_t *cg, eir_fn_t *callee);
+static LLVMTypeRef task_frame_type(codegen_t *cg, eir_fn_t *callee);
+static LLVMValueRef entry_alloca(codegen_t *cg, LLVMTypeRef type);
+static LLVMValueRef call(codegen_t *cg, LLVMValueRef fn, LLVMValueRef *args,
+                         unsigned n);
+static LLVMValueRef call_runtime(codegen_t *cg, const char *name,
+                                 LLVMTypeRef ret, LLVMValueRef *args,
+                                 unsigned n);
+static void add_attribute(codegen_t *cg, LLVMValueRef fn, const char *name);
+static LLVMValueRef unsupported(codegen_t *cg, eir_instr_t *i);
+static LLVMValueRef value(codegen_t *cg, eir_instr_t *i, eir_type_t type);
+static LLVMValueRef to_word(codegen_t *cg, eir_instr_t *i);
+static LLVMValueRef coerce(codegen_t *cg, LLVMValueRef v, eir_type_t from,
+                           eir_type_t to);
+static LLVMTypeRef llvm_type(codegen_t *cg, eir_type_t type);
+
+/*
+ * generate an LLVM module from m in ctx. if m has a main function, C's main
+ * calls it and exits with its result. returns NULL if something couldn't be
+ * generated, after reporting why.
+ */
+LLVMModuleRef codegen_module(eir_module_t *m, LLVMContextRef ctx)
+{
+    size_t n = 0;
+
+    for (eir_fn_t *fn = m->first; fn; fn = fn->next)
+        ++n;
+
+    eir_fn_t **fns = smalloc(sizeof(eir_fn_t *) * (n + 1));
+
+    n = 0;
+
+    for (eir_fn_t *fn = m->first; fn; fn = fn->next)
+        fns[n++] = fn;
+
+    LLVMModuleRef mod = codegen_partition(m, fns, NULL, n, ctx);
+
+    free(fns);
+
+    return mod;
+}
+
+/*
+ * generate a module with the n functions in fns. the ones that aren't
+ * exported are internal to it, calls to functions of m that aren't in fns
+ * are left for the linker. C's main is generated with erupt's.
+ */
+LLVMModuleRef codegen_partition(eir_module_t *m, eir_fn_t **fns,
+                                bool *exported, size_t n, LLVMContextRef ctx)
+{
+    codegen_t cg;
+    bool has_main = false;
+
+    init_codegen(&cg, m, m->name, ctx);
+
+    verbose_printf("generating LLVM IR for %zu function(s)", n);
+
+    cg.hidden = true;
+
+    for (size_t i = 0; i < n; ++i)
+        has_main |= strcmp(fns[i]->name, ENTRY_POINT) == 0;
+
+    cg.has_counters = has_main;
+
+    for (size_t i = 0; i < n; ++i) {
+        generate_fn(&cg, fns[i], NULL);
+
+        if (exported && exported[i]) {
+            LLVMSetLinkage(cg.llvm_fn, LLVMExternalLinkage);
+        } else {
+            LLVMSetLinkage(cg.llvm_fn, LLVMInternalLinkage);
+            LLVMSetVisibility(cg.llvm_fn, LLVMDefaultVisibility);
+        }
+    }
+
+    if (has_main)
+        generate_entry(&cg);
+
+    return finish_codegen(&cg);
+}
+
+/*
+ * generate a module with only fn in it, defined as symbol. calls to other
+ * functions of m are left for the linker, calls of fn to itself are not.
+ */
+LLVMModuleRef codegen_fn(eir_module_t *m, eir_fn_t *fn, const char *symbol,
+                         LLVMContextRef ctx)
+{
+    codegen_t cg;
+
+    init_codegen(&cg, m, symbol, ctx);
+    generate_fn(&cg, fn, symbol);
+
+    return finish_codegen(&cg);
+}
+
+/*
+ * like codegen_fn, but calls are made through the table of tiers and the
+ * code is counted if tiers has counters.
+ */
+LLVMModuleRef codegen_tiered_fn(eir_module_t *m, eir_fn_t *fn,
+                                const char *symbol,
+                                const codegen_tiers_t *tiers,
+                                LLVMContextRef ctx)
+{
+    codegen_t cg;
+
+    init_codegen(&cg, m, symbol, ctx);
+    cg.tiers = tiers;
+    generate_fn(&cg, fn, symbol);
+
+    return finish_codegen(&cg);
+}
+
+/* the symbol the function called name is generated as, to be freed */
+char *codegen_symbol(const char *name)
+{
+    char *symbol = smalloc(sizeof(SYMBOL_PREFIX) + strlen(name));
+
+    sprintf(symbol, SYMBOL_PREFIX "%s", name);
+
+    return symbol;
+}
+
+static void init_codegen(codegen_t *cg, eir_module_t *m, const char *name,
+                         LLVMContextRef ctx)
+{
+    memset(cg, 0, sizeof(codegen_t));
+
+    cg->target = m->name;
+    cg->m = m;
+    cg->ctx = ctx;
+    cg->mod = LLVMModuleCreateWithNameInContext(name, ctx);
+    cg->b = LLVMCreateBuilderInContext(ctx);
+
+    cg->i1 = LLVMInt1TypeInContext(ctx);
+    cg->i32 = LLVMInt32TypeInContext(ctx);
+    cg->i64 = LLVMInt64TypeInContext(ctx);
+    cg->f64 = LLVMDoubleTypeInContext(ctx);
+    cg->ptr = LLVMPointerType(LLVMInt8TypeInContext(ctx), 0);
+    cg->list = LLVMPointerType(cg->i64, 0);
+    cg->void_type = LLVMVoidTypeInContext(ctx);
+
+    if (m->debug_info)
+        init_debug_info(cg);
+}
+
+/* verify the generated module, gives NULL if generating it failed */
+static LLVMModuleRef finish_codegen(codegen_t *cg)
+{
+    LLVMDisposeBuilder(cg->b);
+
+    if (cg->pool)
+        generate_pool(cg);
+
+    free(cg->literals);
+    free(cg->literal_slots);
+
+    if (cg->di) {
+        LLVMDIBuilderFinalize(cg->di);
+        LLVMDisposeDIBuilder(cg->di);
+    }
+
+    if (!cg->failed) {
+        char *msg = NULL;
+
+        if (LLVMVerifyModule(cg->mod, LLVMReturnStatusAction, &msg)) {
+            erupt_error("generated invalid LLVM IR: %s", msg);
+            cg->failed = true;
+        }
+
+        LLVMDisposeMessage(msg);
+    }
+
+    if (cg->failed) {
+        LLVMDisposeModule(cg->mod);
+        return NULL;
+    }
+
+    verbose_printf("generated LLVM IR");
+
+    return cg->mod;
+}
+
+/* the LLVM function fn is called through, declared on first use */
+static LLVMValueRef get_fn(codegen_t *cg, eir_fn_t *fn)
+{
+    if (fn == cg->fn)
+        return cg->llvm_fn;
+
+    char *symbol = codegen_symbol(fn->name);
+    LLVMValueRef llvm_fn = LLVMGetNamedFunction(cg->mod, symbol);
+
+    if (llvm_fn) {
+        free(symbol);
+        return llvm_fn;
+    }
+
+    LLVMTypeRef *params = smalloc(sizeof(LLVMTypeRef) * (fn->n_params + 1));
+
+    for (size_t i = 0; i < fn->n_params; ++i)
+        params[i] = cg->i64;
+
+    LLVMTypeRef type = LLVMFunctionType(llvm_type(cg, fn->ret), params,
+                                        fn->n_params, false);
+
+    llvm_fn = LLVMAddFunction(cg->mod, symbol, type);
+    add_attribute(cg, llvm_fn, "nounwind");
+
+    if (cg->hidden)
+        LLVMSetVisibility(llvm_fn, LLVMHiddenVisibility);
+
+    free(params);
+    free(symbol);
+
+    return llvm_fn;
+}
+
+static void generate_fn(codegen_t *cg, eir_fn_t *fn, const char *symbol)
+{
+    size_t n_blocks = 0;
+
+    eir_number(fn);
+
+    for (eir_block_t *b = fn->first; b; b = b->next)
+        ++n_blocks;
+
+    eir_block_t **order = smalloc(sizeof(eir_block_t *) * n_blocks);
+    size_t n = reverse_postorder(fn, n_blocks, order);
+
+    cg->fn = NULL;
+    cg->llvm_fn = get_fn(cg, fn);
+    cg->fn = fn;
+
+    if (symbol)
+        LLVMSetValueName2(cg->llvm_fn, symbol, strlen(symbol));
+
+    if (cg->di)
+        debug_fn(cg, fn);
+
+    /* functions that never ran are kept out of the way of the hot ones */
+    if (fn->count != UNKNOWN_COUNT) {
+        set_profile(cg, cg->llvm_fn, "function_entry_count", &fn->count, 1);
+
+        if (fn->count == 0)
+            add_attribute(cg, cg->llvm_fn, "cold");
+    }
+
+    cg->blocks = scalloc(n_blocks, sizeof(LLVMBasicBlockRef));
+    cg->ends = scalloc(n_blocks, sizeof(LLVMBasicBlockRef));
+
+    /* in reverse postorder every value is generated before it's used */
+    for (size_t i = 0; i < n; ++i) {
+        cg->blocks[order[i]->id] = LLVMAppendBasicBlockInContext(cg->ctx,
+                                                                 cg->llvm_fn,
+                                                                 "");
+    }
+
+    bool *counted = cg->tiers && cg->tiers->counters ?
+                    loop_headers(order, n, n_blocks) : NULL;
+
+    for (size_t i = 0; i < n; ++i)
+        generate_block(cg, order[i], counted && counted[i]);
+
+    /* phis can only be completed once all their incoming values exist */
+    for (size_t i = 0; i < n; ++i) {
+        for (eir_instr_t *instr = order[i]->first; instr; instr = instr->next) {
+            if (instr->op == EIR_PHI)
+                add_incoming(cg, instr);
+        }
+    }
+
+    /* what's generated next isn't part of fn */
+    if (cg->di)
+        LLVMSetCurrentDebugLocation2(cg->b, NULL);
+
+    free(cg->blocks);
+    free(cg->ends);
+    free(counted);
+    free(order);
+}
+
+static void generate_block(codegen_t *cg, eir_block_t *block, bool counted)
+{
+    LLVMPositionBuilderAtEnd(cg->b, cg->blocks[block->id]);
+
+    for (eir_instr_t *instr = block->first; instr; instr = instr->next) {
+        /* phis have to stay at the start of the block */
+        if (counted && instr->op != EIR_PHI) {
+            generate_count(cg);
+            counted = false;
+        }
+
+        if (cg->di)
+            debug_location(cg, instr->line_n);
+
+        instr->data = generate_instr(cg, instr);
+    }
+
+    /* checks inserted by the instructions may have split the block */
+    cg->ends[block->id] = LLVMGetInsertBlock(cg->b);
+}
+
+/*
+ * a DWARF compile unit for the source file. erupt has no DWARF language of
+ * its own, so it's described as C, which is what debuggers understand best.
+ */
+static void init_debug_info(codegen_t *cg)
+{
+    char *path = strdup(cg->m->name);
+    char *dir = strdup(cg->m->name);
+    char *file = basename(path);
+    char *file_dir = dirname(dir);
+    const char *producer = "erupt " ERUPT_VERSION;
+
+    cg->di = LLVMCreateDIBuilder(cg->mod);
+    cg->di_file = LLVMDIBuilderCreateFile(cg->di, file, strlen(file),
+                                          file_dir, strlen(file_dir));
+
+    LLVMDIBuilderCreateCompileUnit(cg->di, LLVMDWARFSourceLanguageC,
+                                   cg->di_file, producer, strlen(producer),
+                                   false, "", 0, 0, "", 0,
+                                   LLVMDWARFEmissionFull, 0, false, false,
+                                   "", 0, "", 0);
+
+    LLVMAddModuleFlag(cg->mod, LLVMModuleFlagBehaviorWarning,
+                      "Debug Info Version", strlen("Debug Info Version"),
+                      LLVMValueAsMetadata(LLVMConstInt(
+                          cg->i32, LLVMDebugMetadataVersion(), false)));
+    LLVMAddModuleFlag(cg->mod, LLVMModuleFlagBehaviorWarning, "Dwarf Version",
+                      strlen("Dwarf Version"),
+                      LLVMValueAsMetadata(LLVMConstInt(cg->i32, 4, false)));
+
+    free(path);
+    free(dir);
+}
+
+/*
+ * a subprogram for fn, named like in the source. functions with debug info
+ * keep their frame pointer, so profilers can walk the stack without DWARF.
+ */
+static void debug_fn(codegen_t *cg, eir_fn_t *fn)
+{
+    size_t length = 0;
+    const char *symbol = LLVMGetValueName2(cg->llvm_fn, &length);
+    LLVMMetadataRef type = LLVMDIBuilderCreateSubroutineType(cg->di,
+                                                             cg->di_file,
+                                                             NULL, 0,
+                                                             LLVMDIFlagZero);
+
+    cg->di_fn = LLVMDIBuilderCreateFunction(cg->di, cg->di_file, fn->name,
+                                            strlen(fn->name), symbol, length,
+                                            cg->di_file, (unsigned)fn->line_n,
+                                            type, false, true,
+                                            (unsigned)fn->line_n,
+                                            LLVMDIFlagZero, false);
+
+    LLVMSetSubprogram(cg->llvm_fn, cg->di_fn);
+    LLVMAddAttributeAtIndex(cg->llvm_fn, LLVMAttributeFunctionIndex,
+                            LLVMCreateStringAttribute(cg->ctx, "frame-pointer",
+                                                      strlen("frame-pointer"),
+                                                      "all", strlen("all")));
+}
+
+/* what's generated next is for line_n of the function being generated */
+static void debug_location(codegen_t *cg, size_t line_n)
+{
+    LLVMSetCurrentDebugLocation2(cg->b, LLVMDIBuilderCreateDebugLocation(
+        cg->ctx, (unsigned)line_n, 0, cg->di_fn, NULL));
+}
+
+/*
+ * which blocks of order are counted: the entry, which counts calls, and
+ * those entered from a block after them, which count loop iterations.
+ */
+static bool *loop_headers(eir_block_t **order, size_t n, size_t n_blocks)
+{
+    size_t *position = smalloc(sizeof(size_t) * n_blocks);
+    bool *counted = scalloc(n + 1, sizeof(bool));
+
+    for (size_t i = 0; i < n; ++i)
+        position[order[i]->id] = i;
+
+    counted[0] = true;
+
+    for (size_t i = 1; i < n; ++i) {
+        eir_block_t **preds;
+        size_t n_preds = eir_preds(order[i], &preds);
+
+        for (size_t k = 0; k < n_preds; ++k) {
+            if (position[preds[k]->id] >= i)
+                counted[i] = true;
+        }
+
+        free(preds);
+    }
+
+    free(position);
+
+    return counted;
+}
+
+/* if (++counters[index] == threshold) tier_up(arg, index); */
+static void generate_count(codegen_t *cg)
+{
+    const codegen_tiers_t *tiers = cg->tiers;
+    LLVMTypeRef i32_ptr = LLVMPointerType(cg->i32, 0);
+    LLVMValueRef counter = address(cg, &tiers->counters[cg->fn->index],
+                                   i32_ptr);
+    LLVMValueRef one = LLVMConstInt(cg->i32, 1, false);
+
+    /* atomic, so tasks running in parallel can't skip the threshold */
+    LLVMValueRef count = LLVMBuildAdd(
+        cg->b, LLVMBuildAtomicRMW(cg->b, LLVMAtomicRMWBinOpAdd, counter, one,
+                                  LLVMAtomicOrderingMonotonic, false),
+        one, ""
+    );
+    LLVMBasicBlockRef hot = LLVMAppendBasicBlockInContext(cg->ctx,
+                                                          cg->llvm_fn, "");
+    LLVMBasicBlockRef done = LLVMAppendBasicBlockInContext(cg->ctx,
+                                                           cg->llvm_fn, "");
+    LLVMTypeRef params[] = { cg->ptr, cg->i64 };
+    LLVMTypeRef type = LLVMFunctionType(cg->void_type, params, 2, false);
+    LLVMValueRef args[] = {
+        address(cg, tiers->arg, cg->ptr),
+        LLVMConstInt(cg->i64, cg->fn->index, false)
+    };
+
+    LLVMBuildCondBr(cg->b,
+                    LLVMBuildICmp(cg->b, LLVMIntEQ, count,
+                                  LLVMConstInt(cg->i32, tiers->threshold,
+                                               false), ""),
+                    hot, done);
+
+    LLVMPositionBuilderAtEnd(cg->b, hot);
+    LLVMBuildCall2(cg->b, type, address(cg, (void *)(uintptr_t)tiers->tier_up,
+                                        LLVMPointerType(type, 0)),
+                   args, 2, "");
+    LLVMBuildBr(cg->b, done);
+
+    LLVMPositionBuilderAtEnd(cg->b, done);
+}
+
+/*
+ * call fn. in the tiered JIT that goes through the table, except for the
+ * recursive calls of optimized code, which can't be replaced by anything
+ * better.
+ */
+static LLVMValueRef call_fn(codegen_t *cg, eir_fn_t *fn, LLVMValueRef *args,
+                            unsigned n)
+{
+    if (!cg->tiers || (fn == cg->fn && !cg->tiers->counters))
+        return call(cg, get_fn(cg, fn), args, n);
+
+    LLVMTypeRef *params = smalloc(sizeof(LLVMTypeRef) * (fn->n_params + 1));
+
+    for (size_t i = 0; i < fn->n_params; ++i)
+        params[i] = cg->i64;
+
+    LLVMTypeRef type = LLVMFunctionType(llvm_type(cg, fn->ret), params,
+                                        fn->n_params, false);
+    LLVMValueRef entry = address(cg, &cg->tiers->table[fn->index],
+                                 LLVMPointerType(cg->ptr, 0));
+    LLVMValueRef target = LLVMBuildLoad2(cg->b, cg->ptr, entry, "");
+
+    /* the table is written by the thread that compiles the hot code */
+    LLVMSetOrdering(target, LLVMAtomicOrderingMonotonic);
+    LLVMSetAlignment(target, sizeof(void *));
+
+    LLVMValueRef v = LLVMBuildCall2(
+        cg->b, type,
+        LLVMBuildBitCast(cg->b, target, LLVMPointerType(type, 0), ""),
+        args, n, ""
+    );
+
+    free(params);
+
+    return v;
+}
+
+/* counters are atomic, tasks running in parallel can't lose counts */
+static void generate_profile_count(codegen_t *cg, eir_instr_t *i)
+{
+    LLVMValueRef index = LLVMConstInt(cg->i64, (uint64_t)i->imm.i, false);
+    LLVMValueRef counter = LLVMConstGEP2(cg->i64, profile_counters(cg),
+                                         &index, 1);
+
+    LLVMBuildAtomicRMW(cg->b, LLVMAtomicRMWBinOpAdd, counter,
+                       LLVMConstInt(cg->i64, 1, false),
+                       LLVMAtomicOrderingMonotonic, false);
+}
+
+/* the first profile counter, the others follow it */
+static LLVMValueRef profile_counters(codegen_t *cg)
+{
+    LLVMValueRef counters = LLVMGetNamedGlobal(cg->mod, PROFILE_COUNTERS);
+
+    if (!counters) {
+        size_t n = cg->has_counters ? cg->m->n_counters : 0;
+        LLVMTypeRef type = LLVMArrayType(cg->i64, (unsigned)n);
+
+        counters = LLVMAddGlobal(cg->mod, type, PROFILE_COUNTERS);
+
+        if (cg->has_counters)
+            LLVMSetInitializer(counters, LLVMConstNull(type));
+    }
+
+    return LLVMConstBitCast(counters, cg->list);
+}
+
+/* erupt_profile_start(names, counters, n), so the profile is written */
+static void start_profile(codegen_t *cg)
+{
+    size_t n = cg->m->n_counters;
+    LLVMValueRef *names = smalloc(sizeof(LLVMValueRef) * n);
+
+    for (size_t i = 0; i < n; ++i) {
+        const char *name = cg->m->counters[i];
+        LLVMValueRef s = LLVMConstStringInContext(cg->ctx, name,
+                                                  (unsigned)strlen(name),
+                                                  false);
+        LLVMValueRef global = LLVMAddGlobal(cg->mod, LLVMTypeOf(s), "");
+
+        LLVMSetInitializer(global, s);
+        LLVMSetGlobalConstant(global, true);
+        LLVMSetLinkage(global, LLVMPrivateLinkage);
+        names[i] = LLVMConstBitCast(global, cg->ptr);
+    }
+
+    LLVMValueRef table = LLVMAddGlobal(cg->mod, LLVMArrayType(cg->ptr,
+                                                              (unsigned)n),
+                                       "");
+
+    LLVMSetInitializer(table, LLVMConstArray(cg->ptr, names, (unsigned)n));
+    LLVMSetGlobalConstant(table, true);
+    LLVMSetLinkage(table, LLVMPrivateLinkage);
+
+    LLVMValueRef args[] = {
+        LLVMConstBitCast(table, LLVMPointerType(cg->ptr, 0)),
+        profile_counters(cg),
+        LLVMConstInt(cg->i64, n, false)
+    };
+
+    call_runtime(cg, "erupt_profile_start", cg->void_type, args, 3);
+    free(names);
+}
+
+/*
+ * attach counts from a profile to v as !prof metadata of kind. branch
+ * weights are 32 bits, so they're scaled down to fit. like clang, every
+ * weight is at least 1, so no branch looks impossible.
+ */
+static void set_profile(codegen_t *cg, LLVMValueRef v, const char *kind,
+                        const uint64_t *counts, size_t n)
+{
+    LLVMMetadataRef *md = smalloc(sizeof(LLVMMetadataRef) * (n + 1));
+    bool branch = strcmp(kind, "branch_weights") == 0;
+    uint64_t max = 0, scale = 1;
+
+    for (size_t i = 0; i < n; ++i)
+        max = counts[i] > max ? counts[i] : max;
+
+    if (branch && max >= UINT32_MAX)
+        scale = max / UINT32_MAX + 1;
+
+    md[0] = LLVMMDStringInContext2(cg->ctx, kind, strlen(kind));
+
+    for (size_t i = 0; i < n; ++i) {
+        LLVMValueRef count = branch ?
+            LLVMConstInt(cg->i32, counts[i] / scale + 1, false) :
+            LLVMConstInt(cg->i64, counts[i], false);
+
+        md[i + 1] = LLVMValueAsMetadata(count);
+    }
+
+    LLVMMetadataRef node = LLVMMDNodeInContext2(cg->ctx, md, n + 1);
+    unsigned prof = LLVMGetMDKindIDInContext(cg->ctx, "prof", 4);
+
+    if (LLVMIsAFunction(v))
+        LLVMGlobalSetMetadata(v, prof, node);
+    else
+        LLVMSetMetadata(v, prof, LLVMMetadataAsValue(cg->ctx, node));
+
+    free(md);
+}
+
+/* a pointer into the JIT's own memory, as a constant */
+static LLVMValueRef address(codegen_t *cg, void *p, LLVMTypeRef type)
+{
+    return LLVMConstIntToPtr(LLVMConstInt(cg->i64, (uintptr_t)p, false),
+                             type);
+}
+
+/* int main(int argc, char **argv) { return erupt_main(); } */
+static void generate_entry(codegen_t *cg)
+{
+    eir_fn_t *fn = eir_lookup_fn(cg->m, ENTRY_POINT);
+    LLVMTypeRef params[] = { cg->i32, LLVMPointerType(cg->ptr, 0) };
+    LLVMValueRef entry = LLVMAddFunction(cg->mod, "main",
+                                         LLVMFunctionType(cg->i32, params, 2,
+                                                          false));
+
+    LLVMPositionBuilderAtEnd(cg->b, LLVMAppendBasicBlockInContext(cg->ctx,
+                                                                  entry, ""));
+
+    cg->fn = NULL;
+
+    if (cg->m->n_counters)
+        start_profile(cg);
+
+    LLVMValueRef result = call_fn(cg, fn, NULL, 0);
+
+    /* main's result is the exit status if it's an int */
+    if (fn->ret == EIR_INT && fn->n_params == 0) {
+        result = call_runtime(cg, "erupt_int_wrap", cg->i64, &result, 1);
+        LLVMBuildRet(cg->b, LLVMBuildTrunc(cg->b, result, cg->i32, ""));
+    } else {
+        LLVMBuildRet(cg->b, LLVMConstInt(cg->i32, 0, false));
+    }
+}
+
+static size_t reverse_postorder(eir_fn_t *fn, size_t n_blocks,
+                                eir_block_t **order)
+{
+    bool *visited = scalloc(n_blocks, sizeof(bool));
+    eir_block_t **stack = smalloc(sizeof(eir_block_t *) * n_blocks);
+    size_t *next = smalloc(sizeof(size_t) * n_blocks);
+    size_t depth = 0, n = n_blocks;
+
+    visited[fn->first->id] = true;
+    stack[depth] = fn->first;
+    next[depth++] = 0;
+
+    while (depth) {
+        eir_block_t *b = stack[depth - 1];
+        eir_instr_t *term = eir_terminator(b);
+
+        if (term && next[depth - 1] < term->n_blocks) {
+            eir_block_t *succ = term->blocks[next[depth - 1]++];
+
+            if (!visited[succ->id]) {
+                visited[succ->id] = true;
+                stack[depth] = succ;
+                next[depth++] = 0;
+            }
+        } else {
+            /* postorder, filled in from the back */
+            order[--n] = b;
+            --depth;
+        }
+    }
+
+    memmove(order, order + n, sizeof(eir_block_t *) * (n_blocks - n));
+
+    free(visited);
+    free(stack);
+    free(next);
+
+    return n_blocks - n;
+}
+
+static LLVMValueRef generate_instr(codegen_t *cg, eir_instr_t *i)
+{
+    LLVMBuilderRef b = cg->b;
+
+    switch (i->op) {
+    case EIR_CONST_INT:
+        if (i->type == EIR_INT)
+            return generate_int(cg, i->imm.i);
+
+        return LLVMConstInt(llvm_type(cg, i->type), (uint64_t)i->imm.i, true);
+    case EIR_CONST_FLOAT:
+        return LLVMConstReal(cg->f64, i->imm.f);
+    case EIR_CONST_STRING:
+        return generate_string(cg, i->imm.s);
+    case EIR_CONST_BIGNUM:
+        return generate_bignum(cg, i->imm.s);
+    case EIR_PARAM:
+        return coerce(cg, LLVMGetParam(cg->llvm_fn, (unsigned)i->imm.i),
+                      EIR_INT, i->type);
+    case EIR_MAKE_LIST:
+        return generate_list(cg, i);
+    case EIR_BINOP:
+        return generate_binop(cg, i);
+    case EIR_UNOP:
+        return generate_unop(cg, i);
+    case EIR_CALL:
+        return generate_call(cg, i);
+    case EIR_SPAWN:
+        return generate_spawn(cg, i);
+    case EIR_JOIN:
+        return generate_join(cg, i);
+    case EIR_CLOSURE:
+        return generate_closure(cg, i);
+    case EIR_ENV:
+        return generate_env(cg, i);
+    case EIR_APPLY:
+        return generate_apply(cg, i);
+    case EIR_PHI:
+        return LLVMBuildPhi(b, llvm_type(cg, i->type), "");
+    case EIR_COUNT:
+        generate_profile_count(cg, i);
+        return NULL;
+    case EIR_BR:
+        return LLVMBuildBr(b, cg->blocks[i->blocks[0]->id]);
+    case EIR_CONDBR: {
+        LLVMValueRef br = LLVMBuildCondBr(b, value(cg, i->operands[0],
+                                                   EIR_BOOL),
+                                          cg->blocks[i->blocks[0]->id],
+                                          cg->blocks[i->blocks[1]->id]);
+
+        if (i->weights)
+            set_profile(cg, br, "branch_weights", i->weights, 2);
+
+        return br;
+    }
+    case EIR_SWITCH: {
+        LLVMValueRef sw = LLVMBuildSwitch(b, value(cg, i->operands[0],
+                                                   EIR_INT),
+                                          cg->blocks[i->blocks[0]->id],
+                                          (unsigned)i->n_cases);
+
+        /* the cases are small ints, a bignum goes to the default */
+        for (size_t k = 0; k < i->n_cases; ++k) {
+            LLVMAddCase(sw, LLVMConstInt(cg->i64,
+                                         (uint64_t)ERUPT_TAG(i->cases[k]),
+                                         true),
+                        cg->blocks[i->blocks[k + 1]->id]);
+        }
+
+        if (i->weights)
+            set_profile(cg, sw, "branch_weights", i->weights, i->n_blocks);
+
+        return sw;
+    }
+    case EIR_RET:
+        return LLVMBuildRet(b, value(cg, i->operands[0], cg->fn->ret));
+    case EIR_NOMATCH: {
+        LLVMValueRef name = LLVMBuildGlobalStringPtr(b, cg->fn->name, "");
+
+        call_runtime(cg, "erupt_nomatch", cg->void_type, &name, 1);
+        add_attribute(cg, LLVMGetNamedFunction(cg->mod, "erupt_nomatch"),
+                      "noreturn");
+
+        return LLVMBuildUnreachable(b);
+    }
+    case EIR_OPCODE_COUNT:
+        break;
+    }
+
+    return unsupported(cg, i);
+}
+
+/*
+ * a list's values are made into words before the list is allocated, boxing
+ * a float can collect. small lists that don't escape are all tail, and are
+ * laid out on the stack like erupt_list_t.
+ */
+static LLVMValueRef generate_list(codegen_t *cg, eir_instr_t *i)
+{
+    size_t n = i->n_operands;
+    bool on_stack = i->on_stack && n <= ERUPT_LIST_BRANCH;
+    size_t first = on_stack ? 5 : 0;
+    LLVMValueRef *words = smalloc(sizeof(LLVMValueRef) * (n + 1));
+    LLVMValueRef mem, list;
+
+    for (size_t k = 0; k < n; ++k)
+        words[k] = to_word(cg, i->operands[k]);
+
+    mem = entry_alloca(cg, LLVMArrayType(cg->i64, (unsigned)(first + n)));
+    mem = LLVMBuildBitCast(cg->b, mem, cg->list, "");
+
+    if (on_stack) {
+        uint64_t fields[] = {
+            ERUPT_HEADER(ERUPT_LIST, sizeof(erupt_list_t) +
+                                     sizeof(int64_t) * n),
+            (uint64_t)ERUPT_TAG(n), 0, 0, 0
+        };
+
+        for (size_t k = 0; k < first; ++k) {
+            LLVMValueRef index = LLVMConstInt(cg->i64, k, false);
+
+            LLVMBuildStore(cg->b, LLVMConstInt(cg->i64, fields[k], false),
+                           LLVMBuildGEP2(cg->b, cg->i64, mem, &index, 1, ""));
+        }
+    }
+
+    for (size_t k = 0; k < n; ++k) {
+        LLVMValueRef index = LLVMConstInt(cg->i64, first + k, false);
+        LLVMValueRef slot = LLVMBuildGEP2(cg->b, cg->i64, mem, &index, 1, "");
+
+        LLVMBuildStore(cg->b, words[k], slot);
+    }
+
+    free(words);
+
+    if (on_stack) {
+        LLVMValueRef one = LLVMConstInt(cg->i64, 1, false);
+
+        list = LLVMBuildGEP2(cg->b, cg->i64, mem, &one, 1, "");
+    } else {
+        LLVMValueRef args[] = { mem, LLVMConstInt(cg->i64, n, false) };
+
+        list = call_runtime(cg, "erupt_list_from", cg->list, args, 2);
+    }
+
+    return list;
+}
+
+/*
+ * a string constant. short strings are stored in the pointer, others in the
+ * pool, with a header like a flat string on the heap.
+ */
+static LLVMValueRef generate_string(codegen_t *cg, const char *s)
+{
+    size_t length = strlen(s);
+
+    if (length <= ERUPT_SHORT_STRING) {
+        erupt_string_t *str = erupt_string_from(s, (int64_t)length);
+
+        return LLVMConstIntToPtr(LLVMConstInt(cg->i64, (uintptr_t)str,
+                                              false), cg->ptr);
+    }
+
+    if (!cg->pool) {
+        cg->pool = LLVMAddGlobal(cg->mod, LLVMInt8TypeInContext(cg->ctx),
+                                 "");
+    }
+
+    LLVMValueRef offset = LLVMConstInt(cg->i64, literal_offset(cg, s, length)
+                                                + sizeof(uint64_t), false);
+
+    return LLVMConstInBoundsGEP2(LLVMInt8TypeInContext(cg->ctx), cg->pool,
+                                 &offset, 1);
+}
+
+/* where the header of the literal s is in the pool, added if it isn't yet */
+static size_t literal_offset(codegen_t *cg, const char *s, size_t length)
+{
+    if (cg->n_literals * 2 >= cg->n_literal_slots) {
+        size_t *old = cg->literal_slots, n_old = cg->n_literal_slots;
+
+        cg->n_literal_slots = n_old ? n_old * 2 : 64;
+        cg->literal_slots = scalloc(cg->n_literal_slots, sizeof(size_t));
+
+        for (size_t i = 0; i < n_old; ++i) {
+            if (old[i])
+                *literal_slot(cg, cg->literals[old[i] - 1].s) = old[i];
+        }
+
+        free(old);
+    }
+
+    size_t *slot = literal_slot(cg, s);
+
+    if (!*slot) {
+        cg->literals = srealloc(cg->literals, sizeof(literal_t) *
+                                              (cg->n_literals + 1));
+        cg->literals[cg->n_literals].s = s;
+        cg->literals[cg->n_literals].length = length;
+        cg->literals[cg->n_literals].offset = cg->pool_size;
+        cg->pool_size += 2 * sizeof(uint64_t) +
+                         ((length + sizeof(uint64_t)) &
+                          ~(sizeof(uint64_t) - 1));
+        *slot = ++cg->n_literals;
+    }
+
+    return cg->literals[*slot - 1].offset;
+}
+
+/* the slot of s in the hash table of literals, or the empty one it goes in */
+static size_t *literal_slot(codegen_t *cg, const char *s)
+{
+    size_t mask = cg->n_literal_slots - 1;
+    uint32_t hash = 2166136261u;
+
+    for (const char *c = s; *c; ++c)
+        hash = (hash ^ (unsigned char)*c) * 16777619u;
+
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        size_t k = cg->literal_slots[i];
+
+        if (!k || strcmp(cg->literals[k - 1].s, s) == 0)
+            return &cg->literal_slots[i];
+    }
+}
+
+/* the pool of literals, in place of the placeholder they point into */
+static void generate_pool(codegen_t *cg)
+{
+    size_t n = cg->n_literals * 3;
+    LLVMValueRef *fields = smalloc(sizeof(LLVMValueRef) * n);
+
+    for (size_t i = 0; i < cg->n_literals; ++i) {
+        const literal_t *l = &cg->literals[i];
+        size_t padded = (l->length + sizeof(uint64_t)) &
+                        ~(sizeof(uint64_t) - 1);
+        char *bytes = scalloc(padded, 1);
+
+        memcpy(bytes, l->s, l->length);
+
+        fields[i * 3] = LLVMConstInt(cg->i64, ERUPT_HEADER(ERUPT_STRING,
+                                     sizeof(erupt_string_t) + padded), false);
+        fields[i * 3 + 1] = LLVMConstInt(cg->i64, l->length, false);
+        fields[i * 3 + 2] = LLVMConstStringInContext(cg->ctx, bytes,
+                                                     (unsigned)padded, true);
+        free(bytes);
+    }
+
+    LLVMValueRef init = LLVMConstStructInContext(cg->ctx, fields,
+                                                 (unsigned)n, false);
+    LLVMValueRef pool = LLVMAddGlobal(cg->mod, LLVMTypeOf(init), ".strings");
+
+    LLVMSetInitializer(pool, init);
+    LLVMSetGlobalConstant(pool, true);
+    LLVMSetLinkage(pool, LLVMPrivateLinkage);
+    LLVMSetUnnamedAddress(pool, LLVMGlobalUnnamedAddr);
+    LLVMSetAlignment(pool, sizeof(uint64_t));
+
+    LLVMReplaceAllUsesWith(cg->pool, LLVMConstBitCast(pool, cg->ptr));
+    LLVMDeleteGlobal(cg->pool);
+    free(fields);
+}
+
+static LLVMValueRef generate_binop(codegen_t *cg, eir_instr_t *i)
+{
+    LLVMBuilderRef b = cg->b;
+    eir_instr_t *lhs = i->operands[0], *rhs = i->operands[1];
+
+    if (i->type == EIR_BOOL)
+        return generate_compare(cg, i);
+
+    if (i->type == EIR_STRING || i->type == EIR_LIST) {
+        /* one of them can be a word typed as an int */
+        if (i->symbol != PLUS ||
+            (lhs->type != i->type && rhs->type != i->type) ||
+            (lhs->type != i->type && lhs->type != EIR_INT) ||
+            (rhs->type != i->type && rhs->type != EIR_INT))
+            return unsupported(cg, i);
+
+        LLVMValueRef args[] = { value(cg, lhs, i->type),
+                                value(cg, rhs, i->type) };
+
+        return call_runtime(cg, i->type == EIR_STRING ? "erupt_string_concat"
+                                                      : "erupt_list_concat",
+                            llvm_type(cg, i->type), args, 2);
+    }
+
+    if (i->type == EIR_FLOAT) {
+        LLVMValueRef x = value(cg, lhs, EIR_FLOAT), y = value(cg, rhs,
+                                                              EIR_FLOAT);
+
+        switch (i->symbol) {
+        case PLUS: return LLVMBuildFAdd(b, x, y, "");
+        case MIN: return LLVMBuildFSub(b, x, y, "");
+        case STAR: return LLVMBuildFMul(b, x, y, "");
+        case SLASH: return LLVMBuildFDiv(b, x, y, "");
+        case MOD: return LLVMBuildFRem(b, x, y, "");
+        case STAR_STAR: {
+            LLVMTypeRef types[] = { cg->f64 };
+            unsigned id = LLVMLookupIntrinsicID("llvm.pow", 8);
+            LLVMValueRef pow = LLVMGetIntrinsicDeclaration(cg->mod, id,
+                                                           types, 1);
+            LLVMValueRef args[] = { x, y };
+
+            return LLVMBuildCall2(b, LLVMIntrinsicGetType(cg->ctx, id, types,
+                                                          1),
+                                  pow, args, 2, "");
+        }
+        default:
+            return unsupported(cg, i);
+        }
+    }
+
+    LLVMValueRef x = value(cg, lhs, EIR_INT), y = value(cg, rhs, EIR_INT);
+    LLVMValueRef args[] = { x, y };
+    LLVMValueRef small = is_small(cg, x, y);
+    LLVMValueRef zero = LLVMConstInt(cg->i64, 0, false);
+    LLVMValueRef fast, overflow, shift, fits;
+    const char *fn;
+
+    /*
+     * small ints are worked out here, the runtime gets the bignums and
+     * whatever overflows. x is v << 1, so x + y and x * v are tagged too.
+     */
+    switch (i->symbol) {
+    case PLUS:
+    case MIN:
+        fast = with_overflow(cg, i->symbol == PLUS ? "llvm.sadd.with.overflow"
+                                                   : "llvm.ssub.with.overflow",
+                             x, y, &overflow);
+        fn = i->symbol == PLUS ? "erupt_int_add" : "erupt_int_sub";
+        break;
+    case STAR:
+        fast = with_overflow(cg, "llvm.smul.with.overflow", x, untag(cg, y),
+                             &overflow);
+        fn = "erupt_int_mul";
+        break;
+    case SLASH:
+    case MOD:
+        return generate_division(cg, i->symbol, x, y);
+    case STAR_STAR:
+        return call_runtime(cg, "erupt_int_pow", cg->i64, args, 2);
+    case B_AND:
+        return int_op(cg, LLVMBuildAnd(b, x, y, ""), small, "erupt_int_and",
+                      cg->i64, args, 2);
+    case B_OR:
+        return int_op(cg, LLVMBuildOr(b, x, y, ""), small, "erupt_int_or",
+                      cg->i64, args, 2);
+    case B_XOR:
+        return int_op(cg, LLVMBuildXor(b, x, y, ""), small, "erupt_int_xor",
+                      cg->i64, args, 2);
+    case L_SHIFT:
+        /* fast if no bits are shifted out, which shifting back shows */
+        shift = untag(cg, y);
+        fits = LLVMBuildICmp(b, LLVMIntULT, shift,
+                             LLVMConstInt(cg->i64, 63, false), "");
+        shift = LLVMBuildSelect(b, fits, shift, zero, "");
+        fast = LLVMBuildShl(b, x, shift, "");
+        overflow = LLVMBuildICmp(b, LLVMIntNE, LLVMBuildAShr(b, fast, shift,
+                                                             ""), x, "");
+        small = LLVMBuildAnd(b, small, fits, "");
+        fn = "erupt_int_shl";
+        break;
+    case R_SHIFT:
+        /* floor(2v / 2^s) with the low bit cleared is floor(v / 2^s) << 1 */
+        shift = untag(cg, y);
+        fits = LLVMBuildICmp(b, LLVMIntULT, shift,
+                             LLVMConstInt(cg->i64, 64, false), "");
+        shift = LLVMBuildSelect(b, fits, shift, zero, "");
+        fast = LLVMBuildAnd(b, LLVMBuildAShr(b, x, shift, ""),
+                            LLVMConstInt(cg->i64, (uint64_t)-2, true), "");
+        return int_op(cg, fast, LLVMBuildAnd(b, small, fits, ""),
+                      "erupt_int_shr", cg->i64, args, 2);
+    default:
+        return unsupported(cg, i);
+    }
+
+    return int_op(cg, fast, LLVMBuildAnd(b, small, LLVMBuildNot(b, overflow,
+                                                                 ""), ""),
+                  fn, cg->i64, args, 2);
+}
+
+static LLVMValueRef generate_compare(codegen_t *cg, eir_instr_t *i)
+{
+    static const struct {
+        token_type_t symbol;
+        LLVMIntPredicate sint;
+        LLVMIntPredicate uint;
+        LLVMRealPredicate real;
+    } predicates[] = {
+        { EQ_EQ, LLVMIntEQ, LLVMIntEQ, LLVMRealOEQ },
+        { BANG_EQ, LLVMIntNE, LLVMIntNE, LLVMRealUNE },
+        { LT, LLVMIntSLT, LLVMIntULT, LLVMRealOLT },
+        { LT_EQ, LLVMIntSLE, LLVMIntULE, LLVMRealOLE },
+        { GT, LLVMIntSGT, LLVMIntUGT, LLVMRealOGT },
+        { GT_EQ, LLVMIntSGE, LLVMIntUGE, LLVMRealOGE }
+    };
+    LLVMBuilderRef b = cg->b;
+    eir_instr_t *lhs = i->operands[0], *rhs = i->operands[1];
+    eir_type_t lt = lhs->type, rt = rhs->type;
+
+    if (i->symbol == AND || i->symbol == OR) {
+        LLVMValueRef x = value(cg, lhs, EIR_BOOL), y = value(cg, rhs, EIR_BOOL);
+
+        return i->symbol == AND ? LLVMBuildAnd(b, x, y, "")
+                                : LLVMBuildOr(b, x, y, "");
+    }
+
+    for (size_t k = 0; k < sizeof(predicates) / sizeof(predicates[0]); ++k) {
+        if (predicates[k].symbol != i->symbol)
+            continue;
+
+        if (lt == EIR_FLOAT || rt == EIR_FLOAT) {
+            return LLVMBuildFCmp(b, predicates[k].real,
+                                 value(cg, lhs, EIR_FLOAT),
+                                 value(cg, rhs, EIR_FLOAT), "");
+        }
+
+        if ((lt == EIR_STRING || lt == EIR_LIST) && rt == lt) {
+            LLVMValueRef args[] = { lhs->data, rhs->data };
+            LLVMValueRef c = call_runtime(cg, lt == EIR_STRING ?
+                                              "erupt_string_compare" :
+                                              "erupt_list_compare",
+                                          cg->i32, args, 2);
+
+            return LLVMBuildICmp(b, predicates[k].sint, c,
+                                 LLVMConstInt(cg->i32, 0, false), "");
+        }
+
+        if (lt == EIR_STRING || lt == EIR_LIST || rt == EIR_STRING ||
+            rt == EIR_LIST) {
+            break;
+        }
+
+        if (lt == EIR_BOOL && rt == EIR_BOOL) {
+            return LLVMBuildICmp(b, predicates[k].uint, lhs->data, rhs->data,
+                                 "");
+        }
+
+        /*
+         * tagging keeps the order of small ints, equal bignums can be
+         * different objects though, so those are compared by the runtime
+         */
+        LLVMValueRef args[] = { value(cg, lhs, EIR_INT),
+                                value(cg, rhs, EIR_INT) };
+        LLVMValueRef fast = LLVMBuildICmp(b, predicates[k].sint, args[0],
+                                          args[1], "");
+        slow_path_t slow;
+
+        if (!start_slow_path(cg, &slow, is_small(cg, args[0], args[1])))
+            return fast;
+
+        LLVMValueRef c = call_runtime(cg, "erupt_int_compare", cg->i32, args,
+                                      2);
+
+        return finish_slow_path(cg, &slow, fast,
+                                LLVMBuildICmp(b, predicates[k].sint, c,
+                                              LLVMConstInt(cg->i32, 0, false),
+                                              ""));
+    }
+
+    return unsupported(cg, i);
+}
+
+/*
+ * the quotient of small ints is small too, except for ERUPT_INT_MIN / -1.
+ * dividing by zero is left to the runtime, which panics.
+ */
+static LLVMValueRef generate_division(codegen_t *cg, token_type_t symbol,
+                                      LLVMValueRef a, LLVMValueRef b)
+{
+    LLVMBuilderRef builder = cg->b;
+    LLVMValueRef args[] = { a, b };
+    LLVMValueRef x = untag(cg, a), divisor = untag(cg, b), fast, overflow;
+    LLVMValueRef ok = is_small(cg, a, b);
+
+    /* whatever isn't divided here mustn't trap either */
+    if (!LLVMIsAConstantInt(b) || LLVMConstIntGetSExtValue(b) == 0) {
+        ok = LLVMBuildAnd(builder, ok,
+                          LLVMBuildIsNotNull(builder, divisor, ""), "");
+        divisor = LLVMBuildSelect(builder, ok, divisor,
+                                  LLVMConstInt(cg->i64, 1, false), "");
+    }
+
+    if (symbol == SLASH) {
+        LLVMValueRef q = LLVMBuildSDiv(builder, x, divisor, "");
+
+        fast = with_overflow(cg, "llvm.sadd.with.overflow", q, q, &overflow);
+        ok = LLVMBuildAnd(builder, ok, LLVMBuildNot(builder, overflow, ""),
+                          "");
+    } else {
+        fast = LLVMBuildShl(builder, LLVMBuildSRem(builder, x, divisor, ""),
+                            LLVMConstInt(cg->i64, 1, false), "");
+    }
+
+    return int_op(cg, fast, ok, symbol == SLASH ? "erupt_int_div"
+                                                : "erupt_int_mod",
+                  cg->i64, args, 2);
+}
+
+static LLVMValueRef generate_unop(codegen_t *cg, eir_instr_t *i)
+{
+    eir_instr_t *operand = i->operands[0];
+    LLVMValueRef x = operand->data, zero = LLVMConstInt(cg->i64, 0, false);
+    LLVMValueRef small = NULL, fast, overflow;
+
+    if (operand->type == EIR_INT)
+        small = is_small(cg, x, x);
+
+    switch (i->symbol) {
+    case PLUS:
+        return value(cg, operand, i->type);
+    case MIN:
+        if (operand->type == EIR_FLOAT)
+            return LLVMBuildFNeg(cg->b, operand->data, "");
+
+        if (operand->type != EIR_INT)
+            break;
+
+        fast = with_overflow(cg, "llvm.ssub.with.overflow", zero, x,
+                             &overflow);
+
+        return int_op(cg, fast, LLVMBuildAnd(cg->b, small,
+                                             LLVMBuildNot(cg->b, overflow, ""),
+                                             ""),
+                      "erupt_int_neg", cg->i64, &x, 1);
+    case BANG:
+        return LLVMBuildNot(cg->b, value(cg, operand, EIR_BOOL), "");
+    case B_NOT:
+        if (operand->type != EIR_INT)
+            break;
+
+        /* ~v << 1 is ~(v << 1) with the low bit cleared */
+        fast = LLVMBuildXor(cg->b, x, LLVMConstInt(cg->i64, (uint64_t)-2,
+                                                   true), "");
+
+        return int_op(cg, fast, small, "erupt_int_not", cg->i64, &x, 1);
+    default:
+        break;
+    }
+
+    return unsupported(cg, i);
+}
+
+/* v as a tagged int, a bignum if it's too big to be small */
+static LLVMValueRef generate_int(codegen_t *cg, int64_t v)
+{
+    if (v >= ERUPT_INT_MIN && v <= ERUPT_INT_MAX)
+        return LLVMConstInt(cg->i64, (uint64_t)ERUPT_TAG(v), true);
+
+    LLVMValueRef arg = LLVMConstInt(cg->i64, (uint64_t)v, true);
+
+    return call_runtime(cg, "erupt_int_from_int64", cg->i64, &arg, 1);
+}
+
+/* the literal with these digits, which never fits in a word */
+static LLVMValueRef generate_bignum(codegen_t *cg, const char *digits)
+{
+    LLVMValueRef arg = LLVMBuildGlobalStringPtr(cg->b, digits, "");
+
+    return call_runtime(cg, "erupt_int_parse", cg->i64, &arg, 1);
+}
+
+/*
+ * branch to a new block for the slow path if ok is false, expecting it to
+ * be true. returns false, without branching, if ok is always true.
+ */
+static bool start_slow_path(codegen_t *cg, slow_path_t *p, LLVMValueRef ok)
+{
+    static const uint64_t likely[] = { 1 << 20, 0 };
+
+    if (LLVMIsAConstantInt(ok) && LLVMConstIntGetZExtValue(ok))
+        return false;
+
+    LLVMBasicBlockRef slow = LLVMAppendBasicBlockInContext(cg->ctx,
+                                                           cg->llvm_fn, "");
+
+    p->fast = LLVMGetInsertBlock(cg->b);
+    p->done = LLVMAppendBasicBlockInContext(cg->ctx, cg->llvm_fn, "");
+
+    set_profile(cg, LLVMBuildCondBr(cg->b, ok, p->done, slow),
+                "branch_weights", likely, 2);
+
+    LLVMPositionBuilderAtEnd(cg->b, slow);
+
+    return true;
+}
+
+/* join the slow path with the fast one, the result is fast or slow */
+static LLVMValueRef finish_slow_path(codegen_t *cg, slow_path_t *p,
+                                     LLVMValueRef fast, LLVMValueRef slow)
+{
+    LLVMBasicBlockRef from = LLVMGetInsertBlock(cg->b);
+
+    LLVMBuildBr(cg->b, p->done);
+    LLVMPositionBuilderAtEnd(cg->b, p->done);
+
+    LLVMValueRef phi = LLVMBuildPhi(cg->b, LLVMTypeOf(fast), "");
+
+    LLVMAddIncoming(phi, &fast, &p->fast, 1);
+    LLVMAddIncoming(phi, &slow, &from, 1);
+
+    return phi;
+}
+
+/*
+ * fast if ok, otherwise call fn of the runtime with args, which handles
+ * every int. the runtime is always called where the block can't be split.
+ */
+static LLVMValueRef int_op(codegen_t *cg, LLVMValueRef fast, LLVMValueRef ok,
+                           const char *fn, LLVMTypeRef ret, LLVMValueRef *args,
+                           unsigned n)
+{
+    slow_path_t slow;
+
+    if (cg->in_phi)
+        return call_runtime(cg, fn, ret, args, n);
+
+    if (!start_slow_path(cg, &slow, ok))
+        return fast;
+
+    return finish_slow_path(cg, &slow, fast, call_runtime(cg, fn, ret, args,
+                                                          n));
+}
+
+/* x op y, with *overflow set to whether it overflowed */
+static LLVMValueRef with_overflow(codegen_t *cg, const char *name,
+                                  LLVMValueRef x, LLVMValueRef y,
+                                  LLVMValueRef *overflow)
+{
+    LLVMTypeRef types[] = { cg->i64 };
+    unsigned id = LLVMLookupIntrinsicID(name, strlen(name));
+    LLVMValueRef fn = LLVMGetIntrinsicDeclaration(cg->mod, id, types, 1);
+    LLVMValueRef args[] = { x, y };
+    LLVMValueRef r = LLVMBuildCall2(cg->b, LLVMIntrinsicGetType(cg->ctx, id,
+                                                                types, 1),
+                                    fn, args, 2, "");
+
+    *overflow = LLVMBuildExtractValue(cg->b, r, 1, "");
+
+    return LLVMBuildExtractValue(cg->b, r, 0, "");
+}
+
+/* whether the tagged ints x and y are both small */
+static LLVMValueRef is_small(codegen_t *cg, LLVMValueRef x, LLVMValueRef y)
+{
+    LLVMValueRef bits = LLVMBuildAnd(cg->b, LLVMBuildOr(cg->b, x, y, ""),
+                                     LLVMConstInt(cg->i64, 1, false), "");
+
+    return LLVMBuildICmp(cg->b, LLVMIntEQ, bits,
+                         LLVMConstInt(cg->i64, 0, false), "");
+}
+
+static LLVMValueRef untag(codegen_t *cg, LLVMValueRef v)
+{
+    return LLVMBuildAShr(cg->b, v, LLVMConstInt(cg->i64, 1, false), "");
+}
+
+static LLVMValueRef generate_call(codegen_t *cg, eir_instr_t *i)
+{
+    eir_fn_t *callee = eir_lookup_fn(cg->m, i->callee);
+
+    if (!callee)
+        return generate_builtin(cg, i);
+
+    if (callee->n_params != i->n_operands) {
+        file_error(cg->target, i->line_n, "'%s' takes %zu argument(s), %zu "
+                   "given", i->callee, callee->n_params, i->n_operands);
+        cg->failed = true;
+
+        return LLVMGetUndef(llvm_type(cg, i->type));
+    }
+
+    LLVMValueRef *args = smalloc(sizeof(LLVMValueRef) * (i->n_operands + 1));
+
+    for (size_t k = 0; k < i->n_operands; ++k)
+        args[k] = value(cg, i->operands[k], EIR_INT);
+
+    LLVMValueRef v = call_fn(cg, callee, args, (unsigned)i->n_operands);
+
+    free(args);
+
+    return coerce(cg, v, callee->ret, i->type);
+}
+
+/* functions of the standard library that are generated inline */
+static LLVMValueRef generate_builtin(codegen_t *cg, eir_instr_t *i)
+{
+    if (strcmp(i->callee, "IO.print") == 0 && i->n_operands == 1) {
+        eir_instr_t *arg = i->operands[0];
+        LLVMValueRef v = arg->data;
+
+        switch (arg->type) {
+        case EIR_BOOL:
+            v = LLVMBuildZExt(cg->b, v, cg->i32, "");
+            call_runtime(cg, "erupt_print_bool", cg->void_type, &v, 1);
+            break;
+        case EIR_FLOAT:
+            call_runtime(cg, "erupt_print_float", cg->void_type, &v, 1);
+            break;
+        case EIR_STRING:
+            call_runtime(cg, "erupt_print_string", cg->void_type, &v, 1);
+            break;
+        case EIR_LIST:
+            call_runtime(cg, "erupt_print_list", cg->void_type, &v, 1);
+            break;
+        default:
+            v = value(cg, arg, EIR_INT);
+            call_runtime(cg, "erupt_print_int", cg->void_type, &v, 1);
+        }
+
+        return LLVMConstNull(llvm_type(cg, i->type));
+    }
+
+    if (strcmp(i->callee, "IO.flush") == 0 && i->n_operands == 0) {
+        call_runtime(cg, "erupt_io_flush", cg->void_type, NULL, 0);
+        return LLVMConstNull(llvm_type(cg, i->type));
+    }
+
+    file_error(cg->target, i->line_n, "undefined function '%s'", i->callee);
+    cg->failed = true;
+
+    return LLVMGetUndef(llvm_type(cg, i->type));
+}
+
+/*
+ * a spawned call gets a frame in the caller's stack holding the task, the
+ * arguments and room for the result. the task runs a thunk that unpacks the
+ * frame and calls the function.
+ */
+static LLVMValueRef generate_spawn(codegen_t *cg, eir_instr_t *i)
+{
+    eir_fn_t *callee = eir_lookup_fn(cg->m, i->callee);
+
+    if (!callee || callee->n_params != i->n_operands) {
+        file_error(cg->target, i->line_n, "can't evaluate '%s' in parallel",
+                   i->callee);
+        cg->failed = true;
+
+        return LLVMGetUndef(cg->ptr);
+    }
+
+    LLVMTypeRef frame_type = task_frame_type(cg, callee);
+    LLVMValueRef frame = entry_alloca(cg, frame_type);
+
+    for (size_t k = 0; k < i->n_operands; ++k) {
+        LLVMBuildStore(cg->b, value(cg, i->operands[k], EIR_INT),
+                       LLVMBuildStructGEP2(cg->b, frame_type, frame,
+                                           (unsigned)k + 1, ""));
+    }
+
+    LLVMValueRef args[] = {
+        LLVMBuildBitCast(cg->b, LLVMBuildStructGEP2(cg->b, frame_type, frame,
+                                                    0, ""), cg->ptr, ""),
+        task_thunk(cg, callee),
+        LLVMBuildBitCast(cg->b, frame, cg->ptr, "")
+    };
+
+    call_runtime(cg, "erupt_fork", cg->void_type, args, 3);
+
+    return frame;
+}
+
+static LLVMValueRef generate_join(codegen_t *cg, eir_instr_t *i)
+{
+    eir_instr_t *spawn = i->operands[0];
+    eir_fn_t *callee = eir_lookup_fn(cg->m, spawn->callee);
+    LLVMValueRef frame = spawn->data;
+
+    if (!callee)
+        return LLVMGetUndef(llvm_type(cg, i->type));
+
+    LLVMTypeRef frame_type = task_frame_type(cg, callee);
+    unsigned result = (unsigned)callee->n_params + 1;
+    LLVMValueRef task = LLVMBuildBitCast(cg->b,
+                                         LLVMBuildStructGEP2(cg->b, frame_type,
+                                                             frame, 0, ""),
+                                         cg->ptr, "");
+
+    call_runtime(cg, "erupt_join", cg->void_type, &task, 1);
+
+    LLVMValueRef v = LLVMBuildLoad2(cg->b, llvm_type(cg, callee->ret),
+                                    LLVMBuildStructGEP2(cg->b, frame_type,
+                                                        frame, result, ""),
+                                    "");
+
+    return coerce(cg, v, callee->ret, i->type);
+}
+
+/*
+ * a closure without captures is a constant, like a string literal. one with
+ * captures is allocated from its words, the way a list is.
+ */
+static LLVMValueRef generate_closure(codegen_t *cg, eir_instr_t *i)
+{
+    eir_fn_t *entry = eir_lookup_fn(cg->m, i->callee);
+    LLVMValueRef code = get_fn(cg, entry);
+    size_t n = i->n_operands;
+
+    if (!n)
+        return static_closure(cg, entry, code);
+
+    /* captures are passed like arguments, as ints */
+    LLVMValueRef env = entry_alloca(cg, LLVMArrayType(cg->i64, (unsigned)n));
+
+    env = LLVMBuildBitCast(cg->b, env, cg->list, "");
+
+    for (size_t k = 0; k < n; ++k) {
+        LLVMValueRef index = LLVMConstInt(cg->i64, k, false);
+
+        LLVMBuildStore(cg->b, value(cg, i->operands[k], EIR_INT),
+                       LLVMBuildGEP2(cg->b, cg->i64, env, &index, 1, ""));
+    }
+
+    LLVMValueRef args[] = {
+        LLVMBuildBitCast(cg->b, code, cg->ptr, ""),
+        LLVMConstInt(cg->i64, entry->n_params - 1, false),
+        env,
+        LLVMConstInt(cg->i64, n, false)
+    };
+
+    return LLVMBuildOr(cg->b,
+                       LLVMBuildPtrToInt(cg->b,
+                                         call_runtime(cg, "erupt_closure_from",
+                                                      cg->list, args, 4),
+                                         cg->i64, ""),
+                       LLVMConstInt(cg->i64, 1, false), "");
+}
+
+/* a constant closure of entry, made once per module */
+static LLVMValueRef static_closure(codegen_t *cg, eir_fn_t *entry,
+                                   LLVMValueRef code)
+{
+    char *symbol = codegen_symbol(entry->name);
+    char *name = smalloc(strlen(symbol) + sizeof(".closure"));
+    LLVMTypeRef type = LLVMArrayType(cg->i64, 3);
+    LLVMValueRef one = LLVMConstInt(cg->i64, 1, false);
+
+    sprintf(name, "%s.closure", symbol);
+    free(symbol);
+
+    LLVMValueRef closure = LLVMGetNamedGlobal(cg->mod, name);
+
+    if (!closure) {
+        LLVMValueRef fields[] = {
+            LLVMConstInt(cg->i64, ERUPT_HEADER(ERUPT_CLOSURE,
+                                               sizeof(erupt_closure_t)),
+                         false),
+            LLVMConstPtrToInt(code, cg->i64),
+            LLVMConstInt(cg->i64, (uint64_t)ERUPT_TAG(entry->n_params - 1),
+                         false)
+        };
+
+        closure = LLVMAddGlobal(cg->mod, type, name);
+        LLVMSetInitializer(closure, LLVMConstArray(cg->i64, fields, 3));
+        LLVMSetGlobalConstant(closure, true);
+        LLVMSetLinkage(closure, LLVMPrivateLinkage);
+        LLVMSetAlignment(closure, sizeof(uint64_t));
+    }
+
+    free(name);
+
+    /* the reference is to the word after the header */
+    LLVMValueRef index[] = { LLVMConstInt(cg->i64, 0, false), one };
+
+    return LLVMConstOr(LLVMConstPtrToInt(LLVMConstInBoundsGEP2(type, closure,
+                                                               index, 2),
+                                         cg->i64), one);
+}
+
+/* the words of the closure f refers to */
+static LLVMValueRef closure_words(codegen_t *cg, LLVMValueRef f)
+{
+    return LLVMBuildIntToPtr(cg->b,
+                             LLVMBuildAnd(cg->b, f,
+                                          LLVMConstInt(cg->i64, ~1ull, true),
+                                          ""),
+                             cg->list, "");
+}
+
+/* the words of a closure are its code, its arity and then what it captured */
+static LLVMValueRef generate_env(codegen_t *cg, eir_instr_t *i)
+{
+    LLVMValueRef closure = closure_words(cg, value(cg, i->operands[0],
+                                                   EIR_INT));
+    LLVMValueRef index = LLVMConstInt(cg->i64, (uint64_t)i->imm.i + 2,
+                                      false);
+
+    return LLVMBuildLoad2(cg->b, cg->i64,
+                          LLVMBuildGEP2(cg->b, cg->i64, closure, &index, 1,
+                                        ""), "");
+}
+
+/*
+ * call a closure, with itself as the first argument. it's checked to be a
+ * closure that takes as many arguments as it's given first, the checks fail
+ * on the cold path.
+ */
+static LLVMValueRef generate_apply(codegen_t *cg, eir_instr_t *i)
+{
+    LLVMBuilderRef b = cg->b;
+    unsigned n = (unsigned)i->n_operands;
+    LLVMValueRef f = value(cg, i->operands[0], EIR_INT);
+    LLVMValueRef one = LLVMConstInt(cg->i64, 1, false);
+    LLVMValueRef minus_one = LLVMConstInt(cg->i64, (uint64_t)-1, true);
+
+    check_apply(cg, LLVMBuildICmp(b, LLVMIntEQ,
+                                  LLVMBuildAnd(b, f, LLVMConstInt(cg->i64, 7,
+                                                                  false), ""),
+                                  one, ""), f, n - 1);
+
+    LLVMValueRef closure = closure_words(cg, f);
+    LLVMValueRef header = LLVMBuildLoad2(b, cg->i64,
+                                         LLVMBuildGEP2(b, cg->i64, closure,
+                                                       &minus_one, 1, ""),
+                                         "");
+    LLVMValueRef kind = LLVMBuildAnd(b, LLVMBuildLShr(b, header,
+                                                      LLVMConstInt(cg->i64, 8,
+                                                                   false),
+                                                      ""),
+                                     LLVMConstInt(cg->i64, 0xff, false), "");
+    LLVMValueRef arity = LLVMBuildLoad2(b, cg->i64,
+                                        LLVMBuildGEP2(b, cg->i64, closure,
+                                                      &one, 1, ""), "");
+
+    check_apply(cg, LLVMBuildAnd(b,
+        LLVMBuildICmp(b, LLVMIntEQ, kind,
+                      LLVMConstInt(cg->i64, ERUPT_CLOSURE, false), ""),
+        LLVMBuildICmp(b, LLVMIntEQ, arity,
+                      LLVMConstInt(cg->i64, (uint64_t)ERUPT_TAG(n - 1),
+                                   false), ""),
+        ""), f, n - 1);
+
+    LLVMTypeRef *params = smalloc(sizeof(LLVMTypeRef) * n);
+    LLVMValueRef *args = smalloc(sizeof(LLVMValueRef) * n);
+
+    args[0] = f;
+
+    for (unsigned k = 0; k < n; ++k) {
+        params[k] = cg->i64;
+
+        if (k)
+            args[k] = value(cg, i->operands[k], EIR_INT);
+    }
+
+    LLVMTypeRef type = LLVMFunctionType(cg->i64, params, n, false);
+    LLVMValueRef code = LLVMBuildLoad2(b, cg->i64, closure, "");
+    LLVMValueRef v = LLVMBuildCall2(b, type,
+                                    LLVMBuildIntToPtr(b, code,
+                                                      LLVMPointerType(type, 0),
+                                                      ""),
+                                    args, n, "");
+
+    free(params);
+    free(args);
+
+    return v;
+}
+
+/* unless ok, f can't be called with n arguments */
+static void check_apply(codegen_t *cg, LLVMValueRef ok, LLVMValueRef f,
+                        size_t n)
+{
+    slow_path_t slow;
+
+    if (!start_slow_path(cg, &slow, ok))
+        return;
+
+    LLVMValueRef args[] = { f, LLVMConstInt(cg->i64, n, false) };
+
+    call_runtime(cg, "erupt_apply_error", cg->void_type, args, 2);
+    add_attribute(cg, LLVMGetNamedFunction(cg->mod, "erupt_apply_error"),
+                  "noreturn");
+    LLVMBuildUnreachable(cg->b);
+    LLVMPositionBuilderAtEnd(cg->b, slow.done);
+}
+
+static void add_incoming(codegen_t *cg, eir_instr_t *phi)
+{
+    for (size_t k = 0; k < phi->n_operands; ++k) {
+        LLVMBasicBlockRef from = cg->ends[phi->blocks[k]->id];
+
+        if (!from)
+            continue;
+
+        /* conversions of the value happen at the end of its block */
+        LLVMPositionBuilderBefore(cg->b, LLVMGetBasicBlockTerminator(from));
+
+        cg->in_phi = true;
+
+        LLVMValueRef v = value(cg, phi->operands[k], phi->type);
+
+        cg->in_phi = false;
+
+        LLVMAddIncoming(phi->data, &v, &from, 1);
+    }
+}
+
+static LLVMValueRef task_thunk(codegen_t *cg, eir_fn_t *callee)
+{
+    char *symbol = codegen_symbol(callee->name);
+    char *name = smalloc(strlen(symbol) + sizeof(".task"));
+
+    sprintf(name, "%s.task", symbol);
+    free(symbol);
+
+    LLVMValueRef thunk = LLVMGetNamedFunction(cg->mod, name);
+
+    if (thunk) {
+        free(name);
+        return thunk;
+    }
+
+    LLVMBasicBlockRef saved = LLVMGetInsertBlock(cg->b);
+    LLVMMetadataRef location = LLVMGetCurrentDebugLocation2(cg->b);
+    LLVMTypeRef frame_type = task_frame_type(cg, callee);
+    LLVMValueRef *args = smalloc(sizeof(LLVMValueRef) *
+                                 (callee->n_params + 1));
+
+    thunk = LLVMAddFunction(cg->mod, name, LLVMFunctionType(cg->void_type,
+                                                            &cg->ptr, 1,
+                                                            false));
+    LLVMSetLinkage(thunk, LLVMInternalLinkage);
+    add_attribute(cg, thunk, "nounwind");
+
+    LLVMPositionBuilderAtEnd(cg->b, LLVMAppendBasicBlockInContext(cg->ctx,
+                                                                  thunk, ""));
+    LLVMSetCurrentDebugLocation2(cg->b, NULL);
+
+    LLVMValueRef frame = LLVMBuildBitCast(cg->b, LLVMGetParam(thunk, 0),
+                                          LLVMPointerType(frame_type, 0), "");
+
+    for (size_t k = 0; k < callee->n_params; ++k) {
+        args[k] = LLVMBuildLoad2(cg->b, cg->i64,
+                                 LLVMBuildStructGEP2(cg->b, frame_type, frame,
+                                                     (unsigned)k + 1, ""),
+                                 "");
+    }
+
+    LLVMValueRef result = call_fn(cg, callee, args,
+                                  (unsigned)callee->n_params);
+
+    LLVMBuildStore(cg->b, result,
+                   LLVMBuildStructGEP2(cg->b, frame_type, frame,
+                                       (unsigned)callee->n_params + 1, ""));
+    LLVMBuildRetVoid(cg->b);
+
+    LLVMPositionBuilderAtEnd(cg->b, saved);
+    LLVMSetCurrentDebugLocation2(cg->b, location);
+
+    free(args);
+    free(name);
+
+    return thunk;
+}
+
+/* { task, arguments..., result } */
+static LLVMTypeRef task_frame_type(codegen_t *cg, eir_fn_t *callee)
+{
+    size_t n = callee->n_params + 2;
+    LLVMTypeRef *fields = smalloc(sizeof(LLVMTypeRef) * n);
+
+    fields[0] = LLVMArrayType(cg->i64, ERUPT_TASK_SIZE / sizeof(int64_t));
+
+    for (size_t k = 0; k < callee->n_params; ++k)
+        fields[k + 1] = cg->i64;
+
+    fields[n - 1] = llvm_type(cg, callee->ret);
+
+    LLVMTypeRef type = LLVMStructTypeInContext(cg->ctx, fields, (unsigned)n,
+                                               false);
+
+    free(fields);
+
+    return type;
+}
+
+/* allocas in the entry block are promoted and never grow the stack */
+static LLVMValueRef entry_alloca(codegen_t *cg, LLVMTypeRef type)
+{
+    LLVMBuilderRef b = LLVMCreateBuilderInContext(cg->ctx);
+    LLVMBasicBlockRef entry = LLVMGetEntryBasicBlock(cg->llvm_fn);
+    LLVMValueRef first = LLVMGetFirstInstruction(entry);
+
+    if (first)
+        LLVMPositionBuilderBefore(b, first);
+    else
+        LLVMPositionBuilderAtEnd(b, entry);
+
+    LLVMValueRef v = LLVMBuildAlloca(b, type, "");
+
+    LLVMDisposeBuilder(b);
+
+    return v;
+}
+
+static LLVMValueRef call(codegen_t *cg, LLVMValueRef fn, LLVMValueRef *args,
+                         unsigned n)
+{
+    return LLVMBuildCall2(cg->b, LLVMGlobalGetValueType(fn), fn, args, n, "");
+}
+
+/* call a function of the runtime library, declaring it on first use */
+static LLVMValueRef call_runtime(codegen_t *cg, const char *name,
+                                 LLVMTypeRef ret, LLVMValueRef *args,
+                                 unsigned n)
+{
+    LLVMValueRef fn = LLVMGetNamedFunction(cg->mod, name);
+
+    if (!fn) {
+        LLVMTypeRef *params = smalloc(sizeof(LLVMTypeRef) * (n + 1));
+
+        for (unsigned k = 0; k < n; ++k)
+            params[k] = LLVMTypeOf(args[k]);
+
+        fn = LLVMAddFunction(cg->mod, name, LLVMFunctionType(ret, params, n,
+                                                             false));
+        add_attribute(cg, fn, "nounwind");
+
+        free(params);
+    }
+
+    return call(cg, fn, args, n);
+}
+
+static void add_attribute(codegen_t *cg, LLVMValueRef fn, const char *name)
+{
+    unsigned kind = LLVMGetEnumAttributeKindForName(name, strlen(name));
+
+    LLVMAddAttributeAtIndex(fn, LLVMAttributeFunctionIndex,
+                            LLVMCreateEnumAttribute(cg->ctx, kind, 0));
+}
+
+static LLVMValueRef unsupported(codegen_t *cg, eir_instr_t *i)
+{
+    if (i->op == EIR_BINOP || i->op == EIR_UNOP) {
+        file_error(cg->target, i->line_n, "unsupported operator '%s' for "
+                   "%s", token_type_str(i->symbol),
+                   eir_type_str(i->operands[0]->type));
+    } else {
+        file_error(cg->target, i->line_n, "can't generate code for this "
+                   "instruction");
+    }
+
+    cg->failed = true;
+
+    return LLVMGetUndef(llvm_type(cg, i->type));
+}
+
+static LLVMValueRef value(codegen_t *cg, eir_instr_t *i, eir_type_t type)
+{
+    return coerce(cg, i->data, i->type, type);
+}
+
+/* a value as a word, for storing it in a list. floats are boxed */
+static LLVMValueRef to_word(codegen_t *cg, eir_instr_t *i)
+{
+    if (i->type == EIR_FLOAT) {
+        LLVMValueRef v = i->data;
+
+        return call_runtime(cg, "erupt_float_box", cg->i64, &v, 1);
+    }
+
+    return value(cg, i, EIR_INT);
+}
+
+static bool is_pointer(eir_type_t type)
+{
+    return type == EIR_STRING || type == EIR_LIST || type == EIR_TASK;
+}
+
+/* convert v, a value of type from, to an equivalent value of type to */
+static LLVMValueRef coerce(codegen_t *cg, LLVMValueRef v, eir_type_t from,
+                           eir_type_t to)
+{
+    LLVMBuilderRef b = cg->b;
+
+    /* void values are never looked at, they are a 0 int */
+    if (from == EIR_VOID)
+        from = EIR_INT;
+
+    if (to == EIR_VOID)
+        to = EIR_INT;
+
+    if (from == to)
+        return v;
+
+    switch (to) {
+    case EIR_BOOL:
+        if (from == EIR_FLOAT) {
+            return LLVMBuildFCmp(b, LLVMRealUNE, v, LLVMConstReal(cg->f64, 0),
+                                 "");
+        }
+
+        if (is_pointer(from))
+            return LLVMBuildIsNotNull(b, v, "");
+
+        return LLVMBuildICmp(b, LLVMIntNE, v, LLVMConstInt(cg->i64, 0, false),
+                             "");
+    case EIR_INT:
+        if (from == EIR_BOOL)
+            return LLVMBuildShl(b, LLVMBuildZExt(b, v, cg->i64, ""),
+                                LLVMConstInt(cg->i64, 1, false), "");
+
+        if (from == EIR_FLOAT) {
+            /* floats in (-2^62, 2^62) truncate to small ints */
+            LLVMValueRef limit = LLVMConstReal(cg->f64, 0x1p62);
+            LLVMValueRef fits = LLVMBuildAnd(b,
+                LLVMBuildFCmp(b, LLVMRealOLT, v, limit, ""),
+                LLVMBuildFCmp(b, LLVMRealOGT, v, LLVMConstFNeg(limit), ""),
+                "");
+            LLVMValueRef fast = LLVMBuildShl(b, LLVMBuildFPToSI(b, v, cg->i64,
+                                                                ""),
+                                             LLVMConstInt(cg->i64, 1, false),
+                                             "");
+
+            return int_op(cg, fast, fits, "erupt_int_from_float", cg->i64, &v,
+                          1);
+        }
+
+        /* a reference has its low bit set, to tell it from a small int */
+        return LLVMBuildOr(b, LLVMBuildPtrToInt(b, v, cg->i64, ""),
+                           LLVMConstInt(cg->i64, 1, false), "");
+    case EIR_FLOAT:
+        if (from == EIR_BOOL)
+            return LLVMBuildUIToFP(b, v, cg->f64, "");
+
+        if (from == EIR_INT) {
+            LLVMValueRef fast = LLVMBuildSIToFP(b, untag(cg, v), cg->f64, "");
+
+            return int_op(cg, fast, is_small(cg, v, v), "erupt_int_to_float",
+                          cg->f64, &v, 1);
+        }
+
+        return LLVMBuildSIToFP(b, coerce(cg, v, from, EIR_INT), cg->f64, "");
+    default:
+        if (is_pointer(from))
+            return LLVMBuildBitCast(b, v, llvm_type(cg, to), "");
+
+        return LLVMBuildIntToPtr(b, LLVMBuildAnd(b, coerce(cg, v, from,
+                                                           EIR_INT),
+                                                 LLVMConstInt(cg->i64, ~1ull,
+                                                              true),
+                                                 ""),
+                                 llvm_type(cg, to), "");
+    }
+}
+
+static LLVMTypeRef llvm_type(codegen_t *cg, eir_type_t type)
+{
+    switch (type) {
+    case EIR_BOOL:
+        return cg->i1;
+    case EIR_FLOAT:
+        return cg->f64;
+    case EIR_STRING:
+    case EIR_TASK:
+        return cg->ptr;
+    case EIR_LIST:
+        return cg->list;
+    default:
+        return cg->i64;
+    }
+}
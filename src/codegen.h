@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2015 soud
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef CODEGEN_H
+#define CODEGEN_H
+
+#include <llvm-c/Core.h>
+#include <stdint.h>
+
+#include "eir.h"
+
+/* symbols of functions are prefixed, a C name can't contain a dot */
+#define SYMBOL_PREFIX "er."
+
+/* the counters of instrumented programs, defined next to C's main */
+#define PROFILE_COUNTERS "erupt_profile_counters"
+
+/*
+ * how functions reach each other in the tiered JIT. a call loads its
+ * target from table, indexed by the callee's index, so code can be
+ * replaced while it runs. code of the first tier counts its calls and loop
+ * iterations in counters, and calls tier_up(arg, index) when a count reaches
+ * threshold. optimized code has no counters.
+ */
+typedef struct {
+    void **table;
+    uint32_t *counters;
+    uint32_t threshold;
+    void (*tier_up)(void *arg, int64_t index);
+    void *arg;
+} codegen_tiers_t;
+
+LLVMModuleRef codegen_module(eir_module_t *m, LLVMContextRef ctx);
+LLVMModuleRef codegen_partition(eir_module_t *m, eir_fn_t **fns,
+                                bool *exported, size_t n, LLVMContextRef ctx);
+LLVMModuleRef codegen_fn(eir_module_t *m, eir_fn_t *fn, const char *symbol,
+                         LLVMContextRef ctx);
+LLVMModuleRef codegen_tiered_fn(eir_module_t *m, eir_fn_t *fn,
+                                const char *symbol,
+                                const codegen_tiers_t *tiers,
+                                LLVMContextRef ctx);
+char *codegen_symbol(const char *name);
+
+#endif /* !CODEGEN_H */
@@ -0,0 +1,166 @@
+/*
+ * Copyright (C) 2015 soud
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "dce.h"
+#include "callgraph.h"
+#include "erupt.h"
+
+typedef struct {
+    const char **names;
+    size_t n_names;
+} called_t;
+
+static void mark_reachable(callgraph_t *cg, cg_node_t *node, bool *live);
+static void collect_called(ast_node_t *node, void *data);
+static bool module_used(called_t *called, const char *module);
+
+/*
+ * drop every function that can't be reached from main, along with the 'use'
+ * imports none of the remaining code calls into. modules pulled in through
+ * 'use' and 'include' are expected to already be merged into ast, with the
+ * functions of a used module named Module.fn, so their definitions are
+ * treated like any other. a program without main (eg. a module on its own)
+ * is left alone. returns the number of definitions that were removed.
+ */
+size_t eliminate_dead_functions(ast_node_list_t *ast)
+{
+    if (!ast)
+        return 0;
+
+    callgraph_t *cg = build_callgraph(ast);
+    cg_node_t *entry = callgraph_lookup(cg, ENTRY_POINT);
+
+    if (!entry) {
+        verbose_printf("no '%s' function, keeping all definitions",
+                       ENTRY_POINT);
+        destroy_callgraph(cg);
+        return 0;
+    }
+
+    verbose_printf("eliminating functions unreachable from '%s'",
+                   ENTRY_POINT);
+
+    bool *live = scalloc(cg->n_nodes, sizeof(bool));
+    called_t called = { NULL, 0 };
+    size_t removed = 0;
+
+    mark_reachable(cg, entry, live);
+
+    for (size_t i = 0; i < cg->n_nodes; ++i) {
+        cg_node_t *node = &cg->nodes[i];
+
+        if (!live[i])
+            verbose_printf("removing unreachable function '%s'", node->name);
+
+        for (size_t j = 0; j < node->n_clauses; ++j) {
+            if (live[i]) {
+                visit_node_list(node->clauses[j]->fn.body, collect_called,
+                                &called);
+                continue;
+            }
+
+            remove_node(ast, node->clauses[j]);
+            destroy_node(node->clauses[j]);
+            ++removed;
+        }
+    }
+
+    /* the call graph borrowed names from the clauses that were destroyed */
+    destroy_callgraph(cg);
+    free(live);
+
+    for (ast_node_list_t *nl = ast, *next; nl; nl = next) {
+        ast_node_t *node = nl->node;
+
+        next = nl->next;
+
+        if (!node || node->type != TYPE_IMPORT || node->import.include ||
+            module_used(&called, node->import.name))
+            continue;
+
+        verbose_printf("removing unused module '%s'", node->import.name);
+
+        /* removing the head pulls the next cell into it, look at it again */
+        if (nl == ast)
+            next = ast;
+
+        remove_node(ast, node);
+        destroy_node(node);
+        ++removed;
+    }
+
+    free(called.names);
+
+    verbose_printf("removed %zu unreachable definition(s)", removed);
+
+    return removed;
+}
+
+static void mark_reachable(callgraph_t *cg, cg_node_t *node, bool *live)
+{
+    size_t i = node - cg->nodes;
+
+    if (live[i])
+        return;
+
+    live[i] = true;
+
+    for (size_t j = 0; j < node->n_callees; ++j)
+        mark_reachable(cg, &cg->nodes[node->callees[j]], live);
+}
+
+/*
+ * the names the code calls or takes as a value, like build_callgraph() sees
+ * them: x |> IO.print calls IO.print through a var.
+ */
+static void collect_called(ast_node_t *node, void *data)
+{
+    called_t *called = data;
+    const char *name;
+
+    if (node->type == TYPE_CALL)
+        name = node->call.name;
+    else if (node->type == TYPE_CLOSURE && node->closure.name)
+        name = node->closure.name;
+    else if (node->type == TYPE_VAR && !node->var.v)
+        name = node->var.name;
+    else
+        return;
+
+    called->names = srealloc(called->names,
+                             sizeof(char *) * (called->n_names + 1));
+    called->names[called->n_names++] = name;
+}
+
+static bool module_used(called_t *called, const char *module)
+{
+    size_t len = strlen(module);
+
+    for (size_t i = 0; i < called->n_names; ++i) {
+        const char *name = called->names[i];
+
+        if (strncmp(name, module, len) == 0 && name[len] == '.')
+            return true;
+    }
+
+    return false;
+}
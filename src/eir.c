@@ -0,0 +1,816 @@
+/*
+ * Copyright (C) 2015 soud
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "eir.h"
+
+static eir_instr_t *create_instr(eir_builder_t *b, eir_opcode_t op,
+                                 eir_type_t type);
+static void add_operand(eir_instr_t *instr, eir_instr_t *v);
+static void add_block(eir_instr_t *instr, eir_block_t *block);
+static void destroy_instr(eir_instr_t *instr);
+static void dump_instr(eir_instr_t *instr, FILE *out);
+static void dump_float(double v, FILE *out);
+static bool verify_fn(eir_fn_t *fn);
+
+static const char *opcode_names[] = {
+    "const", "const", "const", "const", "param", "list", "binop", "unop",
+    "call", "spawn", "join", "closure", "env", "apply", "phi", "count", "br",
+    "condbr", "switch", "ret", "nomatch"
+};
+
+eir_module_t *create_eir_module(const char *name)
+{
+    eir_module_t *m = smalloc(sizeof(eir_module_t));
+
+    m->name = strdup(name);
+    m->records = NULL;
+    m->counters = NULL;
+    m->n_counters = 0;
+    m->debug_info = false;
+    m->first = NULL;
+    m->last = NULL;
+
+    return m;
+}
+
+eir_fn_t *eir_add_fn(eir_module_t *m, const char *name, size_t n_params)
+{
+    eir_fn_t *fn = smalloc(sizeof(eir_fn_t));
+
+    fn->name = strdup(name);
+    fn->n_params = n_params;
+    fn->ret = EIR_INT;
+    fn->index = m->last ? m->last->index + 1 : 0;
+    fn->scc = 0;
+    fn->count = UNKNOWN_COUNT;
+    fn->line_n = 0;
+    fn->first = NULL;
+    fn->last = NULL;
+    fn->next = NULL;
+
+    if (m->last)
+        m->last->next = fn;
+    else
+        m->first = fn;
+
+    m->last = fn;
+
+    return fn;
+}
+
+eir_fn_t *eir_lookup_fn(eir_module_t *m, const char *name)
+{
+    for (eir_fn_t *fn = m->first; fn; fn = fn->next) {
+        if (strcmp(fn->name, name) == 0)
+            return fn;
+    }
+
+    return NULL;
+}
+
+/* the fields are named by the caller, they're words until typed */
+eir_record_t *eir_add_record(eir_module_t *m, const char *name,
+                             size_t n_fields)
+{
+    eir_record_t *r = smalloc(sizeof(eir_record_t)), **last = &m->records;
+
+    r->name = strdup(name);
+    r->n_fields = n_fields;
+    r->fields = scalloc(n_fields + 1, sizeof(char *));
+    r->types = smalloc(sizeof(eir_type_t) * (n_fields + 1));
+    r->next = NULL;
+
+    for (size_t i = 0; i < n_fields; ++i)
+        r->types[i] = EIR_INT;
+
+    while (*last)
+        last = &(*last)->next;
+
+    *last = r;
+
+    return r;
+}
+
+eir_record_t *eir_lookup_record(eir_module_t *m, const char *name)
+{
+    for (eir_record_t *r = m->records; r; r = r->next) {
+        if (strcmp(r->name, name) == 0)
+            return r;
+    }
+
+    return NULL;
+}
+
+eir_block_t *eir_add_block(eir_fn_t *fn)
+{
+    eir_block_t *block = smalloc(sizeof(eir_block_t));
+
+    block->id = 0;
+    block->first = NULL;
+    block->last = NULL;
+    block->parent = fn;
+    block->prev = fn->last;
+    block->next = NULL;
+
+    if (fn->last)
+        fn->last->next = block;
+    else
+        fn->first = block;
+
+    fn->last = block;
+
+    return block;
+}
+
+eir_instr_t *eir_const_int(eir_builder_t *b, int64_t v)
+{
+    eir_instr_t *instr = create_instr(b, EIR_CONST_INT, EIR_INT);
+
+    instr->imm.i = v;
+
+    return instr;
+}
+
+eir_instr_t *eir_const_float(eir_builder_t *b, double v)
+{
+    eir_instr_t *instr = create_instr(b, EIR_CONST_FLOAT, EIR_FLOAT);
+
+    instr->imm.f = v;
+
+    return instr;
+}
+
+eir_instr_t *eir_const_string(eir_builder_t *b, const char *v)
+{
+    eir_instr_t *instr = create_instr(b, EIR_CONST_STRING, EIR_STRING);
+
+    instr->imm.s = strdup(v);
+
+    return instr;
+}
+
+eir_instr_t *eir_const_bignum(eir_builder_t *b, const char *digits)
+{
+    eir_instr_t *instr = create_instr(b, EIR_CONST_BIGNUM, EIR_INT);
+
+    instr->imm.s = strdup(digits);
+
+    return instr;
+}
+
+eir_instr_t *eir_param(eir_builder_t *b, size_t index, eir_type_t type)
+{
+    eir_instr_t *instr = create_instr(b, EIR_PARAM, type);
+
+    instr->imm.i = index;
+
+    return instr;
+}
+
+eir_instr_t *eir_list(eir_builder_t *b, eir_instr_t **elements, size_t n)
+{
+    eir_instr_t *instr = create_instr(b, EIR_MAKE_LIST, EIR_LIST);
+
+    for (size_t i = 0; i < n; ++i)
+        add_operand(instr, elements[i]);
+
+    return instr;
+}
+
+eir_instr_t *eir_binop(eir_builder_t *b, token_type_t symbol,
+                       eir_instr_t *lhs, eir_instr_t *rhs)
+{
+    eir_type_t type;
+
+    switch (symbol) {
+    case EQ_EQ:
+    case BANG_EQ:
+    case LT:
+    case LT_EQ:
+    case GT:
+    case GT_EQ:
+    case AND:
+    case OR:
+        type = EIR_BOOL;
+        break;
+    default:
+        /*
+         * ints are promoted to floats, strings and lists concatenate. a
+         * word that isn't a literal, like a parameter, is typed as an int
+         * but can hold the string or list it's added to.
+         */
+        if (lhs->type == EIR_FLOAT || rhs->type == EIR_FLOAT)
+            type = EIR_FLOAT;
+        else if (lhs->type == EIR_STRING || lhs->type == EIR_LIST)
+            type = lhs->type;
+        else if ((rhs->type == EIR_STRING || rhs->type == EIR_LIST) &&
+                 lhs->op != EIR_CONST_INT && lhs->op != EIR_CONST_BIGNUM)
+            type = rhs->type;
+        else
+            type = EIR_INT;
+    }
+
+    eir_instr_t *instr = create_instr(b, EIR_BINOP, type);
+
+    instr->symbol = symbol;
+    add_operand(instr, lhs);
+    add_operand(instr, rhs);
+
+    return instr;
+}
+
+eir_instr_t *eir_unop(eir_builder_t *b, token_type_t symbol,
+                      eir_instr_t *operand)
+{
+    eir_instr_t *instr = create_instr(b, EIR_UNOP,
+                                      symbol == BANG ? EIR_BOOL
+                                                     : operand->type);
+
+    instr->symbol = symbol;
+    add_operand(instr, operand);
+
+    return instr;
+}
+
+eir_instr_t *eir_call(eir_builder_t *b, const char *callee,
+                      eir_instr_t **args, size_t n, eir_type_t type)
+{
+    eir_instr_t *instr = create_instr(b, EIR_CALL, type);
+
+    instr->callee = strdup(callee);
+
+    for (size_t i = 0; i < n; ++i)
+        add_operand(instr, args[i]);
+
+    return instr;
+}
+
+eir_instr_t *eir_spawn(eir_builder_t *b, const char *callee,
+                       eir_instr_t **args, size_t n)
+{
+    eir_instr_t *instr = eir_call(b, callee, args, n, EIR_TASK);
+
+    instr->op = EIR_SPAWN;
+
+    return instr;
+}
+
+eir_instr_t *eir_join(eir_builder_t *b, eir_instr_t *task, eir_type_t type)
+{
+    eir_instr_t *instr = create_instr(b, EIR_JOIN, type);
+
+    add_operand(instr, task);
+
+    return instr;
+}
+
+/*
+ * closures are words, like the parameters of functions. callee takes the
+ * closure and the arguments of a call, see lower.c.
+ */
+eir_instr_t *eir_closure(eir_builder_t *b, const char *callee,
+                         eir_instr_t **captures, size_t n)
+{
+    eir_instr_t *instr = eir_call(b, callee, captures, n, EIR_INT);
+
+    instr->op = EIR_CLOSURE;
+
+    return instr;
+}
+
+eir_instr_t *eir_env(eir_builder_t *b, eir_instr_t *closure, size_t index)
+{
+    eir_instr_t *instr = create_instr(b, EIR_ENV, EIR_INT);
+
+    instr->imm.i = (int64_t)index;
+    add_operand(instr, closure);
+
+    return instr;
+}
+
+eir_instr_t *eir_apply(eir_builder_t *b, eir_instr_t *closure,
+                       eir_instr_t **args, size_t n)
+{
+    eir_instr_t *instr = create_instr(b, EIR_APPLY, EIR_INT);
+
+    add_operand(instr, closure);
+
+    for (size_t i = 0; i < n; ++i)
+        add_operand(instr, args[i]);
+
+    return instr;
+}
+
+eir_instr_t *eir_phi(eir_builder_t *b, eir_type_t type)
+{
+    return create_instr(b, EIR_PHI, type);
+}
+
+void eir_add_incoming(eir_instr_t *phi, eir_instr_t *v, eir_block_t *from)
+{
+    add_operand(phi, v);
+    add_block(phi, from);
+}
+
+eir_instr_t *eir_count(eir_builder_t *b, size_t counter)
+{
+    eir_instr_t *instr = create_instr(b, EIR_COUNT, EIR_VOID);
+
+    instr->imm.i = (int64_t)counter;
+
+    return instr;
+}
+
+eir_instr_t *eir_br(eir_builder_t *b, eir_block_t *to)
+{
+    eir_instr_t *instr = create_instr(b, EIR_BR, EIR_VOID);
+
+    add_block(instr, to);
+
+    return instr;
+}
+
+eir_instr_t *eir_condbr(eir_builder_t *b, eir_instr_t *cond,
+                        eir_block_t *then, eir_block_t *otherwise)
+{
+    eir_instr_t *instr = create_instr(b, EIR_CONDBR, EIR_VOID);
+
+    add_operand(instr, cond);
+    add_block(instr, then);
+    add_block(instr, otherwise);
+
+    return instr;
+}
+
+eir_instr_t *eir_switch(eir_builder_t *b, eir_instr_t *v,
+                        eir_block_t *otherwise)
+{
+    eir_instr_t *instr = create_instr(b, EIR_SWITCH, EIR_VOID);
+
+    add_operand(instr, v);
+    add_block(instr, otherwise);
+
+    return instr;
+}
+
+void eir_add_case(eir_instr_t *sw, int64_t v, eir_block_t *to)
+{
+    sw->cases = srealloc(sw->cases, sizeof(int64_t) * (sw->n_cases + 1));
+    sw->cases[sw->n_cases++] = v;
+
+    add_block(sw, to);
+}
+
+eir_instr_t *eir_ret(eir_builder_t *b, eir_instr_t *v)
+{
+    eir_instr_t *instr = create_instr(b, EIR_RET, EIR_VOID);
+
+    add_operand(instr, v);
+
+    return instr;
+}
+
+eir_instr_t *eir_nomatch(eir_builder_t *b)
+{
+    return create_instr(b, EIR_NOMATCH, EIR_VOID);
+}
+
+/* weights has a count for every target of term, NULL forgets them */
+void eir_set_weights(eir_instr_t *term, const uint64_t *weights)
+{
+    free(term->weights);
+    term->weights = NULL;
+
+    if (!weights)
+        return;
+
+    term->weights = smalloc(sizeof(uint64_t) * term->n_blocks);
+    memcpy(term->weights, weights, sizeof(uint64_t) * term->n_blocks);
+}
+
+bool eir_is_terminator(eir_instr_t *instr)
+{
+    return instr && instr->op >= EIR_BR;
+}
+
+eir_instr_t *eir_terminator(eir_block_t *block)
+{
+    return eir_is_terminator(block->last) ? block->last : NULL;
+}
+
+/*
+ * the blocks branching to block, in layout order, stored in a newly
+ * allocated *preds. a block branching to block more than once (eg. a
+ * switch) is only listed once.
+ */
+size_t eir_preds(eir_block_t *block, eir_block_t ***preds)
+{
+    size_t n = 0;
+
+    *preds = NULL;
+
+    for (eir_block_t *b = block->parent->first; b; b = b->next) {
+        eir_instr_t *term = eir_terminator(b);
+
+        if (!term)
+            continue;
+
+        for (size_t i = 0; i < term->n_blocks; ++i) {
+            if (term->blocks[i] != block)
+                continue;
+
+            *preds = srealloc(*preds, sizeof(eir_block_t *) * (n + 1));
+            (*preds)[n++] = b;
+            break;
+        }
+    }
+
+    return n;
+}
+
+void eir_replace_uses(eir_fn_t *fn, eir_instr_t *old, eir_instr_t *new)
+{
+    for (eir_block_t *b = fn->first; b; b = b->next) {
+        for (eir_instr_t *i = b->first; i; i = i->next) {
+            for (size_t j = 0; j < i->n_operands; ++j) {
+                if (i->operands[j] == old)
+                    i->operands[j] = new;
+            }
+        }
+    }
+}
+
+void eir_remove_instr(eir_instr_t *instr)
+{
+    eir_block_t *block = instr->parent;
+
+    if (instr->prev)
+        instr->prev->next = instr->next;
+    else
+        block->first = instr->next;
+
+    if (instr->next)
+        instr->next->prev = instr->prev;
+    else
+        block->last = instr->prev;
+
+    destroy_instr(instr);
+}
+
+/*
+ * remove block and everything in it. phis in the blocks it branched to
+ * forget about it.
+ */
+void eir_remove_block(eir_block_t *block)
+{
+    eir_fn_t *fn = block->parent;
+    eir_instr_t *term = eir_terminator(block);
+
+    for (size_t i = 0; term && i < term->n_blocks; ++i)
+        eir_forget_pred(term->blocks[i], block);
+
+    if (block->prev)
+        block->prev->next = block->next;
+    else
+        fn->first = block->next;
+
+    if (block->next)
+        block->next->prev = block->prev;
+    else
+        fn->last = block->prev;
+
+    for (eir_instr_t *i = block->first, *next; i; i = next) {
+        next = i->next;
+        destroy_instr(i);
+    }
+
+    free(block);
+}
+
+/* drop the incoming values from pred of the phis in block */
+void eir_forget_pred(eir_block_t *block, eir_block_t *pred)
+{
+    for (eir_instr_t *phi = block->first; phi && phi->op == EIR_PHI;
+         phi = phi->next) {
+        size_t k = 0;
+
+        for (size_t j = 0; j < phi->n_blocks; ++j) {
+            if (phi->blocks[j] == pred)
+                continue;
+
+            phi->operands[k] = phi->operands[j];
+            phi->blocks[k++] = phi->blocks[j];
+        }
+
+        phi->n_operands = phi->n_blocks = k;
+    }
+}
+
+/* give every block and value of fn a number, in layout order */
+void eir_number(eir_fn_t *fn)
+{
+    size_t blocks = 0, values = 0;
+
+    for (eir_block_t *b = fn->first; b; b = b->next) {
+        b->id = blocks++;
+
+        for (eir_instr_t *i = b->first; i; i = i->next)
+            i->id = i->type == EIR_VOID ? 0 : values++;
+    }
+}
+
+const char *eir_type_str(eir_type_t type)
+{
+    const char *type_names[] = {
+        "void", "bool", "int", "float", "string", "list", "task"
+    };
+
+    return type <= EIR_TASK ? type_names[type] : "???";
+}
+
+bool verify_eir_module(eir_module_t *m)
+{
+    bool ok = true;
+
+    for (eir_fn_t *fn = m->first; fn; fn = fn->next)
+        ok &= verify_fn(fn);
+
+    return ok;
+}
+
+void dump_eir_module(eir_module_t *m, FILE *out)
+{
+    fprintf(out, "; module %s\n", m->name);
+
+    for (eir_record_t *r = m->records; r; r = r->next) {
+        fprintf(out, "\nrecord %s {", r->name);
+
+        for (size_t i = 0; i < r->n_fields; ++i) {
+            fprintf(out, "%s %s: %s", i ? "," : "", r->fields[i],
+                    eir_type_str(r->types[i]));
+        }
+
+        fprintf(out, " }\n");
+    }
+
+    for (eir_fn_t *fn = m->first; fn; fn = fn->next) {
+        fprintf(out, "\n");
+        dump_eir_fn(fn, out);
+    }
+}
+
+/* the text of a function only depends on its code, it doubles as its key */
+void dump_eir_fn(eir_fn_t *fn, FILE *out)
+{
+    eir_number(fn);
+
+    fprintf(out, "fn %s/%zu -> %s", fn->name, fn->n_params,
+            eir_type_str(fn->ret));
+
+    if (fn->count != UNKNOWN_COUNT)
+        fprintf(out, " !count %" PRIu64, fn->count);
+
+    fprintf(out, " {\n");
+
+    for (eir_block_t *b = fn->first; b; b = b->next) {
+        fprintf(out, "b%zu:\n", b->id);
+
+        for (eir_instr_t *i = b->first; i; i = i->next)
+            dump_instr(i, out);
+    }
+
+    fprintf(out, "}\n");
+}
+
+void destroy_eir_module(eir_module_t *m)
+{
+    if (!m)
+        return;
+
+    for (eir_fn_t *fn = m->first, *next_fn; fn; fn = next_fn) {
+        next_fn = fn->next;
+
+        for (eir_block_t *b = fn->first, *next_b; b; b = next_b) {
+            next_b = b->next;
+
+            for (eir_instr_t *i = b->first, *next_i; i; i = next_i) {
+                next_i = i->next;
+                destroy_instr(i);
+            }
+
+            free(b);
+        }
+
+        free(fn->name);
+        free(fn);
+    }
+
+    for (eir_record_t *r = m->records, *next_r; r; r = next_r) {
+        next_r = r->next;
+
+        for (size_t i = 0; i < r->n_fields; ++i)
+            free(r->fields[i]);
+
+        free(r->fields);
+        free(r->types);
+        free(r->name);
+        free(r);
+    }
+
+    for (size_t i = 0; i < m->n_counters; ++i)
+        free(m->counters[i]);
+
+    free(m->counters);
+    free(m->name);
+    free(m);
+}
+
+static eir_instr_t *create_instr(eir_builder_t *b, eir_opcode_t op,
+                                 eir_type_t type)
+{
+    eir_instr_t *instr = scalloc(1, sizeof(eir_instr_t));
+    eir_block_t *block = b->block;
+
+    instr->op = op;
+    instr->type = type;
+    instr->line_n = b->line_n;
+    instr->parent = block;
+    instr->prev = block->last;
+
+    if (block->last)
+        block->last->next = instr;
+    else
+        block->first = instr;
+
+    block->last = instr;
+
+    return instr;
+}
+
+static void add_operand(eir_instr_t *instr, eir_instr_t *v)
+{
+    instr->operands = srealloc(instr->operands,
+                               sizeof(eir_instr_t *) * (instr->n_operands + 1));
+    instr->operands[instr->n_operands++] = v;
+}
+
+static void add_block(eir_instr_t *instr, eir_block_t *block)
+{
+    instr->blocks = srealloc(instr->blocks,
+                             sizeof(eir_block_t *) * (instr->n_blocks + 1));
+    instr->blocks[instr->n_blocks++] = block;
+}
+
+static void destroy_instr(eir_instr_t *instr)
+{
+    if (instr->op == EIR_CONST_STRING || instr->op == EIR_CONST_BIGNUM)
+        free(instr->imm.s);
+
+    free(instr->callee);
+    free(instr->operands);
+    free(instr->blocks);
+    free(instr->cases);
+    free(instr->weights);
+    free(instr);
+}
+
+static void dump_instr(eir_instr_t *instr, FILE *out)
+{
+    fprintf(out, "  ");
+
+    if (instr->type != EIR_VOID)
+        fprintf(out, "%%%zu = ", instr->id);
+
+    fprintf(out, "%s", opcode_names[instr->op]);
+
+    switch (instr->op) {
+    case EIR_CONST_INT: fprintf(out, " %" PRId64, instr->imm.i); break;
+    case EIR_CONST_FLOAT: dump_float(instr->imm.f, out); break;
+    case EIR_CONST_STRING: fprintf(out, " \"%s\"", instr->imm.s); break;
+    case EIR_CONST_BIGNUM: fprintf(out, " %s", instr->imm.s); break;
+    case EIR_PARAM:
+    case EIR_COUNT: fprintf(out, " %" PRId64, instr->imm.i); break;
+    case EIR_BINOP:
+    case EIR_UNOP: fprintf(out, " %s", token_type_str(instr->symbol)); break;
+    case EIR_CALL:
+    case EIR_SPAWN:
+    case EIR_CLOSURE: fprintf(out, " %s", instr->callee); break;
+    case EIR_ENV: fprintf(out, " %" PRId64, instr->imm.i); break;
+    default: break;
+    }
+
+    for (size_t i = 0; i < instr->n_operands; ++i) {
+        fprintf(out, "%s%%%zu", i ? ", " : " ", instr->operands[i]->id);
+
+        if (instr->op == EIR_PHI)
+            fprintf(out, " from b%zu", instr->blocks[i]->id);
+    }
+
+    if (instr->op == EIR_SWITCH) {
+        for (size_t i = 0; i < instr->n_cases; ++i)
+            fprintf(out, ", %" PRId64 " -> b%zu", instr->cases[i],
+                    instr->blocks[i + 1]->id);
+
+        fprintf(out, ", else -> b%zu", instr->blocks[0]->id);
+    } else if (instr->op != EIR_PHI) {
+        for (size_t i = 0; i < instr->n_blocks; ++i)
+            fprintf(out, "%sb%zu", i || instr->n_operands ? ", " : " ",
+                    instr->blocks[i]->id);
+    }
+
+    if (instr->type != EIR_VOID)
+        fprintf(out, " : %s", eir_type_str(instr->type));
+
+    if (instr->on_stack)
+        fprintf(out, " !stack");
+
+    for (size_t i = 0; instr->weights && i < instr->n_blocks; ++i)
+        fprintf(out, "%s%" PRIu64, i ? ", " : " !weights ", instr->weights[i]);
+
+    fprintf(out, "\n");
+}
+
+/* the shortest form that reads back as the same double */
+static void dump_float(double v, FILE *out)
+{
+    char buffer[32];
+
+    for (int precision = 1; precision <= 17; ++precision) {
+        snprintf(buffer, sizeof(buffer), "%.*g", precision, v);
+
+        if (strtod(buffer, NULL) == v)
+            break;
+    }
+
+    fprintf(out, " %s", buffer);
+}
+
+static bool verify_fn(eir_fn_t *fn)
+{
+    bool ok = true;
+
+    eir_number(fn);
+
+    for (eir_block_t *b = fn->first; b; b = b->next) {
+        if (!eir_terminator(b)) {
+            erupt_error("eir: b%zu in '%s' has no terminator", b->id,
+                        fn->name);
+            ok = false;
+        }
+
+        eir_block_t **preds;
+        size_t n_preds = eir_preds(b, &preds);
+
+        free(preds);
+
+        for (eir_instr_t *i = b->first; i; i = i->next) {
+            if (eir_is_terminator(i) && i != b->last) {
+                erupt_error("eir: terminator in the middle of b%zu in '%s'",
+                            b->id, fn->name);
+                ok = false;
+            }
+
+            if (i->op == EIR_PHI && (i->prev && i->prev->op != EIR_PHI)) {
+                erupt_error("eir: %%%zu in '%s' isn't at the start of b%zu",
+                            i->id, fn->name, b->id);
+                ok = false;
+            }
+
+            if (i->op == EIR_PHI && i->n_operands != n_preds) {
+                erupt_error("eir: %%%zu in '%s' has %zu incoming values, but "
+                            "b%zu has %zu predecessors", i->id, fn->name,
+                            i->n_operands, b->id, n_preds);
+                ok = false;
+            }
+
+            for (size_t j = 0; j < i->n_blocks; ++j) {
+                if (i->blocks[j]->parent != fn) {
+                    erupt_error("eir: branch to another function in '%s'",
+                                fn->name);
+                    ok = false;
+                }
+            }
+        }
+    }
+
+    return ok;
+}
@@ -0,0 +1,249 @@
+/*
+ * Copyright (C) 2015 soud
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef EIR_H
+#define EIR_H
+
+/*
+ * EIR, erupt's intermediate representation. a typed SSA form with basic
+ * blocks and phi nodes that sits between the AST and the backends. every
+ * instruction is also the value it produces.
+ */
+
+#include <inttypes.h>
+
+#include "erupt.h"
+#include "token.h"
+
+typedef struct eir_instr_t eir_instr_t;
+typedef struct eir_block_t eir_block_t;
+typedef struct eir_fn_t eir_fn_t;
+typedef struct eir_record_t eir_record_t;
+typedef struct eir_module_t eir_module_t;
+
+typedef enum {
+    EIR_VOID,
+    EIR_BOOL,
+    EIR_INT,
+    EIR_FLOAT,
+    EIR_STRING,
+    EIR_LIST,
+    EIR_TASK
+} eir_type_t;
+
+typedef enum {
+    EIR_CONST_INT,    /* imm.i */
+    EIR_CONST_FLOAT,  /* imm.f */
+    EIR_CONST_STRING, /* imm.s */
+    EIR_CONST_BIGNUM, /* imm.s, the digits of an int outside int64 */
+    EIR_PARAM,        /* imm.i is the parameter's index */
+    EIR_MAKE_LIST,    /* operands are the elements */
+    EIR_BINOP,        /* symbol, operands[0] and operands[1] */
+    EIR_UNOP,         /* symbol, operands[0] */
+    EIR_CALL,         /* callee, operands are the arguments */
+    EIR_SPAWN,        /* like EIR_CALL, but evaluated in a task */
+    EIR_JOIN,         /* waits for the task operands[0], gives its result */
+    EIR_CLOSURE,      /* a closure of callee over the operands */
+    EIR_ENV,          /* the captured value imm.i of the closure operands[0] */
+    EIR_APPLY,        /* calls the closure operands[0] with the others */
+    EIR_PHI,          /* operands[i] when coming from blocks[i] */
+    EIR_COUNT,        /* adds 1 to the profile counter imm.i */
+
+    /* terminators, every block ends in exactly one */
+    EIR_BR,           /* to blocks[0] */
+    EIR_CONDBR,       /* to blocks[0] if operands[0], else blocks[1] */
+    EIR_SWITCH,       /* to blocks[i + 1] if operands[0] is cases[i], else
+                         blocks[0] */
+    EIR_RET,          /* returns operands[0] */
+    EIR_NOMATCH,      /* no clause of the function matched its arguments */
+
+    EIR_OPCODE_COUNT
+} eir_opcode_t;
+
+struct eir_instr_t {
+    eir_opcode_t op;
+    eir_type_t type;
+
+    /* the source line the instruction was generated for, 0 if unknown */
+    size_t line_n;
+
+    token_type_t symbol;
+    char *callee;
+
+    union {
+        int64_t i;
+        double f;
+        char *s;
+    } imm;
+
+    eir_instr_t **operands;
+    size_t n_operands;
+
+    eir_block_t **blocks;
+    size_t n_blocks;
+
+    int64_t *cases;
+    size_t n_cases;
+
+    /* how often a branch went to each of blocks, from a profile, or NULL */
+    uint64_t *weights;
+
+    /* lists that escape analysis found can't outlive the call */
+    bool on_stack;
+
+    /* scratch space for passes and backends, numbered by eir_number() */
+    size_t id;
+    void *data;
+
+    eir_block_t *parent;
+    eir_instr_t *prev;
+    eir_instr_t *next;
+};
+
+struct eir_block_t {
+    size_t id;
+
+    eir_instr_t *first;
+    eir_instr_t *last;
+
+    eir_fn_t *parent;
+    eir_block_t *prev;
+    eir_block_t *next;
+};
+
+struct eir_fn_t {
+    char *name;
+    size_t n_params;
+    eir_type_t ret;
+
+    /* position in the module, functions keep it when others are removed */
+    size_t index;
+
+    /* component in the call graph, callees come first */
+    size_t scc;
+
+    /* calls, from a profile, UNKNOWN_COUNT without one */
+    uint64_t count;
+
+    /* the source line of its first clause, 0 if unknown */
+    size_t line_n;
+
+    eir_block_t *first;
+    eir_block_t *last;
+
+    eir_fn_t *next;
+};
+
+/*
+ * a record definition, with its fields in declaration order. their types
+ * are those of their default values.
+ */
+struct eir_record_t {
+    char *name;
+    size_t n_fields;
+    char **fields;
+    eir_type_t *types;
+
+    eir_record_t *next;
+};
+
+struct eir_module_t {
+    char *name;
+
+    /* in the order they're defined */
+    eir_record_t *records;
+
+    /* the names of the profile counters, when the program is instrumented */
+    char **counters;
+    size_t n_counters;
+
+    /* generate debug info for the lines of the instructions (-g) */
+    bool debug_info;
+
+    eir_fn_t *first;
+    eir_fn_t *last;
+};
+
+/* instructions are inserted at the end of block, which moves with them */
+typedef struct {
+    eir_fn_t *fn;
+    eir_block_t *block;
+    size_t line_n;
+} eir_builder_t;
+
+eir_module_t *create_eir_module(const char *name);
+eir_fn_t *eir_add_fn(eir_module_t *m, const char *name, size_t n_params);
+eir_fn_t *eir_lookup_fn(eir_module_t *m, const char *name);
+eir_record_t *eir_add_record(eir_module_t *m, const char *name,
+                             size_t n_fields);
+eir_record_t *eir_lookup_record(eir_module_t *m, const char *name);
+eir_block_t *eir_add_block(eir_fn_t *fn);
+
+eir_instr_t *eir_const_int(eir_builder_t *b, int64_t v);
+eir_instr_t *eir_const_float(eir_builder_t *b, double v);
+eir_instr_t *eir_const_string(eir_builder_t *b, const char *v);
+eir_instr_t *eir_const_bignum(eir_builder_t *b, const char *digits);
+eir_instr_t *eir_param(eir_builder_t *b, size_t index, eir_type_t type);
+eir_instr_t *eir_list(eir_builder_t *b, eir_instr_t **elements, size_t n);
+eir_instr_t *eir_binop(eir_builder_t *b, token_type_t symbol,
+                       eir_instr_t *lhs, eir_instr_t *rhs);
+eir_instr_t *eir_unop(eir_builder_t *b, token_type_t symbol,
+                      eir_instr_t *operand);
+eir_instr_t *eir_call(eir_builder_t *b, const char *callee,
+                      eir_instr_t **args, size_t n, eir_type_t type);
+eir_instr_t *eir_spawn(eir_builder_t *b, const char *callee,
+                       eir_instr_t **args, size_t n);
+eir_instr_t *eir_join(eir_builder_t *b, eir_instr_t *task, eir_type_t type);
+eir_instr_t *eir_closure(eir_builder_t *b, const char *callee,
+                         eir_instr_t **captures, size_t n);
+eir_instr_t *eir_env(eir_builder_t *b, eir_instr_t *closure, size_t index);
+eir_instr_t *eir_apply(eir_builder_t *b, eir_instr_t *closure,
+                       eir_instr_t **args, size_t n);
+eir_instr_t *eir_phi(eir_builder_t *b, eir_type_t type);
+void eir_add_incoming(eir_instr_t *phi, eir_instr_t *v, eir_block_t *from);
+eir_instr_t *eir_count(eir_builder_t *b, size_t counter);
+eir_instr_t *eir_br(eir_builder_t *b, eir_block_t *to);
+eir_instr_t *eir_condbr(eir_builder_t *b, eir_instr_t *cond,
+                        eir_block_t *then, eir_block_t *otherwise);
+eir_instr_t *eir_switch(eir_builder_t *b, eir_instr_t *v,
+                        eir_block_t *otherwise);
+void eir_add_case(eir_instr_t *sw, int64_t v, eir_block_t *to);
+eir_instr_t *eir_ret(eir_builder_t *b, eir_instr_t *v);
+eir_instr_t *eir_nomatch(eir_builder_t *b);
+void eir_set_weights(eir_instr_t *term, const uint64_t *weights);
+
+bool eir_is_terminator(eir_instr_t *instr);
+eir_instr_t *eir_terminator(eir_block_t *block);
+size_t eir_preds(eir_block_t *block, eir_block_t ***preds);
+void eir_replace_uses(eir_fn_t *fn, eir_instr_t *old, eir_instr_t *new);
+void eir_remove_instr(eir_instr_t *instr);
+void eir_remove_block(eir_block_t *block);
+void eir_forget_pred(eir_block_t *block, eir_block_t *pred);
+void eir_number(eir_fn_t *fn);
+
+const char *eir_type_str(eir_type_t type);
+bool verify_eir_module(eir_module_t *m);
+void dump_eir_module(eir_module_t *m, FILE *out);
+void dump_eir_fn(eir_fn_t *fn, FILE *out);
+void destroy_eir_module(eir_module_t *m);
+
+#endif /* !EIR_H */
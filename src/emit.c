@@ -0,0 +1,601 @@
+/*
+ * Copyright (C) 2015 soud
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * turning LLVM modules into something that runs: optimizing them with
+ * LLVM's pass pipelines and emitting native code for the host.
+ */
+
+#include <llvm-c/BitReader.h>
+#include <llvm-c/BitWriter.h>
+#include <llvm-c/Target.h>
+#include <llvm-c/Transforms/PassBuilder.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "codegen.h"
+#include "dce.h"
+#include "emit.h"
+#include "lto.h"
+
+typedef struct emit_job emit_job_t;
+
+/* a step of compiling, done for every partition, filling in its slot */
+typedef bool (*emit_step_t)(emit_job_t *job, size_t i,
+                            LLVMTargetMachineRef tm);
+
+struct emit_job {
+    eir_module_t *m;
+    partition_t *partitions;
+    size_t n;
+    int opt_level;
+
+    /* NULL when the cache is disabled */
+    cache_t *cache;
+
+    /* everything besides the code that goes into a cache key */
+    char *salt;
+
+    emit_step_t step;
+    atomic_size_t next;
+    atomic_bool failed;
+    LLVMMemoryBufferRef *objects;
+
+    /* with LTO, the partitions are compiled to bitcode first */
+    LLVMMemoryBufferRef *bitcode;
+    lto_summary_t *summaries;
+    lto_imports_t *imports;
+};
+
+typedef struct {
+    emit_job_t *job;
+    LLVMTargetMachineRef tm;
+    pthread_t thread;
+} emit_worker_t;
+
+static bool run_pipeline(LLVMModuleRef mod, LLVMTargetMachineRef tm,
+                         const char *name, int opt_level);
+static void run_workers(emit_job_t *job, emit_worker_t *workers,
+                        size_t n_workers, emit_step_t step);
+static void *emit_worker(void *arg);
+static bool emit_partition(emit_job_t *job, size_t i,
+                           LLVMTargetMachineRef tm);
+static bool emit_bitcode(emit_job_t *job, size_t i, LLVMTargetMachineRef tm);
+static bool emit_thin_object(emit_job_t *job, size_t i,
+                             LLVMTargetMachineRef tm);
+static bool emit_module(LLVMModuleRef mod, LLVMTargetMachineRef tm,
+                        LLVMMemoryBufferRef *object);
+static bool summarize_bitcode(LLVMMemoryBufferRef bitcode,
+                              lto_summary_t *summary);
+static void free_buffers(LLVMMemoryBufferRef *buffers, size_t n);
+static char *create_salt(cache_t *cache, LLVMTargetMachineRef tm,
+                         int opt_level, const char *source);
+static void partition_key(emit_job_t *job, partition_t *partition,
+                          const char *stage, char *key);
+static void thin_object_key(emit_job_t *job, size_t i, char *key);
+static LLVMCodeGenOptLevel codegen_opt_level(int opt_level);
+
+/*
+ * a target machine for the host, tuned for its CPU. returns NULL if LLVM
+ * doesn't support it, after reporting why.
+ */
+LLVMTargetMachineRef create_target_machine(int opt_level)
+{
+    LLVMTargetRef target = NULL;
+    char *triple = LLVMGetDefaultTargetTriple();
+    char *msg = NULL;
+
+    LLVMInitializeNativeTarget();
+    LLVMInitializeNativeAsmPrinter();
+
+    if (LLVMGetTargetFromTriple(triple, &target, &msg)) {
+        erupt_error("unsupported target '%s': %s", triple, msg);
+        LLVMDisposeMessage(msg);
+        LLVMDisposeMessage(triple);
+
+        return NULL;
+    }
+
+    char *cpu = LLVMGetHostCPUName();
+    char *features = LLVMGetHostCPUFeatures();
+    LLVMTargetMachineRef tm = LLVMCreateTargetMachine(
+        target, triple, cpu, features, codegen_opt_level(opt_level),
+        LLVMRelocPIC, LLVMCodeModelDefault
+    );
+
+    LLVMDisposeMessage(cpu);
+    LLVMDisposeMessage(features);
+    LLVMDisposeMessage(triple);
+
+    return tm;
+}
+
+/* run LLVM's default<On> pipeline on mod, the same one clang -On uses */
+bool optimize_module(LLVMModuleRef mod, LLVMTargetMachineRef tm,
+                     int opt_level)
+{
+    return run_pipeline(mod, tm, "default", opt_level);
+}
+
+/*
+ * run the pipeline name<On> on mod. the module is retargeted to tm first
+ * so the passes know its data layout.
+ */
+static bool run_pipeline(LLVMModuleRef mod, LLVMTargetMachineRef tm,
+                         const char *name, int opt_level)
+{
+    char pipeline[sizeof("thinlto-pre-link<O0>")];
+    char *triple = LLVMGetTargetMachineTriple(tm);
+    LLVMTargetDataRef layout = LLVMCreateTargetDataLayout(tm);
+    LLVMPassBuilderOptionsRef options = LLVMCreatePassBuilderOptions();
+
+    LLVMSetTarget(mod, triple);
+    LLVMSetModuleDataLayout(mod, layout);
+
+    snprintf(pipeline, sizeof(pipeline), "%s<O%d>", name, opt_level);
+
+    verbose_printf("running LLVM pipeline %s", pipeline);
+
+    LLVMPassBuilderOptionsSetLoopVectorization(options, opt_level > 1);
+    LLVMPassBuilderOptionsSetSLPVectorization(options, opt_level > 1);
+    LLVMPassBuilderOptionsSetLoopUnrolling(options, opt_level > 1);
+
+    LLVMErrorRef err = LLVMRunPasses(mod, pipeline, tm, options);
+
+    LLVMDisposePassBuilderOptions(options);
+    LLVMDisposeTargetData(layout);
+    LLVMDisposeMessage(triple);
+
+    if (err) {
+        char *msg = LLVMGetErrorMessage(err);
+
+        erupt_error("optimizing failed: %s", msg);
+        LLVMDisposeErrorMessage(msg);
+
+        return false;
+    }
+
+    return true;
+}
+
+bool emit_object(LLVMModuleRef mod, LLVMTargetMachineRef tm, const char *path)
+{
+    char *msg = NULL;
+
+    verbose_printf("emitting object file '%s'", path);
+
+    /* LLVM wants a mutable path */
+    char *filename = strdup(path);
+    bool failed = LLVMTargetMachineEmitToFile(tm, mod, filename,
+                                              LLVMObjectFile, &msg);
+
+    free(filename);
+
+    if (failed) {
+        erupt_error("couldn't emit '%s': %s", path, msg);
+        LLVMDisposeMessage(msg);
+
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * generate, optimize and compile every partition in a context of its own,
+ * on jobs threads. partitions found in cache aren't compiled again. with
+ * lto, functions are imported across partitions before they're compiled,
+ * see lto.h. gives an object for each partition, in the same order, or NULL
+ * if one of them failed after reporting why.
+ */
+LLVMMemoryBufferRef *emit_partitions(eir_module_t *m, partition_t *partitions,
+                                     size_t n, int opt_level, int jobs,
+                                     cache_t *cache, bool lto)
+{
+    emit_job_t job;
+    size_t n_workers = (size_t)jobs < n ? (size_t)jobs : n;
+    emit_worker_t *workers = scalloc(n_workers + 1, sizeof(emit_worker_t));
+
+    memset(&job, 0, sizeof(emit_job_t));
+    job.m = m;
+    job.partitions = partitions;
+    job.n = n;
+    job.opt_level = opt_level;
+    job.cache = cache;
+    job.objects = scalloc(n + 1, sizeof(LLVMMemoryBufferRef));
+    atomic_init(&job.next, 0);
+    atomic_init(&job.failed, false);
+
+    verbose_printf("compiling %zu partition(s) on %zu thread(s)%s", n,
+                   n_workers, lto ? " with LTO" : "");
+
+    /* target machines are created here, LLVM's initialization isn't safe */
+    for (size_t i = 0; i < n_workers; ++i) {
+        workers[i].job = &job;
+
+        if (!(workers[i].tm = create_target_machine(opt_level)))
+            atomic_store(&job.failed, true);
+    }
+
+    if (cache && n_workers && !atomic_load(&job.failed))
+        job.salt = create_salt(cache, workers[0].tm, opt_level,
+                               m->debug_info ? m->name : NULL);
+
+    if (lto) {
+        job.bitcode = scalloc(n + 1, sizeof(LLVMMemoryBufferRef));
+        job.summaries = scalloc(n + 1, sizeof(lto_summary_t));
+
+        run_workers(&job, workers, n_workers, emit_bitcode);
+
+        /* the thin link, the only step that sees every partition */
+        if (!atomic_load(&job.failed))
+            job.imports = thin_link(job.summaries, n);
+
+        run_workers(&job, workers, n_workers, emit_thin_object);
+
+        for (size_t i = 0; i < n; ++i)
+            destroy_summary(&job.summaries[i]);
+
+        if (job.imports)
+            destroy_imports(job.imports, n);
+
+        free_buffers(job.bitcode, n);
+        free(job.summaries);
+    } else {
+        run_workers(&job, workers, n_workers, emit_partition);
+    }
+
+    for (size_t i = 0; i < n_workers; ++i) {
+        if (workers[i].tm)
+            LLVMDisposeTargetMachine(workers[i].tm);
+    }
+
+    free(workers);
+    free(job.salt);
+
+    if (atomic_load(&job.failed)) {
+        free_buffers(job.objects, n);
+
+        return NULL;
+    }
+
+    return job.objects;
+}
+
+void emit_llvm(LLVMModuleRef mod, FILE *out)
+{
+    char *ir = LLVMPrintModuleToString(mod);
+
+    fputs(ir, out);
+    LLVMDisposeMessage(ir);
+}
+
+/* do step for every partition, unless an earlier step failed */
+static void run_workers(emit_job_t *job, emit_worker_t *workers,
+                        size_t n_workers, emit_step_t step)
+{
+    if (atomic_load(&job->failed))
+        return;
+
+    job->step = step;
+    atomic_store(&job->next, 0);
+
+    /* the calling thread is the first worker */
+    for (size_t i = 1; i < n_workers; ++i)
+        pthread_create(&workers[i].thread, NULL, emit_worker, &workers[i]);
+
+    if (n_workers)
+        emit_worker(&workers[0]);
+
+    for (size_t i = 1; i < n_workers; ++i)
+        pthread_join(workers[i].thread, NULL);
+}
+
+static void *emit_worker(void *arg)
+{
+    emit_worker_t *worker = arg;
+    emit_job_t *job = worker->job;
+    size_t i;
+
+    while ((i = atomic_fetch_add(&job->next, 1)) < job->n) {
+        if (atomic_load(&job->failed))
+            break;
+
+        /* every partition has a slot of its own, the order is fixed */
+        if (!job->step(job, i, worker->tm))
+            atomic_store(&job->failed, true);
+    }
+
+    return NULL;
+}
+
+static bool emit_partition(emit_job_t *job, size_t i,
+                           LLVMTargetMachineRef tm)
+{
+    partition_t *partition = &job->partitions[i];
+    char key[CACHE_KEY_LENGTH + 1];
+
+    if (job->cache) {
+        partition_key(job, partition, "object", key);
+
+        if ((job->objects[i] = cache_load(job->cache, key)))
+            return true;
+    }
+
+    LLVMContextRef ctx = LLVMContextCreate();
+    LLVMModuleRef mod = codegen_partition(job->m, partition->fns,
+                                          partition->exported,
+                                          partition->n_fns, ctx);
+    bool ok = mod && optimize_module(mod, tm, job->opt_level) &&
+              emit_module(mod, tm, &job->objects[i]);
+
+    if (mod)
+        LLVMDisposeModule(mod);
+
+    LLVMContextDispose(ctx);
+
+    if (ok && job->cache)
+        cache_store(job->cache, key, job->objects[i]);
+
+    return ok;
+}
+
+/* the first step of LTO, the partition's bitcode and its summary */
+static bool emit_bitcode(emit_job_t *job, size_t i, LLVMTargetMachineRef tm)
+{
+    partition_t *partition = &job->partitions[i];
+    char key[CACHE_KEY_LENGTH + 1];
+
+    if (job->cache) {
+        partition_key(job, partition, "bitcode", key);
+
+        if ((job->bitcode[i] = cache_load(job->cache, key)))
+            return summarize_bitcode(job->bitcode[i], &job->summaries[i]);
+    }
+
+    LLVMContextRef ctx = LLVMContextCreate();
+    LLVMModuleRef mod = codegen_partition(job->m, partition->fns,
+                                          partition->exported,
+                                          partition->n_fns, ctx);
+    bool ok = mod && run_pipeline(mod, tm, "thinlto-pre-link",
+                                  job->opt_level);
+
+    if (ok) {
+        job->bitcode[i] = LLVMWriteBitcodeToMemoryBuffer(mod);
+        summarize_module(mod, &job->summaries[i]);
+    }
+
+    if (mod)
+        LLVMDisposeModule(mod);
+
+    LLVMContextDispose(ctx);
+
+    if (ok && job->cache)
+        cache_store(job->cache, key, job->bitcode[i]);
+
+    return ok;
+}
+
+/* the last step of LTO, the partition compiled with its imports */
+static bool emit_thin_object(emit_job_t *job, size_t i,
+                             LLVMTargetMachineRef tm)
+{
+    char key[CACHE_KEY_LENGTH + 1];
+
+    if (job->cache) {
+        thin_object_key(job, i, key);
+
+        if ((job->objects[i] = cache_load(job->cache, key)))
+            return true;
+    }
+
+    LLVMContextRef ctx = LLVMContextCreate();
+    LLVMModuleRef mod = NULL;
+    bool ok = !LLVMParseBitcodeInContext2(ctx, job->bitcode[i], &mod) &&
+              import_functions(mod, job->bitcode, &job->imports[i]) &&
+              run_pipeline(mod, tm, "thinlto", job->opt_level) &&
+              emit_module(mod, tm, &job->objects[i]);
+
+    if (mod)
+        LLVMDisposeModule(mod);
+
+    LLVMContextDispose(ctx);
+
+    if (ok && job->cache)
+        cache_store(job->cache, key, job->objects[i]);
+
+    return ok;
+}
+
+static bool emit_module(LLVMModuleRef mod, LLVMTargetMachineRef tm,
+                        LLVMMemoryBufferRef *object)
+{
+    char *msg = NULL;
+
+    if (LLVMTargetMachineEmitToMemoryBuffer(tm, mod, LLVMObjectFile, &msg,
+                                            object)) {
+        erupt_error("couldn't emit object: %s", msg);
+        LLVMDisposeMessage(msg);
+        *object = NULL;
+
+        return false;
+    }
+
+    return true;
+}
+
+/* the summary of bitcode that came from the cache */
+static bool summarize_bitcode(LLVMMemoryBufferRef bitcode,
+                              lto_summary_t *summary)
+{
+    LLVMContextRef ctx = LLVMContextCreate();
+    LLVMModuleRef mod = NULL;
+    bool ok = !LLVMParseBitcodeInContext2(ctx, bitcode, &mod);
+
+    if (ok) {
+        summarize_module(mod, summary);
+        LLVMDisposeModule(mod);
+    } else {
+        erupt_error("couldn't read cached bitcode");
+    }
+
+    LLVMContextDispose(ctx);
+
+    return ok;
+}
+
+static void free_buffers(LLVMMemoryBufferRef *buffers, size_t n)
+{
+    for (size_t i = 0; i < n; ++i) {
+        if (buffers[i])
+            LLVMDisposeMemoryBuffer(buffers[i]);
+    }
+
+    free(buffers);
+}
+
+/*
+ * the compiler, its options and the target the objects are compiled for.
+ * with debug info, source is the path the objects' DWARF names, relative
+ * ones are taken from the working directory.
+ */
+static char *create_salt(cache_t *cache, LLVMTargetMachineRef tm,
+                         int opt_level, const char *source)
+{
+    char *triple = LLVMGetTargetMachineTriple(tm);
+    char *cpu = LLVMGetTargetMachineCPU(tm);
+    char *features = LLVMGetTargetMachineFeatureString(tm);
+    char *salt = NULL;
+    size_t size = 0;
+    FILE *out = open_memstream(&salt, &size);
+
+    fprintf(out, "%s\nO%d%s %s %s %s\n", cache->compiler, opt_level,
+            source ? " g" : "", triple, cpu, features);
+
+    if (source) {
+        char *cwd = source[0] != '/' ? getcwd(NULL, 0) : NULL;
+
+        fprintf(out, "source %s%s%s\n", cwd ? cwd : "", cwd ? "/" : "",
+                source);
+        free(cwd);
+    }
+
+    fclose(out);
+
+    LLVMDisposeMessage(triple);
+    LLVMDisposeMessage(cpu);
+    LLVMDisposeMessage(features);
+
+    return salt;
+}
+
+/*
+ * a partition's object only depends on its own code and on the signatures
+ * of what it calls in other partitions, so that's what goes into its key.
+ * with debug info, the source lines of the code are part of it too.
+ */
+static void partition_key(emit_job_t *job, partition_t *partition,
+                          const char *stage, char *key)
+{
+    char *text = NULL;
+    size_t size = 0;
+    FILE *out = open_memstream(&text, &size);
+
+    fprintf(out, "%s%s\n", job->salt, stage);
+
+    for (size_t f = 0; f < partition->n_fns; ++f) {
+        fprintf(out, "%s ", partition->exported[f] ? "exported" : "internal");
+        dump_eir_fn(partition->fns[f], out);
+
+        if (job->m->debug_info)
+            fprintf(out, "line %zu\n", partition->fns[f]->line_n);
+
+        for (eir_block_t *b = partition->fns[f]->first; b; b = b->next) {
+            for (eir_instr_t *i = b->first; i; i = i->next) {
+                if (job->m->debug_info)
+                    fprintf(out, "line %zu\n", i->line_n);
+
+                if (i->op != EIR_CALL && i->op != EIR_SPAWN &&
+                    i->op != EIR_CLOSURE)
+                    continue;
+
+                eir_fn_t *callee = eir_lookup_fn(job->m, i->callee);
+
+                if (callee)
+                    fprintf(out, "calls %s/%zu -> %s\n", callee->name,
+                            callee->n_params, eir_type_str(callee->ret));
+                else
+                    fprintf(out, "calls builtin %s\n", i->callee);
+            }
+        }
+
+        /* main's partition defines the profile counters and their names */
+        if (strcmp(partition->fns[f]->name, ENTRY_POINT) == 0) {
+            for (size_t c = 0; c < job->m->n_counters; ++c)
+                fprintf(out, "counter %s\n", job->m->counters[c]);
+        }
+    }
+
+    fclose(out);
+    cache_key(text, size, key);
+    free(text);
+}
+
+/*
+ * with LTO, an object depends on the bitcode of its own partition and on
+ * that of the partitions it imports from.
+ */
+static void thin_object_key(emit_job_t *job, size_t i, char *key)
+{
+    lto_imports_t *imports = &job->imports[i];
+    char *text = NULL;
+    size_t size = 0;
+    FILE *out = open_memstream(&text, &size);
+
+    fprintf(out, "%sthinlto\n", job->salt);
+    fwrite(LLVMGetBufferStart(job->bitcode[i]), 1,
+           LLVMGetBufferSize(job->bitcode[i]), out);
+
+    for (size_t k = 0; k < imports->n; ++k) {
+        LLVMMemoryBufferRef bitcode = job->bitcode[imports->from[k]];
+
+        fprintf(out, "\nimport %s\n", imports->names[k]);
+        fwrite(LLVMGetBufferStart(bitcode), 1, LLVMGetBufferSize(bitcode),
+               out);
+    }
+
+    fclose(out);
+    cache_key(text, size, key);
+    free(text);
+}
+
+static LLVMCodeGenOptLevel codegen_opt_level(int opt_level)
+{
+    switch (opt_level) {
+    case 0: return LLVMCodeGenLevelNone;
+    case 1: return LLVMCodeGenLevelLess;
+    case 2: return LLVMCodeGenLevelDefault;
+    default: return LLVMCodeGenLevelAggressive;
+    }
+}
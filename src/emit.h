@@ -0,0 +1,47 @@
+/*
+ * Copyright (C) 2015 soud
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef EMIT_H
+#define EMIT_H
+
+#include <llvm-c/Core.h>
+#include <llvm-c/TargetMachine.h>
+
+#include "cache.h"
+#include "eir.h"
+#include "erupt.h"
+#include "partition.h"
+
+#define DEFAULT_OPT_LEVEL 2
+#define MAX_OPT_LEVEL 3
+
+LLVMTargetMachineRef create_target_machine(int opt_level);
+bool optimize_module(LLVMModuleRef mod, LLVMTargetMachineRef tm,
+                     int opt_level);
+bool emit_object(LLVMModuleRef mod, LLVMTargetMachineRef tm,
+                 const char *path);
+LLVMMemoryBufferRef *emit_partitions(eir_module_t *m, partition_t *partitions,
+                                     size_t n, int opt_level, int jobs,
+                                     cache_t *cache, bool lto);
+void emit_llvm(LLVMModuleRef mod, FILE *out);
+
+#endif /* !EMIT_H */
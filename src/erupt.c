@@ -49,6 +49,18 @@ void *scalloc(size_t n, size_t size)
     return chunk;
 }
 
+void *srealloc(void *ptr, size_t size)
+{
+    void *chunk = realloc(ptr, size);
+
+    if (chunk == NULL) {
+        erupt_fatal_error("failed to allocate memory");
+        exit(ERUPT_ERROR);
+    }
+
+    return chunk;
+}
+
 void verbose_printf(const char *fmt, ...)
 {
     if (!VERBOSE)
@@ -28,6 +28,7 @@
 #endif
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -38,6 +39,11 @@
 #define ERUPT_ERROR -1
 #define ERUPT_LEX_ERROR -2
 #define ERUPT_PARSER_ERROR -3
+#define ERUPT_COMPILE_ERROR -4
+
+/* profile counts that aren't known, and code that isn't counted */
+#define UNKNOWN_COUNT UINT64_MAX
+#define NO_COUNTER SIZE_MAX
 
 #define erupt_error(...) error_printf("erupt", 0, ##__VA_ARGS__)
 #define file_error(file, ...) error_printf(file, ##__VA_ARGS__)
@@ -65,6 +71,7 @@ extern bool VERBOSE;
 
 void *smalloc(size_t size);
 void *scalloc(size_t n, size_t size);
+void *srealloc(void *ptr, size_t size);
 void verbose_printf(const char *fmt, ...);
 void warning_printf(const char *m, size_t line, const char *fmt, ...);
 void error_printf(const char *m, size_t line, const char *fmt, ...);
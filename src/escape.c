@@ -0,0 +1,328 @@
+/*
+ * Copyright (C) 2015 soud
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "escape.h"
+#include "callgraph.h"
+#include "erupt.h"
+
+typedef struct {
+    callgraph_t *cg;
+
+    /* per function in cg, whether each parameter may outlive the call */
+    bool **params;
+    size_t *n_params;
+
+    bool changed;
+    bool mark;
+    size_t on_stack;
+} escape_t;
+
+/* names, within one clause, of the values that escape */
+typedef struct {
+    const char **names;
+    size_t n_names;
+    bool grown;
+} names_t;
+
+/* runtime functions that never hold on to their arguments */
+static const char *non_retaining[] = {
+    "IO.print",
+    "IO.flush",
+};
+
+static void analyze_clause(escape_t *e, cg_node_t *fn, ast_node_t *clause);
+static void walk_body(escape_t *e, names_t *n, ast_node_list_t *body,
+                      bool escaping);
+static void walk(escape_t *e, names_t *n, ast_node_t *node, bool escaping);
+static void walk_args(escape_t *e, names_t *n, const char *callee,
+                      ast_node_t *first, ast_node_list_t *args);
+static bool arg_escapes(escape_t *e, const char *callee, size_t i);
+static bool is_comparison(token_type_t symbol);
+static bool has_name(names_t *n, const char *name);
+static void add_name(names_t *n, const char *name);
+
+/*
+ * decide which list literals can't outlive the function they're created
+ * in, and mark them on_stack so codegen can put them in the function's
+ * frame instead of on the heap. string literals are never allocated, they
+ * are short strings or constants in the literal pool. a value escapes when
+ * it's returned, stored in something that escapes or passed to a parameter
+ * that escapes. parameters start out as not escaping and are marked as
+ * needed until nothing changes, which also handles recursion. returns the
+ * number of lists marked.
+ */
+size_t analyze_escapes(ast_node_list_t *ast)
+{
+    if (!ast)
+        return 0;
+
+    escape_t e;
+
+    e.cg = build_callgraph(ast);
+    e.params = scalloc(e.cg->n_nodes + 1, sizeof(bool *));
+    e.n_params = scalloc(e.cg->n_nodes + 1, sizeof(size_t));
+    e.on_stack = 0;
+
+    verbose_printf("analyzing escaping values");
+
+    for (size_t i = 0; i < e.cg->n_nodes; ++i) {
+        cg_node_t *fn = &e.cg->nodes[i];
+
+        for (size_t j = 0; j < fn->n_clauses; ++j) {
+            size_t n = 0;
+
+            for (ast_node_list_t *nl = fn->clauses[j]->fn.prototype->prototype.args;
+                 nl && nl->node; nl = nl->next)
+                ++n;
+
+            if (n > e.n_params[i])
+                e.n_params[i] = n;
+        }
+
+        e.params[i] = scalloc(e.n_params[i] + 1, sizeof(bool));
+    }
+
+    e.mark = false;
+
+    do {
+        e.changed = false;
+
+        for (size_t i = 0; i < e.cg->n_nodes; ++i) {
+            for (size_t j = 0; j < e.cg->nodes[i].n_clauses; ++j)
+                analyze_clause(&e, &e.cg->nodes[i], e.cg->nodes[i].clauses[j]);
+        }
+    } while (e.changed);
+
+    /* the summaries are final, now mark the literals themselves */
+    e.mark = true;
+
+    for (size_t i = 0; i < e.cg->n_nodes; ++i) {
+        for (size_t j = 0; j < e.cg->nodes[i].n_clauses; ++j)
+            analyze_clause(&e, &e.cg->nodes[i], e.cg->nodes[i].clauses[j]);
+    }
+
+    for (size_t i = 0; i < e.cg->n_nodes; ++i)
+        free(e.params[i]);
+
+    free(e.params);
+    free(e.n_params);
+    destroy_callgraph(e.cg);
+
+    verbose_printf("%zu list(s) can be allocated on the stack", e.on_stack);
+
+    return e.on_stack;
+}
+
+static void analyze_clause(escape_t *e, cg_node_t *fn, ast_node_t *clause)
+{
+    names_t n = { NULL, 0, false };
+    bool mark = e->mark;
+
+    /* bindings can be used before the use that makes them escape is seen */
+    e->mark = false;
+
+    do {
+        n.grown = false;
+        walk_body(e, &n, clause->fn.body, true);
+    } while (n.grown);
+
+    e->mark = mark;
+
+    if (mark)
+        walk_body(e, &n, clause->fn.body, true);
+
+    size_t i = 0, fn_i = fn - e->cg->nodes;
+
+    for (ast_node_list_t *nl = clause->fn.prototype->prototype.args;
+         nl && nl->node; nl = nl->next, ++i) {
+        ast_node_t *param = nl->node;
+
+        if (param->type != TYPE_VAR || e->params[fn_i][i])
+            continue;
+
+        if (has_name(&n, param->var.name)) {
+            e->params[fn_i][i] = true;
+            e->changed = true;
+        }
+    }
+
+    free(n.names);
+}
+
+/* only the last expression of a body is its value */
+static void walk_body(escape_t *e, names_t *n, ast_node_list_t *body,
+                      bool escaping)
+{
+    for (; body; body = body->next)
+        walk(e, n, body->node, body->next ? false : escaping);
+}
+
+static void walk(escape_t *e, names_t *n, ast_node_t *node, bool escaping)
+{
+    if (!node)
+        return;
+
+    switch (node->type) {
+    case TYPE_INT:
+    case TYPE_FLOAT:
+    case TYPE_STRING:
+    case TYPE_PROTO:
+    case TYPE_STRUCT:
+    case TYPE_FN:
+    case TYPE_IMPORT:
+        break;
+    case TYPE_LIST: {
+        size_t length = 0;
+
+        for (ast_node_list_t *nl = node->list.values; nl; nl = nl->next) {
+            if (nl->node)
+                ++length;
+
+            /* whatever is stored in the list lives as long as the list */
+            walk(e, n, nl->node, escaping);
+        }
+
+        if (e->mark && !escaping && length <= MAX_STACK_LIST_LENGTH) {
+            node->list.on_stack = true;
+            ++e->on_stack;
+        }
+        break;
+    }
+    case TYPE_VAR:
+        if (node->var.v) {
+            walk(e, n, node->var.v, has_name(n, node->var.name));
+            break;
+        }
+
+        if (escaping && !has_name(n, node->var.name)) {
+            add_name(n, node->var.name);
+            n->grown = true;
+        }
+        break;
+    case TYPE_CALL:
+        walk_args(e, n, node->call.name, NULL, node->call.args);
+        break;
+    case TYPE_CLOSURE:
+        /* a closure can be called after the function returns */
+        for (ast_node_list_t *nl = node->closure.captures; nl; nl = nl->next)
+            walk(e, n, nl->node, true);
+        break;
+    case TYPE_IF:
+        walk(e, n, node->if_expr.condition, false);
+        walk_body(e, n, node->if_expr.true_body, escaping);
+        walk_body(e, n, node->if_expr.false_body, escaping);
+        break;
+    case TYPE_EXPR: {
+        token_type_t symbol = node->expr.operator ?
+                              node->expr.operator->symbol : 0;
+
+        if (symbol == PIPE && node->expr.rhs &&
+            node->expr.rhs->type == TYPE_CALL) {
+            walk_args(e, n, node->expr.rhs->call.name, node->expr.lhs,
+                      node->expr.rhs->call.args);
+            break;
+        }
+
+        /*
+         * a comparison only produces a boolean, anything else might hand
+         * back (part of) its operands, eg. list concatenation.
+         */
+        bool operands = is_comparison(symbol) ? false : escaping;
+
+        walk(e, n, node->expr.lhs, operands);
+        walk(e, n, node->expr.rhs, operands);
+        break;
+    }
+    case TYPE_RETURN:
+        walk(e, n, node->return_expr.expr, true);
+        break;
+    }
+}
+
+static void walk_args(escape_t *e, names_t *n, const char *callee,
+                      ast_node_t *first, ast_node_list_t *args)
+{
+    size_t i = 0;
+
+    if (first)
+        walk(e, n, first, arg_escapes(e, callee, i++));
+
+    for (; args; args = args->next) {
+        if (args->node)
+            walk(e, n, args->node, arg_escapes(e, callee, i++));
+    }
+}
+
+static bool arg_escapes(escape_t *e, const char *callee, size_t i)
+{
+    cg_node_t *fn = callgraph_lookup(e->cg, callee);
+
+    if (fn) {
+        size_t fn_i = fn - e->cg->nodes;
+
+        /* arity mismatches are errors, don't assume anything about them */
+        return i < e->n_params[fn_i] ? e->params[fn_i][i] : true;
+    }
+
+    size_t n = sizeof non_retaining / sizeof non_retaining[0];
+
+    for (size_t j = 0; j < n; ++j) {
+        if (strcmp(callee, non_retaining[j]) == 0)
+            return false;
+    }
+
+    return true;
+}
+
+static bool is_comparison(token_type_t symbol)
+{
+    switch (symbol) {
+    case EQ_EQ:
+    case BANG_EQ:
+    case LT:
+    case LT_EQ:
+    case GT:
+    case GT_EQ:
+    case AND:
+    case OR:
+    case BANG:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static bool has_name(names_t *n, const char *name)
+{
+    for (size_t i = 0; i < n->n_names; ++i) {
+        if (strcmp(n->names[i], name) == 0)
+            return true;
+    }
+
+    return false;
+}
+
+static void add_name(names_t *n, const char *name)
+{
+    n->names = srealloc(n->names, sizeof(char *) * (n->n_names + 1));
+    n->names[n->n_names++] = name;
+}
@@ -0,0 +1,745 @@
+/*
+ * Copyright (C) 2015 soud
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "inline.h"
+#include "callgraph.h"
+#include "erupt.h"
+
+/* relative costs used by node_cost */
+#define COST_LEAF 1
+#define COST_OPERATOR 1
+#define COST_CALL 5
+#define COST_BRANCH 3
+
+typedef struct {
+    callgraph_t *cg;
+    int threshold;
+    int budget;
+    size_t inlined;
+
+    /* the count of the hottest clause, 0 without a profile */
+    uint64_t hottest;
+
+    /* the cell of the statement being inlined into, and temporaries so far */
+    ast_node_list_t *statement;
+    size_t temps;
+} inliner_t;
+
+/* where the uses of parameters are in the order a body is evaluated */
+typedef struct {
+    ast_node_t **params;
+    ast_node_t **args;
+    size_t n;
+
+    /* the parameter after the last one used, and whether there was a call */
+    size_t next;
+    bool called;
+
+    /* whether the argument can be evaluated where the parameter is used */
+    bool *in_place;
+} order_t;
+
+static int clause_threshold(inliner_t *in, ast_node_t *clause, int threshold);
+static int node_list_cost(ast_node_list_t *nl);
+static void inline_node_list(inliner_t *in, ast_node_list_t *nl);
+static void inline_statements(inliner_t *in, ast_node_list_t *nl);
+static void inline_node(inliner_t *in, ast_node_t *node);
+static bool try_inline(inliner_t *in, ast_node_t *site, const char *name,
+                       ast_node_t *piped, ast_node_list_t *args);
+static ast_node_t *inline_body(cg_node_t *callee, int threshold);
+static bool is_trivial(ast_node_t *node);
+static bool has_binding(ast_node_t *node);
+static bool has_call(ast_node_t *node);
+static int count_uses(ast_node_t *node, const char *name);
+static int count_calls(ast_node_t *node, const char *name);
+static void order_uses(order_t *o, ast_node_t *node, bool conditional);
+static void order_list(order_t *o, ast_node_list_t *nl, bool conditional);
+static bool is_hoistable(inliner_t *in, ast_node_t *site);
+static ast_node_t *bind_temp(inliner_t *in, ast_node_t *arg);
+static ast_node_list_t *operands(ast_node_t *node);
+static ast_node_t *substitute(ast_node_t *node, ast_node_t **params,
+                              ast_node_t **args, size_t n);
+static void replace_node(ast_node_t *dst, ast_node_t *src);
+
+/*
+ * inline small, single clause, non-recursive functions at their call sites.
+ * functions are visited callees first, so a body is already as small as it
+ * will get by the time it's considered for inlining elsewhere. returns the
+ * number of call sites that were inlined.
+ */
+size_t inline_functions(ast_node_list_t *ast, int threshold)
+{
+    if (!ast || threshold <= 0)
+        return 0;
+
+    inliner_t in = { build_callgraph(ast), threshold, 0, 0, 0, NULL, 0 };
+
+    verbose_printf("inlining functions (threshold %d)", threshold);
+
+    for (size_t i = 0; i < in.cg->n_nodes; ++i) {
+        for (size_t j = 0; j < in.cg->nodes[i].n_clauses; ++j) {
+            uint64_t count = in.cg->nodes[i].clauses[j]->fn.count;
+
+            if (count != UNKNOWN_COUNT && count > in.hottest)
+                in.hottest = count;
+        }
+    }
+
+    for (size_t scc = 0; scc < in.cg->n_sccs; ++scc) {
+        for (size_t i = 0; i < in.cg->n_nodes; ++i) {
+            cg_node_t *caller = &in.cg->nodes[i];
+
+            if (caller->scc != scc)
+                continue;
+
+            for (size_t j = 0; j < caller->n_clauses; ++j) {
+                ast_node_t *clause = caller->clauses[j];
+                int size = node_list_cost(clause->fn.body);
+
+                in.threshold = clause_threshold(&in, clause, threshold);
+
+                if (in.threshold <= 0)
+                    continue;
+
+                in.budget = (size > in.threshold ? size : in.threshold) *
+                            INLINE_GROWTH_FACTOR - size;
+
+                inline_statements(&in, clause->fn.body);
+            }
+        }
+    }
+
+    destroy_callgraph(in.cg);
+
+    verbose_printf("inlined %zu call site(s)", in.inlined);
+
+    return in.inlined;
+}
+
+/* the threshold for call sites in clause, by how hot the profile says it is */
+static int clause_threshold(inliner_t *in, ast_node_t *clause, int threshold)
+{
+    uint64_t count = clause->fn.count;
+
+    if (!in->hottest || count == UNKNOWN_COUNT)
+        return threshold;
+
+    if (count == 0)
+        return 0;
+
+    if (count >= in->hottest / INLINE_HOT_FRACTION)
+        return threshold * INLINE_HOT_FACTOR;
+
+    return threshold;
+}
+
+/*
+ * a rough estimate of the code a node generates. calls are expensive because
+ * of the argument shuffling and the call itself, which is exactly what
+ * inlining gets rid of.
+ */
+int node_cost(ast_node_t *node)
+{
+    if (!node)
+        return 0;
+
+    switch (node->type) {
+    case TYPE_INT:
+    case TYPE_FLOAT:
+    case TYPE_STRING:
+    case TYPE_VAR:
+        return COST_LEAF + (node->type == TYPE_VAR ? node_cost(node->var.v)
+                                                   : 0);
+    case TYPE_LIST:
+        return COST_CALL + node_list_cost(node->list.values);
+    case TYPE_PROTO:
+    case TYPE_STRUCT:
+    case TYPE_IMPORT:
+        return 0;
+    case TYPE_FN:
+        return node_list_cost(node->fn.body);
+    case TYPE_CALL:
+        return COST_CALL + node_list_cost(node->call.args);
+    case TYPE_CLOSURE:
+        return COST_CALL + node_list_cost(node->closure.captures);
+    case TYPE_IF:
+        return COST_BRANCH + node_cost(node->if_expr.condition) +
+               node_list_cost(node->if_expr.true_body) +
+               node_list_cost(node->if_expr.false_body);
+    case TYPE_EXPR:
+        return COST_OPERATOR + node_cost(node->expr.lhs) +
+               node_cost(node->expr.rhs);
+    case TYPE_RETURN:
+        return node_cost(node->return_expr.expr);
+    }
+
+    return 0;
+}
+
+static int node_list_cost(ast_node_list_t *nl)
+{
+    int cost = 0;
+
+    for (; nl; nl = nl->next)
+        cost += node_cost(nl->node);
+
+    return cost;
+}
+
+static void inline_node_list(inliner_t *in, ast_node_list_t *nl)
+{
+    for (; nl; nl = nl->next)
+        inline_node(in, nl->node);
+}
+
+/*
+ * the statements of a body. arguments that can't be substituted are bound
+ * to temporaries in cells in front of the statement's, in->statement
+ * follows the statement to the cell it ends up in.
+ */
+static void inline_statements(inliner_t *in, ast_node_list_t *nl)
+{
+    ast_node_list_t *outer = in->statement;
+
+    for (; nl; nl = nl->next) {
+        if (!nl->node)
+            continue;
+
+        in->statement = nl;
+        inline_node(in, nl->node);
+        nl = in->statement;
+    }
+
+    in->statement = outer;
+}
+
+/*
+ * operands are handled before the node itself, so the arguments of a call
+ * are already inlined when the call is.
+ */
+static void inline_node(inliner_t *in, ast_node_t *node)
+{
+    if (!node)
+        return;
+
+    switch (node->type) {
+    case TYPE_INT:
+    case TYPE_FLOAT:
+    case TYPE_STRING:
+    case TYPE_PROTO:
+    case TYPE_STRUCT:
+    case TYPE_FN:
+    case TYPE_IMPORT:
+        break;
+    case TYPE_LIST:
+        inline_node_list(in, node->list.values);
+        break;
+    case TYPE_VAR:
+        inline_node(in, node->var.v);
+        break;
+    case TYPE_CALL:
+        inline_node_list(in, node->call.args);
+        try_inline(in, node, node->call.name, NULL, node->call.args);
+        break;
+    case TYPE_CLOSURE:
+        inline_node_list(in, node->closure.captures);
+        break;
+    case TYPE_IF:
+        inline_node(in, node->if_expr.condition);
+        inline_statements(in, node->if_expr.true_body);
+        inline_statements(in, node->if_expr.false_body);
+        break;
+    case TYPE_EXPR:
+        inline_node(in, node->expr.lhs);
+
+        /* x |> f(y) is f(x, y), the call itself must not be inlined alone */
+        if (node->expr.operator && node->expr.operator->symbol == PIPE &&
+            node->expr.rhs && node->expr.rhs->type == TYPE_CALL) {
+            ast_node_t *call = node->expr.rhs;
+
+            inline_node_list(in, call->call.args);
+            try_inline(in, node, call->call.name, node->expr.lhs,
+                       call->call.args);
+            break;
+        }
+
+        inline_node(in, node->expr.rhs);
+        break;
+    case TYPE_RETURN:
+        inline_node(in, node->return_expr.expr);
+        break;
+    }
+}
+
+static bool try_inline(inliner_t *in, ast_node_t *site, const char *name,
+                       ast_node_t *piped, ast_node_list_t *args)
+{
+    cg_node_t *callee = callgraph_lookup(in->cg, name);
+
+    if (!callee)
+        return false;
+
+    ast_node_t *body = inline_body(callee, in->threshold);
+
+    if (!body)
+        return false;
+
+    ast_node_list_t *params = callee->clauses[0]->fn.prototype->prototype.args;
+    size_t n_params = 0, n_args = piped ? 1 : 0;
+
+    for (ast_node_list_t *nl = params; nl && nl->node; nl = nl->next)
+        ++n_params;
+
+    for (ast_node_list_t *nl = args; nl && nl->node; nl = nl->next)
+        ++n_args;
+
+    /* arity mismatches are reported by later passes, not silently fixed */
+    if (n_params != n_args)
+        return false;
+
+    int growth = node_cost(body) - COST_CALL;
+
+    if (growth > in->budget)
+        return false;
+
+    ast_node_t **param_nodes = smalloc(sizeof(ast_node_t *) * (n_params + 1));
+    ast_node_t **arg_nodes = smalloc(sizeof(ast_node_t *) * (n_args + 1));
+    size_t i = 0;
+
+    if (piped)
+        arg_nodes[i++] = piped;
+
+    for (ast_node_list_t *nl = args; nl && nl->node; nl = nl->next)
+        arg_nodes[i++] = nl->node;
+
+    i = 0;
+
+    for (ast_node_list_t *nl = params; nl && nl->node; nl = nl->next)
+        param_nodes[i++] = nl->node;
+
+    /*
+     * substituting an argument duplicates or drops it when the parameter
+     * isn't used exactly once, and moves it to where it's used. an argument
+     * with calls has to be used once, unconditionally, in argument order and
+     * before the body calls anything, so its effects happen as they would.
+     * other arguments can't be duplicated unless they're trivial. those
+     * that can't be substituted are bound to temporaries before the
+     * statement, along with every argument with calls before them. a
+     * parameter that is called is a closure, calls are by name and can't
+     * take an argument.
+     */
+    bool *in_place = smalloc(sizeof(bool) * (n_params + 1));
+    order_t order = { param_nodes, arg_nodes, n_params, 0, false, in_place };
+    size_t n_temps = 0;
+    bool ok = true;
+
+    for (i = 0; i < n_params; ++i) {
+        int uses = count_uses(body, param_nodes[i]->var.name);
+
+        in_place[i] = has_call(arg_nodes[i]) ? uses == 1
+                                             : uses <= 1 ||
+                                               is_trivial(arg_nodes[i]);
+
+        if (count_calls(body, param_nodes[i]->var.name))
+            ok = false;
+    }
+
+    order_uses(&order, body, false);
+
+    for (i = 0; i < n_params; ++i) {
+        if (!in_place[i])
+            n_temps = i + 1;
+    }
+
+    if (n_temps && !is_hoistable(in, site))
+        ok = false;
+
+    if (!ok) {
+        free(in_place);
+        free(param_nodes);
+        free(arg_nodes);
+        return false;
+    }
+
+    /* in_place now says which arguments are still the call's own nodes */
+    for (i = 0; i < n_temps; ++i) {
+        in_place[i] = in_place[i] && !has_call(arg_nodes[i]);
+
+        if (!in_place[i])
+            arg_nodes[i] = bind_temp(in, arg_nodes[i]);
+    }
+
+    ast_node_t *inlined = substitute(body, param_nodes, arg_nodes, n_params);
+
+    for (i = 0; i < n_temps; ++i) {
+        if (!in_place[i])
+            destroy_node(arg_nodes[i]);
+    }
+
+    free(in_place);
+    free(param_nodes);
+    free(arg_nodes);
+
+    verbose_printf("inlined call to '%s'", name);
+
+    replace_node(site, inlined);
+
+    in->budget -= growth;
+    ++in->inlined;
+
+    return true;
+}
+
+/*
+ * the expression a call to callee can be replaced with, or NULL if callee
+ * isn't a candidate: it has to be a single clause matching plain
+ * parameters, consisting of one expression that is cheap enough and
+ * doesn't bind a name anywhere, not even in the body of an if.
+ */
+static ast_node_t *inline_body(cg_node_t *callee, int threshold)
+{
+    if (callee->recursive || callee->n_clauses != 1)
+        return NULL;
+
+    ast_node_t *fn = callee->clauses[0];
+
+    if (!fn->fn.prototype || !fn->fn.body || fn->fn.body->next)
+        return NULL;
+
+    for (ast_node_list_t *nl = fn->fn.prototype->prototype.args;
+         nl && nl->node; nl = nl->next) {
+        /* literal patterns need clause dispatch, they can't be inlined */
+        if (nl->node->type != TYPE_VAR || nl->node->var.v)
+            return NULL;
+    }
+
+    ast_node_t *body = fn->fn.body->node;
+
+    if (body && body->type == TYPE_RETURN)
+        body = body->return_expr.expr;
+
+    if (!body || has_binding(body))
+        return NULL;
+
+    return node_cost(body) <= threshold ? body : NULL;
+}
+
+/*
+ * walk node in the order it's evaluated, clearing in_place for the
+ * arguments with calls whose parameter is used out of order.
+ */
+static void order_uses(order_t *o, ast_node_t *node, bool conditional)
+{
+    if (!node)
+        return;
+
+    switch (node->type) {
+    case TYPE_VAR:
+        if (node->var.v) {
+            order_uses(o, node->var.v, conditional);
+            break;
+        }
+
+        for (size_t i = 0; i < o->n; ++i) {
+            if (strcmp(node->var.name, o->params[i]->var.name) != 0 ||
+                !has_call(o->args[i]))
+                continue;
+
+            if (conditional || o->called || i < o->next)
+                o->in_place[i] = false;
+
+            o->next = i + 1;
+        }
+        break;
+    case TYPE_LIST:
+        order_list(o, node->list.values, conditional);
+        break;
+    case TYPE_CALL:
+        order_list(o, node->call.args, conditional);
+        o->called = true;
+        break;
+    case TYPE_CLOSURE:
+        order_list(o, node->closure.captures, conditional);
+        break;
+    case TYPE_IF:
+        order_uses(o, node->if_expr.condition, conditional);
+        order_list(o, node->if_expr.true_body, true);
+        order_list(o, node->if_expr.false_body, true);
+        break;
+    case TYPE_EXPR: {
+        token_type_t symbol = node->expr.operator ?
+                              node->expr.operator->symbol : PLUS;
+
+        order_uses(o, node->expr.lhs, conditional);
+        order_uses(o, node->expr.rhs, conditional || symbol == AND ||
+                                      symbol == OR);
+
+        /* x |> f calls f after evaluating x */
+        if (symbol == PIPE)
+            o->called = true;
+        break;
+    }
+    case TYPE_RETURN:
+        order_uses(o, node->return_expr.expr, conditional);
+        break;
+    default:
+        break;
+    }
+}
+
+static void order_list(order_t *o, ast_node_list_t *nl, bool conditional)
+{
+    for (; nl; nl = nl->next)
+        order_uses(o, nl->node, conditional);
+}
+
+/*
+ * whether evaluating arguments before the statement that contains site is
+ * the same as evaluating them at site: site has to be what the statement
+ * evaluates first and last, the statement itself or the value it binds or
+ * returns.
+ */
+static bool is_hoistable(inliner_t *in, ast_node_t *site)
+{
+    ast_node_t *statement = in->statement ? in->statement->node : NULL;
+
+    if (!statement)
+        return false;
+
+    return site == statement ||
+           (statement->type == TYPE_VAR && statement->var.v == site) ||
+           (statement->type == TYPE_RETURN &&
+            statement->return_expr.expr == site);
+}
+
+/*
+ * bind a copy of arg to a new name in front of the statement, and return a
+ * reference to it. the statement moves to a new cell after the binding.
+ */
+static ast_node_t *bind_temp(inliner_t *in, ast_node_t *arg)
+{
+    char name[32];
+    ast_node_list_t *cell = create_node_list();
+
+    snprintf(name, sizeof(name), "inline$%zu", ++in->temps);
+
+    cell->node = in->statement->node;
+    cell->next = in->statement->next;
+    in->statement->node = create_var(name, false, copy_node(arg));
+    in->statement->node->line_n = cell->node->line_n;
+    in->statement->next = cell;
+    in->statement = cell;
+
+    return create_var(name, false, NULL);
+}
+
+static bool is_trivial(ast_node_t *node)
+{
+    switch (node->type) {
+    case TYPE_INT:
+    case TYPE_FLOAT:
+        return true;
+    case TYPE_VAR:
+        return !node->var.v;
+    default:
+        return false;
+    }
+}
+
+static void find_binding(ast_node_t *node, void *data)
+{
+    if (node->type == TYPE_VAR && node->var.v)
+        *(bool *)data = true;
+}
+
+static bool has_binding(ast_node_t *node)
+{
+    bool found = false;
+
+    visit_node(node, find_binding, &found);
+
+    return found;
+}
+
+static void find_call(ast_node_t *node, void *data)
+{
+    if (node->type == TYPE_CALL)
+        *(bool *)data = true;
+}
+
+static bool has_call(ast_node_t *node)
+{
+    bool found = false;
+
+    visit_node(node, find_call, &found);
+
+    return found;
+}
+
+typedef struct {
+    const char *name;
+    int uses;
+} uses_t;
+
+static void find_use(ast_node_t *node, void *data)
+{
+    uses_t *u = data;
+
+    if (node->type == TYPE_VAR && !node->var.v &&
+        strcmp(node->var.name, u->name) == 0)
+        ++u->uses;
+}
+
+static int count_uses(ast_node_t *node, const char *name)
+{
+    uses_t u = { name, 0 };
+
+    visit_node(node, find_use, &u);
+
+    return u.uses;
+}
+
+static void find_named_call(ast_node_t *node, void *data)
+{
+    uses_t *u = data;
+    ast_node_t *rhs = node->type == TYPE_EXPR ? node->expr.rhs : NULL;
+
+    if (node->type == TYPE_CALL && strcmp(node->call.name, u->name) == 0)
+        ++u->uses;
+
+    /* x |> f calls f */
+    if (rhs && node->expr.operator && node->expr.operator->symbol == PIPE &&
+        rhs->type == TYPE_VAR && !rhs->var.v &&
+        strcmp(rhs->var.name, u->name) == 0)
+        ++u->uses;
+}
+
+static int count_calls(ast_node_t *node, const char *name)
+{
+    uses_t u = { name, 0 };
+
+    visit_node(node, find_named_call, &u);
+
+    return u.uses;
+}
+
+/* the values in a list, the arguments of a call or a closure's captures */
+static ast_node_list_t *operands(ast_node_t *node)
+{
+    switch (node->type) {
+    case TYPE_LIST:
+        return node->list.values;
+    case TYPE_CALL:
+        return node->call.args;
+    default:
+        return node->closure.captures;
+    }
+}
+
+/*
+ * copy node, replacing references to params with copies of args. inline_body
+ * rejects bodies that bind names of their own, so there's nothing that can
+ * be captured or shadowed.
+ */
+static ast_node_t *substitute(ast_node_t *node, ast_node_t **params,
+                              ast_node_t **args, size_t n)
+{
+    if (!node)
+        return NULL;
+
+    if (node->type == TYPE_VAR && !node->var.v) {
+        for (size_t i = 0; i < n; ++i) {
+            if (strcmp(node->var.name, params[i]->var.name) == 0)
+                return copy_node(args[i]);
+        }
+
+        return copy_node(node);
+    }
+
+    ast_node_t *copy = copy_node(node);
+
+    switch (copy->type) {
+    case TYPE_LIST:
+    case TYPE_CALL:
+    case TYPE_CLOSURE: {
+        ast_node_list_t *src = operands(node), *dst = operands(copy);
+
+        for (; src && dst; src = src->next, dst = dst->next) {
+            if (!dst->node)
+                continue;
+
+            destroy_node(dst->node);
+            dst->node = substitute(src->node, params, args, n);
+        }
+        break;
+    }
+    case TYPE_IF:
+        destroy_node(copy->if_expr.condition);
+        copy->if_expr.condition = substitute(node->if_expr.condition, params,
+                                             args, n);
+
+        for (ast_node_list_t *s = node->if_expr.true_body,
+                             *d = copy->if_expr.true_body;
+             s && d; s = s->next, d = d->next) {
+            destroy_node(d->node);
+            d->node = substitute(s->node, params, args, n);
+        }
+
+        for (ast_node_list_t *s = node->if_expr.false_body,
+                             *d = copy->if_expr.false_body;
+             s && d; s = s->next, d = d->next) {
+            destroy_node(d->node);
+            d->node = substitute(s->node, params, args, n);
+        }
+        break;
+    case TYPE_EXPR:
+        destroy_node(copy->expr.lhs);
+        destroy_node(copy->expr.rhs);
+        copy->expr.lhs = substitute(node->expr.lhs, params, args, n);
+        copy->expr.rhs = substitute(node->expr.rhs, params, args, n);
+        break;
+    case TYPE_RETURN:
+        destroy_node(copy->return_expr.expr);
+        copy->return_expr.expr = substitute(node->return_expr.expr, params,
+                                            args, n);
+        break;
+    default:
+        break;
+    }
+
+    return copy;
+}
+
+/*
+ * overwrite dst with src in place, so whatever points at dst sees the
+ * replacement. dst's old contents are destroyed and src's shell is freed.
+ */
+static void replace_node(ast_node_t *dst, ast_node_t *src)
+{
+    ast_node_t *old = smalloc(sizeof(ast_node_t));
+
+    *old = *dst;
+    *dst = *src;
+
+    free(src);
+    destroy_node(old);
+}
@@ -0,0 +1,44 @@
+/*
+ * Copyright (C) 2015 soud
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef INLINE_H
+#define INLINE_H
+
+#include "ast.h"
+
+#define DEFAULT_INLINE_THRESHOLD 25
+
+/* a caller stops receiving inlined bodies once it grows past this factor */
+#define INLINE_GROWTH_FACTOR 4
+
+/*
+ * with a profile, clauses run at least 1 / INLINE_HOT_FRACTION as often as
+ * the hottest one inline up to INLINE_HOT_FACTOR times the threshold, and
+ * clauses that never ran don't inline at all.
+ */
+#define INLINE_HOT_FRACTION 10
+#define INLINE_HOT_FACTOR 4
+
+size_t inline_functions(ast_node_list_t *ast, int threshold);
+int node_cost(ast_node_t *node);
+
+#endif /* !INLINE_H */
@@ -0,0 +1,830 @@
+/*
+ * Copyright (C) 2015 soud
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * running programs in memory with LLVM's ORC JIT. every function is
+ * reached through a lazy stub: the first call generates, optimizes and
+ * compiles only that function, then patches the stub to jump to it. a
+ * function is defined as <symbol>.impl and calls other functions through
+ * their stubs, so nothing is compiled before it's needed.
+ *
+ * the tiered JIT starts every function unoptimized, which compiles much
+ * faster, and counts its calls and loop iterations. a function whose count
+ * reaches TIER_UP_THRESHOLD is optimized by a background thread as
+ * <symbol>.opt. calls go through a table the optimized code is swapped into,
+ * so every later call runs it. a call that is already running keeps running
+ * the unoptimized code.
+ *
+ * the JIT's code is registered with gdb. with perf, every function is also
+ * written to /tmp/perf-<pid>.map once it's compiled, and LLVM writes a
+ * jitdump for perf inject.
+ */
+
+#include <inttypes.h>
+#include <llvm-c/Error.h>
+#include <llvm-c/ExecutionEngine.h>
+#include <llvm-c/LLJIT.h>
+#include <llvm-c/Object.h>
+#include <llvm-c/Orc.h>
+#include <llvm-c/OrcEE.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "codegen.h"
+#include "dce.h"
+#include "emit.h"
+#include "jit.h"
+#include "../runtime/runtime.h"
+
+typedef struct {
+    eir_module_t *m;
+    LLVMOrcLLJITRef jit;
+
+    /* only used by the optimization pipeline, which isn't thread-safe */
+    LLVMTargetMachineRef tm;
+    pthread_mutex_t tm_lock;
+    int opt_level;
+
+    /* only for the tiered JIT */
+    bool tiered;
+    codegen_tiers_t tiers;
+    eir_fn_t **fns;
+    size_t n_fns;
+
+    /* functions waiting to be optimized, in the order they got hot */
+    size_t *queue;
+    size_t queue_head;
+    size_t queue_tail;
+    bool *queued;
+    bool stopping;
+    pthread_mutex_t queue_lock;
+    pthread_cond_t queue_cond;
+    pthread_t tier_thread;
+    bool tier_thread_started;
+
+    /* only with perf: the perf map, and the code that isn't in it yet */
+    FILE *perf_map;
+    char **unmapped;
+    uint64_t *unmapped_sizes;
+    size_t n_unmapped;
+    pthread_mutex_t perf_lock;
+} jit_t;
+
+typedef struct {
+    jit_t *jit;
+    eir_fn_t *fn;
+    char *symbol;
+} lazy_fn_t;
+
+/* the runtime is linked into erupt, generated code calls it directly */
+static const struct {
+    const char *name;
+    void *address;
+} runtime_symbols[] = {
+    { "erupt_panic", (void *)erupt_panic },
+    { "erupt_nomatch", (void *)erupt_nomatch },
+    { "erupt_float_box", (void *)erupt_float_box },
+    { "erupt_int_add", (void *)erupt_int_add },
+    { "erupt_int_sub", (void *)erupt_int_sub },
+    { "erupt_int_mul", (void *)erupt_int_mul },
+    { "erupt_int_div", (void *)erupt_int_div },
+    { "erupt_int_mod", (void *)erupt_int_mod },
+    { "erupt_int_pow", (void *)erupt_int_pow },
+    { "erupt_int_neg", (void *)erupt_int_neg },
+    { "erupt_int_and", (void *)erupt_int_and },
+    { "erupt_int_or", (void *)erupt_int_or },
+    { "erupt_int_xor", (void *)erupt_int_xor },
+    { "erupt_int_not", (void *)erupt_int_not },
+    { "erupt_int_shl", (void *)erupt_int_shl },
+    { "erupt_int_shr", (void *)erupt_int_shr },
+    { "erupt_int_compare", (void *)erupt_int_compare },
+    { "erupt_int_to_float", (void *)erupt_int_to_float },
+    { "erupt_int_from_float", (void *)erupt_int_from_float },
+    { "erupt_int_from_int64", (void *)erupt_int_from_int64 },
+    { "erupt_int_wrap", (void *)erupt_int_wrap },
+    { "erupt_int_parse", (void *)erupt_int_parse },
+    { "erupt_print_int", (void *)erupt_print_int },
+    { "erupt_print_float", (void *)erupt_print_float },
+    { "erupt_print_bool", (void *)erupt_print_bool },
+    { "erupt_print_string", (void *)erupt_print_string },
+    { "erupt_print_list", (void *)erupt_print_list },
+    { "erupt_io_flush", (void *)erupt_io_flush },
+    { "erupt_string_concat", (void *)erupt_string_concat },
+    { "erupt_string_compare", (void *)erupt_string_compare },
+    { "erupt_list_from", (void *)erupt_list_from },
+    { "erupt_list_concat", (void *)erupt_list_concat },
+    { "erupt_list_compare", (void *)erupt_list_compare },
+    { "erupt_closure_from", (void *)erupt_closure_from },
+    { "erupt_apply_error", (void *)erupt_apply_error },
+    { "erupt_fork", (void *)erupt_fork },
+    { "erupt_join", (void *)erupt_join }
+};
+
+#define N_RUNTIME_SYMBOLS (sizeof runtime_symbols / sizeof runtime_symbols[0])
+
+static LLVMOrcLLJITRef create_jit(jit_t *j, int opt_level);
+static LLVMOrcObjectLayerRef create_object_layer(void *ctx,
+                                                 LLVMOrcExecutionSessionRef es,
+                                                 const char *triple);
+static bool open_perf_map(jit_t *j);
+static void close_perf_map(jit_t *j);
+static LLVMErrorRef find_symbols(void *ctx, LLVMMemoryBufferRef *object);
+static void write_perf_map(jit_t *j);
+static bool define_runtime(LLVMOrcLLJITRef jit);
+static bool define_lazy_fns(jit_t *j, LLVMOrcLazyCallThroughManagerRef lctm,
+                            LLVMOrcIndirectStubsManagerRef ism);
+static int call_main(eir_fn_t *main_fn, LLVMOrcExecutorAddress address);
+static bool start_tiers(jit_t *j);
+static void stop_tiers(jit_t *j);
+static void tier_up(void *arg, int64_t index);
+static void *tier_up_worker(void *arg);
+static void optimize_fn(jit_t *j, eir_fn_t *fn);
+static void materialize_fn(void *ctx,
+                           LLVMOrcMaterializationResponsibilityRef mr);
+static void discard_fn(void *ctx, LLVMOrcJITDylibRef jd,
+                       LLVMOrcSymbolStringPoolEntryRef symbol);
+static void destroy_fn(void *ctx);
+static LLVMErrorRef optimize_transform(void *ctx,
+                                       LLVMOrcThreadSafeModuleRef *tsm,
+                                       LLVMOrcMaterializationResponsibilityRef
+                                       mr);
+static LLVMErrorRef optimize_jit_module(void *ctx, LLVMModuleRef mod);
+/* /tmp/perf-<pid>.map, where perf looks for the symbols of JIT-ed code */
+static bool open_perf_map(jit_t *j)
+{
+    char path[sizeof("/tmp/perf-.map") + 3 * sizeof(pid_t)];
+
+    sprintf(path, "/tmp/perf-%ld.map", (long)getpid());
+
+    if (!(j->perf_map = fopen(path, "w"))) {
+        erupt_error("couldn't open '%s' for writing", path);
+        return false;
+    }
+
+    return true;
+}
+
+static void close_perf_map(jit_t *j)
+{
+    if (j->perf_map)
+        fclose(j->perf_map);
+
+    for (size_t i = 0; i < j->n_unmapped; ++i)
+        free(j->unmapped[i]);
+
+    free(j->unmapped);
+    free(j->unmapped_sizes);
+}
+
+/*
+ * remember the functions an object defines and their sizes, for the perf
+ * map. their addresses are only known once the object is linked.
+ */
+static LLVMErrorRef find_symbols(void *ctx, LLVMMemoryBufferRef *object)
+{
+    jit_t *j = ctx;
+    char *msg = NULL;
+    LLVMBinaryRef binary = LLVMCreateBinary(*object, NULL, &msg);
+
+    if (!binary) {
+        LLVMDisposeMessage(msg);
+        return LLVMErrorSuccess;
+    }
+
+    LLVMSymbolIteratorRef sym = LLVMObjectFileCopySymbolIterator(binary);
+
+    pthread_mutex_lock(&j->perf_lock);
+
+    for (; !LLVMObjectFileIsSymbolIteratorAtEnd(binary, sym);
+         LLVMMoveToNextSymbol(sym)) {
+        const char *name = LLVMGetSymbolName(sym);
+        uint64_t size = LLVMGetSymbolSize(sym);
+
+        /* task thunks are local to their object and can't be looked up */
+        if (size == 0 || strncmp(name, SYMBOL_PREFIX,
+                                 strlen(SYMBOL_PREFIX)) != 0 ||
+            strstr(name, ".task"))
+            continue;
+
+        j->unmapped = srealloc(j->unmapped,
+                               sizeof(char *) * (j->n_unmapped + 1));
+        j->unmapped_sizes = srealloc(j->unmapped_sizes,
+                                     sizeof(uint64_t) * (j->n_unmapped + 1));
+        j->unmapped[j->n_unmapped] = strdup(name);
+        j->unmapped_sizes[j->n_unmapped++] = size;
+    }
+
+    pthread_mutex_unlock(&j->perf_lock);
+
+    LLVMDisposeSymbolIterator(sym);
+    LLVMDisposeBinary(binary);
+
+    return LLVMErrorSuccess;
+}
+
+/*
+ * add the code compiled since the last time to the perf map, named after
+ * the function in the source and where its clauses start, like
+ * "fib (fib.er:1)". optimized code is marked as such.
+ */
+static void write_perf_map(jit_t *j)
+{
+    pthread_mutex_lock(&j->perf_lock);
+
+    char **names = j->unmapped;
+    uint64_t *sizes = j->unmapped_sizes;
+    size_t n = j->n_unmapped;
+
+    j->unmapped = NULL;
+    j->unmapped_sizes = NULL;
+    j->n_unmapped = 0;
+
+    pthread_mutex_unlock(&j->perf_lock);
+
+    for (size_t i = 0; i < n; ++i) {
+        LLVMOrcExecutorAddress address = 0;
+        LLVMErrorRef err = LLVMOrcLLJITLookup(j->jit, &address, names[i]);
+
+        if (err) {
+            LLVMConsumeError(err);
+            free(names[i]);
+            continue;
+        }
+
+        /* er.<name>.impl or er.<name>.opt */
+        char *name = names[i] + strlen(SYMBOL_PREFIX);
+        char *suffix = strrchr(name, '.');
+        bool optimized = suffix && strcmp(suffix, JIT_OPT_SUFFIX) == 0;
+
+        if (suffix && (optimized || strcmp(suffix, JIT_IMPL_SUFFIX) == 0))
+            *suffix = '\0';
+
+        eir_fn_t *fn = eir_lookup_fn(j->m, name);
+
+        pthread_mutex_lock(&j->perf_lock);
+        fprintf(j->perf_map, "%" PRIx64 " %" PRIx64 " %s", address, sizes[i],
+                name);
+
+        if (fn && fn->line_n)
+            fprintf(j->perf_map, " (%s:%zu)", j->m->name, fn->line_n);
+
+        fputs(optimized ? " [optimized]\n" : "\n", j->perf_map);
+        fflush(j->perf_map);
+        pthread_mutex_unlock(&j->perf_lock);
+
+        free(names[i]);
+    }
+
+    free(names);
+    free(sizes);
+}
+
+static void report_error(void *ctx, LLVMErrorRef err);
+static bool check(LLVMErrorRef err, const char *what);
+static void lazy_call_failed(void);
+
+/*
+ * compile m in memory and run its main function. *status is main's result
+ * if it's an int, otherwise 0. when tiered, functions are only optimized
+ * once they're hot. with perf, the compiled code is described for perf.
+ * returns false if the program couldn't be started, after reporting why.
+ */
+bool run_jit(eir_module_t *m, int opt_level, bool tiered, bool perf,
+             int *status)
+{
+    eir_fn_t *main_fn = eir_lookup_fn(m, ENTRY_POINT);
+    LLVMOrcLazyCallThroughManagerRef lctm = NULL;
+    LLVMOrcIndirectStubsManagerRef ism = NULL;
+    LLVMOrcExecutorAddress address = 0;
+    char *main_symbol = NULL;
+    jit_t j;
+    bool ok = false;
+
+    if (!main_fn) {
+        erupt_error("'%s' has no %s function", m->name, ENTRY_POINT);
+        return false;
+    }
+
+    memset(&j, 0, sizeof(jit_t));
+    j.m = m;
+    j.opt_level = opt_level;
+    j.tiered = tiered;
+    j.tm = create_target_machine(opt_level);
+    pthread_mutex_init(&j.tm_lock, NULL);
+    pthread_mutex_init(&j.perf_lock, NULL);
+
+    /* in the tiered JIT, the JIT's own pipeline only compiles the first tier */
+    if (!j.tm || (perf && !open_perf_map(&j)) ||
+        !(j.jit = create_jit(&j, tiered ? 0 : opt_level))) {
+        if (j.tm)
+            LLVMDisposeTargetMachine(j.tm);
+
+        close_perf_map(&j);
+
+        return false;
+    }
+
+    main_symbol = codegen_symbol(ENTRY_POINT);
+
+    const char *triple = LLVMOrcLLJITGetTripleString(j.jit);
+    LLVMOrcExecutionSessionRef es = LLVMOrcLLJITGetExecutionSession(j.jit);
+
+    LLVMOrcExecutionSessionSetErrorReporter(es, report_error, NULL);
+    LLVMOrcIRTransformLayerSetTransform(LLVMOrcLLJITGetIRTransformLayer(j.jit),
+                                        optimize_transform, &j);
+
+    if (j.perf_map)
+        LLVMOrcObjectTransformLayerSetTransform(
+            LLVMOrcLLJITGetObjTransformLayer(j.jit), find_symbols, &j);
+
+    if (define_runtime(j.jit) &&
+        check(LLVMOrcCreateLocalLazyCallThroughManager(
+                  triple, es, (LLVMOrcJITTargetAddress)(uintptr_t)
+                  lazy_call_failed, &lctm),
+              "creating lazy call-through manager") &&
+        (ism = LLVMOrcCreateLocalIndirectStubsManager(triple)) &&
+        define_lazy_fns(&j, lctm, ism) &&
+        (!tiered || start_tiers(&j)) &&
+        check(LLVMOrcLLJITLookup(j.jit, &address, main_symbol),
+              "looking up main")) {
+        verbose_printf("running '%s'", m->name);
+
+        *status = call_main(main_fn, address);
+        erupt_io_flush();
+        ok = true;
+    }
+
+    if (tiered)
+        stop_tiers(&j);
+
+    if (j.perf_map)
+        write_perf_map(&j);
+
+    /* the stubs go before the JIT, like in LLVM's own lazy JIT */
+    if (ism)
+        LLVMOrcDisposeIndirectStubsManager(ism);
+
+    if (lctm)
+        LLVMOrcDisposeLazyCallThroughManager(lctm);
+
+    check(LLVMOrcDisposeLLJIT(j.jit), "shutting down JIT");
+
+    LLVMDisposeTargetMachine(j.tm);
+    pthread_mutex_destroy(&j.tm_lock);
+    close_perf_map(&j);
+    pthread_mutex_destroy(&j.perf_lock);
+    free(main_symbol);
+
+    return ok;
+}
+
+static LLVMOrcLLJITRef create_jit(jit_t *j, int opt_level)
+{
+    LLVMOrcLLJITRef jit = NULL;
+    LLVMTargetMachineRef tm = create_target_machine(opt_level);
+    LLVMOrcLLJITBuilderRef builder = LLVMOrcCreateLLJITBuilder();
+
+    if (!tm) {
+        LLVMOrcDisposeLLJITBuilder(builder);
+        return NULL;
+    }
+
+    /* the builder takes the target machine, the JIT takes the builder */
+    LLVMOrcLLJITBuilderSetJITTargetMachineBuilder(
+        builder, LLVMOrcJITTargetMachineBuilderCreateFromTargetMachine(tm)
+    );
+    LLVMOrcLLJITBuilderSetObjectLinkingLayerCreator(builder,
+                                                    create_object_layer, j);
+
+    if (!check(LLVMOrcCreateLLJIT(&jit, builder), "creating JIT"))
+        return NULL;
+
+    return jit;
+}
+
+/* LLVM's own linking layer, with the listeners for gdb and perf */
+static LLVMOrcObjectLayerRef create_object_layer(void *ctx,
+                                                 LLVMOrcExecutionSessionRef es,
+                                                 const char *triple)
+{
+    jit_t *j = ctx;
+    LLVMOrcObjectLayerRef layer =
+        LLVMOrcCreateRTDyldObjectLinkingLayerWithSectionMemoryManager(es);
+    LLVMJITEventListenerRef gdb = LLVMCreateGDBRegistrationListener();
+    LLVMJITEventListenerRef perf = j->perf_map ?
+                                   LLVMCreatePerfJITEventListener() : NULL;
+
+    (void)triple;
+
+    if (gdb)
+        LLVMOrcRTDyldObjectLinkingLayerRegisterJITEventListener(layer, gdb);
+
+    /* NULL if LLVM was built without perf support */
+    if (perf)
+        LLVMOrcRTDyldObjectLinkingLayerRegisterJITEventListener(layer, perf);
+
+    return layer;
+}
+
+/* the runtime, and the C library for whatever LLVM generates calls to */
+static bool define_runtime(LLVMOrcLLJITRef jit)
+{
+    LLVMOrcJITDylibRef jd = LLVMOrcLLJITGetMainJITDylib(jit);
+    LLVMJITCSymbolMapPair symbols[N_RUNTIME_SYMBOLS];
+    LLVMOrcDefinitionGeneratorRef process = NULL;
+
+    for (size_t i = 0; i < N_RUNTIME_SYMBOLS; ++i) {
+        symbols[i].Name = LLVMOrcLLJITMangleAndIntern(jit,
+                                                      runtime_symbols[i].name);
+        symbols[i].Sym.Address = (uintptr_t)runtime_symbols[i].address;
+        symbols[i].Sym.Flags.GenericFlags = LLVMJITSymbolGenericFlagsExported |
+                                            LLVMJITSymbolGenericFlagsCallable;
+        symbols[i].Sym.Flags.TargetFlags = 0;
+    }
+
+    if (!check(LLVMOrcJITDylibDefine(jd, LLVMOrcAbsoluteSymbols(
+                   symbols, N_RUNTIME_SYMBOLS)), "defining runtime"))
+        return false;
+
+    if (!check(LLVMOrcCreateDynamicLibrarySearchGeneratorForProcess(
+                   &process, LLVMOrcLLJITGetGlobalPrefix(jit), NULL, NULL),
+               "searching process symbols"))
+        return false;
+
+    LLVMOrcJITDylibAddGenerator(jd, process);
+
+    return true;
+}
+
+/*
+ * define every function as <symbol>.impl, which is only generated when
+ * looked up, and <symbol> as a stub that looks it up on its first call.
+ */
+static bool define_lazy_fns(jit_t *j, LLVMOrcLazyCallThroughManagerRef lctm,
+                            LLVMOrcIndirectStubsManagerRef ism)
+{
+    LLVMOrcJITDylibRef jd = LLVMOrcLLJITGetMainJITDylib(j->jit);
+    LLVMJITSymbolFlags flags = {
+        LLVMJITSymbolGenericFlagsExported | LLVMJITSymbolGenericFlagsCallable,
+        0
+    };
+    LLVMOrcCSymbolAliasMapPairs stubs = NULL;
+    size_t n = 0;
+
+    for (eir_fn_t *fn = j->m->first; fn; fn = fn->next, ++n) {
+        char *symbol = codegen_symbol(fn->name);
+        lazy_fn_t *lazy = smalloc(sizeof(lazy_fn_t));
+
+        lazy->jit = j;
+        lazy->fn = fn;
+        lazy->symbol = smalloc(strlen(symbol) + sizeof(JIT_IMPL_SUFFIX));
+        sprintf(lazy->symbol, "%s" JIT_IMPL_SUFFIX, symbol);
+
+        LLVMOrcCSymbolFlagsMapPair impl = {
+            LLVMOrcLLJITMangleAndIntern(j->jit, lazy->symbol), flags
+        };
+
+        if (!check(LLVMOrcJITDylibDefine(jd,
+                       LLVMOrcCreateCustomMaterializationUnit(
+                           lazy->symbol, lazy, &impl, 1, NULL, materialize_fn,
+                           discard_fn, destroy_fn
+                       )), "defining function")) {
+            free(symbol);
+            free(stubs);
+            return false;
+        }
+
+        stubs = srealloc(stubs, sizeof(LLVMOrcCSymbolAliasMapPair) * (n + 1));
+        stubs[n].Name = LLVMOrcLLJITMangleAndIntern(j->jit, symbol);
+        stubs[n].Entry.Name = LLVMOrcLLJITMangleAndIntern(j->jit,
+                                                          lazy->symbol);
+        stubs[n].Entry.Flags = flags;
+
+        free(symbol);
+    }
+
+    bool ok = check(LLVMOrcJITDylibDefine(jd, LLVMOrcLazyReexports(
+                        lctm, ism, jd, stubs, n)), "defining stubs");
+
+    free(stubs);
+
+    return ok;
+}
+
+static int call_main(eir_fn_t *main_fn, LLVMOrcExecutorAddress address)
+{
+    if (main_fn->ret == EIR_FLOAT) {
+        ((double (*)(void))(uintptr_t)address)();
+        return 0;
+    }
+
+    if (main_fn->ret == EIR_BOOL) {
+        ((bool (*)(void))(uintptr_t)address)();
+        return 0;
+    }
+
+    int64_t result = ((int64_t (*)(void))(uintptr_t)address)();
+
+    return main_fn->ret == EIR_INT ? (int)erupt_int_wrap(result) : 0;
+}
+
+/*
+ * fill the table with every function's stub, and start the thread that
+ * optimizes hot functions.
+ */
+static bool start_tiers(jit_t *j)
+{
+    for (eir_fn_t *fn = j->m->first; fn; fn = fn->next) {
+        if (fn->index >= j->n_fns)
+            j->n_fns = fn->index + 1;
+    }
+
+    j->fns = scalloc(j->n_fns + 1, sizeof(eir_fn_t *));
+    j->queue = smalloc(sizeof(size_t) * (j->n_fns + 1));
+    j->queued = scalloc(j->n_fns + 1, sizeof(bool));
+    j->tiers.table = scalloc(j->n_fns + 1, sizeof(void *));
+    j->tiers.counters = scalloc(j->n_fns + 1, sizeof(uint32_t));
+    j->tiers.threshold = TIER_UP_THRESHOLD;
+    j->tiers.tier_up = tier_up;
+    j->tiers.arg = j;
+    pthread_mutex_init(&j->queue_lock, NULL);
+    pthread_cond_init(&j->queue_cond, NULL);
+
+    for (eir_fn_t *fn = j->m->first; fn; fn = fn->next) {
+        char *symbol = codegen_symbol(fn->name);
+        LLVMOrcExecutorAddress stub = 0;
+        bool found = check(LLVMOrcLLJITLookup(j->jit, &stub, symbol),
+                           "looking up stub");
+
+        free(symbol);
+
+        if (!found)
+            return false;
+
+        j->fns[fn->index] = fn;
+        j->tiers.table[fn->index] = (void *)(uintptr_t)stub;
+    }
+
+    if (pthread_create(&j->tier_thread, NULL, tier_up_worker, j) != 0) {
+        erupt_error("couldn't start the thread that optimizes hot code");
+        return false;
+    }
+
+    j->tier_thread_started = true;
+
+    return true;
+}
+
+/*
+ * wait for the optimization in progress and release the tiers. with a perf
+ * map, what's still queued is optimized first, so the map has every
+ * function that got hot, however soon the program ended after.
+ */
+static void stop_tiers(jit_t *j)
+{
+    if (j->tier_thread_started) {
+        pthread_mutex_lock(&j->queue_lock);
+        j->stopping = true;
+        pthread_cond_signal(&j->queue_cond);
+        pthread_mutex_unlock(&j->queue_lock);
+        pthread_join(j->tier_thread, NULL);
+    }
+
+    if (j->fns) {
+        pthread_mutex_destroy(&j->queue_lock);
+        pthread_cond_destroy(&j->queue_cond);
+    }
+
+    free(j->fns);
+    free(j->queue);
+    free(j->queued);
+    free(j->tiers.table);
+    free(j->tiers.counters);
+}
+
+/* called by unoptimized code when the function index gets hot */
+static void tier_up(void *arg, int64_t index)
+{
+    jit_t *j = arg;
+
+    pthread_mutex_lock(&j->queue_lock);
+
+    if (!j->queued[index]) {
+        j->queued[index] = true;
+        j->queue[j->queue_tail++] = (size_t)index;
+        pthread_cond_signal(&j->queue_cond);
+    }
+
+    pthread_mutex_unlock(&j->queue_lock);
+}
+
+static void *tier_up_worker(void *arg)
+{
+    jit_t *j = arg;
+
+    pthread_mutex_lock(&j->queue_lock);
+
+    while (!j->stopping || j->perf_map) {
+        if (j->queue_head == j->queue_tail) {
+            if (j->stopping)
+                break;
+
+            pthread_cond_wait(&j->queue_cond, &j->queue_lock);
+            continue;
+        }
+
+        eir_fn_t *fn = j->fns[j->queue[j->queue_head++]];
+
+        pthread_mutex_unlock(&j->queue_lock);
+        optimize_fn(j, fn);
+        pthread_mutex_lock(&j->queue_lock);
+    }
+
+    pthread_mutex_unlock(&j->queue_lock);
+
+    return NULL;
+}
+
+/*
+ * compile fn with every optimization and swap it into the table. if that
+ * fails the unoptimized code just keeps running.
+ */
+static void optimize_fn(jit_t *j, eir_fn_t *fn)
+{
+    char *base = codegen_symbol(fn->name);
+    char *symbol = smalloc(strlen(base) + sizeof(JIT_OPT_SUFFIX));
+    LLVMContextRef ctx = LLVMContextCreate();
+    codegen_tiers_t tiers = j->tiers;
+    LLVMMemoryBufferRef object = NULL;
+    LLVMOrcExecutorAddress address = 0;
+    char *msg = NULL;
+
+    sprintf(symbol, "%s" JIT_OPT_SUFFIX, base);
+    free(base);
+
+    /* optimized code isn't counted, there's no tier above it */
+    tiers.counters = NULL;
+
+    LLVMModuleRef mod = codegen_tiered_fn(j->m, fn, symbol, &tiers, ctx);
+
+    pthread_mutex_lock(&j->tm_lock);
+
+    if (mod && optimize_module(mod, j->tm, j->opt_level) &&
+        LLVMTargetMachineEmitToMemoryBuffer(j->tm, mod, LLVMObjectFile, &msg,
+                                            &object)) {
+        erupt_error("couldn't emit '%s': %s", fn->name, msg);
+        LLVMDisposeMessage(msg);
+        object = NULL;
+    }
+
+    pthread_mutex_unlock(&j->tm_lock);
+
+    if (mod)
+        LLVMDisposeModule(mod);
+
+    LLVMContextDispose(ctx);
+
+    /* the JIT takes the object */
+    if (object &&
+        check(LLVMOrcLLJITAddObjectFile(j->jit,
+                                        LLVMOrcLLJITGetMainJITDylib(j->jit),
+                                        object), "adding optimized code") &&
+        check(LLVMOrcLLJITLookup(j->jit, &address, symbol),
+              "looking up optimized code")) {
+        __atomic_store_n(&j->tiers.table[fn->index],
+                         (void *)(uintptr_t)address, __ATOMIC_RELEASE);
+
+        if (j->perf_map)
+            write_perf_map(j);
+
+        verbose_printf("optimized '%s'", fn->name);
+    }
+
+    free(symbol);
+}
+
+/* generate a function on its first call, in a context of its own */
+static void materialize_fn(void *ctx,
+                           LLVMOrcMaterializationResponsibilityRef mr)
+{
+    lazy_fn_t *lazy = ctx;
+    jit_t *j = lazy->jit;
+
+    verbose_printf("compiling '%s'", lazy->fn->name);
+
+    /* what was compiled before has been linked by now */
+    if (j->perf_map)
+        write_perf_map(j);
+
+    LLVMOrcThreadSafeContextRef tsc = LLVMOrcCreateNewThreadSafeContext();
+    LLVMContextRef llvm_ctx = LLVMOrcThreadSafeContextGetContext(tsc);
+    LLVMModuleRef mod = j->tiered ?
+                        codegen_tiered_fn(j->m, lazy->fn, lazy->symbol,
+                                          &j->tiers, llvm_ctx) :
+                        codegen_fn(j->m, lazy->fn, lazy->symbol, llvm_ctx);
+
+    if (!mod) {
+        LLVMOrcMaterializationResponsibilityFailMaterialization(mr);
+        LLVMOrcDisposeMaterializationResponsibility(mr);
+        LLVMOrcDisposeThreadSafeContext(tsc);
+
+        return;
+    }
+
+    /* the module keeps the context alive */
+    LLVMOrcThreadSafeModuleRef tsm = LLVMOrcCreateNewThreadSafeModule(mod,
+                                                                      tsc);
+
+    LLVMOrcDisposeThreadSafeContext(tsc);
+    LLVMOrcIRTransformLayerEmit(LLVMOrcLLJITGetIRTransformLayer(lazy->jit->jit),
+                                mr, tsm);
+}
+
+static void discard_fn(void *ctx, LLVMOrcJITDylibRef jd,
+                       LLVMOrcSymbolStringPoolEntryRef symbol)
+{
+    (void)ctx;
+    (void)jd;
+    (void)symbol;
+}
+
+static void destroy_fn(void *ctx)
+{
+    lazy_fn_t *lazy = ctx;
+
+    free(lazy->symbol);
+    free(lazy);
+}
+
+static LLVMErrorRef optimize_transform(void *ctx,
+                                       LLVMOrcThreadSafeModuleRef *tsm,
+                                       LLVMOrcMaterializationResponsibilityRef
+                                       mr)
+{
+    (void)mr;
+
+    return LLVMOrcThreadSafeModuleWithModuleDo(*tsm, optimize_jit_module,
+                                               ctx);
+}
+
+static LLVMErrorRef optimize_jit_module(void *ctx, LLVMModuleRef mod)
+{
+    jit_t *j = ctx;
+
+    /* the first tier is left unoptimized, it has to compile fast */
+    if (j->tiered)
+        return LLVMErrorSuccess;
+
+    pthread_mutex_lock(&j->tm_lock);
+
+    bool ok = optimize_module(mod, j->tm, j->opt_level);
+
+    pthread_mutex_unlock(&j->tm_lock);
+
+    return ok ? LLVMErrorSuccess : LLVMCreateStringError("optimizing failed");
+}
+
+static void report_error(void *ctx, LLVMErrorRef err)
+{
+    (void)ctx;
+
+    check(err, "JIT");
+}
+
+/* report err if there is one, returns whether there wasn't */
+static bool check(LLVMErrorRef err, const char *what)
+{
+    if (!err)
+        return true;
+
+    char *msg = LLVMGetErrorMessage(err);
+
+    erupt_error("%s failed: %s", what, msg);
+    LLVMDisposeErrorMessage(msg);
+
+    return false;
+}
+
+static void lazy_call_failed(void)
+{
+    erupt_panic("a function couldn't be compiled");
+}
@@ -21,6 +21,7 @@
  */
 
 #include "lexer.h"
+#include "number.h"
 
 static lexer_t *create_lexer(const char *target, const char *source);
 static char current(lexer_t *l);
@@ -28,6 +29,7 @@ static char peek(lexer_t *l);
 static char eat(lexer_t *l);
 static void emit(lexer_t *l, token_type_t type);
 static void raw_emit(lexer_t *l, char *value, token_type_t type);
+static void *allocate(lexer_t *l, size_t size);
 static bool is_number(char c);
 static bool is_ident(char c);
 static bool is_whitespace(char c);
@@ -37,6 +39,23 @@ static void read_ident(lexer_t *l);
 static void read_comment(lexer_t *l);
 static void switch_eq(lexer_t *l, token_type_t tok_a, token_type_t tok_b);
 static char *current_token(lexer_t *l);
+static char *big_digits(lexer_t *l);
+/* the current token without underscores, from the current chunk */
+static char *big_digits(lexer_t *l)
+{
+    char *digits = allocate(l, sizeof(char) * (l->pos - l->start) + 1);
+    char *q = digits;
+
+    for (size_t i = l->start; i < l->pos; ++i) {
+        if (l->source[i] != '_')
+            *q++ = l->source[i];
+    }
+
+    *q = '\0';
+
+    return digits;
+}
+
 static void unquote(char **s, char quote);
 
 static const keyword_t keywords[] = {
@@ -182,6 +201,7 @@ static lexer_t *create_lexer(const char *target, const char *source)
 
     l->target = target;
     l->source = source;
+    l->length = strlen(source);
 
     l->line_n = 1;
     l->start = 0;
@@ -191,6 +211,7 @@ static lexer_t *create_lexer(const char *target, const char *source)
 
     l->tail = NULL;
     l->tokens = NULL;
+    l->chunks = NULL;
 
     return l;
 }
@@ -222,7 +243,9 @@ static void emit(lexer_t *l, token_type_t type)
 
 static void raw_emit(lexer_t *l, char *value, token_type_t type)
 {
-    token_t *token = new_token(type, value, l->start, l->pos, l->line_n);
+    token_t *token = allocate(l, sizeof(token_t));
+
+    init_token(token, type, value, l->start, l->pos, l->line_n);
 
     if (l->tail == NULL)
         l->tokens = token;
@@ -232,6 +255,32 @@ static void raw_emit(lexer_t *l, char *value, token_type_t type)
     l->tail = token;
 }
 
+/* from the current chunk, the lexer frees them all at once */
+static void *allocate(lexer_t *l, size_t size)
+{
+    lexer_chunk_t *chunk = l->chunks;
+
+    /* everything stays aligned for tokens */
+    size = (size + 7) & ~(size_t)7;
+
+    if (!chunk || chunk->size - chunk->used < size) {
+        size_t chunk_size = size > LEXER_CHUNK_SIZE ? size : LEXER_CHUNK_SIZE;
+
+        chunk = smalloc(sizeof(lexer_chunk_t) + chunk_size);
+        chunk->next = l->chunks;
+        chunk->used = 0;
+        chunk->size = chunk_size;
+
+        l->chunks = chunk;
+    }
+
+    void *p = chunk->data + chunk->used;
+
+    chunk->used += size;
+
+    return p;
+}
+
 static bool is_number(char c)
 {
     return (c >= '0' && c <= '9') || c == '.';
@@ -258,7 +307,7 @@ static void read_string(lexer_t *l, char id)
         if (current(l) == '\n')
             l->line_n++;
 
-        if (peek(l) == EOF) {
+        if (peek(l) == '\0') {
             /* unclosed string, exit immediately */
             file_fatal_error(l->target, l->line_n,
                              "unexpected EOF while scanning string");
@@ -275,18 +324,32 @@ static void read_string(lexer_t *l, char id)
     raw_emit(l, value, STRING);
 }
 
+/* numbers are converted right away, the token holds the value */
 static void read_number(lexer_t *l)
 {
-    token_type_t type = INT;
+    number_t n;
 
-    while (is_number(peek(l))) {
-        if (peek(l) == '.')
-            type = FLOAT;
+    l->pos = l->start + scan_number(l->source + l->start,
+                                    l->source + l->length, &n);
 
-        eat(l);
+    if (n.type == ERROR) {
+        char *value = current_token(l);
+
+        file_error(l->target, l->line_n, "%s '%s'", n.error, value);
+        l->failed = true;
+
+        raw_emit(l, value, ERROR);
+        return;
     }
 
-    emit(l, type);
+    emit(l, n.type);
+
+    if (n.type == FLOAT)
+        l->tail->number.f = n.f;
+    else if (!n.big)
+        l->tail->number.i = n.i;
+    else
+        l->tail->big = big_digits(l);
 }
 
 static void read_ident(lexer_t *l)
@@ -295,26 +358,25 @@ static void read_ident(lexer_t *l)
         eat(l);
 
     /* the read ident might be a reserved keyword */
-    char *ident = current_token(l);
+    const char *ident = l->source + l->start;
+    size_t length = l->pos - l->start;
     size_t n_keywords = sizeof keywords / sizeof keywords[0];
 
     for (size_t i = 0; i < n_keywords; ++i) {
-        if (strcmp(ident, keywords[i].name) == 0) {
+        if (strncmp(ident, keywords[i].name, length) == 0 &&
+            keywords[i].name[length] == '\0') {
             emit(l, keywords[i].type);
-            free(ident);
             return;
         }
     }
 
-    free(ident);
-
     emit(l, IDENT);
 }
 
 static void read_comment(lexer_t *l)
 {
     while (1) {
-        if (peek(l) == EOF)
+        if (peek(l) == '\0')
             break;
 
         if (peek(l) == '\n') {
@@ -340,8 +402,9 @@ static void switch_eq(lexer_t *l, token_type_t tok_a, token_type_t tok_b)
 
 static char *current_token(lexer_t *l)
 {
-    char *value = smalloc(sizeof(char) * (l->pos - l->start) + 1);
-    strncpy(value, l->source + l->start, l->pos);
+    char *value = allocate(l, sizeof(char) * (l->pos - l->start) + 1);
+
+    memcpy(value, l->source + l->start, l->pos - l->start);
 
     value[l->pos - l->start] = '\0';
 
@@ -365,8 +428,12 @@ void destroy_lexer(lexer_t *l)
 
     verbose_printf("destroying lexer");
 
-    if (l->tokens)
-        destroy_tokens(l->tokens);
+    while (l->chunks) {
+        lexer_chunk_t *next = l->chunks->next;
+
+        free(l->chunks);
+        l->chunks = next;
+    }
 
     free(l);
 
@@ -26,9 +26,20 @@
 #include "erupt.h"
 #include "token.h"
 
+/* in bytes, tokens and their values are allocated from chunks this big */
+#define LEXER_CHUNK_SIZE (64 * 1024)
+
+typedef struct lexer_chunk {
+    struct lexer_chunk *next;
+    size_t used;
+    size_t size;
+    char data[];
+} lexer_chunk_t;
+
 typedef struct {
     const char *target;
     const char *source;
+    size_t length;
 
     size_t line_n;
     size_t start;
@@ -36,6 +47,7 @@ typedef struct {
 
     token_t *tokens;
     token_t *tail;
+    lexer_chunk_t *chunks;
 
     bool failed;
 } lexer_t;
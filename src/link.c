@@ -0,0 +1,264 @@
+/*
+ * Copyright (C) 2015 soud
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * linking objects into executables. erupt built against LLD (see the
+ * Makefile) links in its own process, statically, with the C library and
+ * startup files make found. otherwise the system's C compiler driver is
+ * run, which knows where those are.
+ *
+ * compiled objects never go to disk, they're kept in memory files the
+ * linker reads through /proc/self/fd.
+ */
+
+#include <libgen.h>
+#include <limits.h>
+#include <spawn.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "link.h"
+#ifdef HAVE_LLD
+# include "lld.h"
+#endif
+
+extern char **environ;
+
+static bool run_linker(char **objects, size_t n, const char *output,
+                       char *runtime);
+static char *try_runtime(const char *dir, const char *rel);
+static int open_object(LLVMMemoryBufferRef object, char **path);
+
+/*
+ * the runtime library compiled programs are linked against. $ERUPT_RUNTIME
+ * overrides where it is, otherwise it's looked for next to the erupt binary
+ * (a build directory) and in ../lib/erupt (an installation).
+ */
+char *find_runtime(void)
+{
+    char exe[PATH_MAX];
+    char *path = getenv("ERUPT_RUNTIME");
+    ssize_t len;
+
+    if (path)
+        return strdup(path);
+
+    if ((len = readlink("/proc/self/exe", exe, sizeof(exe) - 1)) > 0) {
+        exe[len] = '\0';
+
+        char *dir = dirname(exe);
+
+        if ((path = try_runtime(dir, RUNTIME_LIB)) ||
+            (path = try_runtime(dir, "../lib/erupt/" RUNTIME_LIB)))
+            return path;
+    }
+
+    erupt_error("couldn't find the runtime library '%s', set ERUPT_RUNTIME "
+                "to its path", RUNTIME_LIB);
+
+    return NULL;
+}
+
+/* link the object files with the runtime into the executable output */
+bool link_executable(char **objects, size_t n, const char *output)
+{
+    char *runtime = find_runtime();
+
+    if (!runtime)
+        return false;
+
+    bool linked = run_linker(objects, n, output, runtime);
+
+    free(runtime);
+
+    return linked;
+}
+
+/* link the n compiled objects into the executable output */
+bool link_objects(LLVMMemoryBufferRef *objects, size_t n, const char *output)
+{
+    char **paths = scalloc(n + 1, sizeof(char *));
+    int *fds = smalloc(sizeof(int) * (n + 1));
+    bool ok = true;
+    size_t opened = 0;
+
+    for (; opened < n && ok; ++opened)
+        ok = (fds[opened] = open_object(objects[opened],
+                                        &paths[opened])) >= 0;
+
+    ok = ok && link_executable(paths, n, output);
+
+    for (size_t i = 0; i < opened; ++i) {
+        if (fds[i] >= 0)
+            close(fds[i]);
+
+        free(paths[i]);
+    }
+
+    free(paths);
+    free(fds);
+
+    return ok;
+}
+
+#ifdef HAVE_LLD
+static bool run_linker(char **objects, size_t n, const char *output,
+                       char *runtime)
+{
+    const char **argv = smalloc(sizeof(char *) * (n + 24));
+    int argc = 0;
+
+    argv[argc++] = "ld.lld";
+    argv[argc++] = "-static";
+    argv[argc++] = "--eh-frame-hdr";
+    argv[argc++] = "-o";
+    argv[argc++] = output;
+    argv[argc++] = LIBC_DIR "crt1.o";
+    argv[argc++] = LIBC_DIR "crti.o";
+    argv[argc++] = LIBGCC_DIR "crtbeginT.o";
+
+    for (size_t i = 0; i < n; ++i)
+        argv[argc++] = objects[i];
+
+    argv[argc++] = runtime;
+    argv[argc++] = "-L" LIBGCC_DIR;
+    argv[argc++] = "-L" LIBC_DIR;
+    argv[argc++] = "--start-group";
+    argv[argc++] = "-lm";
+    argv[argc++] = "-lgcc";
+    argv[argc++] = "-lgcc_eh";
+    argv[argc++] = "-lpthread";
+    argv[argc++] = "-lc";
+    argv[argc++] = "--end-group";
+    argv[argc++] = LIBGCC_DIR "crtend.o";
+    argv[argc++] = LIBC_DIR "crtn.o";
+
+    verbose_printf("linking '%s' with lld", output);
+
+    bool linked = lld_link(argv, argc);
+
+    free(argv);
+
+    if (!linked)
+        erupt_error("linking '%s' failed", output);
+
+    return linked;
+}
+#else
+/* link with $CC */
+static bool run_linker(char **objects, size_t n, const char *output,
+                       char *runtime)
+{
+    const char *cc = getenv("CC") ? getenv("CC") : "cc";
+    char **argv = smalloc(sizeof(char *) * (n + 8));
+    size_t argc = 0;
+    pid_t pid;
+    int status = 0;
+
+    argv[argc++] = (char *)cc;
+    argv[argc++] = "-o";
+    argv[argc++] = (char *)output;
+
+    for (size_t i = 0; i < n; ++i)
+        argv[argc++] = objects[i];
+
+    argv[argc++] = runtime;
+    argv[argc++] = "-pthread";
+    argv[argc++] = "-lm";
+    argv[argc] = NULL;
+
+    verbose_printf("linking '%s' with %s", output, cc);
+
+    int spawned = posix_spawnp(&pid, cc, NULL, NULL, argv, environ);
+
+    free(argv);
+
+    if (spawned != 0) {
+        erupt_error("couldn't run the linker '%s'", cc);
+        return false;
+    }
+
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+        WEXITSTATUS(status) != 0) {
+        erupt_error("linking '%s' failed", output);
+        return false;
+    }
+
+    return true;
+}
+#endif
+
+static char *try_runtime(const char *dir, const char *rel)
+{
+    char *path = smalloc(strlen(dir) + strlen(rel) + 2);
+
+    sprintf(path, "%s/%s", dir, rel);
+
+    if (access(path, R_OK) == 0)
+        return path;
+
+    free(path);
+
+    return NULL;
+}
+
+/*
+ * put object in a memory file and give its descriptor, path is where the
+ * linker can read it. falls back to a temporary file, which is unlinked
+ * right away.
+ */
+static int open_object(LLVMMemoryBufferRef object, char **path)
+{
+    const char *data = LLVMGetBufferStart(object);
+    size_t size = LLVMGetBufferSize(object);
+    int fd = memfd_create("erupt.o", 0);
+
+    if (fd < 0) {
+        const char *tmpdir = getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp";
+        char *tmp = smalloc(strlen(tmpdir) + sizeof("/erupt-XXXXXX.o"));
+
+        sprintf(tmp, "%s/erupt-XXXXXX.o", tmpdir);
+
+        if ((fd = mkstemps(tmp, 2)) >= 0)
+            unlink(tmp);
+
+        free(tmp);
+    }
+
+    if (fd < 0) {
+        erupt_error("couldn't create a file for an object");
+        return -1;
+    }
+
+    if (write(fd, data, size) != (ssize_t)size) {
+        erupt_error("couldn't write an object");
+        close(fd);
+
+        return -1;
+    }
+
+    *path = smalloc(sizeof("/proc/self/fd/") + 3 * sizeof(int));
+    sprintf(*path, "/proc/self/fd/%d", fd);
+
+    return fd;
+}
@@ -0,0 +1,923 @@
+/*
+ * Copyright (C) 2015 soud
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "lower.h"
+#include "callgraph.h"
+
+/* the function a closure of fn calls, see closure_entry */
+#define ENTRY_SUFFIX "$closure"
+
+typedef struct {
+    const char *name;
+    eir_instr_t *v;
+} binding_t;
+
+typedef struct {
+    const char *target;
+    eir_module_t *m;
+    callgraph_t *cg;
+    eir_builder_t b;
+
+    binding_t *env;
+    size_t n_env;
+
+    bool failed;
+} lower_t;
+
+static void lower_struct(lower_t *l, ast_node_t *node);
+static eir_type_t field_type(ast_node_t *v);
+static void lower_fn(lower_t *l, cg_node_t *node);
+static size_t *order_clauses(cg_node_t *node, bool profiled);
+static bool disjoint(ast_node_t *a, ast_node_t *b);
+static bool lower_patterns(lower_t *l, ast_node_t *clause,
+                           eir_instr_t **params, eir_block_t **next,
+                           const uint64_t *weights);
+static eir_instr_t *lower_body(lower_t *l, ast_node_list_t *body);
+static eir_instr_t *lower_node(lower_t *l, ast_node_t *node);
+static eir_instr_t *lower_contents(lower_t *l, ast_node_t *node);
+static eir_instr_t *lower_call(lower_t *l, const char *callee,
+                               ast_node_t *first, ast_node_list_t *args,
+                               bool spawn);
+static eir_instr_t *lower_closure(lower_t *l, const char *name,
+                                  ast_node_list_t *captures);
+static eir_fn_t *closure_entry(lower_t *l, cg_node_t *node,
+                               size_t n_captures);
+static eir_instr_t *lower_if(lower_t *l, ast_node_t *node);
+static eir_instr_t *lower_logical(lower_t *l, ast_node_t *node);
+static eir_instr_t *lower_expr(lower_t *l, ast_node_t *node);
+static eir_instr_t *lower_literal(lower_t *l, ast_node_t *node);
+static eir_instr_t *to_bool(lower_t *l, eir_instr_t *v);
+static bool terminated(lower_t *l);
+static void bind(lower_t *l, const char *name, eir_instr_t *v);
+static eir_instr_t *lookup(lower_t *l, const char *name);
+static void type_calls(eir_module_t *m);
+
+/*
+ * lower every function in ast to EIR. the clauses of a function become one
+ * EIR function that tests their patterns in order, or in the order of their
+ * profile counts where that doesn't change which clause matches. until
+ * there's type inference parameters and results of calls are taken to be
+ * ints. returns NULL if something couldn't be lowered, after reporting why.
+ */
+eir_module_t *lower_ast(const char *target, ast_node_list_t *ast)
+{
+    lower_t l;
+
+    l.target = target;
+    l.m = create_eir_module(target);
+    l.cg = build_callgraph(ast);
+    l.env = NULL;
+    l.n_env = 0;
+    l.failed = false;
+
+    verbose_printf("lowering AST to EIR");
+
+    for (ast_node_list_t *nl = ast; nl && nl->node; nl = nl->next) {
+        if (nl->node->type == TYPE_STRUCT)
+            lower_struct(&l, nl->node);
+    }
+
+    for (size_t i = 0; i < l.cg->n_nodes; ++i)
+        lower_fn(&l, &l.cg->nodes[i]);
+
+    type_calls(l.m);
+
+    free(l.env);
+    destroy_callgraph(l.cg);
+
+    if (l.failed) {
+        destroy_eir_module(l.m);
+        return NULL;
+    }
+
+    verbose_printf("lowered AST to EIR");
+
+    return l.m;
+}
+
+/* the fields of a struct are variables, typed by their default values */
+static void lower_struct(lower_t *l, ast_node_t *node)
+{
+    ast_struct_t *s = &node->struct_stmt;
+    size_t n = 0;
+
+    if (eir_lookup_record(l->m, s->name)) {
+        file_error(l->target, node->line_n, "redefinition of struct %s",
+                   s->name);
+        l->failed = true;
+        return;
+    }
+
+    for (ast_node_list_t *nl = s->fields; nl && nl->node; nl = nl->next)
+        ++n;
+
+    eir_record_t *r = eir_add_record(l->m, s->name, n);
+    size_t i = 0;
+
+    for (ast_node_list_t *nl = s->fields; nl && nl->node; nl = nl->next) {
+        ast_node_t *field = nl->node;
+
+        if (field->type != TYPE_VAR) {
+            file_error(l->target, field->line_n,
+                       "fields of struct %s have to be names", s->name);
+            l->failed = true;
+            return;
+        }
+
+        for (size_t j = 0; j < i; ++j) {
+            if (strcmp(r->fields[j], field->var.name) == 0) {
+                file_error(l->target, field->line_n,
+                           "duplicate field %s in struct %s",
+                           field->var.name, s->name);
+                l->failed = true;
+                return;
+            }
+        }
+
+        r->fields[i] = strdup(field->var.name);
+        r->types[i++] = field_type(field->var.v);
+    }
+}
+
+/* the type v has, following eir_binop, fields without one hold any word */
+static eir_type_t field_type(ast_node_t *v)
+{
+    if (!v)
+        return EIR_INT;
+
+    switch (v->type) {
+    case TYPE_FLOAT:
+        return EIR_FLOAT;
+    case TYPE_STRING:
+        return EIR_STRING;
+    case TYPE_LIST:
+        return EIR_LIST;
+    case TYPE_EXPR:
+        break;
+    default:
+        return EIR_INT;
+    }
+
+    if (!v->expr.operator)
+        return EIR_INT;
+
+    switch (v->expr.operator->symbol) {
+    case EQ_EQ:
+    case BANG_EQ:
+    case LT:
+    case LT_EQ:
+    case GT:
+    case GT_EQ:
+    case AND:
+    case OR:
+    case BANG:
+        return EIR_BOOL;
+    case PIPE:
+        return EIR_INT;
+    default:
+        break;
+    }
+
+    eir_type_t lhs = field_type(v->expr.lhs), rhs = field_type(v->expr.rhs);
+
+    if (!v->expr.lhs || !v->expr.rhs)
+        return v->expr.lhs ? lhs : rhs;
+
+    if (lhs == EIR_FLOAT || rhs == EIR_FLOAT)
+        return EIR_FLOAT;
+
+    return lhs == EIR_STRING || lhs == EIR_LIST ? lhs : EIR_INT;
+}
+
+static size_t arity(ast_node_t *clause)
+{
+    size_t n = 0;
+
+    for (ast_node_list_t *nl = clause->fn.prototype->prototype.args;
+         nl && nl->node; nl = nl->next)
+        ++n;
+
+    return n;
+}
+
+static void lower_fn(lower_t *l, cg_node_t *node)
+{
+    size_t n_params = arity(node->clauses[0]);
+    eir_fn_t *fn = eir_add_fn(l->m, node->name, n_params);
+
+    fn->scc = node->scc;
+    eir_instr_t **params = smalloc(sizeof(eir_instr_t *) * (n_params + 1));
+    uint64_t left = 0;
+    size_t typed = SIZE_MAX;
+    bool profiled = true;
+
+    for (size_t i = 0; i < node->n_clauses; ++i) {
+        profiled &= node->clauses[i]->fn.count != UNKNOWN_COUNT;
+        left += node->clauses[i]->fn.count;
+    }
+
+    if (profiled)
+        fn->count = left;
+
+    size_t *order = order_clauses(node, profiled);
+
+    fn->line_n = node->clauses[0]->line_n;
+
+    l->b.fn = fn;
+    l->b.block = eir_add_block(fn);
+    l->b.line_n = fn->line_n;
+
+    for (size_t i = 0; i < n_params; ++i)
+        params[i] = eir_param(&l->b, i, EIR_INT);
+
+    for (size_t i = 0; i < node->n_clauses; ++i) {
+        ast_node_t *clause = node->clauses[order[i]];
+        eir_block_t *next = NULL;
+
+        if (!l->b.block) {
+            file_warning(l->target, clause->line_n,
+                         "clause %zu of '%s' is never matched", order[i] + 1,
+                         node->name);
+            break;
+        }
+
+        if (arity(clause) != n_params) {
+            file_error(l->target, clause->line_n, "clause %zu of '%s' takes "
+                       "%zu argument(s), the first takes %zu", order[i] + 1,
+                       node->name, arity(clause), n_params);
+            l->failed = true;
+            break;
+        }
+
+        l->n_env = 0;
+        l->b.line_n = clause->line_n;
+
+        /* a test goes to its clause, or to the clauses after it */
+        uint64_t weights[2] = { clause->fn.count, 0 };
+
+        if (profiled)
+            weights[1] = left -= clause->fn.count;
+
+        if (!lower_patterns(l, clause, params, &next,
+                            profiled ? weights : NULL))
+            break;
+
+        if (clause->fn.counter != NO_COUNTER)
+            eir_count(&l->b, clause->fn.counter);
+
+        eir_instr_t *v = lower_body(l, clause->fn.body);
+
+        if (!v)
+            break;
+
+        if (!terminated(l))
+            eir_ret(&l->b, v);
+
+        /* the first clause that has a type decides, not the first tested */
+        if (order[i] < typed && v->type != EIR_VOID) {
+            fn->ret = v->type;
+            typed = order[i];
+        }
+
+        /* a clause without literal patterns always matches */
+        l->b.block = next;
+    }
+
+    if (l->b.block && !terminated(l))
+        eir_nomatch(&l->b);
+
+    free(params);
+    free(order);
+}
+
+/*
+ * the order to test the clauses of node in. hotter clauses go first, but
+ * only past clauses that can't match the same arguments, so the first
+ * clause that matches stays the same.
+ */
+static size_t *order_clauses(cg_node_t *node, bool profiled)
+{
+    size_t *order = smalloc(sizeof(size_t) * node->n_clauses);
+    bool swapped = true;
+
+    for (size_t i = 0; i < node->n_clauses; ++i)
+        order[i] = i;
+
+    while (profiled && swapped) {
+        swapped = false;
+
+        for (size_t i = 1; i < node->n_clauses; ++i) {
+            ast_node_t *a = node->clauses[order[i - 1]];
+            ast_node_t *b = node->clauses[order[i]];
+
+            if (b->fn.count > a->fn.count && disjoint(a, b)) {
+                size_t swap = order[i - 1];
+
+                order[i - 1] = order[i];
+                order[i] = swap;
+                swapped = true;
+            }
+        }
+    }
+
+    return order;
+}
+
+/* whether no arguments match both clauses, because of a literal pattern */
+static bool disjoint(ast_node_t *a, ast_node_t *b)
+{
+    ast_node_list_t *x = a->fn.prototype->prototype.args;
+    ast_node_list_t *y = b->fn.prototype->prototype.args;
+
+    for (; x && y && x->node && y->node; x = x->next, y = y->next) {
+        ast_node_t *p = x->node, *q = y->node;
+
+        if (p->type != q->type)
+            continue;
+
+        /* 0x10... and 18... can be the same bignum */
+        if ((p->type == TYPE_INT && !p->int_num.big && !q->int_num.big &&
+             p->int_num.v != q->int_num.v) ||
+            (p->type == TYPE_FLOAT && p->float_num.v != q->float_num.v) ||
+            (p->type == TYPE_STRING && strcmp(p->string.v, q->string.v) != 0))
+            return true;
+    }
+
+    return false;
+}
+
+/*
+ * test the literal patterns of clause against the parameters, continuing
+ * in *next when one doesn't match, and bind the names of the others. the
+ * tests are weighted by weights, if it isn't NULL.
+ */
+static bool lower_patterns(lower_t *l, ast_node_t *clause,
+                           eir_instr_t **params, eir_block_t **next,
+                           const uint64_t *weights)
+{
+    size_t i = 0;
+
+    for (ast_node_list_t *nl = clause->fn.prototype->prototype.args;
+         nl && nl->node; nl = nl->next, ++i) {
+        ast_node_t *pattern = nl->node;
+
+        switch (pattern->type) {
+        case TYPE_VAR:
+            if (!pattern->var.v) {
+                bind(l, pattern->var.name, params[i]);
+                continue;
+            }
+            break;
+        case TYPE_INT:
+        case TYPE_FLOAT:
+        case TYPE_STRING: {
+            if (!*next)
+                *next = eir_add_block(l->b.fn);
+
+            eir_block_t *match = eir_add_block(l->b.fn);
+            eir_instr_t *literal = lower_literal(l, pattern);
+            eir_instr_t *cmp = eir_binop(&l->b, EQ_EQ, params[i], literal);
+
+            eir_set_weights(eir_condbr(&l->b, cmp, match, *next), weights);
+            l->b.block = match;
+            continue;
+        }
+        default:
+            break;
+        }
+
+        file_error(l->target, l->b.line_n, "unsupported pattern in '%s'",
+                   clause->fn.prototype->prototype.name);
+        l->failed = true;
+
+        return false;
+    }
+
+    return true;
+}
+
+/* the value of a body is its last expression, an empty body is 0 */
+static eir_instr_t *lower_body(lower_t *l, ast_node_list_t *body)
+{
+    eir_instr_t *v = NULL;
+
+    for (; body; body = body->next) {
+        if (!body->node)
+            continue;
+
+        if (!(v = lower_node(l, body->node)))
+            return NULL;
+    }
+
+    return v ? v : eir_const_int(&l->b, 0);
+}
+
+/* lower node, the instructions generated for it get its line */
+static eir_instr_t *lower_node(lower_t *l, ast_node_t *node)
+{
+    size_t line_n = l->b.line_n;
+
+    if (node->line_n)
+        l->b.line_n = node->line_n;
+
+    eir_instr_t *v = lower_contents(l, node);
+
+    l->b.line_n = line_n;
+
+    return v;
+}
+
+static eir_instr_t *lower_contents(lower_t *l, ast_node_t *node)
+{
+    switch (node->type) {
+    case TYPE_INT:
+    case TYPE_FLOAT:
+    case TYPE_STRING:
+        return lower_literal(l, node);
+    case TYPE_LIST: {
+        size_t n = 0;
+        eir_instr_t **elements = NULL;
+
+        for (ast_node_list_t *nl = node->list.values; nl; nl = nl->next) {
+            if (!nl->node)
+                continue;
+
+            eir_instr_t *v = lower_node(l, nl->node);
+
+            if (!v) {
+                free(elements);
+                return NULL;
+            }
+
+            elements = srealloc(elements, sizeof(eir_instr_t *) * (n + 1));
+            elements[n++] = v;
+        }
+
+        eir_instr_t *list = eir_list(&l->b, elements, n);
+
+        list->on_stack = node->list.on_stack;
+        free(elements);
+
+        return list;
+    }
+    case TYPE_VAR: {
+        if (node->var.v) {
+            eir_instr_t *v = lower_node(l, node->var.v);
+
+            if (v)
+                bind(l, node->var.name, v);
+
+            return v;
+        }
+
+        eir_instr_t *v = lookup(l, node->var.name);
+
+        if (v)
+            return v;
+
+        cg_node_t *fn = callgraph_lookup(l->cg, node->var.name);
+
+        /*
+         * a function without arguments can be called by its name alone,
+         * others are taken as a value
+         */
+        if (fn && arity(fn->clauses[0]) == 0)
+            return lower_call(l, node->var.name, NULL, NULL, false);
+
+        if (fn)
+            return lower_closure(l, node->var.name, NULL);
+
+        file_error(l->target, l->b.line_n, "undefined name '%s'",
+                   node->var.name);
+        l->failed = true;
+
+        return NULL;
+    }
+    case TYPE_CALL:
+        return lower_call(l, node->call.name, NULL, node->call.args, false);
+    case TYPE_CLOSURE:
+        if (node->closure.name)
+            return lower_closure(l, node->closure.name,
+                                 node->closure.captures);
+
+        file_error(l->target, l->b.line_n, "lambda in '%s' wasn't lifted",
+                   l->b.fn->name);
+        l->failed = true;
+
+        return NULL;
+    case TYPE_IF:
+        return lower_if(l, node);
+    case TYPE_EXPR:
+        return lower_expr(l, node);
+    case TYPE_RETURN: {
+        eir_instr_t *v = node->return_expr.expr ?
+                         lower_node(l, node->return_expr.expr) :
+                         eir_const_int(&l->b, 0);
+
+        if (!v)
+            return NULL;
+
+        eir_ret(&l->b, v);
+
+        /* anything after a return is dead, give it a block of its own */
+        l->b.block = eir_add_block(l->b.fn);
+
+        return v;
+    }
+    case TYPE_PROTO:
+    case TYPE_STRUCT:
+    case TYPE_FN:
+    case TYPE_IMPORT:
+        break;
+    }
+
+    file_error(l->target, l->b.line_n,
+               "unexpected definition inside a function");
+    l->failed = true;
+
+    return NULL;
+}
+
+static eir_instr_t *lower_call(lower_t *l, const char *callee,
+                               ast_node_t *first, ast_node_list_t *args,
+                               bool spawn)
+{
+    size_t n = 0;
+    eir_instr_t **values = NULL, *closure = NULL;
+
+    /* calls go to functions first, then to closures bound to the name */
+    if (!spawn && !callgraph_lookup(l->cg, callee))
+        closure = lookup(l, callee);
+
+    if (first) {
+        values = smalloc(sizeof(eir_instr_t *));
+
+        if (!(values[n++] = lower_node(l, first))) {
+            free(values);
+            return NULL;
+        }
+    }
+
+    for (; args; args = args->next) {
+        if (!args->node)
+            continue;
+
+        eir_instr_t *v = lower_node(l, args->node);
+
+        if (!v) {
+            free(values);
+            return NULL;
+        }
+
+        values = srealloc(values, sizeof(eir_instr_t *) * (n + 1));
+        values[n++] = v;
+    }
+
+    eir_instr_t *call;
+
+    if (closure)
+        call = eir_apply(&l->b, closure, values, n);
+    else if (spawn)
+        call = eir_spawn(&l->b, callee, values, n);
+    else
+        call = eir_call(&l->b, callee, values, n, EIR_INT);
+
+    free(values);
+
+    return call;
+}
+
+/*
+ * a closure of the function name over the values of captures, which are
+ * passed to it after the arguments of a call
+ */
+static eir_instr_t *lower_closure(lower_t *l, const char *name,
+                                  ast_node_list_t *captures)
+{
+    size_t n = 0;
+    eir_instr_t **values = NULL;
+
+    for (; captures; captures = captures->next) {
+        if (!captures->node)
+            continue;
+
+        eir_instr_t *v = lower_node(l, captures->node);
+
+        if (!v) {
+            free(values);
+            return NULL;
+        }
+
+        values = srealloc(values, sizeof(eir_instr_t *) * (n + 1));
+        values[n++] = v;
+    }
+
+    eir_fn_t *entry = closure_entry(l, callgraph_lookup(l->cg, name), n);
+    eir_instr_t *closure = eir_closure(&l->b, entry->name, values, n);
+
+    free(values);
+
+    return closure;
+}
+
+/*
+ * the function closures of node call: it takes the closure and the
+ * arguments, and calls node with the arguments followed by the n_captures
+ * values in the closure's environment. made on first use.
+ */
+static eir_fn_t *closure_entry(lower_t *l, cg_node_t *node,
+                               size_t n_captures)
+{
+    size_t n_args = arity(node->clauses[0]);
+    char *name = smalloc(strlen(node->name) + sizeof(ENTRY_SUFFIX));
+
+    strcpy(name, node->name);
+    strcat(name, ENTRY_SUFFIX);
+
+    eir_fn_t *entry = eir_lookup_fn(l->m, name);
+
+    if (entry) {
+        free(name);
+        return entry;
+    }
+
+    eir_builder_t b = l->b;
+    eir_instr_t **args = smalloc(sizeof(eir_instr_t *) * (n_args + 1));
+
+    n_args -= n_captures;
+    entry = eir_add_fn(l->m, name, n_args + 1);
+    entry->scc = node->scc;
+    entry->line_n = node->clauses[0]->line_n;
+
+    l->b.fn = entry;
+    l->b.block = eir_add_block(entry);
+    l->b.line_n = entry->line_n;
+
+    eir_instr_t *closure = eir_param(&l->b, 0, EIR_INT);
+
+    for (size_t i = 0; i < n_args; ++i)
+        args[i] = eir_param(&l->b, i + 1, EIR_INT);
+
+    for (size_t i = 0; i < n_captures; ++i)
+        args[n_args + i] = eir_env(&l->b, closure, i);
+
+    eir_ret(&l->b, eir_call(&l->b, node->name, args, n_args + n_captures,
+                            EIR_INT));
+
+    l->b = b;
+    free(args);
+    free(name);
+
+    return entry;
+}
+
+static eir_instr_t *lower_if(lower_t *l, ast_node_t *node)
+{
+    eir_instr_t *cond = lower_node(l, node->if_expr.condition);
+
+    if (!cond)
+        return NULL;
+
+    eir_block_t *then = eir_add_block(l->b.fn);
+    eir_block_t *otherwise = eir_add_block(l->b.fn);
+    eir_block_t *merge = eir_add_block(l->b.fn);
+
+    eir_instr_t *br = eir_condbr(&l->b, to_bool(l, cond), then, otherwise);
+
+    if (node->if_expr.counts[0] != UNKNOWN_COUNT)
+        eir_set_weights(br, node->if_expr.counts);
+
+    l->b.block = then;
+
+    if (node->if_expr.counter != NO_COUNTER)
+        eir_count(&l->b, node->if_expr.counter);
+
+    eir_instr_t *then_v = lower_body(l, node->if_expr.true_body);
+    eir_block_t *then_end = l->b.block;
+
+    if (!then_v)
+        return NULL;
+
+    if (!terminated(l))
+        eir_br(&l->b, merge);
+
+    l->b.block = otherwise;
+
+    if (node->if_expr.counter != NO_COUNTER)
+        eir_count(&l->b, node->if_expr.counter + 1);
+
+    eir_instr_t *else_v = node->if_expr.false_body ?
+                          lower_body(l, node->if_expr.false_body) :
+                          eir_const_int(&l->b, 0);
+    eir_block_t *else_end = l->b.block;
+
+    if (!else_v)
+        return NULL;
+
+    if (!terminated(l))
+        eir_br(&l->b, merge);
+
+    l->b.block = merge;
+
+    eir_instr_t *phi = eir_phi(&l->b, then_v->type);
+
+    if (eir_terminator(then_end)->op == EIR_BR)
+        eir_add_incoming(phi, then_v, then_end);
+
+    if (eir_terminator(else_end)->op == EIR_BR)
+        eir_add_incoming(phi, else_v, else_end);
+
+    /* both branches returned, nothing reaches the merge block */
+    if (!phi->n_operands) {
+        eir_remove_instr(phi);
+        return eir_const_int(&l->b, 0);
+    }
+
+    return phi;
+}
+
+/* 'and' and 'or' only evaluate their rhs when they have to */
+static eir_instr_t *lower_logical(lower_t *l, ast_node_t *node)
+{
+    eir_instr_t *lhs = lower_node(l, node->expr.lhs);
+
+    if (!lhs)
+        return NULL;
+
+    lhs = to_bool(l, lhs);
+
+    eir_block_t *lhs_end = l->b.block;
+    eir_block_t *rhs_block = eir_add_block(l->b.fn);
+    eir_block_t *merge = eir_add_block(l->b.fn);
+
+    if (node->expr.operator->symbol == AND)
+        eir_condbr(&l->b, lhs, rhs_block, merge);
+    else
+        eir_condbr(&l->b, lhs, merge, rhs_block);
+
+    l->b.block = rhs_block;
+
+    eir_instr_t *rhs = lower_node(l, node->expr.rhs);
+
+    if (!rhs)
+        return NULL;
+
+    rhs = to_bool(l, rhs);
+
+    eir_block_t *rhs_end = l->b.block;
+
+    eir_br(&l->b, merge);
+
+    l->b.block = merge;
+
+    eir_instr_t *phi = eir_phi(&l->b, EIR_BOOL);
+
+    eir_add_incoming(phi, lhs, lhs_end);
+    eir_add_incoming(phi, rhs, rhs_end);
+
+    return phi;
+}
+
+static eir_instr_t *lower_expr(lower_t *l, ast_node_t *node)
+{
+    ast_operator_t *op = node->expr.operator;
+    ast_node_t *lhs = node->expr.lhs, *rhs = node->expr.rhs;
+
+    if (!op || (!lhs && !rhs)) {
+        file_error(l->target, l->b.line_n, "malformed expression");
+        l->failed = true;
+        return NULL;
+    }
+
+    if (op->unary || !lhs || !rhs) {
+        eir_instr_t *v = lower_node(l, lhs ? lhs : rhs);
+
+        return v ? eir_unop(&l->b, op->symbol, v) : NULL;
+    }
+
+    switch (op->symbol) {
+    case PIPE:
+        /* x |> f(y) is f(x, y) and x |> f is f(x) */
+        if (rhs->type == TYPE_CALL)
+            return lower_call(l, rhs->call.name, lhs, rhs->call.args, false);
+
+        if (rhs->type == TYPE_VAR && !rhs->var.v)
+            return lower_call(l, rhs->var.name, lhs, NULL, false);
+
+        file_error(l->target, l->b.line_n,
+                   "the rhs of |> has to be a function");
+        l->failed = true;
+
+        return NULL;
+    case AND:
+    case OR:
+        return lower_logical(l, node);
+    default:
+        break;
+    }
+
+    eir_instr_t *lhs_v, *rhs_v;
+
+    if (node->expr.parallel && lhs->type == TYPE_CALL) {
+        /* evaluate the lhs in a task while evaluating the rhs here */
+        eir_instr_t *task = lower_call(l, lhs->call.name, NULL,
+                                       lhs->call.args, true);
+
+        if (!task || !(rhs_v = lower_node(l, rhs)))
+            return NULL;
+
+        lhs_v = eir_join(&l->b, task, EIR_INT);
+    } else if (!(lhs_v = lower_node(l, lhs)) ||
+               !(rhs_v = lower_node(l, rhs))) {
+        return NULL;
+    }
+
+    return eir_binop(&l->b, op->symbol, lhs_v, rhs_v);
+}
+
+static eir_instr_t *lower_literal(lower_t *l, ast_node_t *node)
+{
+    switch (node->type) {
+    case TYPE_INT:
+        if (node->int_num.big)
+            return eir_const_bignum(&l->b, node->int_num.big);
+
+        return eir_const_int(&l->b, node->int_num.v);
+    case TYPE_FLOAT:
+        return eir_const_float(&l->b, node->float_num.v);
+    case TYPE_STRING:
+        return eir_const_string(&l->b, node->string.v);
+    default:
+        return NULL;
+    }
+}
+
+static eir_instr_t *to_bool(lower_t *l, eir_instr_t *v)
+{
+    if (v->type == EIR_BOOL)
+        return v;
+
+    return eir_binop(&l->b, BANG_EQ, v, eir_const_int(&l->b, 0));
+}
+
+static bool terminated(lower_t *l)
+{
+    return eir_terminator(l->b.block) != NULL;
+}
+
+static void bind(lower_t *l, const char *name, eir_instr_t *v)
+{
+    l->env = srealloc(l->env, sizeof(binding_t) * (l->n_env + 1));
+    l->env[l->n_env].name = name;
+    l->env[l->n_env++].v = v;
+}
+
+/* later bindings shadow earlier ones */
+static eir_instr_t *lookup(lower_t *l, const char *name)
+{
+    for (size_t i = l->n_env; i > 0; --i) {
+        if (strcmp(l->env[i - 1].name, name) == 0)
+            return l->env[i - 1].v;
+    }
+
+    return NULL;
+}
+
+/* calls to functions in the module give whatever the function returns */
+static void type_calls(eir_module_t *m)
+{
+    for (eir_fn_t *fn = m->first; fn; fn = fn->next) {
+        for (eir_block_t *b = fn->first; b; b = b->next) {
+            for (eir_instr_t *i = b->first; i; i = i->next) {
+                eir_instr_t *call = i->op == EIR_JOIN ? i->operands[0] : i;
+
+                if (i->op != EIR_CALL && i->op != EIR_JOIN)
+                    continue;
+
+                eir_fn_t *callee = eir_lookup_fn(m, call->callee);
+
+                if (callee)
+                    i->type = callee->ret;
+            }
+        }
+    }
+}
@@ -0,0 +1,484 @@
+/*
+ * Copyright (C) 2015 soud
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * the summaries, the thin link and the importing of ThinLTO. see lto.h.
+ *
+ * an imported function drags along the local functions and constants it
+ * uses, which are copied with it. that's always fine, except for local
+ * variables that can be written to, since a copy wouldn't see the writes
+ * of the original. functions that use those aren't imported.
+ */
+
+#include <llvm-c/BitReader.h>
+#include <llvm-c/Linker.h>
+
+#include "lto.h"
+
+typedef struct {
+    const char *name;
+    size_t partition;
+    lto_fn_t *fn;
+} lto_def_t;
+
+/* the values of a module that are copied along with the imports */
+typedef struct {
+    LLVMValueRef *values;
+    size_t n;
+} kept_t;
+
+static bool is_local(LLVMValueRef global);
+static bool uses_mutable_local(LLVMValueRef v, size_t depth);
+static void add_callee(lto_fn_t *fn, const char *name);
+static int compare_defs(const void *a, const void *b);
+static void push_callees(lto_fn_t *fn, size_t limit, const char ***work,
+                         size_t **limits, size_t *n_work);
+static bool imports(lto_imports_t *imports, const char *name);
+static void add_import(lto_imports_t *imports, const char *name,
+                       size_t from);
+static LLVMModuleRef extract_imports(LLVMMemoryBufferRef bitcode,
+                                     LLVMContextRef ctx,
+                                     lto_imports_t *imports, size_t from);
+static void keep(kept_t *kept, LLVMValueRef v);
+static bool is_kept(kept_t *kept, LLVMValueRef v);
+static void keep_operands(kept_t *kept, LLVMValueRef v);
+static void delete_body(LLVMValueRef fn);
+static void declare_global(LLVMModuleRef mod, LLVMValueRef global);
+
+/*
+ * summarize the functions mod defines: their size, whether they can be
+ * imported and the external functions they call.
+ */
+void summarize_module(LLVMModuleRef mod, lto_summary_t *summary)
+{
+    summary->fns = NULL;
+    summary->n_fns = 0;
+
+    for (LLVMValueRef f = LLVMGetFirstFunction(mod); f;
+         f = LLVMGetNextFunction(f)) {
+        if (LLVMIsDeclaration(f))
+            continue;
+
+        size_t length = 0;
+        const char *name = LLVMGetValueName2(f, &length);
+        lto_fn_t fn = { strdup(name), 0, !is_local(f), NULL, 0 };
+
+        for (LLVMBasicBlockRef b = LLVMGetFirstBasicBlock(f); b;
+             b = LLVMGetNextBasicBlock(b)) {
+            for (LLVMValueRef i = LLVMGetFirstInstruction(b); i;
+                 i = LLVMGetNextInstruction(i)) {
+                ++fn.size;
+
+                if (fn.importable && uses_mutable_local(i, 0))
+                    fn.importable = false;
+
+                if (LLVMGetInstructionOpcode(i) != LLVMCall)
+                    continue;
+
+                LLVMValueRef callee = LLVMGetCalledValue(i);
+
+                if (LLVMIsAFunction(callee) && !is_local(callee))
+                    add_callee(&fn, LLVMGetValueName2(callee, &length));
+            }
+        }
+
+        summary->fns = srealloc(summary->fns,
+                                sizeof(lto_fn_t) * (summary->n_fns + 1));
+        summary->fns[summary->n_fns++] = fn;
+    }
+}
+
+/*
+ * pick what every partition imports. the functions a partition calls in
+ * other partitions are imported if they're small enough, and so are their
+ * own callees, up to a limit that gets smaller with every level. gives the
+ * imports of each partition, in the order of summaries.
+ */
+lto_imports_t *thin_link(lto_summary_t *summaries, size_t n)
+{
+    size_t n_defs = 0;
+
+    for (size_t p = 0; p < n; ++p)
+        n_defs += summaries[p].n_fns;
+
+    lto_def_t *defs = smalloc(sizeof(lto_def_t) * (n_defs + 1));
+    lto_imports_t *all = scalloc(n + 1, sizeof(lto_imports_t));
+
+    n_defs = 0;
+
+    for (size_t p = 0; p < n; ++p) {
+        for (size_t f = 0; f < summaries[p].n_fns; ++f) {
+            lto_fn_t *fn = &summaries[p].fns[f];
+
+            defs[n_defs++] = (lto_def_t){ fn->name, p, fn };
+        }
+    }
+
+    qsort(defs, n_defs, sizeof(lto_def_t), compare_defs);
+
+    for (size_t p = 0; p < n; ++p) {
+        /* callees to look at, with the limit they're imported under */
+        const char **work = NULL;
+        size_t *limits = NULL, n_work = 0;
+
+        for (size_t f = 0; f < summaries[p].n_fns; ++f) {
+            push_callees(&summaries[p].fns[f], LTO_IMPORT_LIMIT, &work,
+                         &limits, &n_work);
+        }
+
+        while (n_work) {
+            lto_def_t key = { work[--n_work], 0, NULL };
+            size_t limit = limits[n_work];
+            lto_def_t *def = bsearch(&key, defs, n_defs, sizeof(lto_def_t),
+                                     compare_defs);
+
+            if (!def || def->partition == p || !def->fn->importable ||
+                def->fn->size > limit || imports(&all[p], def->name))
+                continue;
+
+            add_import(&all[p], def->name, def->partition);
+
+            push_callees(def->fn, limit * LTO_IMPORT_DECAY / 100, &work,
+                         &limits, &n_work);
+        }
+
+        if (all[p].n)
+            verbose_printf("partition %zu imports %zu function(s)", p,
+                           all[p].n);
+
+        free(work);
+        free(limits);
+    }
+
+    free(defs);
+
+    return all;
+}
+
+/*
+ * link the functions mod imports into it, from the bitcode of the
+ * partitions they're defined in. mod has to be in a context of its own.
+ */
+bool import_functions(LLVMModuleRef mod, LLVMMemoryBufferRef *bitcode,
+                      lto_imports_t *imports)
+{
+    LLVMContextRef ctx = LLVMGetModuleContext(mod);
+
+    for (size_t i = 0; i < imports->n; ++i) {
+        size_t from = imports->from[i];
+        bool seen = false;
+
+        /* every partition is linked in once, with all that comes from it */
+        for (size_t k = 0; k < i && !seen; ++k)
+            seen = imports->from[k] == from;
+
+        if (seen)
+            continue;
+
+        LLVMModuleRef src = extract_imports(bitcode[from], ctx, imports,
+                                            from);
+
+        if (!src || LLVMLinkModules2(mod, src)) {
+            erupt_error("couldn't import functions from partition %zu",
+                        from);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void destroy_summary(lto_summary_t *summary)
+{
+    for (size_t f = 0; f < summary->n_fns; ++f) {
+        for (size_t c = 0; c < summary->fns[f].n_callees; ++c)
+            free(summary->fns[f].callees[c]);
+
+        free(summary->fns[f].callees);
+        free(summary->fns[f].name);
+    }
+
+    free(summary->fns);
+}
+
+void destroy_imports(lto_imports_t *imports, size_t n)
+{
+    for (size_t p = 0; p < n; ++p) {
+        for (size_t i = 0; i < imports[p].n; ++i)
+            free(imports[p].names[i]);
+
+        free(imports[p].names);
+        free(imports[p].from);
+    }
+
+    free(imports);
+}
+
+static bool is_local(LLVMValueRef global)
+{
+    LLVMLinkage linkage = LLVMGetLinkage(global);
+
+    return linkage == LLVMInternalLinkage || linkage == LLVMPrivateLinkage;
+}
+
+/* whether v uses a local variable, directly or through constants */
+static bool uses_mutable_local(LLVMValueRef v, size_t depth)
+{
+    int n = LLVMGetNumOperands(v);
+
+    for (int k = 0; k < n; ++k) {
+        LLVMValueRef op = LLVMGetOperand(v, (unsigned)k);
+
+        if (!op)
+            continue;
+
+        if (LLVMIsAGlobalVariable(op)) {
+            if (is_local(op) && !LLVMIsGlobalConstant(op))
+                return true;
+        } else if (LLVMIsAConstantExpr(op) && depth < 8 &&
+                   uses_mutable_local(op, depth + 1)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void add_callee(lto_fn_t *fn, const char *name)
+{
+    for (size_t c = 0; c < fn->n_callees; ++c) {
+        if (strcmp(fn->callees[c], name) == 0)
+            return;
+    }
+
+    fn->callees = srealloc(fn->callees, sizeof(char *) * (fn->n_callees + 1));
+    fn->callees[fn->n_callees++] = strdup(name);
+}
+
+static int compare_defs(const void *a, const void *b)
+{
+    return strcmp(((const lto_def_t *)a)->name, ((const lto_def_t *)b)->name);
+}
+
+/* add the callees of fn to the work list, to be imported under limit */
+static void push_callees(lto_fn_t *fn, size_t limit, const char ***work,
+                         size_t **limits, size_t *n_work)
+{
+    if (fn->n_callees == 0)
+        return;
+
+    *work = srealloc(*work, sizeof(char *) * (*n_work + fn->n_callees));
+    *limits = srealloc(*limits, sizeof(size_t) * (*n_work + fn->n_callees));
+
+    for (size_t c = 0; c < fn->n_callees; ++c) {
+        (*work)[*n_work] = fn->callees[c];
+        (*limits)[(*n_work)++] = limit;
+    }
+}
+
+static bool imports(lto_imports_t *imports, const char *name)
+{
+    for (size_t i = 0; i < imports->n; ++i) {
+        if (strcmp(imports->names[i], name) == 0)
+            return true;
+    }
+
+    return false;
+}
+
+static void add_import(lto_imports_t *imports, const char *name, size_t from)
+{
+    imports->names = srealloc(imports->names,
+                              sizeof(char *) * (imports->n + 1));
+    imports->from = srealloc(imports->from, sizeof(size_t) * (imports->n + 1));
+    imports->names[imports->n] = strdup(name);
+    imports->from[imports->n++] = from;
+}
+
+/*
+ * read the partition from in ctx and strip it down to what's imported from
+ * it: the imports become available_externally, the locals they use are
+ * kept and everything else is left as a declaration, or removed.
+ */
+static LLVMModuleRef extract_imports(LLVMMemoryBufferRef bitcode,
+                                     LLVMContextRef ctx,
+                                     lto_imports_t *imports, size_t from)
+{
+    LLVMModuleRef src = NULL;
+    kept_t kept = { NULL, 0 };
+
+    if (LLVMParseBitcodeInContext2(ctx, bitcode, &src))
+        return NULL;
+
+    for (size_t i = 0; i < imports->n; ++i) {
+        if (imports->from[i] != from)
+            continue;
+
+        LLVMValueRef fn = LLVMGetNamedFunction(src, imports->names[i]);
+
+        if (fn) {
+            keep(&kept, fn);
+            LLVMSetLinkage(fn, LLVMAvailableExternallyLinkage);
+        }
+    }
+
+    /* first drop every use of what goes, then what isn't used anymore */
+    for (LLVMValueRef f = LLVMGetFirstFunction(src); f;
+         f = LLVMGetNextFunction(f)) {
+        if (!is_kept(&kept, f) && !LLVMIsDeclaration(f))
+            delete_body(f);
+    }
+
+    for (LLVMValueRef g = LLVMGetFirstGlobal(src), next; g; g = next) {
+        next = LLVMGetNextGlobal(g);
+
+        if (!is_kept(&kept, g) && !LLVMIsDeclaration(g) && !is_local(g))
+            declare_global(src, g);
+    }
+
+    for (LLVMValueRef f = LLVMGetFirstFunction(src), next; f; f = next) {
+        next = LLVMGetNextFunction(f);
+
+        if (is_kept(&kept, f))
+            continue;
+
+        if (!LLVMGetFirstUse(f)) {
+            LLVMDeleteFunction(f);
+        } else {
+            LLVMSetLinkage(f, LLVMExternalLinkage);
+            LLVMSetVisibility(f, LLVMDefaultVisibility);
+        }
+    }
+
+    for (LLVMValueRef g = LLVMGetFirstGlobal(src), next; g; g = next) {
+        next = LLVMGetNextGlobal(g);
+
+        if (!is_kept(&kept, g) && !LLVMGetFirstUse(g))
+            LLVMDeleteGlobal(g);
+    }
+
+    free(kept.values);
+
+    return src;
+}
+
+/* keep v, and the locals it uses */
+static void keep(kept_t *kept, LLVMValueRef v)
+{
+    if (is_kept(kept, v))
+        return;
+
+    kept->values = srealloc(kept->values,
+                            sizeof(LLVMValueRef) * (kept->n + 1));
+    kept->values[kept->n++] = v;
+
+    if (LLVMIsAGlobalVariable(v)) {
+        LLVMValueRef init = LLVMGetInitializer(v);
+
+        if (init)
+            keep_operands(kept, init);
+
+        return;
+    }
+
+    for (LLVMBasicBlockRef b = LLVMGetFirstBasicBlock(v); b;
+         b = LLVMGetNextBasicBlock(b)) {
+        for (LLVMValueRef i = LLVMGetFirstInstruction(b); i;
+             i = LLVMGetNextInstruction(i))
+            keep_operands(kept, i);
+    }
+}
+
+static bool is_kept(kept_t *kept, LLVMValueRef v)
+{
+    for (size_t i = 0; i < kept->n; ++i) {
+        if (kept->values[i] == v)
+            return true;
+    }
+
+    return false;
+}
+
+/* keep the local functions and variables v refers to */
+static void keep_operands(kept_t *kept, LLVMValueRef v)
+{
+    if ((LLVMIsAFunction(v) || LLVMIsAGlobalVariable(v))) {
+        if (is_local(v))
+            keep(kept, v);
+
+        return;
+    }
+
+    if (!LLVMIsAConstant(v) && !LLVMIsAInstruction(v))
+        return;
+
+    int n = LLVMGetNumOperands(v);
+
+    for (int k = 0; k < n; ++k) {
+        LLVMValueRef op = LLVMGetOperand(v, (unsigned)k);
+
+        if (op && (LLVMIsAConstant(op) || LLVMIsAFunction(op)))
+            keep_operands(kept, op);
+    }
+}
+
+/* turn fn into a declaration */
+static void delete_body(LLVMValueRef fn)
+{
+    LLVMBasicBlockRef b;
+
+    for (b = LLVMGetFirstBasicBlock(fn); b; b = LLVMGetNextBasicBlock(b)) {
+        for (LLVMValueRef i = LLVMGetFirstInstruction(b); i;
+             i = LLVMGetNextInstruction(i)) {
+            if (LLVMGetTypeKind(LLVMTypeOf(i)) != LLVMVoidTypeKind)
+                LLVMReplaceAllUsesWith(i, LLVMGetUndef(LLVMTypeOf(i)));
+        }
+    }
+
+    for (b = LLVMGetFirstBasicBlock(fn); b; b = LLVMGetNextBasicBlock(b)) {
+        for (LLVMValueRef i = LLVMGetLastInstruction(b), prev; i; i = prev) {
+            prev = LLVMGetPreviousInstruction(i);
+            LLVMInstructionEraseFromParent(i);
+        }
+    }
+
+    while ((b = LLVMGetFirstBasicBlock(fn)))
+        LLVMDeleteBasicBlock(b);
+}
+
+/* replace the definition of global by an external declaration */
+static void declare_global(LLVMModuleRef mod, LLVMValueRef global)
+{
+    size_t length = 0;
+    char *name = strdup(LLVMGetValueName2(global, &length));
+    LLVMValueRef decl = LLVMAddGlobal(mod, LLVMGlobalGetValueType(global),
+                                      "");
+
+    LLVMReplaceAllUsesWith(global, LLVMConstBitCast(decl,
+                                                    LLVMTypeOf(global)));
+    LLVMDeleteGlobal(global);
+
+    if (name[0])
+        LLVMSetValueName2(decl, name, length);
+
+    free(name);
+}
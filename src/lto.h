@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2015 soud
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef LTO_H
+#define LTO_H
+
+#include <llvm-c/Core.h>
+
+#include "erupt.h"
+
+/*
+ * ThinLTO-style link-time optimization across partitions. every partition
+ * is compiled to bitcode along with a summary of the functions it defines.
+ * the thin link reads only the summaries and picks the small functions each
+ * partition imports from the others, which are then copied into it as
+ * available_externally, so they can be inlined but are never emitted twice.
+ */
+
+/* the largest function that's imported, in LLVM instructions */
+#define LTO_IMPORT_LIMIT 100
+
+/* the limit for the callees of an import, in percent of the caller's */
+#define LTO_IMPORT_DECAY 70
+
+typedef struct {
+    char *name;
+
+    /* instructions, after the partition was optimized on its own */
+    size_t size;
+
+    /* exported, and doesn't use any mutable state of its partition */
+    bool importable;
+
+    /* the functions of other partitions it calls */
+    char **callees;
+    size_t n_callees;
+} lto_fn_t;
+
+typedef struct {
+    lto_fn_t *fns;
+    size_t n_fns;
+} lto_summary_t;
+
+/* what a partition imports, names[i] comes from the partition from[i] */
+typedef struct {
+    char **names;
+    size_t *from;
+    size_t n;
+} lto_imports_t;
+
+void summarize_module(LLVMModuleRef mod, lto_summary_t *summary);
+lto_imports_t *thin_link(lto_summary_t *summaries, size_t n);
+bool import_functions(LLVMModuleRef mod, LLVMMemoryBufferRef *bitcode,
+                      lto_imports_t *imports);
+void destroy_summary(lto_summary_t *summary);
+void destroy_imports(lto_imports_t *imports, size_t n);
+
+#endif /* !LTO_H */
@@ -22,21 +22,81 @@
 
 #include <getopt.h>
 #include <sys/stat.h>
-
+#include <unistd.h>
+
+#include "cache.h"
+#include "bytecode.h"
+#include "closure.h"
+#include "codegen.h"
+#include "dce.h"
+#include "emit.h"
 #include "erupt.h"
+#include "escape.h"
+#include "inline.h"
+#include "jit.h"
+#include "link.h"
+#include "lower.h"
+#include "parallel.h"
 #include "parser.h"
+#include "partition.h"
+#include "passes.h"
+#include "profile.h"
+#include "vm.h"
 
 #define MAX_FILE_SIZE 10000000 /* 10MB */
 
+/* options without a short equivalent */
+enum {
+    OPT_INLINE_THRESHOLD = 256,
+    OPT_NO_PARALLEL,
+    OPT_EMIT_EIR,
+    OPT_TIME_PASSES,
+    OPT_DISABLE_PASS,
+    OPT_EMIT_LLVM,
+    OPT_RUN,
+    OPT_TIERED,
+    OPT_NO_CACHE,
+    OPT_BACKEND,
+    OPT_EMIT_BYTECODE,
+    OPT_PROFILE_GENERATE,
+    OPT_PROFILE_USE,
+    OPT_LTO,
+    OPT_PERF_MAP
+};
+
 static int eval(const char *path, char *source);
+static bool use_profile(ast_node_list_t *ast);
+static int compile(eir_module_t *module);
+static int interpret(eir_module_t *module);
+static int emit_module_llvm(eir_module_t *module);
+static bool write_object(LLVMMemoryBufferRef object, const char *path);
 static char *generate_output_name(const char *filename);
 static int get_options(int argc, char *argv[]);
 static char *read_path(const char *path);
 static char *read_file(FILE *handler);
+static bool parse_int_option(const char *name, const char *arg, int *out);
 
 bool SHOW_TOKENS = false;
 bool SHOW_AST = false;
 char *OUTPUT_NAME;
+int INLINE_THRESHOLD = DEFAULT_INLINE_THRESHOLD;
+bool PARALLELIZE = true;
+bool EMIT_EIR = false;
+bool TIME_PASSES = false;
+bool EMIT_LLVM = false;
+int OPT_LEVEL = DEFAULT_OPT_LEVEL;
+int JOBS = 0;
+bool USE_CACHE = true;
+bool RUN = false;
+bool TIERED = false;
+bool USE_VM = false;
+bool EMIT_BYTECODE = false;
+bool PROFILE_GENERATE = false;
+char *PROFILE_USE = NULL;
+bool LTO = false;
+bool COMPILE_ONLY = false;
+bool DEBUG_INFO = false;
+bool PERF_MAP = false;
 
 void usage()
 {
@@ -52,6 +112,51 @@ void usage()
         "               show generated tokens\n"
         "       -A, --ast\n"
         "               show nodes of the generated AST\n"
+        "       -c\n"
+        "               only compile to an object, don't link\n"
+        "       -O LEVEL\n"
+        "               optimization level, 0 to 3 (default: 2)\n"
+        "       -g\n"
+        "               generate debug info, for debuggers and profilers\n"
+        "       -j, --jobs=N\n"
+        "               compile on N threads (default: number of cores)\n"
+        "       --no-cache\n"
+        "               don't reuse or store compiled code in the cache\n"
+        "       --lto\n"
+        "               optimize across the parts of the program that are\n"
+        "               compiled separately, so they can be inlined into\n"
+        "               each other\n"
+        "       --inline-threshold=N\n"
+        "               maximum cost of an inlined function, 0 disables\n"
+        "               inlining (default: 25)\n"
+        "       --no-parallel\n"
+        "               never evaluate independent pure calls in parallel\n"
+        "       --emit-eir\n"
+        "               show the optimized EIR and stop\n"
+        "       --time-passes\n"
+        "               show how long each EIR pass took\n"
+        "       --disable-pass=NAME\n"
+        "               don't run the EIR pass NAME, can be repeated\n"
+        "       --emit-llvm\n"
+        "               show the optimized LLVM IR and stop\n"
+        "       --run\n"
+        "               compile in memory and run the program right away\n"
+        "       --tiered\n"
+        "               like --run, but only optimize the functions that get\n"
+        "               hot, in the background\n"
+        "       --perf-map\n"
+        "               with --run, describe the compiled code to perf in\n"
+        "               /tmp/perf-PID.map and a jitdump\n"
+        "       --backend=NAME\n"
+        "               llvm compiles to native code, vm runs the program\n"
+        "               in the bytecode interpreter (default: llvm)\n"
+        "       --emit-bytecode\n"
+        "               show the bytecode for the VM and stop\n"
+        "       --profile-generate\n"
+        "               count how often every clause and branch runs, the\n"
+        "               program writes the counts to a profile on exit\n"
+        "       --profile-use=FILE\n"
+        "               optimize for the counts in the profile FILE\n"
         "       -h, --help\n"
         "               show this\n",
         stderr
@@ -89,9 +194,17 @@ int main(int argc, char *argv[])
      * if no output name is given, make the output name the name of the file
      * without extension and folder structure.
      */
-    if (!OUTPUT_NAME)
+    if (!OUTPUT_NAME) {
         OUTPUT_NAME = generate_output_name(target);
 
+        if (COMPILE_ONLY) {
+            char *name = smalloc(strlen(OUTPUT_NAME) + sizeof(".o"));
+
+            sprintf(name, "%s.o", OUTPUT_NAME);
+            OUTPUT_NAME = name;
+        }
+    }
+
     /* finally, evaluate the file */
     return eval(target, source);
 }
@@ -127,12 +240,223 @@ static int eval(const char *path, char *source)
         return ERUPT_PARSER_ERROR;
     }
 
+    /* profiling, before anything moves code around */
+    char **counters = NULL;
+    size_t n_counters = 0;
+
+    if (PROFILE_GENERATE)
+        n_counters = instrument_ast(parser->ast, &counters);
+
+    if (PROFILE_USE && !use_profile(parser->ast)) {
+        destroy_parser(parser);
+        destroy_lexer(lexer);
+
+        return ERUPT_ERROR;
+    }
+
+    /* optimization, inlining would count the inlined code twice */
+    eliminate_dead_functions(parser->ast);
+
+    /* lifted lambdas are functions, the passes after this treat them so */
+    lift_lambdas(parser->ast);
+
+    if (!PROFILE_GENERATE)
+        inline_functions(parser->ast, INLINE_THRESHOLD);
+
+    analyze_escapes(parser->ast);
+
+    if (PARALLELIZE)
+        parallelize_exprs(parser->ast);
+
+    /* lowering */
+    eir_module_t *module = lower_ast(path, parser->ast);
+
     destroy_parser(parser);
     destroy_lexer(lexer);
 
+    if (!module) {
+        for (size_t i = 0; i < n_counters; ++i)
+            free(counters[i]);
+
+        free(counters);
+        erupt_fatal_error("compile error(s) occured, stopping compilation.");
+
+        return ERUPT_COMPILE_ERROR;
+    }
+
+    module->counters = counters;
+    module->n_counters = n_counters;
+    module->debug_info = DEBUG_INFO;
+
+    if (!run_eir_passes(module, TIME_PASSES)) {
+        destroy_eir_module(module);
+
+        return ERUPT_COMPILE_ERROR;
+    }
+
+    if (EMIT_EIR) {
+        dump_eir_module(module, stdout);
+        destroy_eir_module(module);
+
+        return ERUPT_OK;
+    }
+
+    int status = ERUPT_COMPILE_ERROR;
+
+    if (USE_VM) {
+        status = interpret(module);
+    } else if (RUN) {
+        if (!run_jit(module, OPT_LEVEL, TIERED, PERF_MAP, &status))
+            status = ERUPT_COMPILE_ERROR;
+    } else {
+        status = compile(module);
+    }
+
+    destroy_eir_module(module);
+
+    return status;
+}
+
+/* read PROFILE_USE and annotate ast with its counts */
+static bool use_profile(ast_node_list_t *ast)
+{
+    profile_t *profile = read_profile(PROFILE_USE);
+
+    if (!profile)
+        return false;
+
+    if (apply_profile(ast, profile) == 0)
+        erupt_warning("profile '%s' doesn't match the program, it's ignored",
+                      PROFILE_USE);
+    else
+        verbose_printf("using profile '%s'", PROFILE_USE);
+
+    destroy_profile(profile);
+
+    return true;
+}
+
+/*
+ * generate native code for module and link it into OUTPUT_NAME. the module
+ * is compiled in partitions, on JOBS threads. with -c it's compiled into a
+ * single object, which is written to OUTPUT_NAME instead.
+ */
+static int compile(eir_module_t *module)
+{
+    size_t n = 0;
+    bool ok = false;
+
+    if (EMIT_LLVM)
+        return emit_module_llvm(module);
+
+    if (!eir_lookup_fn(module, ENTRY_POINT)) {
+        erupt_fatal_error("'%s' has no %s function", module->name,
+                          ENTRY_POINT);
+        return ERUPT_COMPILE_ERROR;
+    }
+
+    if (JOBS < 1)
+        JOBS = (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+    cache_t *cache = USE_CACHE ? open_cache() : NULL;
+    partition_t *partitions = COMPILE_ONLY ? (n = 1, single_partition(module))
+                                           : partition_module(module, &n);
+    LLVMMemoryBufferRef *objects = emit_partitions(module, partitions, n,
+                                                   OPT_LEVEL, JOBS, cache,
+                                                   LTO);
+
+    destroy_partitions(partitions, n);
+    close_cache(cache);
+
+    if (objects) {
+        ok = COMPILE_ONLY ? write_object(objects[0], OUTPUT_NAME)
+                          : link_objects(objects, n, OUTPUT_NAME);
+
+        for (size_t i = 0; i < n; ++i)
+            LLVMDisposeMemoryBuffer(objects[i]);
+
+        free(objects);
+    }
+
+    if (!ok) {
+        erupt_fatal_error("code generation failed, stopping compilation.");
+        return ERUPT_COMPILE_ERROR;
+    }
+
     return ERUPT_OK;
 }
 
+/* the whole module as one optimized LLVM module */
+static int emit_module_llvm(eir_module_t *module)
+{
+    int status = ERUPT_COMPILE_ERROR;
+    LLVMContextRef ctx = LLVMContextCreate();
+    LLVMModuleRef mod = codegen_module(module, ctx);
+    LLVMTargetMachineRef tm = mod ? create_target_machine(OPT_LEVEL) : NULL;
+
+    if (tm && optimize_module(mod, tm, OPT_LEVEL)) {
+        emit_llvm(mod, stdout);
+        status = ERUPT_OK;
+    }
+
+    if (tm)
+        LLVMDisposeTargetMachine(tm);
+
+    if (mod)
+        LLVMDisposeModule(mod);
+
+    LLVMContextDispose(ctx);
+
+    if (status != ERUPT_OK)
+        erupt_fatal_error("code generation failed, stopping compilation.");
+
+    return status;
+}
+
+/* run module in the VM, or show its bytecode */
+static int interpret(eir_module_t *module)
+{
+    int status = ERUPT_COMPILE_ERROR;
+    vm_program_t *program = lower_bytecode(module);
+
+    if (!program) {
+        erupt_fatal_error("compile error(s) occured, stopping compilation.");
+        return ERUPT_COMPILE_ERROR;
+    }
+
+    if (EMIT_BYTECODE) {
+        dump_bytecode(program, stdout);
+        status = ERUPT_OK;
+    } else {
+        run_vm(program, &status);
+    }
+
+    destroy_bytecode(program);
+
+    return status;
+}
+
+/* write a compiled object to path */
+static bool write_object(LLVMMemoryBufferRef object, const char *path)
+{
+    FILE *f = fopen(path, "wb");
+    size_t size = LLVMGetBufferSize(object);
+
+    if (!f) {
+        erupt_error("couldn't open '%s' for writing", path);
+        return false;
+    }
+
+    bool written = fwrite(LLVMGetBufferStart(object), 1, size, f) == size;
+
+    if (fclose(f) != 0 || !written) {
+        erupt_error("couldn't write '%s'", path);
+        return false;
+    }
+
+    return true;
+}
+
 static char *generate_output_name(const char *filename)
 {
     char *result = strdup(filename);
@@ -156,6 +480,22 @@ static int get_options(int argc, char *argv[])
         { "tokens"  , no_argument       , NULL , 'T' },
         { "ast"     , no_argument       , NULL , 'A' },
         { "help"    , no_argument       , NULL , 'h' },
+        { "inline-threshold", required_argument, NULL, OPT_INLINE_THRESHOLD },
+        { "no-parallel", no_argument, NULL, OPT_NO_PARALLEL },
+        { "emit-eir", no_argument, NULL, OPT_EMIT_EIR },
+        { "time-passes", no_argument, NULL, OPT_TIME_PASSES },
+        { "disable-pass", required_argument, NULL, OPT_DISABLE_PASS },
+        { "emit-llvm", no_argument, NULL, OPT_EMIT_LLVM },
+        { "run", no_argument, NULL, OPT_RUN },
+        { "tiered", no_argument, NULL, OPT_TIERED },
+        { "no-cache", no_argument, NULL, OPT_NO_CACHE },
+        { "jobs", required_argument, NULL, 'j' },
+        { "backend", required_argument, NULL, OPT_BACKEND },
+        { "emit-bytecode", no_argument, NULL, OPT_EMIT_BYTECODE },
+        { "profile-generate", no_argument, NULL, OPT_PROFILE_GENERATE },
+        { "profile-use", required_argument, NULL, OPT_PROFILE_USE },
+        { "lto", no_argument, NULL, OPT_LTO },
+        { "perf-map", no_argument, NULL, OPT_PERF_MAP },
         { 0         , 0                 , 0    , 0 }
     };
     int choice = 0;
@@ -163,7 +503,7 @@ static int get_options(int argc, char *argv[])
     while (1) {
         int option_index = 0;
 
-        choice = getopt_long(argc, argv, "o:vVTAh", long_options,
+        choice = getopt_long(argc, argv, "o:vVTAO:j:cgh", long_options,
                              &option_index);
 
         if (choice == -1)
@@ -188,11 +528,105 @@ static int get_options(int argc, char *argv[])
         case 'A':
             SHOW_AST = true;
             break;
+        case 'O':
+            if (strlen(optarg) != 1 || optarg[0] < '0' ||
+                optarg[0] > '0' + MAX_OPT_LEVEL) {
+                erupt_fatal_error("invalid optimization level '%s', it has "
+                                  "to be 0 to %d", optarg, MAX_OPT_LEVEL);
+                return ERUPT_ERROR;
+            }
+
+            OPT_LEVEL = optarg[0] - '0';
+            break;
+        case 'c':
+            COMPILE_ONLY = true;
+            break;
+        case 'g':
+            DEBUG_INFO = true;
+            break;
+        case 'j':
+            if (!parse_int_option("jobs", optarg, &JOBS) || JOBS < 1) {
+                erupt_fatal_error("the number of jobs has to be at least 1");
+                return ERUPT_ERROR;
+            }
+            break;
+        case OPT_INLINE_THRESHOLD:
+            if (!parse_int_option("inline-threshold", optarg,
+                                  &INLINE_THRESHOLD))
+                return ERUPT_ERROR;
+            break;
+        case OPT_NO_PARALLEL:
+            PARALLELIZE = false;
+            break;
+        case OPT_EMIT_EIR:
+            EMIT_EIR = true;
+            break;
+        case OPT_TIME_PASSES:
+            TIME_PASSES = true;
+            break;
+        case OPT_DISABLE_PASS:
+            if (!disable_eir_pass(optarg)) {
+                erupt_fatal_error("unknown pass '%s', available passes are:",
+                                  optarg);
+                list_eir_passes(stderr);
+                return ERUPT_ERROR;
+            }
+            break;
+        case OPT_EMIT_LLVM:
+            EMIT_LLVM = true;
+            break;
+        case OPT_NO_CACHE:
+            USE_CACHE = false;
+            break;
+        case OPT_RUN:
+            RUN = true;
+            break;
+        case OPT_TIERED:
+            RUN = true;
+            TIERED = true;
+            break;
+        case OPT_BACKEND:
+            if (strcmp(optarg, "llvm") != 0 && strcmp(optarg, "vm") != 0) {
+                erupt_fatal_error("unknown backend '%s', it has to be llvm "
+                                  "or vm", optarg);
+                return ERUPT_ERROR;
+            }
+
+            USE_VM = strcmp(optarg, "vm") == 0;
+            break;
+        case OPT_EMIT_BYTECODE:
+            USE_VM = true;
+            EMIT_BYTECODE = true;
+            break;
+        case OPT_PROFILE_GENERATE:
+            PROFILE_GENERATE = true;
+            break;
+        case OPT_PROFILE_USE:
+            PROFILE_USE = optarg;
+            break;
+        case OPT_LTO:
+            LTO = true;
+            break;
+        case OPT_PERF_MAP:
+            PERF_MAP = true;
+            break;
         default:
             usage();
         }
     }
 
+    /* the counters are defined next to C's main, in the executable */
+    if (PROFILE_GENERATE && (RUN || USE_VM)) {
+        erupt_fatal_error("--profile-generate only works when compiling "
+                          "executables");
+        return ERUPT_ERROR;
+    }
+
+    if (PERF_MAP && (!RUN || USE_VM)) {
+        erupt_fatal_error("--perf-map only works with --run or --tiered");
+        return ERUPT_ERROR;
+    }
+
     return ERUPT_OK;
 }
 
@@ -235,3 +669,18 @@ static char *read_file(FILE *handler)
 
     return buffer;
 }
+
+static bool parse_int_option(const char *name, const char *arg, int *out)
+{
+    char *end = NULL;
+    long v = strtol(arg, &end, 10);
+
+    if (*arg == '\0' || *end != '\0' || v < 0 || v > INT_MAX) {
+        erupt_fatal_error("invalid value '%s' for --%s", arg, name);
+        return false;
+    }
+
+    *out = (int)v;
+
+    return true;
+}
@@ -0,0 +1,387 @@
+/*
+ * Copyright (C) 2015 soud
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * floats are converted with the Eisel-Lemire algorithm: the first 19
+ * significant digits are multiplied by a 128-bit approximation of the power
+ * of ten, which gives the correctly rounded double unless the product is
+ * too close to halfway between two of them. only then, or for subnormals,
+ * strtod does it the slow way. see Daniel Lemire, "Number Parsing at a
+ * Gigabyte per Second".
+ */
+
+#include <math.h>
+
+#include "number.h"
+#include "pow10.h"
+
+/* 19 decimal digits always fit in 64 bits */
+#define MAX_DIGITS 19
+
+/* any float with a larger exponent is 0 or infinite, whatever its digits */
+#define MAX_EXPONENT 100000
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define EIGHT_DIGITS
+#endif
+
+typedef struct {
+    /* the first MAX_DIGITS significant digits, and how many there are */
+    uint64_t w;
+    size_t n;
+
+    /* the significant digits after those, and whether one of them isn't 0 */
+    int64_t dropped;
+    bool truncated;
+} digits_t;
+
+/* the powers of ten that are exact doubles */
+static const double exact_powers[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12,
+    1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static const char *scan_radix(const char *p, unsigned bits, number_t *n);
+static const char *scan_decimal(const char *p, const char *end, number_t *n);
+static const char *scan_digits(const char *p, const char *end, digits_t *d,
+                               size_t *count);
+static double slow_path(const char *s, const char *end);
+static unsigned digit_value(char c);
+static bool is_digit(char c);
+static bool is_alnum(char c);
+
+/*
+ * scan the literal at s, which starts with a digit and ends before end,
+ * into n. returns its length, including whatever makes it malformed.
+ */
+size_t scan_number(const char *s, const char *end, number_t *n)
+{
+    const char *p;
+
+    n->error = NULL;
+    n->big = false;
+
+    if (s[0] == '0' && (s[1] == 'x' || s[1] == 'X'))
+        p = scan_radix(s + 2, 4, n);
+    else if (s[0] == '0' && (s[1] == 'b' || s[1] == 'B'))
+        p = scan_radix(s + 2, 1, n);
+    else
+        p = scan_decimal(s, end, n);
+
+    /* 1.2.3, 12ab and 0x1g aren't a number followed by something else */
+    if (is_alnum(*p) || *p == '_' || (*p == '.' && is_digit(p[1]))) {
+        while (is_alnum(*p) || *p == '_' || (*p == '.' && is_digit(p[1])))
+            ++p;
+
+        n->type = ERROR;
+        n->error = "malformed number";
+    }
+
+    return (size_t)(p - s);
+}
+
+/*
+ * w * 10^q as the nearest double. returns false if that can't be told
+ * without looking at more digits than w has.
+ */
+bool decimal_to_double(uint64_t w, int64_t q, double *d)
+{
+    if (w == 0 || q > POW10_MAX) {
+        *d = w == 0 ? 0.0 : INFINITY;
+        return true;
+    }
+
+    if (q < POW10_MIN)
+        return false;
+
+    /* w and 10^q are exact doubles, so is their rounded product */
+    if (w <= UINT64_C(1) << 53 && q >= -22 && q <= 22) {
+        *d = q < 0 ? (double)w / exact_powers[-q]
+                   : (double)w * exact_powers[q];
+        return true;
+    }
+
+    const uint64_t *power = pow10_significands[q - POW10_MIN];
+    int lz = __builtin_clzll(w);
+    unsigned __int128 product;
+    uint64_t upper, lower;
+
+    w <<= lz;
+    product = (unsigned __int128)w * power[0];
+    upper = (uint64_t)(product >> 64);
+    lower = (uint64_t)product;
+
+    /*
+     * power is at most 1 too small, so the product is at most w too small.
+     * if adding that could carry into the bits that are kept, the next 64
+     * bits of the power are needed.
+     */
+    if ((upper & 0x1ff) == 0x1ff && lower + w < lower) {
+        unsigned __int128 next = (unsigned __int128)w * power[1];
+        uint64_t middle = lower + (uint64_t)(next >> 64);
+
+        if (middle < lower)
+            ++upper;
+
+        if (middle + 1 == 0 && (upper & 0x1ff) == 0x1ff &&
+            (uint64_t)next + w < (uint64_t)next)
+            return false;
+
+        lower = middle;
+    }
+
+    /* the 54 bits after the leading 1, one more than a double keeps */
+    uint64_t upper_bit = upper >> 63;
+    uint64_t mantissa = upper >> (upper_bit + 9);
+
+    lz += (int)(1 ^ upper_bit);
+
+    /* exactly halfway, which rounds to even */
+    if (lower == 0 && (upper & 0x1ff) == 0 && (mantissa & 3) == 1)
+        return false;
+
+    mantissa += mantissa & 1;
+    mantissa >>= 1;
+
+    /* rounding up carried into the next power of two */
+    if (mantissa >= UINT64_C(1) << 53) {
+        mantissa = UINT64_C(1) << 52;
+        --lz;
+    }
+
+    mantissa &= ~(UINT64_C(1) << 52);
+
+    /* floor(log2(10^q)), as 217706 / 2^16 is just over log2(10) */
+    int64_t exponent = ((217706 * q) >> 16) + 1024 + 63 - lz;
+
+    /* subnormals and overflows are left to strtod */
+    if (exponent < 1 || exponent > 2046)
+        return false;
+
+    uint64_t bits = mantissa | (uint64_t)exponent << 52;
+
+    memcpy(d, &bits, sizeof(double));
+
+    return true;
+}
+
+/* hex or binary digits, with bits bits each */
+static const char *scan_radix(const char *p, unsigned bits, number_t *n)
+{
+    const char *start = p;
+    unsigned radix = 1u << bits;
+    uint64_t v = 0;
+    bool overflow = false;
+
+    for (;; ++p) {
+        if (*p == '_' && p > start && digit_value(p[-1]) < radix &&
+            digit_value(p[1]) < radix)
+            continue;
+
+        unsigned digit = digit_value(*p);
+
+        if (digit >= radix)
+            break;
+
+        overflow |= v >> (64 - bits) != 0;
+        v = v << bits | digit;
+    }
+
+    if (p == start) {
+        n->type = ERROR;
+        n->error = "malformed number";
+    } else {
+        n->type = INT;
+        n->big = overflow || v > INT64_MAX;
+        n->i = n->big ? 0 : (int64_t)v;
+    }
+
+    return p;
+}
+
+static const char *scan_decimal(const char *p, const char *end, number_t *n)
+{
+    const char *start = p;
+    digits_t d = { 0, 0, 0, false };
+    size_t count, fraction = 0;
+    int64_t exponent = 0;
+
+    p = scan_digits(p, end, &d, &count);
+    n->type = INT;
+
+    if (*p == '.' && is_digit(p[1])) {
+        p = scan_digits(p + 1, end, &d, &fraction);
+        n->type = FLOAT;
+    }
+
+    if ((*p == 'e' || *p == 'E') &&
+        (is_digit(p[1]) || ((p[1] == '+' || p[1] == '-') && is_digit(p[2])))) {
+        bool negative = p[1] == '-';
+
+        for (p += is_digit(p[1]) ? 1 : 2;
+             is_digit(*p) || (*p == '_' && is_digit(p[-1]) && is_digit(p[1]));
+             ++p) {
+            if (*p != '_' && exponent < MAX_EXPONENT)
+                exponent = exponent * 10 + (*p - '0');
+        }
+
+        exponent = negative ? -exponent : exponent;
+        n->type = FLOAT;
+    }
+
+    if (n->type == INT) {
+        n->big = d.dropped || d.w > INT64_MAX;
+        n->i = n->big ? 0 : (int64_t)d.w;
+
+        return p;
+    }
+
+    /*
+     * the value is between w and w + 1 times 10^q. if both round to the
+     * same double, that's the one.
+     */
+    int64_t q = exponent - (int64_t)fraction + d.dropped;
+    double upper;
+
+    if (!decimal_to_double(d.w, q, &n->f) ||
+        (d.truncated && (!decimal_to_double(d.w + 1, q, &upper) ||
+                         upper != n->f)))
+        n->f = slow_path(start, p);
+
+    if (isinf(n->f)) {
+        n->type = ERROR;
+        n->error = "float out of range";
+    }
+
+    return p;
+}
+
+/*
+ * the digits at p, and the underscores between them, added to d. *count
+ * is set to how many digits there are.
+ */
+static const char *scan_digits(const char *p, const char *end, digits_t *d,
+                               size_t *count)
+{
+    const char *start = p;
+
+    *count = 0;
+
+    for (;;) {
+#ifdef EIGHT_DIGITS
+        /*
+         * eight digits at a time while they fit, each byte of chunk is a
+         * digit if adding 0x46 doesn't and subtracting 0x30 doesn't set its
+         * top bit. see Lemire's fast_float.
+         */
+        if (d->n && d->n <= MAX_DIGITS - 8 && end - p >= 8) {
+            uint64_t chunk;
+
+            memcpy(&chunk, p, sizeof(chunk));
+
+            if (!(((chunk + UINT64_C(0x4646464646464646)) |
+                   (chunk - UINT64_C(0x3030303030303030))) &
+                  UINT64_C(0x8080808080808080))) {
+                chunk -= UINT64_C(0x3030303030303030);
+                chunk = chunk * 10 + (chunk >> 8);
+                chunk = (((chunk & UINT64_C(0x000000ff000000ff)) *
+                          UINT64_C(0x000f424000000064)) +
+                         (((chunk >> 16) & UINT64_C(0x000000ff000000ff)) *
+                          UINT64_C(0x0000271000000001))) >> 32;
+
+                d->w = d->w * 100000000 + (uint32_t)chunk;
+                d->n += 8;
+                *count += 8;
+                p += 8;
+                continue;
+            }
+        }
+#else
+        (void)end;
+#endif
+
+        if (*p == '_' && p > start && is_digit(p[-1]) && is_digit(p[1])) {
+            ++p;
+            continue;
+        }
+
+        if (!is_digit(*p))
+            return p;
+
+        unsigned digit = (unsigned)(*p++ - '0');
+
+        ++*count;
+
+        /* leading zeros aren't significant */
+        if (d->n < MAX_DIGITS && (d->n || digit)) {
+            d->w = d->w * 10 + digit;
+            ++d->n;
+        } else if (d->n) {
+            ++d->dropped;
+            d->truncated |= digit != 0;
+        }
+    }
+}
+
+/* strtod on the literal from s to end, without underscores */
+static double slow_path(const char *s, const char *end)
+{
+    char *copy = smalloc((size_t)(end - s) + 1), *q = copy;
+
+    for (const char *p = s; p < end; ++p) {
+        if (*p != '_')
+            *q++ = *p;
+    }
+
+    *q = '\0';
+
+    double d = strtod(copy, NULL);
+
+    free(copy);
+
+    return d;
+}
+
+/* 0-15 for a hex digit, 16 for anything else */
+static unsigned digit_value(char c)
+{
+    if (c >= '0' && c <= '9')
+        return (unsigned)(c - '0');
+
+    if (c >= 'a' && c <= 'f')
+        return (unsigned)(c - 'a' + 10);
+
+    if (c >= 'A' && c <= 'F')
+        return (unsigned)(c - 'A' + 10);
+
+    return 16;
+}
+
+static bool is_digit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+static bool is_alnum(char c)
+{
+    return is_digit(c) || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
@@ -0,0 +1,52 @@
+/*
+ * Copyright (C) 2015 soud
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef NUMBER_H
+#define NUMBER_H
+
+/*
+ * numeric literals, converted while lexing. ints are decimal, hex (0x) or
+ * binary (0b), floats are decimal with an optional exponent. digits can be
+ * separated by underscores: 1_000_000.
+ */
+
+#include "erupt.h"
+#include "token.h"
+
+typedef struct {
+    /* INT, FLOAT or ERROR, when error says what's wrong */
+    token_type_t type;
+    const char *error;
+
+    /* an INT outside int64, i isn't set and the literal is a bignum */
+    bool big;
+
+    union {
+        int64_t i;
+        double f;
+    };
+} number_t;
+
+size_t scan_number(const char *s, const char *end, number_t *n);
+bool decimal_to_double(uint64_t w, int64_t q, double *d);
+
+#endif /* !NUMBER_H */
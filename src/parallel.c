@@ -0,0 +1,179 @@
+/*
+ * Copyright (C) 2015 soud
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "parallel.h"
+#include "callgraph.h"
+#include "erupt.h"
+#include "inline.h"
+
+typedef struct {
+    callgraph_t *cg;
+    bool *impure;
+    size_t parallel;
+} parallel_t;
+
+typedef struct {
+    parallel_t *p;
+    bool impure;
+    bool recurses;
+} scan_t;
+
+static void find_impure(parallel_t *p);
+static void scan_call(ast_node_t *node, void *data);
+static void parallelize_node(ast_node_t *node, void *data);
+static bool worth_a_task(parallel_t *p, ast_node_t *node, bool *pure);
+
+/*
+ * mark binary expressions whose operands are independent, pure and
+ * expensive enough to be evaluated at the same time. fib(x-1) + fib(x-2)
+ * is the typical case. codegen evaluates the lhs of a marked expression in
+ * a runtime task while it evaluates the rhs itself, the runtime falls back
+ * to evaluating it inline when the tasks get too fine grained. returns the
+ * number of expressions marked.
+ */
+size_t parallelize_exprs(ast_node_list_t *ast)
+{
+    if (!ast)
+        return 0;
+
+    parallel_t p;
+
+    p.cg = build_callgraph(ast);
+    p.impure = scalloc(p.cg->n_nodes + 1, sizeof(bool));
+    p.parallel = 0;
+
+    verbose_printf("looking for independent pure subexpressions");
+
+    find_impure(&p);
+
+    for (size_t i = 0; i < p.cg->n_nodes; ++i) {
+        for (size_t j = 0; j < p.cg->nodes[i].n_clauses; ++j)
+            visit_node_list(p.cg->nodes[i].clauses[j]->fn.body,
+                            parallelize_node, &p);
+    }
+
+    free(p.impure);
+    destroy_callgraph(p.cg);
+
+    verbose_printf("%zu expression(s) will be evaluated in parallel",
+                   p.parallel);
+
+    return p.parallel;
+}
+
+/*
+ * a function is pure when it only calls pure functions. anything that isn't
+ * defined in the program, like IO.print, is assumed to have side effects.
+ * impurity spreads from callees to callers until nothing changes.
+ */
+static void find_impure(parallel_t *p)
+{
+    bool changed;
+
+    do {
+        changed = false;
+
+        for (size_t i = 0; i < p->cg->n_nodes; ++i) {
+            cg_node_t *fn = &p->cg->nodes[i];
+            scan_t s = { p, false, false };
+
+            if (p->impure[i])
+                continue;
+
+            for (size_t j = 0; j < fn->n_clauses; ++j)
+                visit_node_list(fn->clauses[j]->fn.body, scan_call, &s);
+
+            if (s.impure) {
+                p->impure[i] = true;
+                changed = true;
+            }
+        }
+    } while (changed);
+}
+
+static void scan_call(ast_node_t *node, void *data)
+{
+    scan_t *s = data;
+    const char *name = node->type == TYPE_CALL ? node->call.name : NULL;
+
+    /* x |> f calls f, which can be a closure */
+    if (node->type == TYPE_EXPR && node->expr.operator &&
+        node->expr.operator->symbol == PIPE && node->expr.rhs &&
+        node->expr.rhs->type == TYPE_VAR && !node->expr.rhs->var.v)
+        name = node->expr.rhs->var.name;
+
+    if (!name)
+        return;
+
+    cg_node_t *callee = callgraph_lookup(s->p->cg, name);
+
+    if (!callee || s->p->impure[callee - s->p->cg->nodes])
+        s->impure = true;
+    else if (callee->recursive)
+        s->recurses = true;
+}
+
+static void parallelize_node(ast_node_t *node, void *data)
+{
+    parallel_t *p = data;
+
+    if (node->type != TYPE_EXPR || !node->expr.operator ||
+        !node->expr.lhs || !node->expr.rhs)
+        return;
+
+    switch (node->expr.operator->symbol) {
+    case AND:
+    case OR:
+    case PIPE:
+        /* the rhs isn't evaluated unconditionally or independently */
+        return;
+    default:
+        break;
+    }
+
+    /* codegen spawns the lhs as a single call with its arguments evaluated */
+    if (node->expr.lhs->type != TYPE_CALL)
+        return;
+
+    bool lhs_pure, rhs_pure;
+
+    if (worth_a_task(p, node->expr.lhs, &lhs_pure) &&
+        worth_a_task(p, node->expr.rhs, &rhs_pure) && lhs_pure && rhs_pure) {
+        node->expr.parallel = true;
+        ++p->parallel;
+    }
+}
+
+/*
+ * a pure operand is worth evaluating in parallel when it's expensive on its
+ * own or calls into recursion, where the real work usually is.
+ */
+static bool worth_a_task(parallel_t *p, ast_node_t *node, bool *pure)
+{
+    scan_t s = { p, false, false };
+
+    visit_node(node, scan_call, &s);
+
+    *pure = !s.impure;
+
+    return s.recurses || node_cost(node) >= PARALLEL_MIN_COST;
+}
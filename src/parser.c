@@ -40,11 +40,20 @@ parser_t *parse(lexer_t *l)
 
     verbose_printf("generating abstract syntax tree");
 
-    do {
+    while (!is(p, _EOF)) {
+        size_t line_n = p->token->line_n;
+
         node = parse_top_level(p);
 
+        if (node) {
+            if (!node->line_n)
+                node->line_n = line_n;
+
+            append_node(p->ast, node);
+        }
+
         eat(p);
-    } while (!is(p, _EOF));
+    }
 
     return p;
 }
@@ -107,7 +116,17 @@ static ast_node_t *parse_if(parser_t *p)
  */
 static ast_node_t *parse_import(parser_t *p)
 {
-    return NULL;
+    bool include = is(p, INCLUDE);
+
+    if (peek(p)->type != IDENT) {
+        parser_file_error(p, "expected module name after '%s'",
+                          token_str(p->token));
+        return NULL;
+    }
+
+    eat(p);
+
+    return create_import(p->token->value, include);
 }
 
 static token_t *peek(parser_t *p)
@@ -0,0 +1,208 @@
+/*
+ * Copyright (C) 2015 soud
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * splitting a module into partitions that are compiled independently. a
+ * partition holds whole components of the call graph, so mutually
+ * recursive functions can still be inlined into each other. partitions
+ * only depend on the program, never on how many threads compile them, so
+ * the output is the same for every -j.
+ *
+ * where a partition ends is picked by the names of the functions rather than
+ * by their sizes. that way a change to one function only changes its own
+ * partition, and the others can come from the compile cache.
+ */
+
+#include "partition.h"
+
+typedef struct {
+    const char *name;
+    size_t partition;
+    size_t index;
+} owner_t;
+
+static size_t fn_size(eir_fn_t *fn);
+static bool ends_partition(eir_fn_t *fn, size_t size);
+static int compare_scc(const void *a, const void *b);
+static int compare_owner(const void *a, const void *b);
+static void add_fn(partition_t *p, eir_fn_t *fn);
+static void mark_exported(partition_t *partitions, size_t n,
+                          owner_t *owners, size_t n_fns);
+
+partition_t *partition_module(eir_module_t *m, size_t *n_partitions)
+{
+    size_t n_fns = 0, n = 0, size = 0;
+
+    for (eir_fn_t *fn = m->first; fn; fn = fn->next)
+        ++n_fns;
+
+    eir_fn_t **fns = smalloc(sizeof(eir_fn_t *) * (n_fns + 1));
+    owner_t *owners = smalloc(sizeof(owner_t) * (n_fns + 1));
+    partition_t *partitions = NULL;
+
+    n_fns = 0;
+
+    for (eir_fn_t *fn = m->first; fn; fn = fn->next)
+        fns[n_fns++] = fn;
+
+    /* components are numbered bottom-up, keep the members of one together */
+    qsort(fns, n_fns, sizeof(eir_fn_t *), compare_scc);
+
+    for (size_t i = 0; i < n_fns; ++i) {
+        bool new_scc = i == 0 || fns[i]->scc != fns[i - 1]->scc;
+
+        if (n == 0 || (new_scc && ends_partition(fns[i], size))) {
+            partitions = srealloc(partitions, sizeof(partition_t) * (n + 1));
+            partitions[n].fns = NULL;
+            partitions[n].exported = NULL;
+            partitions[n++].n_fns = 0;
+            size = 0;
+        }
+
+        add_fn(&partitions[n - 1], fns[i]);
+        size += fn_size(fns[i]);
+
+        owners[i].name = fns[i]->name;
+        owners[i].partition = n - 1;
+        owners[i].index = partitions[n - 1].n_fns - 1;
+    }
+
+    qsort(owners, n_fns, sizeof(owner_t), compare_owner);
+    mark_exported(partitions, n, owners, n_fns);
+
+    free(fns);
+    free(owners);
+
+    verbose_printf("split %zu functions into %zu partition(s)", n_fns, n);
+
+    *n_partitions = n;
+
+    return partitions;
+}
+
+/* the whole module as one partition, for when it has to be one object */
+partition_t *single_partition(eir_module_t *m)
+{
+    partition_t *partition = scalloc(1, sizeof(partition_t));
+
+    for (eir_fn_t *fn = m->first; fn; fn = fn->next)
+        add_fn(partition, fn);
+
+    return partition;
+}
+
+void destroy_partitions(partition_t *partitions, size_t n)
+{
+    for (size_t i = 0; i < n; ++i) {
+        free(partitions[i].fns);
+        free(partitions[i].exported);
+    }
+
+    free(partitions);
+}
+
+static size_t fn_size(eir_fn_t *fn)
+{
+    size_t size = 0;
+
+    for (eir_block_t *b = fn->first; b; b = b->next) {
+        for (eir_instr_t *i = b->first; i; i = i->next)
+            ++size;
+    }
+
+    return size;
+}
+
+/*
+ * whether a partition of size instructions ends before the component that
+ * starts with fn. about one in PARTITION_BOUNDARY names is a boundary.
+ */
+static bool ends_partition(eir_fn_t *fn, size_t size)
+{
+    uint32_t hash = 2166136261u;
+
+    if (size < PARTITION_SIZE / 2)
+        return false;
+
+    if (size >= PARTITION_SIZE * 2)
+        return true;
+
+    /* FNV-1a */
+    for (const char *c = fn->name; *c; ++c)
+        hash = (hash ^ (unsigned char)*c) * 16777619u;
+
+    return hash % PARTITION_BOUNDARY == 0;
+}
+
+/* by component, then by name, so the order doesn't depend on qsort */
+static int compare_scc(const void *a, const void *b)
+{
+    const eir_fn_t *x = *(eir_fn_t * const *)a, *y = *(eir_fn_t * const *)b;
+
+    if (x->scc != y->scc)
+        return x->scc < y->scc ? -1 : 1;
+
+    return strcmp(x->name, y->name);
+}
+
+static int compare_owner(const void *a, const void *b)
+{
+    return strcmp(((const owner_t *)a)->name, ((const owner_t *)b)->name);
+}
+
+static void add_fn(partition_t *p, eir_fn_t *fn)
+{
+    p->fns = srealloc(p->fns, sizeof(eir_fn_t *) * (p->n_fns + 1));
+    p->exported = srealloc(p->exported, sizeof(bool) * (p->n_fns + 1));
+    p->fns[p->n_fns] = fn;
+    p->exported[p->n_fns++] = false;
+}
+
+/*
+ * functions called, or made closures of, from other partitions can't be
+ * internal to theirs
+ */
+static void mark_exported(partition_t *partitions, size_t n,
+                          owner_t *owners, size_t n_fns)
+{
+    for (size_t caller = 0; caller < n; ++caller) {
+        partition_t *p = &partitions[caller];
+
+        for (size_t f = 0; f < p->n_fns; ++f) {
+            for (eir_block_t *b = p->fns[f]->first; b; b = b->next) {
+                for (eir_instr_t *i = b->first; i; i = i->next) {
+                    if (i->op != EIR_CALL && i->op != EIR_SPAWN &&
+                        i->op != EIR_CLOSURE)
+                        continue;
+
+                    owner_t key = { i->callee, 0, 0 };
+                    owner_t *owner = bsearch(&key, owners, n_fns,
+                                             sizeof(owner_t), compare_owner);
+
+                    if (owner && owner->partition != caller)
+                        partitions[owner->partition].exported[owner->index] =
+                            true;
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,48 @@
+/*
+ * Copyright (C) 2015 soud
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef PARTITION_H
+#define PARTITION_H
+
+#include "eir.h"
+
+/*
+ * partitions are filled with components until they have about this many
+ * instrs, between half and twice as many. PARTITION_BOUNDARY is how many
+ * names there are per name that may end one.
+ */
+#define PARTITION_SIZE 2000
+#define PARTITION_BOUNDARY 8
+
+typedef struct {
+    eir_fn_t **fns;
+
+    /* whether fns[i] is called from another partition */
+    bool *exported;
+    size_t n_fns;
+} partition_t;
+
+partition_t *partition_module(eir_module_t *m, size_t *n_partitions);
+partition_t *single_partition(eir_module_t *m);
+void destroy_partitions(partition_t *partitions, size_t n);
+
+#endif /* !PARTITION_H */
@@ -0,0 +1,643 @@
+/*
+ * Copyright (C) 2015 soud
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <time.h>
+
+#include "passes.h"
+#include "../runtime/runtime.h"
+
+typedef struct {
+    const char *name;
+    const char *description;
+    size_t (*run)(eir_fn_t *fn);
+
+    bool enabled;
+    double seconds;
+    size_t changes;
+} eir_pass_t;
+
+static size_t fold_constants(eir_fn_t *fn);
+static size_t build_switches(eir_fn_t *fn);
+static size_t simplify(eir_fn_t *fn);
+
+/* the erupt specific passes, run in this order before any backend */
+static eir_pass_t passes[] = {
+    { "fold", "fold constant operations and branches", fold_constants,
+      true, 0, 0 },
+    { "dispatch", "dispatch clauses on literal patterns with a switch",
+      build_switches, true, 0, 0 },
+    { "simplify", "remove unreachable blocks and unused values, merge "
+      "straight-line blocks", simplify, true, 0, 0 },
+};
+
+#define N_PASSES (sizeof passes / sizeof passes[0])
+
+static bool fold_int(token_type_t symbol, int64_t a, int64_t b, int64_t *r);
+static bool fold_float(token_type_t symbol, double a, double b,
+                       eir_instr_t *instr);
+static void make_const_int(eir_instr_t *instr, int64_t v, eir_type_t type);
+static void make_br(eir_instr_t *term, eir_block_t *to);
+static bool is_case_test(eir_instr_t *cmp, eir_instr_t *v, int64_t *c);
+static void rename_pred(eir_block_t *block, eir_block_t *from,
+                        eir_block_t *to);
+static size_t remove_unreachable(eir_fn_t *fn);
+static size_t remove_unused(eir_fn_t *fn);
+static size_t merge_blocks(eir_fn_t *fn);
+static double now(void);
+
+/*
+ * run every enabled pass over every function of m, checking the result
+ * after each. with time_passes a summary of where the time went is printed
+ * to stderr.
+ */
+bool run_eir_passes(eir_module_t *m, bool time_passes)
+{
+    for (size_t i = 0; i < N_PASSES; ++i) {
+        eir_pass_t *pass = &passes[i];
+
+        if (!pass->enabled) {
+            verbose_printf("skipping disabled EIR pass '%s'", pass->name);
+            continue;
+        }
+
+        verbose_printf("running EIR pass '%s'", pass->name);
+
+        double start = now();
+
+        for (eir_fn_t *fn = m->first; fn; fn = fn->next)
+            pass->changes += pass->run(fn);
+
+        pass->seconds += now() - start;
+
+        if (!verify_eir_module(m)) {
+            erupt_fatal_error("EIR pass '%s' produced invalid EIR",
+                              pass->name);
+            return false;
+        }
+    }
+
+    if (!time_passes)
+        return true;
+
+    double total = 0;
+
+    for (size_t i = 0; i < N_PASSES; ++i)
+        total += passes[i].seconds;
+
+    fprintf(stderr, "%-12s %12s %8s %8s\n", "pass", "time (ms)", "%",
+            "changes");
+
+    for (size_t i = 0; i < N_PASSES; ++i) {
+        if (!passes[i].enabled)
+            continue;
+
+        fprintf(stderr, "%-12s %12.3f %8.1f %8zu\n", passes[i].name,
+                passes[i].seconds * 1000,
+                total > 0 ? passes[i].seconds / total * 100 : 0,
+                passes[i].changes);
+    }
+
+    fprintf(stderr, "%-12s %12.3f\n", "total", total * 1000);
+
+    return true;
+}
+
+bool disable_eir_pass(const char *name)
+{
+    for (size_t i = 0; i < N_PASSES; ++i) {
+        if (strcmp(passes[i].name, name) == 0) {
+            passes[i].enabled = false;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void list_eir_passes(FILE *out)
+{
+    for (size_t i = 0; i < N_PASSES; ++i)
+        fprintf(out, "  %-10s %s\n", passes[i].name, passes[i].description);
+}
+
+/*
+ * fold operations on constants into constants, and branches on constants
+ * into unconditional ones. operations that would overflow or trap are left
+ * for run time.
+ */
+static size_t fold_constants(eir_fn_t *fn)
+{
+    size_t changes = 0;
+
+    for (eir_block_t *b = fn->first; b; b = b->next) {
+        for (eir_instr_t *i = b->first; i; i = i->next) {
+            eir_instr_t *lhs = i->n_operands > 0 ? i->operands[0] : NULL;
+            eir_instr_t *rhs = i->n_operands > 1 ? i->operands[1] : NULL;
+            int64_t r;
+
+            switch (i->op) {
+            case EIR_BINOP:
+                if (lhs->op == EIR_CONST_INT && rhs->op == EIR_CONST_INT &&
+                    fold_int(i->symbol, lhs->imm.i, rhs->imm.i, &r)) {
+                    make_const_int(i, r, i->type);
+                    ++changes;
+                } else if ((lhs->op == EIR_CONST_FLOAT ||
+                            rhs->op == EIR_CONST_FLOAT) &&
+                           (lhs->op == EIR_CONST_INT ||
+                            lhs->op == EIR_CONST_FLOAT) &&
+                           (rhs->op == EIR_CONST_INT ||
+                            rhs->op == EIR_CONST_FLOAT)) {
+                    double a = lhs->op == EIR_CONST_INT ? lhs->imm.i
+                                                        : lhs->imm.f;
+                    double c = rhs->op == EIR_CONST_INT ? rhs->imm.i
+                                                        : rhs->imm.f;
+
+                    changes += fold_float(i->symbol, a, c, i);
+                }
+                break;
+            case EIR_UNOP:
+                if (lhs->op != EIR_CONST_INT)
+                    break;
+
+                if (i->symbol == MIN && lhs->imm.i != INT64_MIN) {
+                    make_const_int(i, -lhs->imm.i, i->type);
+                    ++changes;
+                } else if (i->symbol == B_NOT) {
+                    make_const_int(i, ~lhs->imm.i, i->type);
+                    ++changes;
+                } else if (i->symbol == BANG) {
+                    make_const_int(i, !lhs->imm.i, EIR_BOOL);
+                    ++changes;
+                }
+                break;
+            case EIR_CONDBR:
+                if (lhs->op != EIR_CONST_INT)
+                    break;
+
+                make_br(i, i->blocks[lhs->imm.i ? 0 : 1]);
+                ++changes;
+                break;
+            case EIR_SWITCH: {
+                if (lhs->op != EIR_CONST_INT)
+                    break;
+
+                eir_block_t *to = i->blocks[0];
+
+                for (size_t j = 0; j < i->n_cases; ++j) {
+                    if (i->cases[j] == lhs->imm.i)
+                        to = i->blocks[j + 1];
+                }
+
+                make_br(i, to);
+                ++changes;
+                break;
+            }
+            default:
+                break;
+            }
+        }
+    }
+
+    return changes;
+}
+
+/*
+ * clauses with literal patterns are lowered to a chain of blocks, each
+ * comparing the same parameter against the next literal:
+ *
+ *   fact 0 => ...
+ *   fact 1 => ...
+ *   fact x => ...
+ *
+ * turn such chains into a single switch, which backends can lower to a jump
+ * table or a binary search instead of a linear series of tests.
+ */
+static size_t build_switches(eir_fn_t *fn)
+{
+    size_t changes = 0;
+
+    for (eir_block_t *a = fn->first; a; a = a->next) {
+        eir_instr_t *term = eir_terminator(a);
+        int64_t c;
+
+        if (!term || term->op != EIR_CONDBR ||
+            term->operands[0]->op != EIR_BINOP)
+            continue;
+
+        eir_instr_t *v = term->operands[0]->operands[0];
+
+        if (!is_case_test(term->operands[0], v, &c) ||
+            term->blocks[0] == term->blocks[1])
+            continue;
+
+        /* the literals, where they go and the blocks testing them */
+        size_t n = 1;
+        int64_t *cases = smalloc(sizeof(int64_t));
+        eir_block_t **targets = smalloc(sizeof(eir_block_t *));
+        eir_block_t **tests = smalloc(sizeof(eir_block_t *));
+        eir_block_t *next = term->blocks[1];
+        bool weighted = term->weights;
+
+        cases[0] = c;
+        targets[0] = term->blocks[0];
+        tests[0] = a;
+
+        /* follow the chain for as long as it tests v and nothing else */
+        for (;;) {
+            eir_block_t **preds;
+            size_t n_preds = eir_preds(next, &preds);
+            eir_instr_t *next_term = eir_terminator(next);
+
+            free(preds);
+
+            if (next == a || n_preds != 1 || next->first->op == EIR_PHI ||
+                next_term->op != EIR_CONDBR ||
+                next_term->blocks[0] == next_term->blocks[1])
+                break;
+
+            /* only the literal, the comparison and the branch */
+            eir_instr_t *cmp = next_term->operands[0];
+            size_t n_instrs = 0;
+
+            for (eir_instr_t *i = next->first; i; i = i->next)
+                ++n_instrs;
+
+            if (cmp->parent != next || n_instrs > 3 ||
+                (n_instrs == 3 && next->first != cmp->operands[1]) ||
+                !is_case_test(cmp, v, &c))
+                break;
+
+            bool taken = false;
+
+            for (size_t i = 0; i < n; ++i) {
+                taken |= cases[i] == c || targets[i] == next_term->blocks[0] ||
+                         targets[i] == next_term->blocks[1];
+            }
+
+            if (taken)
+                break;
+
+            cases = srealloc(cases, sizeof(int64_t) * (n + 1));
+            targets = srealloc(targets, sizeof(eir_block_t *) * (n + 1));
+            tests = srealloc(tests, sizeof(eir_block_t *) * (n + 1));
+
+            cases[n] = c;
+            targets[n] = next_term->blocks[0];
+            tests[n++] = next;
+            weighted &= next_term->weights != NULL;
+
+            next = next_term->blocks[1];
+        }
+
+        if (n > 1) {
+            eir_builder_t b = { fn, a, term->line_n };
+            uint64_t *weights = NULL;
+
+            /* a case is taken as often as its test, the default as the last */
+            if (weighted) {
+                weights = smalloc(sizeof(uint64_t) * (n + 1));
+                weights[0] = eir_terminator(tests[n - 1])->weights[1];
+
+                for (size_t i = 0; i < n; ++i)
+                    weights[i + 1] = eir_terminator(tests[i])->weights[0];
+            }
+
+            /* the tests after a become unreachable, simplify removes them */
+            for (size_t i = 1; i < n; ++i)
+                rename_pred(targets[i], tests[i], a);
+
+            rename_pred(next, tests[n - 1], a);
+
+            eir_remove_instr(term);
+
+            eir_instr_t *sw = eir_switch(&b, v, next);
+
+            for (size_t i = 0; i < n; ++i)
+                eir_add_case(sw, cases[i], targets[i]);
+
+            eir_set_weights(sw, weights);
+            free(weights);
+            ++changes;
+        }
+
+        free(cases);
+        free(targets);
+        free(tests);
+    }
+
+    return changes;
+}
+
+static size_t simplify(eir_fn_t *fn)
+{
+    size_t changes = 0, n;
+
+    do {
+        n = remove_unreachable(fn);
+        n += remove_unused(fn);
+        n += merge_blocks(fn);
+
+        changes += n;
+    } while (n);
+
+    return changes;
+}
+
+static bool fold_int(token_type_t symbol, int64_t a, int64_t b, int64_t *r)
+{
+    switch (symbol) {
+    case PLUS: return !__builtin_add_overflow(a, b, r);
+    case MIN: return !__builtin_sub_overflow(a, b, r);
+    case STAR: return !__builtin_mul_overflow(a, b, r);
+    case SLASH:
+        if (b == 0 || (a == INT64_MIN && b == -1))
+            return false;
+        *r = a / b;
+        return true;
+    case MOD:
+        if (b == 0 || (a == INT64_MIN && b == -1))
+            return false;
+        *r = a % b;
+        return true;
+    case STAR_STAR:
+        if (b < 0)
+            return false;
+
+        /* by squaring, 1 ** INT64_MAX shouldn't take INT64_MAX steps */
+        for (*r = 1; b; b >>= 1) {
+            if ((b & 1) && __builtin_mul_overflow(*r, a, r))
+                return false;
+
+            if (b > 1 && __builtin_mul_overflow(a, a, &a))
+                return false;
+        }
+
+        return true;
+    case B_AND: *r = a & b; return true;
+    case B_OR: *r = a | b; return true;
+    case B_XOR: *r = a ^ b; return true;
+    case L_SHIFT:
+        if (b < 0 || b > 62 || a < 0 || a > (INT64_MAX >> b))
+            return false;
+        *r = a << b;
+        return true;
+    case R_SHIFT:
+        if (b < 0 || b > 63)
+            return false;
+        *r = a >> b;
+        return true;
+    case EQ_EQ: *r = a == b; return true;
+    case BANG_EQ: *r = a != b; return true;
+    case LT: *r = a < b; return true;
+    case LT_EQ: *r = a <= b; return true;
+    case GT: *r = a > b; return true;
+    case GT_EQ: *r = a >= b; return true;
+    default: return false;
+    }
+}
+
+static bool fold_float(token_type_t symbol, double a, double b,
+                       eir_instr_t *instr)
+{
+    double r;
+
+    switch (symbol) {
+    case PLUS: r = a + b; break;
+    case MIN: r = a - b; break;
+    case STAR: r = a * b; break;
+    case SLASH: r = a / b; break;
+    case EQ_EQ: make_const_int(instr, a == b, EIR_BOOL); return true;
+    case BANG_EQ: make_const_int(instr, a != b, EIR_BOOL); return true;
+    case LT: make_const_int(instr, a < b, EIR_BOOL); return true;
+    case LT_EQ: make_const_int(instr, a <= b, EIR_BOOL); return true;
+    case GT: make_const_int(instr, a > b, EIR_BOOL); return true;
+    case GT_EQ: make_const_int(instr, a >= b, EIR_BOOL); return true;
+    default: return false;
+    }
+
+    instr->op = EIR_CONST_FLOAT;
+    instr->imm.f = r;
+    instr->n_operands = 0;
+
+    return true;
+}
+
+/* turn instr into a constant in place, so its uses don't need updating */
+static void make_const_int(eir_instr_t *instr, int64_t v, eir_type_t type)
+{
+    instr->op = EIR_CONST_INT;
+    instr->type = type;
+    instr->imm.i = v;
+    instr->n_operands = 0;
+}
+
+static void make_br(eir_instr_t *term, eir_block_t *to)
+{
+    for (size_t i = 0; i < term->n_blocks; ++i) {
+        if (term->blocks[i] == to)
+            continue;
+
+        bool again = false;
+
+        /* a block can be a target more than once, forget it only once */
+        for (size_t j = 0; j < i; ++j)
+            again |= term->blocks[j] == term->blocks[i];
+
+        if (!again)
+            eir_forget_pred(term->blocks[i], term->parent);
+    }
+
+    eir_set_weights(term, NULL);
+
+    term->op = EIR_BR;
+    term->n_operands = 0;
+    term->n_blocks = 1;
+    term->n_cases = 0;
+    term->blocks[0] = to;
+}
+
+/* whether cmp is v == <int literal>, as lowered for a literal pattern */
+static bool is_case_test(eir_instr_t *cmp, eir_instr_t *v, int64_t *c)
+{
+    if (cmp->op != EIR_BINOP || cmp->symbol != EQ_EQ ||
+        cmp->operands[0] != v || v->type != EIR_INT ||
+        cmp->operands[1]->op != EIR_CONST_INT ||
+        cmp->operands[1]->type != EIR_INT)
+        return false;
+
+    *c = cmp->operands[1]->imm.i;
+
+    /* switches compare words, a bignum case is a pointer */
+    return *c >= ERUPT_INT_MIN && *c <= ERUPT_INT_MAX;
+}
+
+static void rename_pred(eir_block_t *block, eir_block_t *from,
+                        eir_block_t *to)
+{
+    for (eir_instr_t *phi = block->first; phi && phi->op == EIR_PHI;
+         phi = phi->next) {
+        for (size_t i = 0; i < phi->n_blocks; ++i) {
+            if (phi->blocks[i] == from)
+                phi->blocks[i] = to;
+        }
+    }
+}
+
+static void mark_reachable(eir_block_t *block)
+{
+    if (block->id)
+        return;
+
+    block->id = 1;
+
+    eir_instr_t *term = eir_terminator(block);
+
+    for (size_t i = 0; term && i < term->n_blocks; ++i)
+        mark_reachable(term->blocks[i]);
+}
+
+static size_t remove_unreachable(eir_fn_t *fn)
+{
+    size_t removed = 0;
+
+    for (eir_block_t *b = fn->first; b; b = b->next)
+        b->id = 0;
+
+    mark_reachable(fn->first);
+
+    for (eir_block_t *b = fn->first, *next; b; b = next) {
+        next = b->next;
+
+        if (!b->id) {
+            eir_remove_block(b);
+            ++removed;
+        }
+    }
+
+    return removed;
+}
+
+static bool has_side_effects(eir_instr_t *instr)
+{
+    switch (instr->op) {
+    case EIR_CALL:
+    case EIR_SPAWN:
+    case EIR_JOIN:
+    case EIR_APPLY:
+    case EIR_COUNT:
+        return true;
+    default:
+        return eir_is_terminator(instr);
+    }
+}
+
+static size_t remove_unused(eir_fn_t *fn)
+{
+    size_t removed = 0;
+
+    for (eir_block_t *b = fn->first; b; b = b->next) {
+        for (eir_instr_t *i = b->first; i; i = i->next)
+            i->id = 0;
+    }
+
+    /* id counts the uses of every value */
+    for (eir_block_t *b = fn->first; b; b = b->next) {
+        for (eir_instr_t *i = b->first; i; i = i->next) {
+            for (size_t j = 0; j < i->n_operands; ++j)
+                ++i->operands[j]->id;
+        }
+    }
+
+    for (eir_block_t *b = fn->first; b; b = b->next) {
+        for (eir_instr_t *i = b->last, *prev; i; i = prev) {
+            prev = i->prev;
+
+            if (i->id || has_side_effects(i))
+                continue;
+
+            /* the operands might have become unused too */
+            for (size_t j = 0; j < i->n_operands; ++j)
+                --i->operands[j]->id;
+
+            eir_remove_instr(i);
+            ++removed;
+        }
+    }
+
+    return removed;
+}
+
+/* append a block to its only predecessor, if that only branches to it */
+static size_t merge_blocks(eir_fn_t *fn)
+{
+    size_t merged = 0;
+
+    for (eir_block_t *b = fn->first->next, *next; b; b = next) {
+        next = b->next;
+
+        eir_block_t **preds;
+        size_t n_preds = eir_preds(b, &preds);
+        eir_block_t *pred = n_preds == 1 ? preds[0] : NULL;
+
+        free(preds);
+
+        if (!pred || pred == b || eir_terminator(pred)->op != EIR_BR ||
+            (b->first && b->first->op == EIR_PHI))
+            continue;
+
+        eir_instr_t *term = eir_terminator(b);
+
+        for (size_t i = 0; term && i < term->n_blocks; ++i)
+            rename_pred(term->blocks[i], b, pred);
+
+        eir_remove_instr(pred->last);
+
+        for (eir_instr_t *i = b->first; i; i = i->next)
+            i->parent = pred;
+
+        if (b->first) {
+            if (pred->last)
+                pred->last->next = b->first;
+            else
+                pred->first = b->first;
+
+            b->first->prev = pred->last;
+            pred->last = b->last;
+        }
+
+        b->first = b->last = NULL;
+
+        eir_remove_block(b);
+        ++merged;
+    }
+
+    return merged;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
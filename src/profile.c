@@ -0,0 +1,294 @@
+/*
+ * Copyright (C) 2015 soud
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <inttypes.h>
+#include <stdarg.h>
+
+#include "profile.h"
+#include "erupt.h"
+
+typedef void (*point_fn_t)(ast_node_t *node, const char *name, void *data);
+
+typedef struct {
+    const char *clause;
+    size_t n_ifs;
+    point_fn_t fn;
+    void *data;
+} point_visitor_t;
+
+typedef struct {
+    char **names;
+    size_t n;
+} instrumenter_t;
+
+typedef struct {
+    profile_t *profile;
+    size_t found;
+} applier_t;
+
+static void visit_points(ast_node_list_t *ast, point_fn_t fn, void *data);
+static void visit_if(ast_node_t *node, void *data);
+static void add_counter(ast_node_t *node, const char *name, void *data);
+static void set_count(ast_node_t *node, const char *name, void *data);
+static bool lookup(profile_t *profile, const char *name, uint64_t *count);
+static int compare_entries(const void *a, const void *b);
+static char *format(const char *fmt, ...);
+
+/*
+ * give every profile point in ast a counter. *names is set to the names of
+ * the counters, the number of which is returned.
+ */
+size_t instrument_ast(ast_node_list_t *ast, char ***names)
+{
+    instrumenter_t in = { NULL, 0 };
+
+    visit_points(ast, add_counter, &in);
+    verbose_printf("instrumented %zu profile point(s)", in.n);
+
+    *names = in.names;
+
+    return in.n;
+}
+
+/* gives NULL if the profile at path couldn't be read, after reporting why */
+profile_t *read_profile(const char *path)
+{
+    FILE *file = fopen(path, "r");
+    char line[1024];
+    size_t line_n = 0;
+
+    if (!file) {
+        erupt_error("couldn't read profile '%s'", path);
+        return NULL;
+    }
+
+    profile_t *profile = scalloc(1, sizeof(profile_t));
+
+    while (fgets(line, sizeof(line), file)) {
+        char name[sizeof(line)];
+        uint64_t count;
+
+        ++line_n;
+
+        if (line[0] == '#' || line[0] == '\n')
+            continue;
+
+        if (sscanf(line, "%s %" SCNu64, name, &count) != 2) {
+            file_error(path, line_n, "malformed profile entry");
+            destroy_profile(profile);
+            fclose(file);
+
+            return NULL;
+        }
+
+        profile->entries = srealloc(profile->entries,
+                                    sizeof(profile_entry_t) * (profile->n + 1));
+        profile->entries[profile->n].name = strdup(name);
+        profile->entries[profile->n++].count = count;
+    }
+
+    fclose(file);
+    qsort(profile->entries, profile->n, sizeof(profile_entry_t),
+          compare_entries);
+
+    /* profiles of several runs can be concatenated, their counts add up */
+    size_t n = 0;
+
+    for (size_t i = 0; i < profile->n; ++i) {
+        profile_entry_t *entry = &profile->entries[i];
+
+        if (n && strcmp(profile->entries[n - 1].name, entry->name) == 0) {
+            profile->entries[n - 1].count += entry->count;
+            free(entry->name);
+        } else {
+            profile->entries[n++] = *entry;
+        }
+    }
+
+    profile->n = n;
+
+    verbose_printf("read %zu count(s) from profile '%s'", profile->n, path);
+
+    return profile;
+}
+
+/*
+ * set the counts of the profile points in ast from profile. returns how many
+ * points it had counts for, points the profile doesn't know stay unknown.
+ */
+size_t apply_profile(ast_node_list_t *ast, profile_t *profile)
+{
+    applier_t applier = { profile, 0 };
+
+    visit_points(ast, set_count, &applier);
+
+    return applier.found;
+}
+
+void destroy_profile(profile_t *profile)
+{
+    if (!profile)
+        return;
+
+    for (size_t i = 0; i < profile->n; ++i)
+        free(profile->entries[i].name);
+
+    free(profile->entries);
+    free(profile);
+}
+
+/*
+ * call fn on every clause and if in ast. clauses are numbered per function,
+ * in the order they're defined, ifs per clause, parents before children.
+ */
+static void visit_points(ast_node_list_t *ast, point_fn_t fn, void *data)
+{
+    const char **seen = NULL;
+    size_t n_seen = 0;
+
+    for (; ast; ast = ast->next) {
+        ast_node_t *node = ast->node;
+
+        if (!node || node->type != TYPE_FN)
+            continue;
+
+        const char *name = node->fn.prototype->prototype.name;
+        size_t clause = 0;
+
+        for (size_t i = 0; i < n_seen; ++i)
+            clause += strcmp(seen[i], name) == 0;
+
+        seen = srealloc(seen, sizeof(char *) * (n_seen + 1));
+        seen[n_seen++] = name;
+
+        char *clause_name = format("%s/%zu", name, clause);
+        point_visitor_t visitor = { clause_name, 0, fn, data };
+
+        fn(node, clause_name, data);
+        visit_node_list(node->fn.body, visit_if, &visitor);
+
+        free(clause_name);
+    }
+
+    free(seen);
+}
+
+static void visit_if(ast_node_t *node, void *data)
+{
+    point_visitor_t *visitor = data;
+
+    if (node->type != TYPE_IF)
+        return;
+
+    char *name = format("%s/if%zu", visitor->clause, visitor->n_ifs++);
+
+    visitor->fn(node, name, visitor->data);
+    free(name);
+}
+
+static void add_counter(ast_node_t *node, const char *name, void *data)
+{
+    instrumenter_t *in = data;
+    size_t n = node->type == TYPE_IF ? 2 : 1;
+
+    in->names = srealloc(in->names, sizeof(char *) * (in->n + n));
+
+    if (node->type == TYPE_IF) {
+        node->if_expr.counter = in->n;
+        in->names[in->n++] = format("%s/then", name);
+        in->names[in->n++] = format("%s/else", name);
+    } else {
+        node->fn.counter = in->n;
+        in->names[in->n++] = strdup(name);
+    }
+}
+
+static void set_count(ast_node_t *node, const char *name, void *data)
+{
+    applier_t *applier = data;
+
+    if (node->type == TYPE_IF) {
+        char *then = format("%s/then", name), *otherwise = format("%s/else",
+                                                                  name);
+        uint64_t counts[2];
+
+        if (lookup(applier->profile, then, &counts[0]) &&
+            lookup(applier->profile, otherwise, &counts[1])) {
+            node->if_expr.counts[0] = counts[0];
+            node->if_expr.counts[1] = counts[1];
+            ++applier->found;
+        }
+
+        free(then);
+        free(otherwise);
+    } else if (lookup(applier->profile, name, &node->fn.count)) {
+        ++applier->found;
+    }
+}
+
+static bool lookup(profile_t *profile, const char *name, uint64_t *count)
+{
+    size_t low = 0, high = profile->n;
+
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        int order = strcmp(profile->entries[mid].name, name);
+
+        if (order == 0) {
+            *count = profile->entries[mid].count;
+            return true;
+        }
+
+        if (order < 0)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    return false;
+}
+
+static int compare_entries(const void *a, const void *b)
+{
+    return strcmp(((const profile_entry_t *)a)->name,
+                  ((const profile_entry_t *)b)->name);
+}
+
+/* like sprintf, into a string of its own */
+static char *format(const char *fmt, ...)
+{
+    va_list args;
+
+    va_start(args, fmt);
+
+    int size = vsnprintf(NULL, 0, fmt, args);
+
+    va_end(args);
+
+    char *s = smalloc((size_t)size + 1);
+
+    va_start(args, fmt);
+    vsnprintf(s, (size_t)size + 1, fmt, args);
+    va_end(args);
+
+    return s;
+}
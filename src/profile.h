@@ -0,0 +1,52 @@
+/*
+ * Copyright (C) 2015 soud
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+/*
+ * profile-guided optimization. the clauses of every function and both
+ * branches of every if are profile points, named after the function, the
+ * clause and the position of the if in it, like fib/2 and fib/2/if0/then.
+ * instrumented programs count how often each point is reached and write the
+ * counts to a profile when they exit, which later compiles read back.
+ */
+
+#include "ast.h"
+
+typedef struct {
+    char *name;
+    uint64_t count;
+} profile_entry_t;
+
+/* the entries are sorted by name */
+typedef struct {
+    profile_entry_t *entries;
+    size_t n;
+} profile_t;
+
+size_t instrument_ast(ast_node_list_t *ast, char ***names);
+profile_t *read_profile(const char *path);
+size_t apply_profile(ast_node_list_t *ast, profile_t *profile);
+void destroy_profile(profile_t *profile);
+
+#endif /* !PROFILE_H */
@@ -22,11 +22,9 @@
 
 #include "token.h"
 
-token_t *new_token(token_type_t type, char *value, size_t start, size_t end,
-                   size_t line_n)
+void init_token(token_t *token, token_type_t type, char *value, size_t start,
+                size_t end, size_t line_n)
 {
-    token_t *token = smalloc(sizeof(token_t));
-
     token->type = type;
 
     token->value = value;
@@ -35,12 +33,17 @@ token_t *new_token(token_type_t type, char *value, size_t start, size_t end,
     token->start = start;
     token->end = end;
 
+    token->number.i = 0;
+    token->big = NULL;
     token->next = NULL;
-
-    return token;
 }
 
 const char *token_str(token_t *token)
+{
+    return token_type_str(token->type);
+}
+
+const char *token_type_str(token_type_t type)
 {
     const char *token_names[] = {
         "", "+", "+=", "-", "-=", "|", "|=", "^", "^=", "&", "&=", "~",
@@ -52,7 +55,7 @@ const char *token_str(token_t *token)
         "eof"
     };
 
-    return token->type < TOKEN_COUNT ? token_names[token->type] : "???";
+    return type < TOKEN_COUNT ? token_names[type] : "???";
 }
 
 void dump_tokens(token_t *tok)
@@ -61,15 +64,3 @@ void dump_tokens(token_t *tok)
         printf("(%16s): %s\n", token_str(tok), tok->value);
     } while ((tok = tok->next));
 }
-
-void destroy_tokens(token_t *ts)
-{
-    if (!ts)
-        return;
-
-    do {
-        free(ts->value);
-    } while ((ts = ts->next));
-
-    free(ts);
-}
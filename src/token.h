@@ -104,13 +104,22 @@ typedef struct token {
     size_t start;
     size_t end;
 
+    /* the value of an INT or FLOAT */
+    union {
+        int64_t i;
+        double f;
+    } number;
+
+    /* the digits of an INT outside int64, without underscores, or NULL */
+    char *big;
+
     struct token *next;
 } token_t;
 
-token_t *new_token(token_type_t type, char *value, size_t start, size_t end,
-                   size_t line_n);
+void init_token(token_t *token, token_type_t type, char *value, size_t start,
+                size_t end, size_t line_n);
 void dump_tokens(token_t *tok);
 const char *token_str(token_t *token);
-void destroy_tokens(token_t *ts);
+const char *token_type_str(token_type_t type);
 
 #endif /* !TOKEN_H */
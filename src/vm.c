@@ -0,0 +1,546 @@
+/*
+ * Copyright (C) 2015 soud
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * the bytecode interpreter. with GCC and clang it's direct threaded: before
+ * a program first runs, every opcode is replaced by the address of the code
+ * that handles it, and every handler jumps straight to the next one. other
+ * compilers get a switch in a loop.
+ */
+
+#include <math.h>
+
+#include "vm.h"
+#include "../runtime/runtime.h"
+
+#if defined(__GNUC__)
+#define VM_THREADED
+#endif
+
+typedef struct {
+    vm_fn_t *fn;
+    vm_instr_t *ret_pc;
+    size_t base;
+    uint16_t ret_reg;
+} vm_frame_t;
+
+static int64_t add(int64_t x, int64_t y);
+static int64_t subtract(int64_t x, int64_t y);
+static int64_t multiply(int64_t x, int64_t y);
+static int64_t divide(int64_t x, int64_t y);
+static int64_t modulo(int64_t x, int64_t y);
+static int64_t shift_left(int64_t x, int64_t y);
+static int64_t shift_right(int64_t x, int64_t y);
+static int64_t to_int(double f);
+
+#ifdef VM_THREADED
+#define VM_CASE(name) op_##name
+#define VM_NEXT do { i = pc++; goto *i->handler; } while (0)
+#else
+#define VM_CASE(name) case VM_##name
+#define VM_NEXT continue
+#endif
+
+#define R(n) r[n]
+
+/*
+ * ints are tagged like in generated code, see runtime.h. small ones are
+ * worked out here, the runtime gets bignums and whatever overflows.
+ */
+#define SMALL(x, y) ERUPT_IS_SMALL((x) | (y))
+#define COMPARE(x, o, y) \
+    (SMALL(x, y) ? (x) o (y) : erupt_int_compare(x, y) o 0)
+#define BITWISE(x, o, y, slow) (SMALL(x, y) ? (x) o (y) : slow(x, y))
+
+/*
+ * run p from its main function. *status is main's result if it's an int,
+ * otherwise 0.
+ */
+bool run_vm(vm_program_t *p, int *status)
+{
+    vm_fn_t *fn = &p->fns[p->entry], *callee;
+    size_t capacity = 1024, base = 0, depth = 0, max_frames = 64;
+    vm_value_t *stack, *r, *k = fn->constants;
+    vm_frame_t *frames = smalloc(sizeof(vm_frame_t) * max_frames);
+    vm_instr_t *pc, *i;
+    vm_value_t result;
+    size_t args;
+
+#ifdef VM_THREADED
+    static const void *handlers[] = {
+#define VM_HANDLER(name) &&op_##name,
+        VM_OPCODES(VM_HANDLER)
+#undef VM_HANDLER
+    };
+
+    if (!p->threaded) {
+        for (size_t f = 0; f < p->n_fns; ++f) {
+            for (size_t n = 0; n < p->fns[f].n_code; ++n) {
+                vm_instr_t *instr = &p->fns[f].code[n];
+
+                instr->handler = handlers[instr->op];
+            }
+        }
+
+        p->threaded = true;
+    }
+#endif
+
+    while (capacity < fn->n_regs)
+        capacity *= 2;
+
+    /* the registers are scanned for references like a thread's stack */
+    stack = scalloc(capacity, sizeof(vm_value_t));
+    erupt_gc_add_roots(stack, stack + capacity);
+    r = stack;
+    pc = fn->code;
+
+    verbose_printf("running bytecode");
+
+#ifdef VM_THREADED
+    VM_NEXT;
+#else
+    for (;;) {
+        i = pc++;
+
+        switch (i->op) {
+#endif
+
+    VM_CASE(MOVE):
+        R(i->a) = R(i->b);
+        VM_NEXT;
+    VM_CASE(LOADK):
+        R(i->a) = k[i->b];
+        VM_NEXT;
+
+    VM_CASE(ADD):
+        R(i->a).i = add(R(i->b).i, R(i->c).i);
+        VM_NEXT;
+    VM_CASE(SUB):
+        R(i->a).i = subtract(R(i->b).i, R(i->c).i);
+        VM_NEXT;
+    VM_CASE(MUL):
+        R(i->a).i = multiply(R(i->b).i, R(i->c).i);
+        VM_NEXT;
+    VM_CASE(DIV):
+        R(i->a).i = divide(R(i->b).i, R(i->c).i);
+        VM_NEXT;
+    VM_CASE(MOD):
+        R(i->a).i = modulo(R(i->b).i, R(i->c).i);
+        VM_NEXT;
+    VM_CASE(POW):
+        R(i->a).i = erupt_int_pow(R(i->b).i, R(i->c).i);
+        VM_NEXT;
+    VM_CASE(BAND):
+        R(i->a).i = BITWISE(R(i->b).i, &, R(i->c).i, erupt_int_and);
+        VM_NEXT;
+    VM_CASE(BOR):
+        R(i->a).i = BITWISE(R(i->b).i, |, R(i->c).i, erupt_int_or);
+        VM_NEXT;
+    VM_CASE(BXOR):
+        R(i->a).i = BITWISE(R(i->b).i, ^, R(i->c).i, erupt_int_xor);
+        VM_NEXT;
+    VM_CASE(SHL):
+        R(i->a).i = shift_left(R(i->b).i, R(i->c).i);
+        VM_NEXT;
+    VM_CASE(SHR):
+        R(i->a).i = shift_right(R(i->b).i, R(i->c).i);
+        VM_NEXT;
+    VM_CASE(ADDK):
+        R(i->a).i = add(R(i->b).i, k[i->c].i);
+        VM_NEXT;
+    VM_CASE(SUBK):
+        R(i->a).i = subtract(R(i->b).i, k[i->c].i);
+        VM_NEXT;
+
+    VM_CASE(FADD):
+        R(i->a).f = R(i->b).f + R(i->c).f;
+        VM_NEXT;
+    VM_CASE(FSUB):
+        R(i->a).f = R(i->b).f - R(i->c).f;
+        VM_NEXT;
+    VM_CASE(FMUL):
+        R(i->a).f = R(i->b).f * R(i->c).f;
+        VM_NEXT;
+    VM_CASE(FDIV):
+        R(i->a).f = R(i->b).f / R(i->c).f;
+        VM_NEXT;
+    VM_CASE(FMOD):
+        R(i->a).f = fmod(R(i->b).f, R(i->c).f);
+        VM_NEXT;
+    VM_CASE(FPOW):
+        R(i->a).f = pow(R(i->b).f, R(i->c).f);
+        VM_NEXT;
+
+    VM_CASE(EQ):
+        R(i->a).i = COMPARE(R(i->b).i, ==, R(i->c).i);
+        VM_NEXT;
+    VM_CASE(NE):
+        R(i->a).i = COMPARE(R(i->b).i, !=, R(i->c).i);
+        VM_NEXT;
+    VM_CASE(LT):
+        R(i->a).i = COMPARE(R(i->b).i, <, R(i->c).i);
+        VM_NEXT;
+    VM_CASE(LE):
+        R(i->a).i = COMPARE(R(i->b).i, <=, R(i->c).i);
+        VM_NEXT;
+    VM_CASE(GT):
+        R(i->a).i = COMPARE(R(i->b).i, >, R(i->c).i);
+        VM_NEXT;
+    VM_CASE(GE):
+        R(i->a).i = COMPARE(R(i->b).i, >=, R(i->c).i);
+        VM_NEXT;
+    VM_CASE(FEQ):
+        R(i->a).i = R(i->b).f == R(i->c).f;
+        VM_NEXT;
+    VM_CASE(FNE):
+        R(i->a).i = R(i->b).f != R(i->c).f;
+        VM_NEXT;
+    VM_CASE(FLT):
+        R(i->a).i = R(i->b).f < R(i->c).f;
+        VM_NEXT;
+    VM_CASE(FLE):
+        R(i->a).i = R(i->b).f <= R(i->c).f;
+        VM_NEXT;
+    VM_CASE(FGT):
+        R(i->a).i = R(i->b).f > R(i->c).f;
+        VM_NEXT;
+    VM_CASE(FGE):
+        R(i->a).i = R(i->b).f >= R(i->c).f;
+        VM_NEXT;
+
+    VM_CASE(NEG):
+        R(i->a).i = subtract(0, R(i->b).i);
+        VM_NEXT;
+    VM_CASE(FNEG):
+        R(i->a).f = -R(i->b).f;
+        VM_NEXT;
+    VM_CASE(NOT):
+        R(i->a).i = !R(i->b).i;
+        VM_NEXT;
+    VM_CASE(BNOT):
+        R(i->a).i = ERUPT_IS_SMALL(R(i->b).i) ? R(i->b).i ^ -2
+                                              : erupt_int_not(R(i->b).i);
+        VM_NEXT;
+    VM_CASE(TOBOOL):
+        R(i->a).i = R(i->b).i != 0;
+        VM_NEXT;
+    VM_CASE(FTOBOOL):
+        R(i->a).i = R(i->b).f != 0.0;
+        VM_NEXT;
+    VM_CASE(ITOF):
+        R(i->a).f = ERUPT_IS_SMALL(R(i->b).i) ?
+                    (double)ERUPT_UNTAG(R(i->b).i) :
+                    erupt_int_to_float(R(i->b).i);
+        VM_NEXT;
+    VM_CASE(FTOI):
+        R(i->a).i = to_int(R(i->b).f);
+        VM_NEXT;
+    VM_CASE(BTOI):
+        R(i->a).i = ERUPT_TAG(R(i->b).i);
+        VM_NEXT;
+    VM_CASE(PTOI):
+        R(i->a).i = ERUPT_REF(R(i->b).p);
+        VM_NEXT;
+    VM_CASE(ITOP):
+        R(i->a).p = ERUPT_DEREF(R(i->b).i);
+        VM_NEXT;
+    VM_CASE(BOXF):
+        R(i->a).i = erupt_float_box(R(i->b).f);
+        VM_NEXT;
+
+    VM_CASE(SCONCAT):
+        R(i->a).p = erupt_string_concat(R(i->b).p, R(i->c).p);
+        VM_NEXT;
+    VM_CASE(LCONCAT):
+        R(i->a).p = erupt_list_concat(R(i->b).p, R(i->c).p);
+        VM_NEXT;
+    VM_CASE(SCMP):
+        R(i->a).i = ERUPT_TAG(erupt_string_compare(R(i->b).p, R(i->c).p));
+        VM_NEXT;
+    VM_CASE(LCMP):
+        R(i->a).i = ERUPT_TAG(erupt_list_compare(R(i->b).p, R(i->c).p));
+        VM_NEXT;
+    VM_CASE(LIST):
+        R(i->a).p = erupt_list_from(&R(i->c).i, i->b);
+        VM_NEXT;
+
+    VM_CASE(PRINTI):
+        erupt_print_int(R(i->a).i);
+        VM_NEXT;
+    VM_CASE(PRINTF):
+        erupt_print_float(R(i->a).f);
+        VM_NEXT;
+    VM_CASE(PRINTB):
+        erupt_print_bool(R(i->a).i != 0);
+        VM_NEXT;
+    VM_CASE(PRINTS):
+        erupt_print_string(R(i->a).p);
+        VM_NEXT;
+    VM_CASE(PRINTL):
+        erupt_print_list(R(i->a).p);
+        VM_NEXT;
+    VM_CASE(FLUSH):
+        erupt_io_flush();
+        VM_NEXT;
+
+    VM_CASE(JMP):
+        pc = fn->code + i->c;
+        VM_NEXT;
+    VM_CASE(JT):
+        if (R(i->a).i)
+            pc = fn->code + i->c;
+        VM_NEXT;
+    VM_CASE(JF):
+        if (!R(i->a).i)
+            pc = fn->code + i->c;
+        VM_NEXT;
+    VM_CASE(JEQ):
+        if (COMPARE(R(i->a).i, ==, R(i->b).i))
+            pc = fn->code + i->c;
+        VM_NEXT;
+    VM_CASE(JNE):
+        if (COMPARE(R(i->a).i, !=, R(i->b).i))
+            pc = fn->code + i->c;
+        VM_NEXT;
+    VM_CASE(JLT):
+        if (COMPARE(R(i->a).i, <, R(i->b).i))
+            pc = fn->code + i->c;
+        VM_NEXT;
+    VM_CASE(JLE):
+        if (COMPARE(R(i->a).i, <=, R(i->b).i))
+            pc = fn->code + i->c;
+        VM_NEXT;
+    VM_CASE(JGT):
+        if (COMPARE(R(i->a).i, >, R(i->b).i))
+            pc = fn->code + i->c;
+        VM_NEXT;
+    VM_CASE(JGE):
+        if (COMPARE(R(i->a).i, >=, R(i->b).i))
+            pc = fn->code + i->c;
+        VM_NEXT;
+    VM_CASE(JEQK):
+        if (COMPARE(R(i->a).i, ==, k[i->b].i))
+            pc = fn->code + i->c;
+        VM_NEXT;
+    VM_CASE(JNEK):
+        if (COMPARE(R(i->a).i, !=, k[i->b].i))
+            pc = fn->code + i->c;
+        VM_NEXT;
+    VM_CASE(JLTK):
+        if (COMPARE(R(i->a).i, <, k[i->b].i))
+            pc = fn->code + i->c;
+        VM_NEXT;
+    VM_CASE(JLEK):
+        if (COMPARE(R(i->a).i, <=, k[i->b].i))
+            pc = fn->code + i->c;
+        VM_NEXT;
+    VM_CASE(JGTK):
+        if (COMPARE(R(i->a).i, >, k[i->b].i))
+            pc = fn->code + i->c;
+        VM_NEXT;
+    VM_CASE(JGEK):
+        if (COMPARE(R(i->a).i, >=, k[i->b].i))
+            pc = fn->code + i->c;
+        VM_NEXT;
+
+    VM_CASE(CLOSURE):
+        R(i->a).i = ERUPT_REF(erupt_closure_from(
+            (void *)(uintptr_t)i->b, (int64_t)p->fns[i->b].n_params - 1,
+            &R(i->c & 0xffff).i, i->c >> 16));
+        VM_NEXT;
+    VM_CASE(ENV):
+        R(i->a).i = ((erupt_closure_t *)ERUPT_DEREF(R(i->b).i))->env[i->c];
+        VM_NEXT;
+
+    /* a closure is called with itself as the first argument */
+    VM_CASE(APPLY): {
+        erupt_closure_t *c = ERUPT_DEREF(R(i->b).i);
+
+        if (!ERUPT_IS_CLOSURE(R(i->b).i) || c->arity != ERUPT_TAG(i->c))
+            erupt_apply_error(R(i->b).i, i->c);
+
+        callee = &p->fns[c->code];
+        args = i->b;
+        goto call;
+    }
+    VM_CASE(CALL):
+        callee = &p->fns[i->b];
+        args = i->c;
+
+    /* the callee's registers start right after the caller's */
+    call: {
+        size_t callee_base = base + fn->n_regs;
+
+        if (depth + 1 >= VM_MAX_DEPTH)
+            erupt_panic("stack overflow in '%s'", callee->name);
+
+        if (depth + 1 >= max_frames) {
+            max_frames *= 2;
+            frames = srealloc(frames, sizeof(vm_frame_t) * max_frames);
+        }
+
+        if (callee_base + callee->n_regs > capacity) {
+            while (callee_base + callee->n_regs > capacity)
+                capacity *= 2;
+
+            erupt_gc_remove_roots(stack);
+            stack = srealloc(stack, sizeof(vm_value_t) * capacity);
+            erupt_gc_add_roots(stack, stack + capacity);
+            r = stack + base;
+        }
+
+        for (size_t n = 0; n < callee->n_params; ++n)
+            stack[callee_base + n] = R(args + n);
+
+        frames[depth++] = (vm_frame_t){ fn, pc, base, i->a };
+        fn = callee;
+        base = callee_base;
+        r = stack + base;
+        k = fn->constants;
+        pc = fn->code;
+        VM_NEXT;
+    }
+    VM_CASE(RET): {
+        vm_frame_t *frame;
+
+        result = R(i->a);
+
+        if (depth == 0)
+            goto done;
+
+        frame = &frames[--depth];
+        fn = frame->fn;
+        pc = frame->ret_pc;
+        base = frame->base;
+        r = stack + base;
+        k = fn->constants;
+        R(frame->ret_reg) = result;
+        VM_NEXT;
+    }
+    VM_CASE(NOMATCH):
+        erupt_nomatch(fn->name);
+
+#ifndef VM_THREADED
+        case VM_OPCODE_COUNT:
+            erupt_panic("invalid opcode in '%s'", fn->name);
+        }
+    }
+#endif
+
+done:
+    *status = fn->ret == EIR_INT ? (int)erupt_int_wrap(result.i) : 0;
+    erupt_io_flush();
+
+    erupt_gc_remove_roots(stack);
+    free(stack);
+    free(frames);
+
+    return true;
+}
+
+static int64_t add(int64_t x, int64_t y)
+{
+    int64_t r;
+
+    if (SMALL(x, y) && !__builtin_add_overflow(x, y, &r))
+        return r;
+
+    return erupt_int_add(x, y);
+}
+
+static int64_t subtract(int64_t x, int64_t y)
+{
+    int64_t r;
+
+    if (SMALL(x, y) && !__builtin_sub_overflow(x, y, &r))
+        return r;
+
+    return erupt_int_sub(x, y);
+}
+
+/* x is v << 1, so x * (y >> 1) is tagged */
+static int64_t multiply(int64_t x, int64_t y)
+{
+    int64_t r;
+
+    if (SMALL(x, y) && !__builtin_mul_overflow(x, ERUPT_UNTAG(y), &r))
+        return r;
+
+    return erupt_int_mul(x, y);
+}
+
+/* like codegen, the runtime panics when dividing by zero */
+static int64_t divide(int64_t x, int64_t y)
+{
+    if (SMALL(x, y) && y != 0) {
+        int64_t q = ERUPT_UNTAG(x) / ERUPT_UNTAG(y);
+
+        /* only ERUPT_INT_MIN / -1 doesn't fit */
+        if (q <= ERUPT_INT_MAX)
+            return ERUPT_TAG(q);
+    }
+
+    return erupt_int_div(x, y);
+}
+
+static int64_t modulo(int64_t x, int64_t y)
+{
+    if (SMALL(x, y) && y != 0)
+        return ERUPT_TAG(ERUPT_UNTAG(x) % ERUPT_UNTAG(y));
+
+    return erupt_int_mod(x, y);
+}
+
+static int64_t shift_left(int64_t x, int64_t y)
+{
+    int64_t s = ERUPT_UNTAG(y);
+
+    if (SMALL(x, y) && s >= 0 && s < 63) {
+        int64_t r = (int64_t)((uint64_t)x << s);
+
+        /* no bits were shifted out */
+        if (r >> s == x)
+            return r;
+    }
+
+    return erupt_int_shl(x, y);
+}
+
+/* floor(2v / 2^s) with the low bit cleared is floor(v / 2^s) << 1 */
+static int64_t shift_right(int64_t x, int64_t y)
+{
+    int64_t s = ERUPT_UNTAG(y);
+
+    if (SMALL(x, y) && s >= 0 && s < 64)
+        return (x >> s) & -2;
+
+    return erupt_int_shr(x, y);
+}
+
+static int64_t to_int(double f)
+{
+    if (f > -0x1p62 && f < 0x1p62)
+        return ERUPT_TAG((int64_t)f);
+
+    return erupt_int_from_float(f);
+}
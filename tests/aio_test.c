@@ -0,0 +1,224 @@
+/*
+ * Copyright (C) 2015 soud
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "erupt.h"
+#include "minunit/minunit.h"
+#include "runtime.h"
+
+#define FILE_SIZE (ERUPT_IO_BUFFER_SIZE * 4)
+
+static char path[] = "/tmp/erupt_aio_XXXXXX";
+static int file = -1;
+
+static char pattern(size_t i)
+{
+    return (char)(i * 7 + i / 251);
+}
+
+static void write_file(void)
+{
+    static char data[FILE_SIZE];
+
+    for (size_t i = 0; i < FILE_SIZE; ++i)
+        data[i] = pattern(i);
+
+    file = mkstemp(path);
+    unlink(path);
+
+    if (write(file, data, FILE_SIZE) != FILE_SIZE)
+        abort();
+}
+
+/* whether buffer holds the n bytes of the file from offset */
+static bool matches(const char *buffer, size_t offset, size_t n)
+{
+    for (size_t i = 0; i < n; ++i) {
+        if (buffer[i] != pattern(offset + i))
+            return false;
+    }
+
+    return true;
+}
+
+MU_TEST(read_file)
+{
+    erupt_aio_t reads[4];
+    char *buffers[4];
+    bool ok = true;
+
+    /* queued together and submitted by the first wait */
+    for (int i = 0; i < 4; ++i) {
+        buffers[i] = erupt_aio_buffer();
+        erupt_aio_read(&reads[i], file, buffers[i], ERUPT_IO_BUFFER_SIZE,
+                       (int64_t)i * ERUPT_IO_BUFFER_SIZE);
+    }
+
+    for (int i = 3; i >= 0; --i) {
+        ok = ok && erupt_aio_wait(&reads[i]) == ERUPT_IO_BUFFER_SIZE &&
+             matches(buffers[i], (size_t)i * ERUPT_IO_BUFFER_SIZE,
+                     ERUPT_IO_BUFFER_SIZE);
+        erupt_aio_release(buffers[i]);
+    }
+
+    mu_assert(ok, "every part of the file should be read");
+
+    /* at the current position, into memory that isn't registered */
+    char small[100];
+    erupt_aio_t r;
+
+    lseek(file, 1000, SEEK_SET);
+    erupt_aio_read(&r, file, small, sizeof(small), -1);
+
+    mu_assert(erupt_aio_wait(&r) == sizeof(small) &&
+              matches(small, 1000, sizeof(small)),
+              "reads without an offset should start at the position");
+
+    erupt_aio_read(&r, -1, small, sizeof(small), 0);
+
+    mu_assert(erupt_aio_wait(&r) == -EBADF, "errors should be -errno");
+}
+
+MU_TEST(pipe_order)
+{
+    int fds[2];
+    char buffer[16] = { 0 };
+    erupt_aio_t r, w;
+
+    pipe(fds);
+
+    /* the read can only complete after the write that follows it */
+    erupt_aio_read(&r, fds[0], buffer, sizeof(buffer), -1);
+    erupt_aio_write(&w, fds[1], "erupt", 5, -1);
+
+    mu_assert(erupt_aio_wait(&r) == 5 && strcmp(buffer, "erupt") == 0,
+              "the read should get what was written");
+    mu_assert(erupt_aio_wait(&w) == 5, "the write should be complete");
+
+    close(fds[0]);
+    close(fds[1]);
+}
+
+MU_TEST(echo)
+{
+    struct sockaddr_in addr = { .sin_family = AF_INET };
+    socklen_t length = sizeof(addr);
+    int server = socket(AF_INET, SOCK_STREAM, 0);
+    int client = socket(AF_INET, SOCK_STREAM, 0);
+    char buffer[16] = { 0 };
+    erupt_aio_t a, r;
+
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(server, (struct sockaddr *)&addr, sizeof(addr));
+    listen(server, 1);
+    getsockname(server, (struct sockaddr *)&addr, &length);
+
+    erupt_aio_accept(&a, server);
+    erupt_aio_submit();
+    connect(client, (struct sockaddr *)&addr, sizeof(addr));
+
+    int conn = (int)erupt_aio_wait(&a);
+
+    mu_assert(conn >= 0, "the connection should be accepted");
+
+    write(client, "ping", 4);
+    erupt_aio_read(&r, conn, buffer, sizeof(buffer), -1);
+
+    mu_assert(erupt_aio_wait(&r) == 4 && strcmp(buffer, "ping") == 0,
+              "the message should arrive");
+
+    close(conn);
+    close(client);
+    close(server);
+}
+
+typedef struct {
+    int part;
+    bool ok;
+} part_t;
+
+static void read_part(void *arg)
+{
+    part_t *p = arg;
+    char buffer[FILE_SIZE / 16];
+    erupt_aio_t r;
+    size_t offset = (size_t)p->part * sizeof(buffer);
+
+    erupt_aio_read(&r, file, buffer, sizeof(buffer), (int64_t)offset);
+    p->ok = erupt_aio_wait(&r) == sizeof(buffer) &&
+            matches(buffer, offset, sizeof(buffer));
+}
+
+MU_TEST(from_tasks)
+{
+    erupt_task_t tasks[16];
+    part_t parts[16];
+    bool ok = true;
+
+    for (int i = 0; i < 16; ++i) {
+        parts[i] = (part_t){ i, false };
+        erupt_fork(&tasks[i], read_part, &parts[i]);
+    }
+
+    for (int i = 15; i >= 0; --i) {
+        erupt_join(&tasks[i]);
+        ok = ok && parts[i].ok;
+    }
+
+    mu_assert(ok, "tasks waiting on IO should all get their part");
+}
+
+MU_TEST_SUITE(test_suite)
+{
+    setenv("ERUPT_THREADS", "4", 1);
+    write_file();
+
+    MU_RUN_TEST(read_file);
+    MU_RUN_TEST(pipe_order);
+    MU_RUN_TEST(echo);
+    MU_RUN_TEST(from_tasks);
+}
+
+int main(int argc, char *argv[])
+{
+    /* the epoll fallback runs the same tests in a child */
+    pid_t child = fork();
+
+    if (child == 0)
+        setenv("ERUPT_AIO", "epoll", 1);
+
+    MU_RUN_SUITE(test_suite);
+    MU_REPORT();
+
+    if (child > 0)
+        waitpid(child, NULL, 0);
+
+    return 0;
+}
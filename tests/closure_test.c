@@ -0,0 +1,179 @@
+/*
+ * Copyright (C) 2015 soud
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "ast.h"
+#include "bytecode.h"
+#include "closure.h"
+#include "erupt.h"
+#include "lower.h"
+#include "minunit/minunit.h"
+#include "test_ast.h"
+#include "passes.h"
+#include "vm.h"
+
+static ast_operator_t plus = { PLUS, 10, ASSOC_LEFT, false };
+static ast_operator_t pipe_op = { PIPE, 1, ASSOC_LEFT, false };
+
+/* apply f x => f(x) */
+static ast_node_t *apply_fn(void)
+{
+    ast_node_list_t *params = list_of(var("f"));
+
+    append_node(params, var("x"));
+
+    return create_fn(create_fn_proto("apply", params),
+                     list_of(create_call("f", list_of(var("x")))));
+}
+
+/* main => k = 5, add = fn y => y + k, then body */
+static ast_node_t *main_fn(ast_node_t *body)
+{
+    ast_node_t *lambda = create_lambda(list_of(var("y")), list_of(
+        create_expr(&plus, var("y"), var("k"))));
+    ast_node_list_t *nl = list_of(create_var("k", false, create_int(5)));
+
+    append_node(nl, create_var("add", false, lambda));
+    append_node(nl, body);
+
+    return create_fn(create_fn_proto("main", NULL), nl);
+}
+
+/* lower ast and run it in the VM, giving main's result */
+static int run(ast_node_list_t *ast)
+{
+    eir_module_t *m = lower_ast("test", ast);
+    vm_program_t *p = NULL;
+    int status = -1;
+
+    if (m && run_eir_passes(m, false))
+        p = lower_bytecode(m);
+
+    if (p && !run_vm(p, &status))
+        status = -1;
+
+    destroy_bytecode(p);
+    destroy_eir_module(m);
+
+    return status;
+}
+
+static ast_node_t *last_fn(ast_node_list_t *ast)
+{
+    while (ast->next)
+        ast = ast->next;
+
+    return ast->node;
+}
+
+MU_TEST(escaping_lambda)
+{
+    ast_node_list_t *args = list_of(var("add"));
+
+    append_node(args, create_int(10));
+
+    ast_node_list_t *ast = list_of(apply_fn());
+
+    append_node(ast, main_fn(create_call("apply", args)));
+
+    mu_assert(lift_lambdas(ast) == 0,
+              "a lambda passed to a function isn't called directly");
+
+    ast_node_t *lifted = last_fn(ast);
+    ast_node_t *closure = ast->next->node->fn.body->next->node->var.v;
+
+    mu_assert(strcmp(lifted->fn.prototype->prototype.name,
+                     "main" LAMBDA_INFIX "1") == 0,
+              "the lambda should be lifted to a top level function");
+    mu_assert(lifted->fn.prototype->prototype.args->next &&
+              !lifted->fn.prototype->prototype.args->next->next,
+              "it should take its argument and the value it captures");
+    mu_assert(closure->type == TYPE_CLOSURE &&
+              strcmp(closure->closure.name, "main" LAMBDA_INFIX "1") == 0,
+              "the lambda should become a closure of that function");
+    mu_assert(strcmp(closure->closure.captures->node->var.name, "k") == 0 &&
+              !closure->closure.captures->next,
+              "the closure should capture k, and only k");
+    mu_assert(run(ast) == 15, "apply(add, 10) should give 15");
+
+    destroy_ast(ast);
+}
+
+MU_TEST(direct_call)
+{
+    ast_node_list_t *ast = list_of(main_fn(create_expr(&plus,
+        create_call("add", list_of(create_int(10))),
+        create_expr(&pipe_op, create_int(3), var("add")))));
+
+    mu_assert(lift_lambdas(ast) == 1,
+              "a lambda that is only called should be called directly");
+
+    ast_node_list_t *body = ast->node->fn.body;
+    ast_node_t *sum = body->next->node;
+
+    mu_assert(body->next && !body->next->next,
+              "the binding of the lambda should be removed");
+    mu_assert(strcmp(sum->expr.lhs->call.name,
+                     "main" LAMBDA_INFIX "1") == 0 &&
+              sum->expr.lhs->call.args->next,
+              "the call should pass k to the lifted function");
+    mu_assert(sum->expr.rhs->expr.rhs->type == TYPE_CALL,
+              "a piped call should be rewritten too");
+    mu_assert(run(ast) == 23, "add(10) + (3 |> add) should give 23");
+
+    destroy_ast(ast);
+}
+
+MU_TEST(function_value)
+{
+    ast_node_list_t *args = list_of(var("double"));
+    ast_node_list_t *params = list_of(var("x"));
+
+    append_node(args, create_int(21));
+
+    ast_node_list_t *ast = list_of(apply_fn());
+
+    append_node(ast, create_fn(create_fn_proto("double", params),
+                               list_of(create_expr(&plus, var("x"),
+                                                   var("x")))));
+    append_node(ast, create_fn(create_fn_proto("main", NULL),
+                               list_of(create_call("apply", args))));
+
+    mu_assert(lift_lambdas(ast) == 0, "there are no lambdas to lift");
+    mu_assert(run(ast) == 42, "apply(double, 21) should give 42");
+
+    destroy_ast(ast);
+}
+
+MU_TEST_SUITE(test_suite)
+{
+    MU_RUN_TEST(escaping_lambda);
+    MU_RUN_TEST(direct_call);
+    MU_RUN_TEST(function_value);
+}
+
+int main(int argc, char *argv[])
+{
+    MU_RUN_SUITE(test_suite);
+    MU_REPORT();
+
+    return 0;
+}
@@ -0,0 +1,680 @@
+/*
+ * Copyright (C) 2015 soud
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <llvm-c/BitWriter.h>
+#include <llvm-c/DebugInfo.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "ast.h"
+#include "cache.h"
+#include "closure.h"
+#include "codegen.h"
+#include "emit.h"
+#include "erupt.h"
+#include "escape.h"
+#include "jit.h"
+#include "link.h"
+#include "lower.h"
+#include "lto.h"
+#include "minunit/minunit.h"
+#include "test_ast.h"
+#include "partition.h"
+#include "passes.h"
+
+#define EXECUTABLE "build/tests/codegen_program"
+#define OBJECT EXECUTABLE ".o"
+
+static ast_operator_t plus = { PLUS, 10, ASSOC_LEFT, false };
+static ast_operator_t minus = { MIN, 10, ASSOC_LEFT, false };
+static ast_operator_t slash = { SLASH, 20, ASSOC_LEFT, false };
+static ast_operator_t star = { STAR, 20, ASSOC_LEFT, false };
+
+/* fib 0 => 0, fib 1 => 1, fib x => fib(x - 1) + fib(x - 2) */
+static ast_node_list_t *fib(ast_node_t *main_body)
+{
+    ast_node_list_t *ast = list_of(clause("fib", create_int(0),
+                                          create_int(0)));
+
+    append_node(ast, clause("fib", create_int(1), create_int(1)));
+    append_node(ast, clause("fib", x(), create_expr(&plus,
+        create_call("fib", list_of(create_expr(&minus, x(), create_int(1)))),
+        create_call("fib", list_of(create_expr(&minus, x(), create_int(2))))
+    )));
+    append_node(ast, clause("main", NULL, main_body));
+
+    return ast;
+}
+
+/* compile ast at -O2 and run it, giving its exit status */
+static int compile_and_run(ast_node_list_t *ast, const char *expected_output)
+{
+    eir_module_t *m = lower_ast("test", ast);
+    LLVMContextRef ctx = LLVMContextCreate();
+    int status = -1;
+
+    destroy_ast(ast);
+
+    if (!m || !run_eir_passes(m, false))
+        return -1;
+
+    LLVMModuleRef mod = codegen_module(m, ctx);
+    LLVMTargetMachineRef tm = create_target_machine(2);
+
+    destroy_eir_module(m);
+
+    if (mod && tm && optimize_module(mod, tm, 2) &&
+        emit_object(mod, tm, OBJECT) &&
+        link_executable((char *[]){ OBJECT }, 1, EXECUTABLE)) {
+        char output[64] = { 0 };
+        FILE *program = popen(EXECUTABLE " 2>/dev/null", "r");
+
+        fread(output, 1, sizeof(output) - 1, program);
+        status = WEXITSTATUS(pclose(program));
+
+        if (expected_output && strcmp(output, expected_output) != 0)
+            status = -1;
+    }
+
+    remove(OBJECT);
+    remove(EXECUTABLE);
+
+    if (mod)
+        LLVMDisposeModule(mod);
+
+    if (tm)
+        LLVMDisposeTargetMachine(tm);
+
+    LLVMContextDispose(ctx);
+
+    return status;
+}
+
+MU_TEST(exit_status)
+{
+    ast_node_list_t *ast = fib(create_call("fib", list_of(create_int(20))));
+
+    /* fib(20) is 6765, the exit status keeps the low byte */
+    mu_assert(compile_and_run(ast, "") == 6765 % 256,
+              "main's result should be the exit status");
+}
+
+MU_TEST(print)
+{
+    ast_node_list_t *ast = fib(create_call("IO.print", list_of(
+        create_call("fib", list_of(create_int(30)))
+    )));
+
+    mu_assert(compile_and_run(ast, "832040\n") == 0,
+              "IO.print should print fib(30)");
+}
+
+/* main => IO.print("pooled, " + "pooled, " + "!") */
+static ast_node_list_t *pooled(void)
+{
+    return list_of(clause("main", NULL, create_call("IO.print", list_of(
+        create_expr(&plus, create_expr(&plus, create_string("pooled, "),
+                                       create_string("pooled, ")),
+                    create_string("!"))
+    ))));
+}
+
+MU_TEST(strings)
+{
+    ast_node_list_t *ast = pooled();
+    eir_module_t *m = lower_ast("test", ast);
+    LLVMContextRef ctx = LLVMContextCreate();
+    LLVMModuleRef mod = m ? codegen_module(m, ctx) : NULL;
+    size_t n_globals = 0, length;
+
+    mu_assert(mod, "string literals should be generated");
+
+    for (LLVMValueRef g = LLVMGetFirstGlobal(mod); g;
+         g = LLVMGetNextGlobal(g))
+        n_globals += strncmp(LLVMGetValueName2(g, &length), ".str", 4) == 0;
+
+    LLVMValueRef pool = LLVMGetNamedGlobal(mod, ".strings");
+
+    /* a header, a length and the bytes of "pooled, " */
+    mu_assert(n_globals == 1 && pool &&
+              LLVMCountStructElementTypes(LLVMGlobalGetValueType(pool)) == 3,
+              "equal literals should be in the pool once, short ones not");
+    mu_assert(compile_and_run(pooled(), "pooled, pooled, !\n") == 0,
+              "pooled literals should be concatenated");
+
+    LLVMDisposeModule(mod);
+    LLVMContextDispose(ctx);
+    destroy_eir_module(m);
+    destroy_ast(ast);
+}
+
+MU_TEST(division_by_zero)
+{
+    /* f x => 1 / x, main => f(0) */
+    ast_node_list_t *ast = list_of(clause("f", x(),
+                                          create_expr(&slash, create_int(1),
+                                                      x())));
+
+    append_node(ast, clause("main", NULL,
+                            create_call("f", list_of(create_int(0)))));
+
+    mu_assert(compile_and_run(ast, "") == 1,
+              "dividing by zero should be a runtime error");
+}
+
+/*
+ * main => l = [1, 2, 3], IO.print(l + [4]), IO.print("on the stack"), 0.
+ * neither list escapes, and the string is a constant.
+ */
+MU_TEST(stack_literals)
+{
+    ast_node_list_t *values = list_of(create_int(1)), *body;
+
+    append_node(values, create_int(2));
+    append_node(values, create_int(3));
+    body = list_of(create_var("l", false, create_list(values)));
+    append_node(body, create_call("IO.print", list_of(
+        create_expr(&plus, var("l"), create_list(list_of(create_int(4))))
+    )));
+    append_node(body, create_call("IO.print", list_of(
+        create_string("on the stack")
+    )));
+    append_node(body, create_int(0));
+
+    ast_node_list_t *ast = list_of(create_fn(create_fn_proto("main", NULL),
+                                             body));
+
+    mu_assert(analyze_escapes(ast) == 2,
+              "the lists should be allocated on the stack");
+    mu_assert(compile_and_run(ast, "[1, 2, 3, 4]\non the stack\n") == 0,
+              "literals on the stack should work like any other");
+}
+
+/*
+ * build acc 0 => acc
+ * build acc n => build(acc + element, n - 1)
+ * main => IO.print(build(empty, 3))
+ */
+static ast_node_list_t *accumulate(ast_node_t *empty, ast_node_t *element)
+{
+    ast_node_list_t *done = list_of(var("acc")), *more = list_of(var("acc"));
+
+    append_node(done, create_int(0));
+    append_node(more, var("n"));
+
+    ast_node_list_t *args = list_of(create_expr(&plus, var("acc"), element));
+
+    append_node(args, create_expr(&minus, var("n"), create_int(1)));
+
+    ast_node_list_t *ast = list_of(create_fn(create_fn_proto("build", done),
+                                             list_of(var("acc"))));
+
+    append_node(ast, create_fn(create_fn_proto("build", more),
+                               list_of(create_call("build", args))));
+
+    ast_node_list_t *build = list_of(empty);
+
+    append_node(build, create_int(3));
+    append_node(ast, clause("main", NULL, create_call("IO.print", list_of(
+        create_call("build", build)))));
+
+    return ast;
+}
+
+/* parameters are typed as ints, + has to find out what they hold */
+MU_TEST(accumulators)
+{
+    mu_assert(compile_and_run(accumulate(
+                  create_list(NULL), create_list(list_of(var("n")))),
+                  "[3, 2, 1]\n") == 0,
+              "a list accumulator should be concatenated");
+    mu_assert(compile_and_run(accumulate(
+                  create_string(""), create_string("ab")),
+                  "ababab\n") == 0,
+              "a string accumulator should be concatenated");
+}
+
+MU_TEST(jit)
+{
+    ast_node_list_t *ast = fib(create_call("fib", list_of(create_int(20))));
+    eir_module_t *m = lower_ast("test", ast);
+    int status = -1;
+
+    mu_assert(m && run_eir_passes(m, false), "fib should be lowered");
+    mu_assert(run_jit(m, 2, false, false, &status), "the JIT should run main");
+    mu_assert(status == 6765, "main should give fib(20)");
+
+    destroy_eir_module(m);
+    destroy_ast(ast);
+}
+
+/*
+ * twice f x => f(f(x)), inc x => x + 1, add x y => x + y and
+ * main => k = 5, add5 = fn y => y + k, then body. lambdas are lifted.
+ */
+static ast_node_list_t *with_closures(ast_node_t *body)
+{
+    ast_node_list_t *twice = list_of(var("f")), *add = list_of(x());
+    ast_node_t *lambda = create_lambda(list_of(var("y")), list_of(
+        create_expr(&plus, var("y"), var("k"))));
+    ast_node_list_t *main_body = list_of(create_var("k", false,
+                                                    create_int(5)));
+
+    append_node(twice, x());
+    append_node(add, var("y"));
+    append_node(main_body, create_var("add5", false, lambda));
+    append_node(main_body, body);
+
+    ast_node_list_t *ast = list_of(create_fn(
+        create_fn_proto("twice", twice),
+        list_of(create_call("f", list_of(create_call("f", list_of(x())))))
+    ));
+
+    append_node(ast, clause("inc", x(), create_expr(&plus, x(),
+                                                    create_int(1))));
+    append_node(ast, create_fn(create_fn_proto("add", add),
+                               list_of(create_expr(&plus, x(), var("y")))));
+    append_node(ast, create_fn(create_fn_proto("main", NULL), main_body));
+    lift_lambdas(ast);
+
+    return ast;
+}
+
+static ast_node_t *call_twice(const char *f, int64_t x)
+{
+    ast_node_list_t *args = list_of(var(f));
+
+    append_node(args, create_int(x));
+
+    return create_call("twice", args);
+}
+
+MU_TEST(closures)
+{
+    /* twice(add5, 10) + twice(inc, 0) */
+    ast_node_list_t *ast = with_closures(create_expr(&plus,
+                                                     call_twice("add5", 10),
+                                                     call_twice("inc", 0)));
+    eir_module_t *m = lower_ast("test", ast);
+    int status = -1;
+
+    mu_assert(m && run_eir_passes(m, false), "closures should be lowered");
+    mu_assert(run_jit(m, 2, false, false, &status) && status == 22,
+              "the JIT should call closures and functions taken as values");
+
+    destroy_eir_module(m);
+
+    mu_assert(compile_and_run(ast, "") == 22,
+              "compiled code should call closures");
+    mu_assert(compile_and_run(with_closures(call_twice("add", 0)), "") == 1,
+              "calling a function with too few arguments is a runtime "
+              "error");
+}
+
+/* emit the partitions of m on jobs threads */
+static LLVMMemoryBufferRef *emit_on(eir_module_t *m, int jobs, cache_t *cache,
+                                    size_t *n)
+{
+    partition_t *partitions = partition_module(m, n);
+    LLVMMemoryBufferRef *objects = emit_partitions(m, partitions, *n, 2, jobs,
+                                                   cache, false);
+
+    destroy_partitions(partitions, *n);
+
+    return objects;
+}
+
+MU_TEST(tiered_jit)
+{
+    /* enough calls for fib to be optimized while it runs */
+    ast_node_list_t *ast = fib(create_call("fib", list_of(create_int(25))));
+    eir_module_t *m = lower_ast("test", ast);
+    int status = -1;
+
+    mu_assert(m && run_eir_passes(m, false), "fib should be lowered");
+    mu_assert(run_jit(m, 2, true, false, &status),
+              "the tiered JIT should run main");
+    mu_assert(status == 75025, "main should give fib(25)");
+
+    destroy_eir_module(m);
+    destroy_ast(ast);
+}
+
+MU_TEST(perf_map)
+{
+    ast_node_list_t *ast = fib(create_call("fib", list_of(create_int(25))));
+    char dir[] = "/tmp/erupt-jitdump-XXXXXX";
+    char map[64], grep[256];
+    size_t line_n = 0;
+    int status = -1;
+
+    for (ast_node_list_t *nl = ast; nl; nl = nl->next)
+        nl->node->line_n = ++line_n;
+
+    eir_module_t *m = lower_ast("fib.er", ast);
+
+    mu_assert(m && run_eir_passes(m, false), "fib should be lowered");
+    mu_assert(mkdtemp(dir), "the jitdump should have a directory");
+    setenv("JITDUMPDIR", dir, 1);
+
+    mu_assert(run_jit(m, 2, true, true, &status) && status == 75025,
+              "the tiered JIT should run main with a perf map");
+
+    sprintf(map, "/tmp/perf-%ld.map", (long)getpid());
+    sprintf(grep, "grep -q '^[0-9a-f]* [0-9a-f]* fib (fib.er:1)$' %s && "
+            "grep -q ' fib (fib.er:1) \\[optimized\\]$' %s", map, map);
+
+    mu_assert(system(grep) == 0,
+              "the perf map should have both tiers of fib");
+
+    char rm[sizeof(dir) + sizeof("rm -rf ")];
+
+    sprintf(rm, "rm -rf %s", dir);
+    system(rm);
+    remove(map);
+    destroy_eir_module(m);
+    destroy_ast(ast);
+}
+
+MU_TEST(parallel_deterministic)
+{
+    ast_node_list_t *ast = fib(create_call("fib", list_of(create_int(20))));
+    eir_module_t *m = lower_ast("test", ast);
+    size_t n_serial, n_parallel;
+
+    mu_assert(m && run_eir_passes(m, false), "fib should be lowered");
+
+    LLVMMemoryBufferRef *serial = emit_on(m, 1, NULL, &n_serial);
+    LLVMMemoryBufferRef *parallel = emit_on(m, 4, NULL, &n_parallel);
+
+    mu_assert(serial && parallel, "the partitions should be compiled");
+    mu_assert(n_serial == n_parallel, "-j shouldn't change the partitions");
+
+    for (size_t i = 0; i < n_serial; ++i) {
+        size_t size = LLVMGetBufferSize(serial[i]);
+
+        mu_assert(size == LLVMGetBufferSize(parallel[i]) &&
+                  memcmp(LLVMGetBufferStart(serial[i]),
+                         LLVMGetBufferStart(parallel[i]), size) == 0,
+                  "-j shouldn't change the objects");
+
+        LLVMDisposeMemoryBuffer(serial[i]);
+        LLVMDisposeMemoryBuffer(parallel[i]);
+    }
+
+    free(serial);
+    free(parallel);
+    destroy_eir_module(m);
+    destroy_ast(ast);
+}
+
+MU_TEST(cache)
+{
+    ast_node_list_t *ast = fib(create_call("fib", list_of(create_int(20))));
+    eir_module_t *m = lower_ast("test", ast);
+    char dir[] = "/tmp/erupt-cache-XXXXXX";
+    size_t n;
+
+    mu_assert(m && run_eir_passes(m, false), "fib should be lowered");
+    mu_assert(mkdtemp(dir), "the cache should have a directory");
+    setenv("XDG_CACHE_HOME", dir, 1);
+
+    cache_t *cache = open_cache();
+
+    mu_assert(cache, "the cache should open");
+
+    LLVMMemoryBufferRef *cold = emit_on(m, 1, cache, &n);
+
+    mu_assert(cold && atomic_load(&cache->misses) == n &&
+              atomic_load(&cache->hits) == 0,
+              "nothing should be cached yet");
+
+    LLVMMemoryBufferRef *warm = emit_on(m, 1, cache, &n);
+
+    mu_assert(warm && atomic_load(&cache->hits) == n,
+              "every partition should come from the cache");
+
+    for (size_t i = 0; i < n; ++i) {
+        size_t size = LLVMGetBufferSize(cold[i]);
+
+        mu_assert(size == LLVMGetBufferSize(warm[i]) &&
+                  memcmp(LLVMGetBufferStart(cold[i]),
+                         LLVMGetBufferStart(warm[i]), size) == 0,
+                  "the cache should give back the same objects");
+
+        LLVMDisposeMemoryBuffer(cold[i]);
+        LLVMDisposeMemoryBuffer(warm[i]);
+    }
+
+    free(cold);
+    free(warm);
+
+    /* the DWARF of equal code from another file names that file */
+    m->debug_info = true;
+    cold = emit_on(m, 1, cache, &n);
+    free(m->name);
+    m->name = strdup("other.er");
+
+    size_t misses = atomic_load(&cache->misses);
+
+    warm = emit_on(m, 1, cache, &n);
+
+    mu_assert(cold && warm && atomic_load(&cache->misses) == misses + n,
+              "objects with debug info should be cached per source file");
+
+    for (size_t i = 0; i < n; ++i) {
+        LLVMDisposeMemoryBuffer(cold[i]);
+        LLVMDisposeMemoryBuffer(warm[i]);
+    }
+
+    char rm[sizeof(dir) + sizeof("rm -rf ")];
+
+    close_cache(cache);
+    sprintf(rm, "rm -rf %s", dir);
+    system(rm);
+
+    free(cold);
+    free(warm);
+    destroy_eir_module(m);
+    destroy_ast(ast);
+}
+
+/* whether a function of mod other than name itself still calls name */
+static bool calls(LLVMModuleRef mod, const char *name)
+{
+    for (LLVMValueRef f = LLVMGetFirstFunction(mod); f;
+         f = LLVMGetNextFunction(f)) {
+        size_t length;
+
+        if (strcmp(LLVMGetValueName2(f, &length), name) == 0)
+            continue;
+
+        for (LLVMBasicBlockRef b = LLVMGetFirstBasicBlock(f); b;
+             b = LLVMGetNextBasicBlock(b)) {
+            for (LLVMValueRef i = LLVMGetFirstInstruction(b); i;
+                 i = LLVMGetNextInstruction(i)) {
+                LLVMValueRef callee = LLVMGetInstructionOpcode(i) == LLVMCall ?
+                                      LLVMGetCalledValue(i) : NULL;
+
+                if (callee &&
+                    strcmp(LLVMGetValueName2(callee, &length), name) == 0)
+                    return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+MU_TEST(lto)
+{
+    /* sq x => x * x, main => sq(7), with sq in a partition of its own */
+    ast_node_list_t *ast = list_of(clause("sq", x(),
+                                          create_expr(&star, x(), x())));
+
+    append_node(ast, clause("main", NULL,
+                            create_call("sq", list_of(create_int(7)))));
+
+    eir_module_t *m = lower_ast("test", ast);
+
+    mu_assert(m && run_eir_passes(m, false), "sq should be lowered");
+
+    eir_fn_t *main_fn = eir_lookup_fn(m, "main"), *sq = eir_lookup_fn(m, "sq");
+    partition_t partitions[] = {
+        { &main_fn, (bool[]){ false }, 1 },
+        { &sq, (bool[]){ true }, 1 }
+    };
+    LLVMContextRef ctx = LLVMContextCreate(), sq_ctx = LLVMContextCreate();
+    LLVMModuleRef mods[] = {
+        codegen_partition(m, &main_fn, partitions[0].exported, 1, ctx),
+        codegen_partition(m, &sq, partitions[1].exported, 1, sq_ctx)
+    };
+    LLVMMemoryBufferRef bitcode[] = {
+        LLVMWriteBitcodeToMemoryBuffer(mods[0]),
+        LLVMWriteBitcodeToMemoryBuffer(mods[1])
+    };
+    lto_summary_t summaries[2];
+
+    summarize_module(mods[0], &summaries[0]);
+    summarize_module(mods[1], &summaries[1]);
+
+    lto_imports_t *imports = thin_link(summaries, 2);
+
+    mu_assert(imports[0].n == 1 && strcmp(imports[0].names[0], "er.sq") == 0 &&
+              imports[0].from[0] == 1, "main's partition should import sq");
+    mu_assert(imports[1].n == 0, "sq's partition shouldn't import anything");
+
+    LLVMTargetMachineRef tm = create_target_machine(2);
+
+    mu_assert(import_functions(mods[0], bitcode, &imports[0]) &&
+              optimize_module(mods[0], tm, 2),
+              "sq should be imported into main's partition");
+    mu_assert(!calls(mods[0], "er.sq"), "sq should be inlined into main");
+
+    LLVMMemoryBufferRef *objects = emit_partitions(m, partitions, 2, 2, 1,
+                                                   NULL, true);
+
+    mu_assert(objects, "the partitions should be compiled with LTO");
+    mu_assert(link_objects(objects, 2, EXECUTABLE) &&
+              WEXITSTATUS(system(EXECUTABLE)) == 49,
+              "the program compiled with LTO should give sq(7)");
+
+    LLVMDisposeMemoryBuffer(objects[0]);
+    LLVMDisposeMemoryBuffer(objects[1]);
+    remove(EXECUTABLE);
+    free(objects);
+    destroy_imports(imports, 2);
+    destroy_summary(&summaries[0]);
+    destroy_summary(&summaries[1]);
+    LLVMDisposeMemoryBuffer(bitcode[0]);
+    LLVMDisposeMemoryBuffer(bitcode[1]);
+    LLVMDisposeModule(mods[0]);
+    LLVMDisposeModule(mods[1]);
+    LLVMDisposeTargetMachine(tm);
+    LLVMContextDispose(ctx);
+    LLVMContextDispose(sq_ctx);
+    destroy_eir_module(m);
+    destroy_ast(ast);
+}
+
+MU_TEST(debug_info)
+{
+    /* fib's clauses on lines 1 to 3, main on line 4 */
+    ast_node_list_t *ast = fib(create_call("fib", list_of(create_int(10))));
+    size_t line_n = 0;
+
+    for (ast_node_list_t *nl = ast; nl; nl = nl->next)
+        nl->node->line_n = ++line_n;
+
+    eir_module_t *m = lower_ast("tests/fib.er", ast);
+
+    mu_assert(m && run_eir_passes(m, false), "fib should be lowered");
+
+    m->debug_info = true;
+
+    LLVMContextRef ctx = LLVMContextCreate();
+    LLVMModuleRef mod = codegen_module(m, ctx);
+
+    mu_assert(mod, "fib should be generated with debug info");
+
+    LLVMValueRef fn = LLVMGetNamedFunction(mod, SYMBOL_PREFIX "fib");
+    LLVMMetadataRef subprogram = LLVMGetSubprogram(fn);
+    bool last_clause = false, in_fib = true;
+
+    mu_assert(subprogram && LLVMDISubprogramGetLine(subprogram) == 1,
+              "fib should start on the line of its first clause");
+
+    for (LLVMBasicBlockRef b = LLVMGetFirstBasicBlock(fn); b;
+         b = LLVMGetNextBasicBlock(b)) {
+        for (LLVMValueRef i = LLVMGetFirstInstruction(b); i;
+             i = LLVMGetNextInstruction(i)) {
+            in_fib &= LLVMGetDebugLocLine(i) >= 1 &&
+                      LLVMGetDebugLocLine(i) <= 3;
+            last_clause |= LLVMGetDebugLocLine(i) == 3;
+        }
+    }
+
+    mu_assert(in_fib && last_clause,
+              "fib's code should be on the lines of its clauses");
+
+    LLVMTargetMachineRef tm = create_target_machine(2);
+
+    mu_assert(optimize_module(mod, tm, 2) && emit_object(mod, tm, OBJECT) &&
+              system("readelf --debug-dump=decodedline " OBJECT
+                     " | grep -q 'fib.er *3 '") == 0,
+              "the object should have a line table for fib.er");
+
+    remove(OBJECT);
+    LLVMDisposeModule(mod);
+    LLVMDisposeTargetMachine(tm);
+    LLVMContextDispose(ctx);
+    destroy_eir_module(m);
+    destroy_ast(ast);
+}
+
+MU_TEST_SUITE(test_suite)
+{
+    setenv("ERUPT_RUNTIME", "build/liberupt_rt.a", 0);
+
+    MU_RUN_TEST(exit_status);
+    MU_RUN_TEST(print);
+    MU_RUN_TEST(strings);
+    MU_RUN_TEST(division_by_zero);
+    MU_RUN_TEST(stack_literals);
+    MU_RUN_TEST(accumulators);
+    MU_RUN_TEST(jit);
+    MU_RUN_TEST(closures);
+    MU_RUN_TEST(tiered_jit);
+    MU_RUN_TEST(perf_map);
+    MU_RUN_TEST(parallel_deterministic);
+    MU_RUN_TEST(cache);
+    MU_RUN_TEST(lto);
+    MU_RUN_TEST(debug_info);
+}
+
+int main(int argc, char *argv[])
+{
+    MU_RUN_SUITE(test_suite);
+    MU_REPORT();
+
+    return 0;
+}
@@ -0,0 +1,122 @@
+/*
+ * Copyright (C) 2015 soud
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "ast.h"
+#include "dce.h"
+#include "erupt.h"
+#include "minunit/minunit.h"
+#include "test_ast.h"
+
+static ast_operator_t pipe_op = { PIPE, 1, ASSOC_LEFT, false };
+
+static ast_node_t *fn(const char *name, ast_node_t *body)
+{
+    return create_fn(create_fn_proto(name, NULL), list_of(body));
+}
+
+static bool defines(ast_node_list_t *ast, int type, const char *name)
+{
+    for (; ast; ast = ast->next) {
+        ast_node_t *node = ast->node;
+
+        if (!node || node->type != type)
+            continue;
+
+        if (type == TYPE_FN &&
+            strcmp(node->fn.prototype->prototype.name, name) == 0)
+            return true;
+
+        if (type == TYPE_IMPORT && strcmp(node->import.name, name) == 0)
+            return true;
+    }
+
+    return false;
+}
+
+MU_TEST(unreachable_functions)
+{
+    ast_node_list_t *ast = list_of(create_import("IO", false));
+
+    append_node(ast, create_import("Math", false));
+    append_node(ast, fn("IO.print", create_int(0)));
+    append_node(ast, fn("IO.read", create_int(0)));
+    append_node(ast, fn("helper", create_int(1)));
+    append_node(ast, fn("unused", create_call("helper", NULL)));
+    append_node(ast, fn("main", create_call("IO.print", list_of(
+        create_call("helper", NULL)))));
+
+    mu_assert(eliminate_dead_functions(ast) == 3,
+              "IO.read, unused and Math should be removed");
+    mu_assert(defines(ast, TYPE_FN, "main"), "main should be kept");
+    mu_assert(defines(ast, TYPE_FN, "helper"), "helper should be kept");
+    mu_assert(defines(ast, TYPE_FN, "IO.print"), "IO.print should be kept");
+    mu_assert(!defines(ast, TYPE_FN, "IO.read"), "IO.read should be gone");
+    mu_assert(!defines(ast, TYPE_FN, "unused"), "unused should be gone");
+    mu_assert(defines(ast, TYPE_IMPORT, "IO"), "IO should be kept");
+    mu_assert(!defines(ast, TYPE_IMPORT, "Math"), "Math should be gone");
+
+    destroy_ast(ast);
+}
+
+MU_TEST(piped_module)
+{
+    /* main => fact(5) |> IO.print */
+    ast_node_list_t *ast = list_of(create_import("IO", false));
+
+    append_node(ast, fn("IO.print", create_int(0)));
+    append_node(ast, fn("fact", create_int(120)));
+    append_node(ast, fn("main", create_expr(&pipe_op,
+        create_call("fact", NULL), var("IO.print"))));
+
+    mu_assert(eliminate_dead_functions(ast) == 0,
+              "nothing should be removed");
+    mu_assert(defines(ast, TYPE_IMPORT, "IO"),
+              "IO should be kept when it's only piped into");
+    mu_assert(defines(ast, TYPE_FN, "IO.print"), "IO.print should be kept");
+
+    destroy_ast(ast);
+}
+
+MU_TEST(no_entry_point)
+{
+    ast_node_list_t *ast = list_of(fn("helper", create_int(1)));
+
+    mu_assert(eliminate_dead_functions(ast) == 0,
+              "modules without main should be left alone");
+
+    destroy_ast(ast);
+}
+
+MU_TEST_SUITE(test_suite)
+{
+    MU_RUN_TEST(unreachable_functions);
+    MU_RUN_TEST(piped_module);
+    MU_RUN_TEST(no_entry_point);
+}
+
+int main(int argc, char *argv[])
+{
+    MU_RUN_SUITE(test_suite);
+    MU_REPORT();
+
+    return 0;
+}
@@ -0,0 +1,292 @@
+/*
+ * Copyright (C) 2015 soud
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "ast.h"
+#include "eir.h"
+#include "erupt.h"
+#include "lower.h"
+#include "minunit/minunit.h"
+#include "test_ast.h"
+#include "passes.h"
+
+static ast_operator_t plus = { PLUS, 10, ASSOC_LEFT, false };
+static ast_operator_t minus = { MIN, 10, ASSOC_LEFT, false };
+static ast_operator_t star = { STAR, 20, ASSOC_LEFT, false };
+static ast_operator_t power = { STAR_STAR, 30, ASSOC_RIGHT, false };
+static ast_operator_t lt = { LT, 5, ASSOC_LEFT, false };
+
+/*
+ * fib 0 => 0
+ * fib 1 => 1
+ * fib x => fib(x - 1) + fib(x - 2)
+ */
+static ast_node_list_t *fib(void)
+{
+    ast_node_list_t *ast = list_of(clause("fib", create_int(0),
+                                          create_int(0)));
+
+    append_node(ast, clause("fib", create_int(1), create_int(1)));
+    append_node(ast, clause("fib", x(), create_expr(&plus,
+        create_call("fib", list_of(create_expr(&minus, x(), create_int(1)))),
+        create_call("fib", list_of(create_expr(&minus, x(), create_int(2))))
+    )));
+
+    return ast;
+}
+
+MU_TEST(builder)
+{
+    eir_module_t *m = create_eir_module("test");
+    eir_fn_t *fn = eir_add_fn(m, "f", 1);
+    eir_builder_t b = { fn, eir_add_block(fn), 0 };
+    eir_block_t *then = eir_add_block(fn), *merge = eir_add_block(fn);
+
+    eir_instr_t *p = eir_param(&b, 0, EIR_INT);
+    eir_instr_t *zero = eir_const_int(&b, 0);
+    eir_block_t *entry = b.block;
+
+    eir_condbr(&b, eir_binop(&b, LT, p, zero), then, merge);
+
+    b.block = then;
+    eir_instr_t *neg = eir_unop(&b, MIN, p);
+    eir_br(&b, merge);
+
+    b.block = merge;
+    eir_instr_t *phi = eir_phi(&b, EIR_INT);
+
+    eir_add_incoming(phi, p, entry);
+    eir_add_incoming(phi, neg, then);
+    eir_ret(&b, phi);
+
+    mu_assert(verify_eir_module(m), "abs should be valid EIR");
+    mu_assert(eir_lookup_fn(m, "f") == fn, "f should be found");
+
+    destroy_eir_module(m);
+}
+
+/* + takes the type of a string or list added to a parameter */
+MU_TEST(concat_types)
+{
+    eir_module_t *m = create_eir_module("test");
+    eir_fn_t *fn = eir_add_fn(m, "f", 1);
+    eir_builder_t b = { fn, eir_add_block(fn), 0 };
+
+    eir_instr_t *p = eir_param(&b, 0, EIR_INT);
+    eir_instr_t *s = eir_const_string(&b, "s");
+
+    mu_assert(eir_binop(&b, PLUS, p, eir_list(&b, NULL, 0))->type ==
+              EIR_LIST, "acc + [] should concatenate lists");
+    mu_assert(eir_binop(&b, PLUS, p, s)->type == EIR_STRING,
+              "acc + \"s\" should concatenate strings");
+    mu_assert(eir_binop(&b, PLUS, eir_const_int(&b, 1), s)->type == EIR_INT,
+              "a literal int is never a string");
+
+    destroy_eir_module(m);
+}
+
+MU_TEST(lower_clauses)
+{
+    ast_node_list_t *ast = fib();
+    eir_module_t *m = lower_ast("test", ast);
+
+    mu_assert(m != NULL, "fib should be lowered");
+    mu_assert(verify_eir_module(m), "lowered fib should be valid EIR");
+
+    eir_fn_t *fn = eir_lookup_fn(m, "fib");
+
+    mu_assert(fn && fn->n_params == 1, "fib should take 1 parameter");
+    mu_assert(run_eir_passes(m, false), "passes should succeed");
+
+    /* the two literal patterns are dispatched with one switch */
+    eir_instr_t *term = eir_terminator(fn->first);
+
+    mu_assert(term->op == EIR_SWITCH, "fib should dispatch with a switch");
+    mu_assert(term->n_cases == 2, "the switch should have 2 cases");
+
+    destroy_eir_module(m);
+    destroy_ast(ast);
+}
+
+MU_TEST(fold)
+{
+    /* main => 6 * 7 */
+    ast_node_list_t *ast = list_of(create_fn(create_fn_proto("main", NULL),
+        list_of(create_expr(&star, create_int(6), create_int(7)))));
+    eir_module_t *m = lower_ast("test", ast);
+
+    mu_assert(run_eir_passes(m, false), "passes should succeed");
+
+    eir_instr_t *ret = eir_terminator(m->first->first);
+
+    mu_assert(ret->op == EIR_RET, "main should return right away");
+    mu_assert(ret->operands[0]->op == EIR_CONST_INT, "6 * 7 should fold");
+    mu_assert(ret->operands[0]->imm.i == 42, "6 * 7 should be 42");
+
+    destroy_eir_module(m);
+    destroy_ast(ast);
+}
+
+/* fold main => base ** exp into r, false if it isn't folded */
+static bool folds_power(int64_t base, int64_t exp, int64_t *r)
+{
+    ast_node_list_t *ast = list_of(create_fn(create_fn_proto("main", NULL),
+        list_of(create_expr(&power, create_int(base), create_int(exp)))));
+    eir_module_t *m = lower_ast("test", ast);
+
+    run_eir_passes(m, false);
+
+    eir_instr_t *v = eir_terminator(m->first->first)->operands[0];
+    bool folded = v->op == EIR_CONST_INT;
+
+    if (folded)
+        *r = v->imm.i;
+
+    destroy_eir_module(m);
+    destroy_ast(ast);
+
+    return folded;
+}
+
+MU_TEST(fold_power)
+{
+    int64_t r;
+
+    mu_assert(folds_power(1, INT64_MAX, &r) && r == 1,
+              "1 ** INT64_MAX should fold right away");
+    mu_assert(folds_power(-1, INT64_MAX, &r) && r == -1,
+              "-1 ** INT64_MAX should be -1");
+    mu_assert(folds_power(0, INT64_MAX, &r) && r == 0,
+              "0 ** INT64_MAX should be 0");
+    mu_assert(folds_power(3, 39, &r) && r == 4052555153018976267,
+              "3 ** 39 should fit");
+    mu_assert(!folds_power(3, 40, &r), "3 ** 40 overflows");
+    mu_assert(!folds_power(2, INT64_MAX, &r), "2 ** INT64_MAX overflows");
+}
+
+MU_TEST(float_literal)
+{
+    /* main => 0.1, which has no exact float representation */
+    double tenth = 0.1;
+    ast_node_list_t *ast = list_of(create_fn(create_fn_proto("main", NULL),
+        list_of(create_float(tenth))));
+    ast_node_t *copy = copy_node(ast->node->fn.body->node);
+
+    mu_assert(memcmp(&copy->float_num.v, &tenth, sizeof(tenth)) == 0,
+              "the literal should stay a double in the ast");
+
+    eir_module_t *m = lower_ast("test", ast);
+    eir_instr_t *ret = eir_terminator(m->first->first);
+
+    mu_assert(ret->operands[0]->op == EIR_CONST_FLOAT,
+              "main should return a float constant");
+    mu_assert(memcmp(&ret->operands[0]->imm.f, &tenth, sizeof(tenth)) == 0,
+              "the constant should round-trip bit-exactly");
+
+    destroy_eir_module(m);
+    destroy_node(copy);
+    destroy_ast(ast);
+}
+
+/*
+ * struct Particle {
+ *     alive = 1 < 2
+ *     id
+ *     x = 0.0
+ *     visible = 1 < 2
+ *     name = "particle"
+ *     y = 0.0
+ * }
+ */
+static ast_node_list_t *particle(void)
+{
+    ast_node_list_t *fields = list_of(create_var("alive", false,
+        create_expr(&lt, create_int(1), create_int(2))));
+
+    append_node(fields, create_var("id", false, NULL));
+    append_node(fields, create_var("x", false, create_float(0.0)));
+    append_node(fields, create_var("visible", false,
+        create_expr(&lt, create_int(1), create_int(2))));
+    append_node(fields, create_var("name", false,
+                                   create_string("particle")));
+    append_node(fields, create_var("y", false, create_float(0.0)));
+
+    return list_of(create_struct("Particle", fields));
+}
+
+MU_TEST(lower_struct)
+{
+    ast_node_list_t *ast = particle();
+    eir_module_t *m = lower_ast("test", ast);
+
+    mu_assert(m != NULL, "Particle should be lowered");
+
+    eir_record_t *r = eir_lookup_record(m, "Particle");
+    eir_type_t types[] = {
+        EIR_BOOL, EIR_INT, EIR_FLOAT, EIR_BOOL, EIR_STRING, EIR_FLOAT
+    };
+
+    mu_assert(r && r->n_fields == 6, "Particle should have 6 fields");
+
+    for (size_t i = 0; i < 6; ++i)
+        mu_assert(r->types[i] == types[i], "fields should be typed");
+
+    destroy_eir_module(m);
+
+    /* naming a field twice is an error */
+    append_node(ast->node->struct_stmt.fields,
+                create_var("x", false, NULL));
+
+    mu_assert(lower_ast("test", ast) == NULL,
+              "duplicate fields should be rejected");
+
+    destroy_ast(ast);
+}
+
+MU_TEST(undefined_name)
+{
+    ast_node_list_t *ast = list_of(clause("f", x(),
+                                          create_var("y", false, NULL)));
+
+    mu_assert(lower_ast("test", ast) == NULL, "y should be undefined");
+
+    destroy_ast(ast);
+}
+
+MU_TEST_SUITE(test_suite)
+{
+    MU_RUN_TEST(builder);
+    MU_RUN_TEST(concat_types);
+    MU_RUN_TEST(lower_clauses);
+    MU_RUN_TEST(fold);
+    MU_RUN_TEST(fold_power);
+    MU_RUN_TEST(float_literal);
+    MU_RUN_TEST(undefined_name);
+    MU_RUN_TEST(lower_struct);
+}
+
+int main(int argc, char *argv[])
+{
+    MU_RUN_SUITE(test_suite);
+    MU_REPORT();
+
+    return 0;
+}
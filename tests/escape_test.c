@@ -0,0 +1,165 @@
+/*
+ * Copyright (C) 2015 soud
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "ast.h"
+#include "closure.h"
+#include "erupt.h"
+#include "escape.h"
+#include "minunit/minunit.h"
+#include "test_ast.h"
+
+static ast_node_t *print(ast_node_t *v)
+{
+    return create_call("IO.print", list_of(v));
+}
+
+/* [1, 2, ..., n] */
+static ast_node_t *list(int64_t n)
+{
+    ast_node_list_t *values = create_node_list();
+
+    for (int64_t i = 1; i <= n; ++i)
+        append_node(values, create_int(i));
+
+    return create_list(values);
+}
+
+/* name => l = v, then body */
+static ast_node_t *bind_then(const char *name, ast_node_t *v,
+                             ast_node_t *body)
+{
+    ast_node_list_t *nl = list_of(create_var("l", false, v));
+
+    append_node(nl, body);
+
+    return create_fn(create_fn_proto(name, NULL), nl);
+}
+
+MU_TEST(local)
+{
+    ast_node_t *l = list(3), *s = create_string("local");
+    ast_node_list_t *ast = list_of(bind_then("main", l, print(var("l"))));
+    ast_node_list_t *body = ast->node->fn.body;
+
+    append_node(body, print(s));
+    append_node(body, create_int(0));
+
+    /* string literals are never allocated, so they aren't counted */
+    mu_assert(analyze_escapes(ast) == 1,
+              "only the list should be allocated on the stack");
+    mu_assert(l->list.on_stack, "a printed list doesn't escape");
+
+    destroy_ast(ast);
+}
+
+MU_TEST(returned)
+{
+    ast_node_t *l = list(3), *k = list(3);
+    ast_node_list_t *ast = list_of(clause("main", NULL, l));
+
+    append_node(ast, bind_then("f", k, var("l")));
+
+    mu_assert(analyze_escapes(ast) == 0, "nothing should be on the stack");
+    mu_assert(!l->list.on_stack, "a returned literal escapes");
+    mu_assert(!k->list.on_stack,
+              "a literal bound to a returned name escapes");
+
+    destroy_ast(ast);
+}
+
+/* main => l = [1, 2, 3], k = fn y => l, apply(k, 0) */
+MU_TEST(captured)
+{
+    ast_node_t *l = list(3);
+    ast_node_list_t *params = list_of(var("f")), *args = list_of(var("k"));
+    ast_node_list_t *ast = list_of(create_fn(
+        create_fn_proto("apply", params),
+        list_of(create_call("f", list_of(var("x"))))
+    ));
+    ast_node_t *main_fn = bind_then("main", l, create_var("k", false,
+        create_lambda(list_of(var("y")), list_of(var("l")))));
+
+    append_node(params, x());
+    append_node(args, create_int(0));
+    append_node(main_fn->fn.body, create_call("apply", args));
+    append_node(ast, main_fn);
+
+    lift_lambdas(ast);
+    analyze_escapes(ast);
+
+    mu_assert(!l->list.on_stack,
+              "a literal captured by a closure outlives the function");
+
+    destroy_ast(ast);
+}
+
+/* keep x => x, drop x => 0, main => keep([1, 2, 3]), drop([1, 2, 3]), 0 */
+MU_TEST(passed)
+{
+    ast_node_t *kept = list(3), *dropped = list(3);
+    ast_node_list_t *ast = list_of(clause("keep", x(), x()));
+    ast_node_list_t *body = list_of(create_call("keep", list_of(kept)));
+
+    append_node(ast, clause("drop", x(), create_int(0)));
+    append_node(body, create_call("drop", list_of(dropped)));
+    append_node(body, create_int(0));
+    append_node(ast, create_fn(create_fn_proto("main", NULL), body));
+
+    analyze_escapes(ast);
+
+    mu_assert(!kept->list.on_stack,
+              "a literal passed to a parameter that escapes escapes");
+    mu_assert(dropped->list.on_stack,
+              "a literal passed to a parameter that doesn't escape doesn't");
+
+    destroy_ast(ast);
+}
+
+MU_TEST(too_large)
+{
+    ast_node_t *l = list(MAX_STACK_LIST_LENGTH + 1);
+    ast_node_list_t *ast = list_of(bind_then("main", l, print(var("l"))));
+
+    append_node(ast->node->fn.body, create_int(0));
+
+    mu_assert(analyze_escapes(ast) == 0, "nothing should be on the stack");
+    mu_assert(!l->list.on_stack, "lists over the limit go to the heap");
+
+    destroy_ast(ast);
+}
+
+MU_TEST_SUITE(test_suite)
+{
+    MU_RUN_TEST(local);
+    MU_RUN_TEST(returned);
+    MU_RUN_TEST(captured);
+    MU_RUN_TEST(passed);
+    MU_RUN_TEST(too_large);
+}
+
+int main(int argc, char *argv[])
+{
+    MU_RUN_SUITE(test_suite);
+    MU_REPORT();
+
+    return 0;
+}
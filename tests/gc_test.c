@@ -0,0 +1,209 @@
+/*
+ * Copyright (C) 2015 soud
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "minunit/minunit.h"
+#include "runtime.h"
+
+/* a string with the digits of n, too long to be short */
+static erupt_string_t *number(int64_t n)
+{
+    char digits[32];
+    int length = snprintf(digits, sizeof digits, "number %" PRId64, n);
+
+    return erupt_string_from(digits, length);
+}
+
+/* [n, "n", 2 ** 70 + n, [n]] */
+static int64_t item(int64_t n)
+{
+    int64_t words[4];
+
+    words[0] = ERUPT_TAG(n);
+    words[1] = ERUPT_REF(number(n));
+    words[2] = erupt_int_add(erupt_int_shl(ERUPT_TAG(1), ERUPT_TAG(70)),
+                             ERUPT_TAG(n));
+    words[3] = ERUPT_REF(erupt_list_from(words, 1));
+
+    return ERUPT_REF(erupt_list_from(words, 4));
+}
+
+static bool item_ok(int64_t v, int64_t n)
+{
+    int64_t expected = item(n);
+
+    return erupt_value_compare(v, expected) == 0;
+}
+
+static void make_garbage(uint64_t bytes)
+{
+    erupt_gc_stats_t stats;
+    uint64_t end;
+
+    erupt_gc_stats(&stats);
+    end = stats.allocated + bytes;
+
+    for (int64_t n = 0; stats.allocated < end; ++n) {
+        (void)item(n);
+
+        if (n % 1024 == 0)
+            erupt_gc_stats(&stats);
+    }
+}
+
+MU_TEST(allocate)
+{
+    char *s = erupt_gc_alloc(ERUPT_STRING, 13);
+    double *f = ERUPT_DEREF(erupt_float_box(2.5));
+
+    mu_assert(ERUPT_KIND(s) == ERUPT_STRING,
+              "the header should have the object's kind");
+    mu_assert((uintptr_t)s % 8 == 0, "objects should be aligned");
+    mu_assert(strlen(s) == 0 && (ERUPT_HEADER_OF(s) >> 16) >= 13,
+              "objects should be zeroed and have room for their size");
+    mu_assert(ERUPT_KIND(f) == ERUPT_FLOAT && *f == 2.5,
+              "boxed floats should hold their value");
+}
+
+/* only the outer list is on the stack, its tree and values are moved */
+MU_TEST(survive)
+{
+    erupt_list_t *l = erupt_list_transient(erupt_list_from(NULL, 0));
+    bool ok = true;
+
+    for (int64_t n = 0; n < 1000; ++n)
+        erupt_list_push(l, item(n));
+
+    erupt_list_persistent(l);
+    erupt_gc_collect(false);
+    make_garbage(16 << 20);
+
+    for (int64_t n = 0; n < 1000; ++n)
+        ok = ok && item_ok(erupt_list_get(l, n), n);
+
+    mu_assert(ok, "values should survive a minor collection");
+
+    erupt_gc_collect(true);
+    make_garbage(16 << 20);
+
+    for (int64_t n = 0; n < 1000; ++n)
+        ok = ok && item_ok(erupt_list_get(l, n), n);
+
+    mu_assert(ok, "values should survive a major collection");
+}
+
+/* a transient changes its nodes in place after they were promoted */
+MU_TEST(transient)
+{
+    erupt_list_t *l = erupt_list_transient(erupt_list_from(NULL, 0));
+    bool ok = true;
+
+    for (int64_t n = 0; n < 4096; ++n)
+        erupt_list_push(l, ERUPT_TAG(n));
+
+    erupt_gc_collect(false);
+
+    for (int64_t n = 0; n < 4096; ++n)
+        erupt_list_set(l, n, ERUPT_REF(number(n)));
+
+    make_garbage(16 << 20);
+
+    for (int64_t n = 0; n < 4096; ++n) {
+        erupt_string_t *expected = number(n);
+
+        ok = ok && erupt_string_compare(ERUPT_DEREF(erupt_list_get(l, n)),
+                                        expected) == 0;
+    }
+
+    mu_assert(ok, "young values in old nodes should be kept");
+}
+
+MU_TEST(reclaim)
+{
+    erupt_gc_stats_t before, after;
+
+    erupt_gc_stats(&before);
+    make_garbage(256 << 20);
+    erupt_gc_stats(&after);
+
+    mu_assert(after.promoted - before.promoted < 1 << 20,
+              "garbage shouldn't be promoted");
+    mu_assert(after.minor > before.minor, "the nursery should be collected");
+    mu_assert(after.heap < 4 * ERUPT_MIN_HEAP_SIZE,
+              "the heap shouldn't grow with garbage");
+}
+
+static void *allocate_and_exit(void *arg)
+{
+    (void)arg;
+    make_garbage(1 << 20);
+
+    return NULL;
+}
+
+/* joining waits for a thread that collects, it mustn't wait for us */
+static void join(void *thread)
+{
+    pthread_join(*(pthread_t *)thread, NULL);
+}
+
+/* a thread that exited can't be waited for by the next collection */
+MU_TEST(thread_exit)
+{
+    erupt_gc_stats_t before, after;
+    pthread_t thread;
+
+    erupt_gc_stats(&before);
+
+    for (int i = 0; i < 4; ++i) {
+        pthread_create(&thread, NULL, allocate_and_exit, NULL);
+        erupt_gc_blocking(join, &thread);
+    }
+
+    erupt_gc_collect(false);
+    erupt_gc_stats(&after);
+
+    mu_assert(after.threads == before.threads,
+              "threads should be unregistered when they exit");
+    mu_assert(after.minor > before.minor, "the collection should finish");
+}
+
+MU_TEST_SUITE(test_suite)
+{
+    MU_RUN_TEST(allocate);
+    MU_RUN_TEST(survive);
+    MU_RUN_TEST(transient);
+    MU_RUN_TEST(reclaim);
+    MU_RUN_TEST(thread_exit);
+}
+
+int main(int argc, char *argv[])
+{
+    MU_RUN_SUITE(test_suite);
+    MU_REPORT();
+
+    return 0;
+}
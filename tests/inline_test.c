@@ -0,0 +1,281 @@
+/*
+ * Copyright (C) 2015 soud
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "ast.h"
+#include "erupt.h"
+#include "inline.h"
+#include "minunit/minunit.h"
+#include "test_ast.h"
+
+static ast_operator_t plus = { PLUS, 10, ASSOC_LEFT, false };
+static ast_operator_t pipe_op = { PIPE, 1, ASSOC_LEFT, false };
+
+/* inc x => x + 1 */
+static ast_node_t *inc_fn(void)
+{
+    return create_fn(
+        create_fn_proto("inc", list_of(create_var("x", false, NULL))),
+        list_of(create_expr(&plus, create_var("x", false, NULL),
+                            create_int(1)))
+    );
+}
+
+/* loop x => loop(x) */
+static ast_node_t *loop_fn(void)
+{
+    return create_fn(
+        create_fn_proto("loop", list_of(create_var("x", false, NULL))),
+        list_of(create_call("loop", list_of(create_var("x", false, NULL))))
+    );
+}
+
+static ast_node_t *main_fn(ast_node_t *body)
+{
+    return create_fn(create_fn_proto("main", NULL), list_of(body));
+}
+
+MU_TEST(small_function)
+{
+    ast_node_list_t *ast = list_of(inc_fn());
+    ast_node_t *main = main_fn(create_call("inc", list_of(create_int(41))));
+
+    append_node(ast, main);
+
+    mu_assert(inline_functions(ast, DEFAULT_INLINE_THRESHOLD) == 1,
+              "call to inc should be inlined");
+
+    ast_node_t *body = main->fn.body->node;
+
+    mu_assert(body->type == TYPE_EXPR, "inlined body should be an expr");
+    mu_assert(body->expr.lhs->type == TYPE_INT, "x should be substituted");
+    mu_assert(body->expr.lhs->int_num.v == 41, "x should be 41");
+
+    destroy_ast(ast);
+}
+
+MU_TEST(pipe)
+{
+    ast_node_list_t *ast = list_of(inc_fn());
+    ast_node_t *main = main_fn(create_expr(&pipe_op, create_int(1),
+                                           create_call("inc", NULL)));
+
+    append_node(ast, main);
+
+    mu_assert(inline_functions(ast, DEFAULT_INLINE_THRESHOLD) == 1,
+              "piped call to inc should be inlined");
+    mu_assert(main->fn.body->node->expr.operator == &plus,
+              "pipe should be replaced by the body of inc");
+
+    destroy_ast(ast);
+}
+
+MU_TEST(recursive_function)
+{
+    ast_node_list_t *ast = list_of(loop_fn());
+
+    append_node(ast, main_fn(create_call("loop", list_of(create_int(1)))));
+
+    mu_assert(inline_functions(ast, DEFAULT_INLINE_THRESHOLD) == 0,
+              "recursive functions should never be inlined");
+
+    destroy_ast(ast);
+}
+
+static ast_node_t *print(int64_t n)
+{
+    return create_call("IO.print", list_of(create_int(n)));
+}
+
+/* twice x => x + x */
+static ast_node_t *twice_fn(void)
+{
+    return create_fn(create_fn_proto("twice", list_of(x())),
+                     list_of(create_expr(&plus, x(), x())));
+}
+
+/* whether node binds a temporary to a call to IO.print(n) */
+static bool binds_print(ast_node_t *node, int64_t n)
+{
+    return node->type == TYPE_VAR && node->var.v &&
+           node->var.v->type == TYPE_CALL &&
+           node->var.v->call.args->node->int_num.v == n;
+}
+
+MU_TEST(duplicated_call)
+{
+    /* called as twice(IO.print(1)) */
+    ast_node_list_t *ast = list_of(twice_fn());
+    ast_node_t *main = main_fn(create_call("twice", list_of(print(1))));
+
+    append_node(ast, main);
+
+    mu_assert(inline_functions(ast, DEFAULT_INLINE_THRESHOLD) == 1,
+              "twice should be inlined");
+
+    ast_node_list_t *body = main->fn.body;
+    ast_node_t *sum = body->next->node;
+
+    mu_assert(binds_print(body->node, 1),
+              "the call should be bound to a temporary");
+    mu_assert(sum->type == TYPE_EXPR && sum->expr.lhs->type == TYPE_VAR &&
+              sum->expr.rhs->type == TYPE_VAR,
+              "calls in arguments should never be duplicated");
+
+    destroy_ast(ast);
+}
+
+MU_TEST(nested_call)
+{
+    /* called as 1 + twice(IO.print(1)), which can't bind a temporary */
+    ast_node_list_t *ast = list_of(twice_fn());
+
+    append_node(ast, main_fn(create_expr(&plus, create_int(1),
+        create_call("twice", list_of(print(1))))));
+
+    mu_assert(inline_functions(ast, DEFAULT_INLINE_THRESHOLD) == 0,
+              "arguments should only be bound before a whole statement");
+
+    destroy_ast(ast);
+}
+
+MU_TEST(argument_order)
+{
+    /* second x y => y + x, called as second(IO.print(1), IO.print(2)) */
+    ast_node_list_t *params = list_of(x()), *args = list_of(print(1));
+
+    append_node(params, var("y"));
+    append_node(args, print(2));
+
+    ast_node_list_t *ast = list_of(create_fn(
+        create_fn_proto("second", params),
+        list_of(create_expr(&plus, var("y"), x()))));
+    ast_node_t *main = main_fn(create_call("second", args));
+
+    append_node(ast, main);
+
+    mu_assert(inline_functions(ast, DEFAULT_INLINE_THRESHOLD) == 1,
+              "second should be inlined");
+
+    ast_node_list_t *body = main->fn.body;
+
+    ast_node_t *sum = body->next->node;
+
+    /* IO.print(2) is still evaluated after the temporary is bound */
+    mu_assert(binds_print(body->node, 1) && sum->type == TYPE_EXPR &&
+              sum->expr.lhs->type == TYPE_CALL,
+              "arguments used out of order should be evaluated in order");
+
+    destroy_ast(ast);
+}
+
+MU_TEST(conditional_use)
+{
+    /* when x => if 1 then x else 0, called as when(IO.print(1)) */
+    ast_node_list_t *ast = list_of(create_fn(
+        create_fn_proto("when", list_of(x())),
+        list_of(create_if(create_int(1), list_of(x()),
+                          list_of(create_int(0))))));
+    ast_node_t *main = main_fn(create_call("when", list_of(print(1))));
+
+    append_node(ast, main);
+
+    mu_assert(inline_functions(ast, DEFAULT_INLINE_THRESHOLD) == 1,
+              "when should be inlined");
+    mu_assert(binds_print(main->fn.body->node, 1) &&
+              main->fn.body->next->node->type == TYPE_IF,
+              "arguments used in a branch should be evaluated before it");
+
+    destroy_ast(ast);
+}
+
+MU_TEST(in_order)
+{
+    /* called as inc(IO.print(1)), x is used once and first */
+    ast_node_list_t *ast = list_of(inc_fn());
+    ast_node_t *main = main_fn(create_call("inc", list_of(print(1))));
+
+    append_node(ast, main);
+
+    mu_assert(inline_functions(ast, DEFAULT_INLINE_THRESHOLD) == 1,
+              "inc should be inlined");
+    mu_assert(!main->fn.body->next &&
+              main->fn.body->node->expr.lhs->type == TYPE_CALL,
+              "an argument used once in order should be substituted");
+
+    destroy_ast(ast);
+}
+
+MU_TEST(threshold)
+{
+    ast_node_list_t *ast = list_of(inc_fn());
+
+    append_node(ast, main_fn(create_call("inc", list_of(create_int(1)))));
+
+    mu_assert(inline_functions(ast, 0) == 0,
+              "a threshold of 0 should disable inlining");
+    mu_assert(inline_functions(ast, 1) == 0,
+              "inc should be too expensive for a threshold of 1");
+
+    destroy_ast(ast);
+}
+
+MU_TEST(nested_binding)
+{
+    /* pick x => if x then y = 1; y + x else x, called as pick(y) */
+    ast_node_list_t *ast = list_of(create_fn(
+        create_fn_proto("pick", list_of(x())),
+        list_of(create_if(x(), list_of(create_var("y", false,
+                                                  create_int(1))),
+                            list_of(x())))
+    ));
+    ast_node_t *then = ast->node->fn.body->node;
+
+    append_node(then->if_expr.true_body, create_expr(&plus, var("y"), x()));
+    append_node(ast, main_fn(create_call("pick", list_of(var("y")))));
+
+    mu_assert(inline_functions(ast, DEFAULT_INLINE_THRESHOLD) == 0,
+              "bodies that bind names should never be inlined");
+
+    destroy_ast(ast);
+}
+
+MU_TEST_SUITE(test_suite)
+{
+    MU_RUN_TEST(small_function);
+    MU_RUN_TEST(pipe);
+    MU_RUN_TEST(recursive_function);
+    MU_RUN_TEST(duplicated_call);
+    MU_RUN_TEST(nested_call);
+    MU_RUN_TEST(argument_order);
+    MU_RUN_TEST(conditional_use);
+    MU_RUN_TEST(in_order);
+    MU_RUN_TEST(threshold);
+    MU_RUN_TEST(nested_binding);
+}
+
+int main(int argc, char *argv[])
+{
+    MU_RUN_SUITE(test_suite);
+    MU_REPORT();
+
+    return 0;
+}
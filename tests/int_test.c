@@ -0,0 +1,220 @@
+/*
+ * Copyright (C) 2015 soud
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "bytecode.h"
+#include "eir.h"
+#include "erupt.h"
+#include "jit.h"
+#include "minunit/minunit.h"
+#include "runtime.h"
+#include "vm.h"
+
+static int64_t big(int64_t base, int64_t exp)
+{
+    return erupt_int_pow(ERUPT_TAG(base), ERUPT_TAG(exp));
+}
+
+static bool equals(int64_t v, const char *expected)
+{
+    char *s = erupt_int_to_string(v);
+    bool ok = strcmp(s, expected) == 0;
+
+    free(s);
+
+    return ok;
+}
+
+MU_TEST(arithmetic)
+{
+    int64_t two_100 = big(2, 100);
+    int64_t max = ERUPT_TAG(ERUPT_INT_MAX), one = ERUPT_TAG(1);
+
+    mu_assert(equals(two_100, "1267650600228229401496703205376"),
+              "2 ** 100 should be a bignum");
+    mu_assert(!ERUPT_IS_SMALL(erupt_int_add(max, one)),
+              "the largest small int plus 1 should be a bignum");
+    mu_assert(erupt_int_sub(erupt_int_add(max, one), one) == max,
+              "results that fit should be small again");
+    mu_assert(erupt_int_div(two_100, big(2, 50)) == big(2, 50),
+              "2 ** 100 / 2 ** 50 should be 2 ** 50");
+    mu_assert(equals(erupt_int_mod(erupt_int_neg(two_100), ERUPT_TAG(7)),
+                     "-2"), "the remainder should have the dividend's sign");
+    mu_assert(erupt_int_compare(erupt_int_neg(two_100), max) < 0,
+              "bignums should be ordered with small ints");
+    mu_assert(equals(erupt_int_from_int64(INT64_MIN), "-9223372036854775808"),
+              "int64s should convert exactly");
+}
+
+/* (10 ** 400 - 1) ** 2 is 399 nines, an eight, 399 zeros and a one */
+MU_TEST(karatsuba)
+{
+    int64_t v = erupt_int_sub(big(10, 400), ERUPT_TAG(1));
+    char expected[801];
+
+    memset(expected, '9', 399);
+    expected[399] = '8';
+    memset(expected + 400, '0', 399);
+    expected[799] = '1';
+    expected[800] = '\0';
+
+    mu_assert(equals(erupt_int_mul(v, v), expected),
+              "large products should be exact");
+}
+
+MU_TEST(bitwise)
+{
+    int64_t two_70 = big(2, 70);
+
+    mu_assert(erupt_int_compare(erupt_int_and(ERUPT_TAG(-1), two_70),
+                                two_70) == 0, "-1 & v should be v");
+    mu_assert(equals(erupt_int_not(two_70), "-1180591620717411303425"),
+              "~v should be -v - 1");
+    mu_assert(erupt_int_shr(two_70, ERUPT_TAG(70)) == ERUPT_TAG(1),
+              "shifting right should shift out the low bits");
+    mu_assert(erupt_int_shr(erupt_int_neg(two_70), ERUPT_TAG(71)) ==
+              ERUPT_TAG(-1), "shifting right should round down");
+    mu_assert(erupt_int_compare(erupt_int_shl(ERUPT_TAG(1), ERUPT_TAG(70)),
+                                two_70) == 0,
+              "shifting left shouldn't lose bits");
+}
+
+/*
+ * main => n, acc = 25, 1, then while n != 0: acc, n = acc * n, n - 1, and
+ * 25! % 251. 25! doesn't fit in 64 bits, wrapping would give 137 or 206.
+ */
+static eir_module_t *factorial(void)
+{
+    eir_module_t *m = create_eir_module("test");
+    eir_fn_t *fn = eir_add_fn(m, "main", 0);
+    eir_block_t *entry = eir_add_block(fn), *loop = eir_add_block(fn),
+                *done = eir_add_block(fn);
+    eir_builder_t b = { fn, entry, 0 };
+
+    fn->ret = EIR_INT;
+
+    eir_instr_t *zero = eir_const_int(&b, 0), *one = eir_const_int(&b, 1),
+                *n0 = eir_const_int(&b, 25), *prime = eir_const_int(&b, 251);
+
+    eir_br(&b, loop);
+
+    b.block = loop;
+    eir_instr_t *n = eir_phi(&b, EIR_INT), *acc = eir_phi(&b, EIR_INT);
+    eir_instr_t *product = eir_binop(&b, STAR, acc, n);
+    eir_instr_t *left = eir_binop(&b, MIN, n, one);
+
+    eir_condbr(&b, eir_binop(&b, BANG_EQ, left, zero), loop, done);
+
+    eir_add_incoming(n, n0, entry);
+    eir_add_incoming(n, left, loop);
+    eir_add_incoming(acc, one, entry);
+    eir_add_incoming(acc, product, loop);
+
+    b.block = done;
+    eir_ret(&b, eir_binop(&b, MOD, product, prime));
+
+    return m;
+}
+
+MU_TEST(overflow_to_bignum)
+{
+    eir_module_t *m = factorial();
+    vm_program_t *p;
+    int status = -1;
+
+    mu_assert(verify_eir_module(m), "the loop should be valid EIR");
+
+    p = lower_bytecode(m);
+    mu_assert(p && run_vm(p, &status), "the VM should run the loop");
+    mu_assert(status == 168, "the VM should give 25! % 251");
+    destroy_bytecode(p);
+
+    status = -1;
+    mu_assert(run_jit(m, 2, false, false, &status),
+              "the JIT should run the loop");
+    mu_assert(status == 168, "the JIT should give 25! % 251");
+
+    destroy_eir_module(m);
+}
+
+/* main => (0x1_0000_0000_0000_0000 - 9223372036854775808) % 1000 */
+static eir_module_t *big_literals(void)
+{
+    eir_module_t *m = create_eir_module("test");
+    eir_fn_t *fn = eir_add_fn(m, "main", 0);
+    eir_builder_t b = { fn, eir_add_block(fn), 0 };
+
+    fn->ret = EIR_INT;
+
+    eir_instr_t *two_64 = eir_const_bignum(&b, "0x10000000000000000");
+    eir_instr_t *two_63 = eir_const_bignum(&b, "9223372036854775808");
+    eir_instr_t *diff = eir_binop(&b, MIN, two_64, two_63);
+
+    eir_ret(&b, eir_binop(&b, MOD, diff, eir_const_int(&b, 1000)));
+
+    return m;
+}
+
+MU_TEST(literals)
+{
+    eir_module_t *m = big_literals();
+    vm_program_t *p;
+    int status = -1;
+
+    mu_assert(equals(erupt_int_parse("9223372036854775808"),
+                     "9223372036854775808"), "INT64_MAX + 1 should parse");
+    mu_assert(erupt_int_compare(erupt_int_parse("0x400000000000000000"),
+                                big(2, 70)) == 0, "hex digits should parse");
+    mu_assert(erupt_int_parse("0b11111111") == ERUPT_TAG(255),
+              "literals that fit should be small");
+
+    p = lower_bytecode(m);
+    mu_assert(p && run_vm(p, &status), "the VM should run main");
+    mu_assert(status == 808, "the VM should load bignum literals");
+    destroy_bytecode(p);
+
+    status = -1;
+    mu_assert(run_jit(m, 2, false, false, &status),
+              "the JIT should run main");
+    mu_assert(status == 808, "the JIT should load bignum literals");
+
+    destroy_eir_module(m);
+}
+
+MU_TEST_SUITE(test_suite)
+{
+    MU_RUN_TEST(arithmetic);
+    MU_RUN_TEST(karatsuba);
+    MU_RUN_TEST(bitwise);
+    MU_RUN_TEST(overflow_to_bignum);
+    MU_RUN_TEST(literals);
+}
+
+int main(int argc, char *argv[])
+{
+    MU_RUN_SUITE(test_suite);
+    MU_REPORT();
+
+    return 0;
+}
@@ -0,0 +1,155 @@
+/*
+ * Copyright (C) 2015 soud
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "erupt.h"
+#include "minunit/minunit.h"
+#include "runtime.h"
+
+static FILE *file;
+static int saved_stdout;
+
+/* send the output of the IO module to a file */
+static void capture(void)
+{
+    fflush(stdout);
+    file = tmpfile();
+    saved_stdout = dup(STDOUT_FILENO);
+    dup2(fileno(file), STDOUT_FILENO);
+}
+
+/* the size of what was written to the file so far */
+static off_t written(void)
+{
+    struct stat st;
+
+    fstat(fileno(file), &st);
+
+    return st.st_size;
+}
+
+/* stop capturing and read what was written into buf */
+static void release(char *buf, size_t size)
+{
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(saved_stdout);
+
+    rewind(file);
+    buf[fread(buf, 1, size - 1, file)] = '\0';
+    fclose(file);
+}
+
+MU_TEST(buffered)
+{
+    char buf[64];
+    int64_t values[] = { ERUPT_TAG(1), ERUPT_TAG(-2), ERUPT_TAG(3) };
+    erupt_list_t *l = erupt_list_from(values, 3);
+
+    capture();
+
+    erupt_print_int(ERUPT_TAG(42));
+    erupt_print_bool(false);
+    erupt_print_string(erupt_string_from("erupt", 5));
+    erupt_print_list(l);
+
+    mu_assert(written() == 0, "output should stay in the buffer");
+
+    erupt_io_flush();
+
+    mu_assert(written() > 0, "IO.flush should write the buffer");
+
+    release(buf, sizeof(buf));
+
+    mu_assert(strcmp(buf, "42\nfalse\nerupt\n[1, -2, 3]\n") == 0,
+              "output should be written in order");
+}
+
+MU_TEST(full_buffer)
+{
+    static char buf[ERUPT_IO_BUFFER_SIZE * 4];
+    char expected[32];
+    size_t length = 0;
+
+    capture();
+
+    for (int64_t i = 0; length < ERUPT_IO_BUFFER_SIZE * 2; ++i) {
+        erupt_print_int(ERUPT_TAG(i * 1000003));
+        length += (size_t)sprintf(expected, "%lld\n", (long long)i * 1000003);
+    }
+
+    mu_assert(written() > 0, "a full buffer should be written");
+
+    erupt_io_flush();
+    release(buf, sizeof(buf));
+
+    mu_assert(strlen(buf) == length, "nothing should be lost");
+    mu_assert(strncmp(buf + length - strlen(expected), expected,
+                      strlen(expected)) == 0, "the last line should be last");
+}
+
+MU_TEST(numbers)
+{
+    double floats[] = {
+        0.0, -0.0, 1.0, -2.5, 0.1, 1.0 / 3, 11005.45, 999999.5, 1e6, 1e-5,
+        0.0001, 123456789.0, 1.5e300, 5e-324, 1.0 / 0.0, -1.0 / 0.0
+    };
+    int64_t ints[] = { 0, -1, INT64_MAX, INT64_MIN };
+    char buf[512], expected[512];
+    size_t length = 0;
+
+    capture();
+
+    for (size_t i = 0; i < sizeof(floats) / sizeof(floats[0]); ++i) {
+        erupt_print_float(floats[i]);
+        length += (size_t)sprintf(expected + length, "%g\n", floats[i]);
+    }
+
+    for (size_t i = 0; i < sizeof(ints) / sizeof(ints[0]); ++i) {
+        erupt_print_int(erupt_int_from_int64(ints[i]));
+        length += (size_t)sprintf(expected + length, "%lld\n",
+                                  (long long)ints[i]);
+    }
+
+    erupt_io_flush();
+    release(buf, sizeof(buf));
+
+    mu_assert(strcmp(buf, expected) == 0, "numbers should print like printf");
+}
+
+MU_TEST_SUITE(test_suite)
+{
+    MU_RUN_TEST(buffered);
+    MU_RUN_TEST(full_buffer);
+    MU_RUN_TEST(numbers);
+}
+
+int main(int argc, char *argv[])
+{
+    MU_RUN_SUITE(test_suite);
+    MU_REPORT();
+
+    return 0;
+}
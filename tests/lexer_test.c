@@ -65,10 +65,79 @@ MU_TEST(comments)
     destroy_lexer(lexer);
 }
 
+MU_TEST(numbers)
+{
+    lexer_t *lexer = lex("test", "1_000_000 0xff_ff 0b1010 9223372036854775807 "
+                                 "0.1 3.14e2 1e-5 2.5E+3 0.30000000000000004 "
+                                 "1.7976931348623157e308 1.x");
+    int64_t ints[] = { 1000000, 0xffff, 10, INT64_MAX };
+    double floats[] = { 0.1, 314.0, 1e-5, 2500.0, 0.30000000000000004,
+                        1.7976931348623157e308 };
+    token_t *t = lexer->tokens;
+
+    mu_assert(!lexer->failed, "the numbers should be valid");
+
+    for (size_t i = 0; i < sizeof(ints) / sizeof(ints[0]); ++i, t = t->next) {
+        mu_assert(is(t, INT), "expected an int");
+        mu_assert(t->number.i == ints[i], "the int should be converted");
+    }
+
+    for (size_t i = 0; i < sizeof(floats) / sizeof(floats[0]);
+         ++i, t = t->next) {
+        mu_assert(is(t, FLOAT), "expected a float");
+        mu_assert(t->number.f == floats[i], "the float should be exact");
+    }
+
+    /* a dot only belongs to a number if a digit follows */
+    mu_assert(is(t, INT) && is(t->next, DOT) && is(t->next->next, IDENT),
+              "1.x should be 1, . and x");
+
+    destroy_lexer(lexer);
+}
+
+MU_TEST(big_numbers)
+{
+    lexer_t *lexer = lex("test", "9223372036854775808 0x1_0000_0000_0000_0000 "
+                                 "9223372036854775807");
+    token_t *t = lexer->tokens;
+
+    mu_assert(!lexer->failed, "ints outside int64 should be valid");
+    mu_assert(is(t, INT) && t->big &&
+              strcmp(t->big, "9223372036854775808") == 0,
+              "INT64_MAX + 1 should keep its digits");
+    mu_assert(is(t->next, INT) && t->next->big &&
+              strcmp(t->next->big, "0x10000000000000000") == 0,
+              "the digits should be kept without underscores");
+    mu_assert(is(t->next->next, INT) && !t->next->next->big,
+              "INT64_MAX should fit");
+
+    destroy_lexer(lexer);
+}
+
+MU_TEST(malformed_numbers)
+{
+    const char *sources[] = {
+        "1.2.3", "12ab", "0x", "0b102", "1__0", "1_", "1e", "1e400"
+    };
+
+    for (size_t i = 0; i < sizeof(sources) / sizeof(sources[0]); ++i) {
+        lexer_t *lexer = lex("test", sources[i]);
+
+        mu_assert(lexer->failed, "the number should be rejected");
+        mu_assert(is(lexer->tokens, ERROR) && is(lexer->tokens->next, _EOF),
+                  "the whole literal should be one error");
+
+        destroy_lexer(lexer);
+    }
+}
+
 MU_TEST_SUITE(test_suite)
 {
     MU_RUN_TEST(tokens);
     MU_RUN_TEST(comments);
+    MU_RUN_TEST(numbers);
+    MU_RUN_TEST(big_numbers);
+    MU_RUN_TEST(malformed_numbers);
 }
 
 int main(int argc, char *argv[])
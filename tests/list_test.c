@@ -0,0 +1,134 @@
+/*
+ * Copyright (C) 2015 soud
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+
+#include "minunit/minunit.h"
+#include "runtime.h"
+
+/* [from, from + 1, ..., to - 1] pushed one at a time onto l */
+static erupt_list_t *range(erupt_list_t *l, int64_t from, int64_t to)
+{
+    for (int64_t i = from; i < to; ++i)
+        l = erupt_list_push(l, ERUPT_TAG(i));
+
+    return l;
+}
+
+/* whether the values of l are first, first + 1, ... */
+static bool counts_from(const erupt_list_t *l, int64_t first)
+{
+    for (int64_t i = 0; i < erupt_list_length(l); ++i) {
+        if (erupt_list_get(l, i) != ERUPT_TAG(first + i))
+            return false;
+    }
+
+    return true;
+}
+
+MU_TEST(persistent)
+{
+    int64_t values[3] = { ERUPT_TAG(1), ERUPT_TAG(2), ERUPT_TAG(3) };
+    erupt_list_t *small = erupt_list_from(values, 3);
+    erupt_list_t *l = range(erupt_list_from(NULL, 0), 0, 10000);
+    erupt_list_t *set = erupt_list_set(l, 5000, ERUPT_TAG(-1));
+    erupt_list_t *pushed = erupt_list_push(l, ERUPT_TAG(10000));
+
+    mu_assert(erupt_list_length(small) == 3
+              && erupt_list_get(small, 2) == ERUPT_TAG(3),
+              "lists should hold the values they're made from");
+    mu_assert(erupt_list_length(l) == 10000 && counts_from(l, 0),
+              "pushing should append values");
+    mu_assert(erupt_list_get(set, 5000) == ERUPT_TAG(-1)
+              && erupt_list_get(l, 5000) == ERUPT_TAG(5000),
+              "setting a value should leave the list as it was");
+    mu_assert(erupt_list_length(pushed) == 10001 && counts_from(pushed, 0)
+              && erupt_list_length(l) == 10000,
+              "pushing should leave the list as it was");
+}
+
+MU_TEST(concat)
+{
+    erupt_list_t *empty = erupt_list_from(NULL, 0);
+    erupt_list_t *l = empty;
+
+    /* uneven pieces leave nodes that aren't full in the middle */
+    for (int64_t i = 0, n = 1; i < 100000; i += n, n = n * 7 % 997 + 1)
+        l = erupt_list_concat(l, range(empty, i, i + n));
+
+    mu_assert(counts_from(l, 0), "concatenation should keep the order");
+    mu_assert(erupt_list_length(erupt_list_concat(l, empty))
+              == erupt_list_length(l), "[] should be the identity");
+
+    erupt_list_t *middle = erupt_list_slice(l, 12345, 87654);
+    erupt_list_t *joined = erupt_list_concat(erupt_list_slice(l, 0, 12345),
+                                             middle);
+
+    mu_assert(erupt_list_length(middle) == 87654 - 12345
+              && counts_from(middle, 12345), "slices should be views");
+    mu_assert(counts_from(erupt_list_set(middle, 0, ERUPT_TAG(12345)), 12345)
+              && counts_from(range(middle, 87654, 90000), 12345),
+              "slices should be lists like any other");
+    mu_assert(erupt_list_compare(joined, erupt_list_slice(l, 0, 87654)) == 0,
+              "slices should concatenate back");
+    mu_assert(erupt_list_compare(middle, l) > 0
+              && erupt_list_compare(joined, l) < 0,
+              "lists should be ordered like strings");
+}
+
+MU_TEST(transient)
+{
+    erupt_list_t *l = range(erupt_list_from(NULL, 0), 0, 1000);
+    erupt_list_t *t = erupt_list_transient(l);
+    bool in_place = true;
+
+    for (int64_t i = 1000; i < 5000; ++i)
+        in_place &= erupt_list_push(t, ERUPT_TAG(i)) == t;
+
+    for (int64_t i = 0; i < 5000; ++i)
+        erupt_list_set(t, i, ERUPT_TAG(i + 1));
+
+    erupt_list_t *p = erupt_list_persistent(t);
+
+    mu_assert(in_place, "transients should change in place");
+    mu_assert(erupt_list_length(l) == 1000 && counts_from(l, 0),
+              "the list a transient was made from should stay the same");
+    mu_assert(erupt_list_length(p) == 5000 && counts_from(p, 1),
+              "transients should keep the changes");
+    mu_assert(erupt_list_push(p, ERUPT_TAG(0)) != p,
+              "persistent lists should be copied again");
+}
+
+MU_TEST_SUITE(test_suite)
+{
+    MU_RUN_TEST(persistent);
+    MU_RUN_TEST(concat);
+    MU_RUN_TEST(transient);
+}
+
+int main(int argc, char *argv[])
+{
+    MU_RUN_SUITE(test_suite);
+    MU_REPORT();
+
+    return 0;
+}
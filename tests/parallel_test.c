@@ -0,0 +1,189 @@
+/*
+ * Copyright (C) 2015 soud
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+
+#include "ast.h"
+#include "erupt.h"
+#include "jit.h"
+#include "lower.h"
+#include "minunit/minunit.h"
+#include "parallel.h"
+#include "passes.h"
+#include "test_ast.h"
+
+/* 2^62, the smallest int that doesn't fit in a tagged word */
+#define BIG INT64_C(4611686018427387904)
+
+static ast_operator_t plus = { PLUS, 10, ASSOC_LEFT, false };
+static ast_operator_t minus = { MIN, 10, ASSOC_LEFT, false };
+static ast_operator_t slash = { SLASH, 20, ASSOC_LEFT, false };
+static ast_operator_t and_op = { AND, 5, ASSOC_LEFT, false };
+static ast_operator_t or_op = { OR, 4, ASSOC_LEFT, false };
+static ast_operator_t pipe_op = { PIPE, 1, ASSOC_LEFT, false };
+
+/* fib(x - n) */
+static ast_node_t *fib_call(int64_t n)
+{
+    return create_call("fib", list_of(create_expr(&minus, x(),
+                                                  create_int(n))));
+}
+
+/*
+ * fib 0 => zero, fib 1 => one, fib x => fib(x - 1) + fib(x - 2), then f x
+ * => body. the sum is the last node.
+ */
+static ast_node_list_t *fib(ast_node_t *zero, ast_node_t *one,
+                            ast_node_t *body)
+{
+    ast_node_list_t *ast = list_of(clause("fib", create_int(0), zero));
+
+    append_node(ast, clause("fib", create_int(1), one));
+    append_node(ast, clause("fib", x(), create_expr(&plus, fib_call(1),
+                                                    fib_call(2))));
+
+    if (body)
+        append_node(ast, clause("f", x(), body));
+
+    return ast;
+}
+
+static ast_node_t *sum_of(ast_node_list_t *ast)
+{
+    return ast->next->next->node->fn.body->node;
+}
+
+MU_TEST(recursive_calls)
+{
+    ast_node_list_t *ast = fib(create_int(0), create_int(1), NULL);
+
+    mu_assert(parallelize_exprs(ast) == 1,
+              "fib(x - 1) + fib(x - 2) should be evaluated in parallel");
+    mu_assert(sum_of(ast)->expr.parallel, "the sum should be marked");
+
+    destroy_ast(ast);
+}
+
+MU_TEST(impure_calls)
+{
+    ast_node_list_t *ast = fib(create_call("IO.print",
+                                           list_of(create_int(0))),
+                               create_int(1), NULL);
+
+    mu_assert(parallelize_exprs(ast) == 0 && !sum_of(ast)->expr.parallel,
+              "calls that print can't be evaluated in parallel");
+
+    destroy_ast(ast);
+}
+
+MU_TEST(dependent_operands)
+{
+    ast_operator_t *ops[] = { &and_op, &or_op };
+
+    for (size_t i = 0; i < 2; ++i) {
+        ast_node_list_t *ast = fib(create_int(0), create_int(1),
+                                   create_expr(ops[i], fib_call(1),
+                                               fib_call(2)));
+
+        /* fib itself is still marked */
+        mu_assert(parallelize_exprs(ast) == 1,
+                  "the rhs of && and || is evaluated conditionally");
+
+        destroy_ast(ast);
+    }
+
+    ast_node_list_t *ast = fib(create_int(0), create_int(1),
+                               create_expr(&pipe_op, fib_call(1),
+                                           var("fib")));
+
+    mu_assert(parallelize_exprs(ast) == 1,
+              "the rhs of |> takes the value of the lhs");
+
+    destroy_ast(ast);
+}
+
+MU_TEST(lhs_not_a_call)
+{
+    ast_node_list_t *ast = fib(create_int(0), create_int(1),
+                               create_expr(&plus,
+                                           create_expr(&plus, x(),
+                                                       fib_call(1)),
+                                           fib_call(2)));
+
+    mu_assert(parallelize_exprs(ast) == 1,
+              "only a call can be evaluated in a task");
+
+    destroy_ast(ast);
+}
+
+/*
+ * fib 0 => 2^62, fib 1 => 2^62, main => fib(25) / 2^62. every sum is a
+ * bignum, the tasks allocate while other threads collect.
+ */
+MU_TEST(fork_join)
+{
+    ast_node_list_t *ast = fib(create_int(BIG), create_int(BIG), NULL);
+    bool spawns = false;
+    int status = -1;
+
+    append_node(ast, clause("main", NULL, create_expr(&slash,
+        create_call("fib", list_of(create_int(25))), create_int(BIG))));
+
+    mu_assert(parallelize_exprs(ast) == 1, "fib should be marked");
+
+    eir_module_t *m = lower_ast("test", ast);
+
+    mu_assert(m && run_eir_passes(m, false), "fib should be lowered");
+
+    for (eir_block_t *b = eir_lookup_fn(m, "fib")->first; b; b = b->next) {
+        for (eir_instr_t *i = b->first; i; i = i->next)
+            spawns |= i->op == EIR_SPAWN;
+    }
+
+    mu_assert(spawns, "fib should spawn a task");
+    mu_assert(run_jit(m, 2, false, false, &status), "the JIT should run main");
+    mu_assert(status == 121393, "main should give fib(26)");
+
+    destroy_eir_module(m);
+    destroy_ast(ast);
+}
+
+MU_TEST_SUITE(test_suite)
+{
+    /* the smallest nursery, so collections happen while tasks run */
+    setenv("ERUPT_NURSERY", "1", 1);
+    setenv("ERUPT_THREADS", "4", 1);
+
+    MU_RUN_TEST(recursive_calls);
+    MU_RUN_TEST(impure_calls);
+    MU_RUN_TEST(dependent_operands);
+    MU_RUN_TEST(lhs_not_a_call);
+    MU_RUN_TEST(fork_join);
+}
+
+int main(int argc, char *argv[])
+{
+    MU_RUN_SUITE(test_suite);
+    MU_REPORT();
+
+    return 0;
+}
@@ -0,0 +1,207 @@
+/*
+ * Copyright (C) 2015 soud
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "ast.h"
+#include "codegen.h"
+#include "emit.h"
+#include "erupt.h"
+#include "link.h"
+#include "lower.h"
+#include "minunit/minunit.h"
+#include "test_ast.h"
+#include "passes.h"
+#include "profile.h"
+
+/* the program and its profile are made in a directory of their own */
+static char dir[] = "/tmp/erupt-profile-XXXXXX";
+static char executable[sizeof(dir) + 32], object[sizeof(dir) + 32];
+static char profile_path[sizeof(dir) + 32];
+
+static ast_operator_t plus = { PLUS, 10, ASSOC_LEFT, false };
+static ast_operator_t minus = { MIN, 10, ASSOC_LEFT, false };
+
+/* fib 0 => 0, fib 1 => 1, fib x => fib(x - 1) + fib(x - 2), main => fib 10 */
+static ast_node_list_t *fib(void)
+{
+    ast_node_list_t *ast = list_of(clause("fib", create_int(0),
+                                          create_int(0)));
+
+    append_node(ast, clause("fib", create_int(1), create_int(1)));
+    append_node(ast, clause("fib", x(), create_expr(&plus,
+        create_call("fib", list_of(create_expr(&minus, x(), create_int(1)))),
+        create_call("fib", list_of(create_expr(&minus, x(), create_int(2))))
+    )));
+    append_node(ast, clause("main", NULL,
+                            create_call("fib", list_of(create_int(10)))));
+
+    return ast;
+}
+
+/* compile an instrumented fib and run it, so it writes its profile */
+static bool generate_profile(void)
+{
+    ast_node_list_t *ast = fib();
+    char **names = NULL;
+    size_t n = instrument_ast(ast, &names);
+    eir_module_t *m = lower_ast("test", ast);
+    LLVMContextRef ctx = LLVMContextCreate();
+    bool ok = false;
+
+    destroy_ast(ast);
+
+    if (!m || !run_eir_passes(m, false))
+        return false;
+
+    m->counters = names;
+    m->n_counters = n;
+
+    LLVMModuleRef mod = codegen_module(m, ctx);
+    LLVMTargetMachineRef tm = create_target_machine(2);
+
+    destroy_eir_module(m);
+
+    if (mod && tm && optimize_module(mod, tm, 2) &&
+        emit_object(mod, tm, object) &&
+        link_executable((char *[]){ object }, 1, executable)) {
+        setenv("ERUPT_PROFILE", profile_path, 1);
+        ok = WEXITSTATUS(system(executable)) == 55;
+    }
+
+    remove(object);
+    remove(executable);
+
+    if (mod)
+        LLVMDisposeModule(mod);
+
+    if (tm)
+        LLVMDisposeTargetMachine(tm);
+
+    LLVMContextDispose(ctx);
+
+    return ok;
+}
+
+static uint64_t count_of(profile_t *profile, const char *name)
+{
+    for (size_t i = 0; i < profile->n; ++i) {
+        if (strcmp(profile->entries[i].name, name) == 0)
+            return profile->entries[i].count;
+    }
+
+    return UNKNOWN_COUNT;
+}
+
+MU_TEST(counts)
+{
+    mu_assert(generate_profile(), "the instrumented program should run");
+
+    profile_t *profile = read_profile(profile_path);
+
+    mu_assert(profile, "the program should write a profile");
+
+    /* fib(10) calls fib 177 times, 34 of them with 0 and 55 with 1 */
+    mu_assert(count_of(profile, "fib/0") == 34, "fib 0 should run 34 times");
+    mu_assert(count_of(profile, "fib/1") == 55, "fib 1 should run 55 times");
+    mu_assert(count_of(profile, "fib/2") == 88, "fib x should run 88 times");
+    mu_assert(count_of(profile, "main/0") == 1, "main should run once");
+
+    destroy_profile(profile);
+}
+
+MU_TEST(use)
+{
+    profile_t *profile = read_profile(profile_path);
+    ast_node_list_t *ast = fib();
+
+    mu_assert(profile, "the profile should be read back");
+    mu_assert(apply_profile(ast, profile) == 4,
+              "every clause should be in the profile");
+
+    eir_module_t *m = lower_ast("test", ast);
+    bool weighted = false;
+
+    mu_assert(m && run_eir_passes(m, false), "fib should be lowered");
+
+    eir_fn_t *f = eir_lookup_fn(m, "fib");
+
+    mu_assert(f->count == 177, "fib's entry count should be its calls");
+
+    for (eir_block_t *b = f->first; b; b = b->next)
+        weighted |= b->last && b->last->weights != NULL;
+
+    mu_assert(weighted, "fib's pattern tests should have branch weights");
+
+    destroy_eir_module(m);
+    destroy_ast(ast);
+    destroy_profile(profile);
+    remove(profile_path);
+}
+
+MU_TEST(merge)
+{
+    FILE *f = fopen(profile_path, "w");
+
+    fputs("# erupt profile\nfib/1 3\nfib/0 2\n# erupt profile\nfib/1 4\n", f);
+    fclose(f);
+
+    profile_t *profile = read_profile(profile_path);
+
+    mu_assert(profile && profile->n == 2, "duplicate entries should merge");
+    mu_assert(count_of(profile, "fib/1") == 7, "merged counts should add up");
+
+    destroy_profile(profile);
+    remove(profile_path);
+}
+
+MU_TEST_SUITE(test_suite)
+{
+    setenv("ERUPT_RUNTIME", "build/liberupt_rt.a", 0);
+
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp");
+        exit(1);
+    }
+
+    sprintf(executable, "%s/program", dir);
+    sprintf(object, "%s/program.o", dir);
+    sprintf(profile_path, "%s/program.profile", dir);
+
+    MU_RUN_TEST(counts);
+    MU_RUN_TEST(use);
+    MU_RUN_TEST(merge);
+
+    remove(object);
+    remove(executable);
+    remove(profile_path);
+    rmdir(dir);
+}
+
+int main(int argc, char *argv[])
+{
+    MU_RUN_SUITE(test_suite);
+    MU_REPORT();
+
+    return 0;
+}
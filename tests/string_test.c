@@ -0,0 +1,132 @@
+/*
+ * Copyright (C) 2015 soud
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <string.h>
+
+#include "minunit/minunit.h"
+#include "runtime.h"
+
+static erupt_string_t *str(const char *s)
+{
+    return erupt_string_from(s, (int64_t)strlen(s));
+}
+
+/* whether the bytes of s are expected */
+static bool equals(const erupt_string_t *s, const char *expected)
+{
+    int64_t length = erupt_string_length(s);
+    char buffer[ERUPT_SHORT_STRING];
+
+    if (length != (int64_t)strlen(expected))
+        return false;
+
+    for (int64_t i = 0, n; i < length; i += n) {
+        const char *bytes = erupt_string_chunk(s, i, &n, buffer);
+
+        if (memcmp(bytes, expected + i, (size_t)n) != 0)
+            return false;
+    }
+
+    return true;
+}
+
+static uint64_t allocated(void)
+{
+    erupt_gc_stats_t stats;
+
+    erupt_gc_stats(&stats);
+
+    return stats.allocated;
+}
+
+MU_TEST(short_strings)
+{
+    uint64_t before = allocated();
+    erupt_string_t *s = erupt_string_concat(str("abc"), str("defg"));
+
+    mu_assert(ERUPT_IS_SHORT(s) && equals(s, "abcdefg"),
+              "short strings should be concatenated in the pointer");
+    mu_assert(allocated() == before, "short strings shouldn't allocate");
+    mu_assert(erupt_value_kind(ERUPT_REF(s)) == ERUPT_STRING &&
+              !ERUPT_IS_REF(ERUPT_REF(s)),
+              "short strings should be strings that aren't objects");
+    mu_assert(!ERUPT_IS_SHORT(erupt_string_concat(s, str("h"))) &&
+              equals(erupt_string_concat(s, str("h")), "abcdefgh"),
+              "longer strings should be flat");
+}
+
+MU_TEST(ropes)
+{
+    char expected[64 * 1024 + 1];
+    erupt_string_t *s = str("");
+
+    /* appended a piece at a time, like output being formatted */
+    for (int i = 0; i < 64 * 1024; i += 8) {
+        memcpy(expected + i, "<piece!>", 8);
+        s = erupt_string_concat(s, str("<piece!>"));
+    }
+
+    expected[64 * 1024] = '\0';
+
+    mu_assert(ERUPT_KIND(s) == ERUPT_ROPE && equals(s, expected),
+              "long concatenations should be ropes");
+    mu_assert(ERUPT_UNTAG(((erupt_rope_t *)s)->depth) < 48,
+              "ropes should be rebalanced");
+
+    erupt_string_t *twice = erupt_string_concat(s, s);
+
+    mu_assert(erupt_string_length(twice) == 2 * erupt_string_length(s) &&
+              ((erupt_rope_t *)twice)->left == ERUPT_REF(s),
+              "concatenations shouldn't copy ropes");
+}
+
+MU_TEST(compare)
+{
+    erupt_string_t *rope = erupt_string_concat(str("a long string, "),
+                                               str("made of two"));
+
+    mu_assert(erupt_string_compare(rope, str("a long string, made of two"))
+              == 0, "ropes should compare by their bytes");
+    mu_assert(erupt_string_compare(str("abc"), str("abd")) < 0 &&
+              erupt_string_compare(str("b"), rope) > 0,
+              "strings should be ordered by their bytes");
+    mu_assert(erupt_string_compare(str("a long"), rope) < 0 &&
+              erupt_string_compare(str(""), str("a")) < 0,
+              "a string should be smaller than one it's a prefix of");
+    mu_assert(erupt_string_compare(str("\xff"), str("a")) > 0,
+              "bytes should be compared unsigned");
+}
+
+MU_TEST_SUITE(test_suite)
+{
+    MU_RUN_TEST(short_strings);
+    MU_RUN_TEST(ropes);
+    MU_RUN_TEST(compare);
+}
+
+int main(int argc, char *argv[])
+{
+    MU_RUN_SUITE(test_suite);
+    MU_REPORT();
+
+    return 0;
+}
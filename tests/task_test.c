@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2015 soud
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <pthread.h>
+
+#include "erupt.h"
+#include "minunit/minunit.h"
+#include "runtime.h"
+
+typedef struct {
+    long n;
+    long result;
+} fib_t;
+
+static void fib(void *arg)
+{
+    fib_t *f = arg;
+
+    if (f->n < 2) {
+        f->result = f->n;
+        return;
+    }
+
+    erupt_task_t task;
+    fib_t a = { f->n - 1, 0 }, b = { f->n - 2, 0 };
+
+    erupt_fork(&task, fib, &a);
+    fib(&b);
+    erupt_join(&task);
+
+    f->result = a.result + b.result;
+}
+
+MU_TEST(fork_join)
+{
+    fib_t f = { 24, 0 };
+
+    fib(&f);
+
+    mu_assert(f.result == 46368, "fib(24) should be 46368");
+    mu_assert(erupt_workers() == 4, "there should be 4 workers");
+}
+
+static void *fib_thread(void *arg)
+{
+    fib(arg);
+
+    return NULL;
+}
+
+MU_TEST(outside_pool)
+{
+    pthread_t thread;
+    fib_t f = { 20, 0 };
+
+    /* threads that aren't workers run their tasks right away */
+    pthread_create(&thread, NULL, fib_thread, &f);
+    pthread_join(thread, NULL);
+
+    mu_assert(f.result == 6765, "fib(20) should be 6765");
+}
+
+MU_TEST_SUITE(test_suite)
+{
+    setenv("ERUPT_THREADS", "4", 1);
+
+    MU_RUN_TEST(fork_join);
+    MU_RUN_TEST(outside_pool);
+}
+
+int main(int argc, char *argv[])
+{
+    MU_RUN_SUITE(test_suite);
+    MU_REPORT();
+
+    return 0;
+}
@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2015 soud
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef TEST_AST_H
+#define TEST_AST_H
+
+/* helpers for the tests that build their programs' AST by hand */
+
+#include "ast.h"
+
+static inline ast_node_list_t *list_of(ast_node_t *node)
+{
+    ast_node_list_t *nl = create_node_list();
+
+    append_node(nl, node);
+
+    return nl;
+}
+
+/* name pattern => body, a function without a pattern takes no arguments */
+static inline ast_node_t *clause(const char *name, ast_node_t *pattern,
+                                 ast_node_t *body)
+{
+    return create_fn(create_fn_proto(name, pattern ? list_of(pattern) : NULL),
+                     list_of(body));
+}
+
+static inline ast_node_t *var(const char *name)
+{
+    return create_var(name, false, NULL);
+}
+
+static inline ast_node_t *x(void)
+{
+    return var("x");
+}
+
+#endif /* !TEST_AST_H */
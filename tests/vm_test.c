@@ -0,0 +1,166 @@
+/*
+ * Copyright (C) 2015 soud
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "ast.h"
+#include "bytecode.h"
+#include "erupt.h"
+#include "lower.h"
+#include "minunit/minunit.h"
+#include "test_ast.h"
+#include "passes.h"
+#include "vm.h"
+
+static ast_operator_t plus = { PLUS, 10, ASSOC_LEFT, false };
+static ast_operator_t minus = { MIN, 10, ASSOC_LEFT, false };
+
+/* fib 0 => 0, fib 1 => 1, fib x => fib(x - 1) + fib(x - 2), main => fib(n) */
+static eir_module_t *fib(int64_t n)
+{
+    ast_node_list_t *ast = list_of(clause("fib", create_int(0),
+                                          create_int(0)));
+
+    append_node(ast, clause("fib", create_int(1), create_int(1)));
+    append_node(ast, clause("fib", x(), create_expr(&plus,
+        create_call("fib", list_of(create_expr(&minus, x(), create_int(1)))),
+        create_call("fib", list_of(create_expr(&minus, x(), create_int(2))))
+    )));
+    append_node(ast, clause("main", NULL,
+                            create_call("fib", list_of(create_int(n)))));
+
+    eir_module_t *m = lower_ast("test", ast);
+
+    destroy_ast(ast);
+
+    if (m && !run_eir_passes(m, false)) {
+        destroy_eir_module(m);
+        return NULL;
+    }
+
+    return m;
+}
+
+static bool uses_opcode(vm_fn_t *fn, vm_opcode_t op)
+{
+    for (size_t pc = 0; pc < fn->n_code; ++pc) {
+        if (fn->code[pc].op == op)
+            return true;
+    }
+
+    return false;
+}
+
+MU_TEST(run)
+{
+    eir_module_t *m = fib(20);
+    vm_program_t *p = m ? lower_bytecode(m) : NULL;
+    int status = -1;
+
+    mu_assert(p, "fib should be lowered to bytecode");
+    mu_assert(run_vm(p, &status), "the VM should run main");
+    mu_assert(status == 6765, "main should give fib(20)");
+
+    /* running a program twice doesn't thread it twice */
+    mu_assert(run_vm(p, &status) && status == 6765,
+              "the program should run again");
+
+    destroy_bytecode(p);
+    destroy_eir_module(m);
+}
+
+MU_TEST(superinstructions)
+{
+    eir_module_t *m = fib(20);
+    vm_program_t *p = m ? lower_bytecode(m) : NULL;
+    vm_fn_t *fn = p ? &p->fns[eir_lookup_fn(m, "fib")->index] : NULL;
+
+    mu_assert(fn, "fib should be lowered to bytecode");
+    mu_assert(uses_opcode(fn, VM_JEQK) || uses_opcode(fn, VM_JLEK),
+              "clause dispatch should compare to the literals directly");
+    mu_assert(uses_opcode(fn, VM_SUBK), "x - 1 should take the constant");
+
+    destroy_bytecode(p);
+    destroy_eir_module(m);
+}
+
+/*
+ * main => a, b, n = 0, 1, 20, then while n != 0: a, b, n = b, a + b, n - 1.
+ * a and b are swapped on every iteration, through their phis.
+ */
+MU_TEST(phi_swap)
+{
+    eir_module_t *m = create_eir_module("test");
+    eir_fn_t *fn = eir_add_fn(m, "main", 0);
+    eir_block_t *entry = eir_add_block(fn), *loop = eir_add_block(fn),
+                *done = eir_add_block(fn);
+    eir_builder_t b = { fn, entry, 0 };
+    int status = -1;
+
+    fn->ret = EIR_INT;
+
+    eir_instr_t *zero = eir_const_int(&b, 0), *one = eir_const_int(&b, 1),
+                *twenty = eir_const_int(&b, 20);
+
+    eir_br(&b, loop);
+
+    b.block = loop;
+    eir_instr_t *a = eir_phi(&b, EIR_INT), *bb = eir_phi(&b, EIR_INT),
+                *n = eir_phi(&b, EIR_INT);
+    eir_instr_t *sum = eir_binop(&b, PLUS, a, bb);
+    eir_instr_t *left = eir_binop(&b, MIN, n, one);
+
+    eir_condbr(&b, eir_binop(&b, BANG_EQ, left, zero), loop, done);
+
+    eir_add_incoming(a, zero, entry);
+    eir_add_incoming(a, bb, loop);
+    eir_add_incoming(bb, one, entry);
+    eir_add_incoming(bb, sum, loop);
+    eir_add_incoming(n, twenty, entry);
+    eir_add_incoming(n, left, loop);
+
+    b.block = done;
+    eir_ret(&b, bb);
+
+    mu_assert(verify_eir_module(m), "the loop should be valid EIR");
+
+    vm_program_t *p = lower_bytecode(m);
+
+    mu_assert(p && run_vm(p, &status), "the VM should run the loop");
+    mu_assert(status == 6765, "the loop should give fib(20)");
+
+    destroy_bytecode(p);
+    destroy_eir_module(m);
+}
+
+MU_TEST_SUITE(test_suite)
+{
+    MU_RUN_TEST(run);
+    MU_RUN_TEST(superinstructions);
+    MU_RUN_TEST(phi_swap);
+}
+
+int main(int argc, char *argv[])
+{
+    MU_RUN_SUITE(test_suite);
+    MU_REPORT();
+
+    return 0;
+}